@@ -2,10 +2,25 @@
 #extension GL_ARB_separate_shader_objects : enable
 #extension GL_ARB_shading_language_420pack : enable
 
+layout(constant_id = 0) const uint variant = 0;
+
+layout(location = 0) flat in uint material;
+
 layout(location = 0) out vec4 FragColor;
 
+const vec3 palette[4] = vec3[](
+	vec3(1.0, 1.0, 1.0),
+	vec3(1.0, 0.4, 0.4),
+	vec3(0.4, 1.0, 0.4),
+	vec3(0.4, 0.4, 1.0)
+);
+
 void main(void)
 {
-	FragColor = vec4(1, 1, 1, 1);
+	// NOTE: Variant 0 stays white, the others only exist to give the benchmark
+	//		 distinct pipelines to switch between.
+	vec3 tint = vec3((variant & 1u) != 0u ? 0.5 : 1.0,
+					 (variant & 2u) != 0u ? 0.5 : 1.0,
+					 (variant & 4u) != 0u ? 0.5 : 1.0);
+	FragColor = vec4(palette[material & 3u] * tint, 1);
 }
-
@@ -4,12 +4,17 @@
 
 layout (location=0) in vec3 position;
 
-layout(std140, binding = 0) uniform matrix_buffer 
+// Per-instance attributes, see YsInstanceData.
+layout (location=1) in mat4 world;
+layout (location=5) in uint material;
+
+// Composed once per frame on the CPU.
+layout(std140, binding = 0) uniform frame_buffer 
 {
-        mat4 world;
-        mat4 view;
-		mat4 projection;        
-} matrices;
+        mat4 view_projection;
+} frame;
+
+layout (location=0) flat out uint out_material;
 
 out gl_PerVertex
 {
@@ -19,7 +24,8 @@ out gl_PerVertex
 
 void main(void)
 {
-	gl_Position = matrices.projection * matrices.view * matrices.world * vec4(position, 1);
+	gl_Position = frame.view_projection * (world * vec4(position, 1));
+	out_material = material;
 	
 	// GL->VK conventions
 	gl_Position.y = -gl_Position.y;
@@ -0,0 +1,114 @@
+#ifndef YS_BARRIER_H
+#define YS_BARRIER_H
+
+#include <stdint.h>
+
+#include <vulkan/vulkan.h>
+
+// Resource state tracking. Every image and buffer shared between passes keeps
+// the layout it is in and how it was last read and written. Moving it to a new
+// usage computes the smallest barrier covering the hazard, if any: read after
+// write, write after write, write after read, or a layout change. Barriers
+// gathered in a batch are emitted together by a single vkCmdPipelineBarrier.
+//
+// States are updated when a transition is recorded, not when it executes, so
+// command buffers must be submitted in the order they were recorded. Batches
+// and statistics are not thread safe.
+
+enum YsUsage : uint32_t
+{
+	YS_USAGE_COLOR_ATTACHMENT,
+	YS_USAGE_DEPTH_ATTACHMENT,
+	YS_USAGE_DEPTH_READ,
+	YS_USAGE_SAMPLED_FRAGMENT,
+	YS_USAGE_SAMPLED_COMPUTE,
+	YS_USAGE_COMPUTE_READ,
+	YS_USAGE_COMPUTE_WRITE,
+	YS_USAGE_TRANSFER_SRC,
+	YS_USAGE_TRANSFER_DST,
+	YS_USAGE_VERTEX_BUFFER,
+	YS_USAGE_INDEX_BUFFER,
+	YS_USAGE_INDIRECT_BUFFER,
+	YS_USAGE_UNIFORM_BUFFER,
+	YS_USAGE_PRESENT,
+	YS_USAGE_COUNT
+};
+
+struct YsResourceState
+{
+	const char*				name = "";
+	bool					image = false;
+	// Always VK_IMAGE_LAYOUT_UNDEFINED for buffers.
+	VkImageLayout			layout = VK_IMAGE_LAYOUT_UNDEFINED;
+	// Last write, or last layout transition.
+	VkPipelineStageFlags	write_stages = 0;
+	VkAccessFlags			write_access = 0;
+	// Reads since the last write, and what the last write was made visible to.
+	VkPipelineStageFlags	read_stages = 0;
+	VkPipelineStageFlags	visible_stages = 0;
+	VkAccessFlags			visible_access = 0;
+};
+
+static const uint32_t	YS_BARRIER_BATCH_SIZE = 16;
+
+struct YsBarrierBatch
+{
+	VkPipelineStageFlags	src_stages = 0;
+	VkPipelineStageFlags	dst_stages = 0;
+	uint32_t				image_count = 0;
+	uint32_t				buffer_count = 0;
+	VkImageMemoryBarrier	images[YS_BARRIER_BATCH_SIZE];
+	VkBufferMemoryBarrier	buffers[YS_BARRIER_BATCH_SIZE];
+	// States transitioned since the last flush, only kept for validation.
+	uint32_t				state_count = 0;
+	const YsResourceState*	states[YS_BARRIER_BATCH_SIZE * 2];
+};
+
+// Counted since the last ys_barrier_reset_stats.
+struct YsBarrierStats
+{
+	uint32_t	flush_count = 0;
+	uint32_t	image_barriers = 0;
+	uint32_t	buffer_barriers = 0;
+	// Transitions that needed no barrier.
+	uint32_t	elided = 0;
+	// Validation only, see ys_barrier_set_validation.
+	uint32_t	redundant = 0;
+	uint32_t	missing = 0;
+};
+
+// Validation reports resources transitioned twice within one batch, the first
+// barrier being useless, and resources used without the transition they need,
+// see ys_barrier_check.
+void ys_barrier_set_validation(bool enabled);
+
+void ys_barrier_image(YsBarrierBatch& batch, YsResourceState& state, VkImage image,
+					  VkImageAspectFlags aspect, YsUsage usage);
+// Covers the whole buffer.
+void ys_barrier_buffer(YsBarrierBatch& batch, YsResourceState& state, VkBuffer buffer,
+					   YsUsage usage);
+// Records the batch, nothing is emitted when it is empty.
+void ys_barrier_flush(YsBarrierBatch& batch, VkCommandBuffer cmd);
+
+// The contents are no longer needed, the next transition starts from
+// VK_IMAGE_LAYOUT_UNDEFINED. It still waits for the uses tracked so far and for
+// wait_stages, e.g. the stage a swapchain image's acquire semaphore is waited at.
+void ys_barrier_discard(YsResourceState& state, VkPipelineStageFlags wait_stages);
+
+// The uses tracked so far are complete: a semaphore signaled after them is
+// waited at wait_stages, or with wait_stages 0, the host waited for them. Their
+// writes are visible to those stages, later uses at other stages chain on them.
+// Used when resources change queues, the tracker only sees one.
+void ys_barrier_complete(YsResourceState& state, VkPipelineStageFlags wait_stages);
+
+// Whether state is in the layout of usage and the last write is visible to it.
+// Reported as a missing transition under validation.
+bool ys_barrier_check(const YsResourceState& state, YsUsage usage);
+
+// Stages a usage accesses the resource from.
+VkPipelineStageFlags ys_usage_stages(YsUsage usage);
+
+const YsBarrierStats& ys_barrier_stats();
+void ys_barrier_reset_stats();
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef YS_CULL_H
+#define YS_CULL_H
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "ys_math.h"
+
+// Frustum culling of bounding volumes stored as structure of arrays. The SIMD
+// paths test 4 (SSE) or 8 (AVX) volumes against all six planes at once. Tests
+// are conservative: a volume is only rejected when it lies entirely outside
+// one of the planes.
+//
+// Culling a range only touches that range of the arrays and of the output,
+// so disjoint ranges can be culled from different threads.
+
+// Planes face inward, p is inside when dot(plane.xyz, p) + plane.w >= 0 for
+// every plane.
+struct YsFrustum
+{
+	float	planes[6][4];
+};
+
+struct YsBoundingSpheres
+{
+	uint32_t			count = 0;
+	std::vector<float>	center_x, center_y, center_z;
+	std::vector<float>	radius;
+};
+
+struct YsBoundingBoxes
+{
+	uint32_t			count = 0;
+	std::vector<float>	center_x, center_y, center_z;
+	std::vector<float>	extent_x, extent_y, extent_z;
+};
+
+// Extracts the planes of a GL clip space view_projection.
+void ys_frustum_from_view_projection(const YsMat4& view_projection, YsFrustum& frustum);
+
+void ys_bounding_spheres_resize(YsBoundingSpheres& spheres, uint32_t count);
+void ys_bounding_boxes_resize(YsBoundingBoxes& boxes, uint32_t count);
+
+inline void
+ys_bounding_sphere_set(YsBoundingSpheres& spheres, uint32_t index,
+					   float x, float y, float z, float radius)
+{
+	spheres.center_x[index] = x;
+	spheres.center_y[index] = y;
+	spheres.center_z[index] = z;
+	spheres.radius[index] = radius;
+}
+
+// Tests volumes [first, first + count) and writes the indices of the visible
+// ones to visible, in increasing order. Returns the number written, visible
+// must have room for count indices.
+uint32_t ys_cull_spheres(const YsFrustum& frustum, const YsBoundingSpheres& spheres,
+						 uint32_t first, uint32_t count, uint32_t* visible);
+uint32_t ys_cull_spheres_scalar(const YsFrustum& frustum, const YsBoundingSpheres& spheres,
+								uint32_t first, uint32_t count, uint32_t* visible);
+
+uint32_t ys_cull_boxes(const YsFrustum& frustum, const YsBoundingBoxes& boxes,
+					   uint32_t first, uint32_t count, uint32_t* visible);
+uint32_t ys_cull_boxes_scalar(const YsFrustum& frustum, const YsBoundingBoxes& boxes,
+							  uint32_t first, uint32_t count, uint32_t* visible);
+
+#endif
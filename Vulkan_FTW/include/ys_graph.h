@@ -0,0 +1,174 @@
+#ifndef YS_GRAPH_H
+#define YS_GRAPH_H
+
+#include <stdint.h>
+
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#include "ys_barrier.h"
+
+// Frame graph. Passes declare the resources they read and write; compiling
+// orders them so that a pass runs after every pass writing what it reads,
+// culls the passes whose results nothing uses, and computes the lifetime of
+// the transient images so that ys_graph_alias can pack them in one memory
+// range wherever lifetimes do not overlap. Executing inserts the barriers in
+// front of each pass through ys_barrier.
+//
+// The graph does not create any Vulkan object. After compiling, the owner
+// creates the transient images and reports their memory requirements, binds
+// them after ys_graph_alias and creates the render passes and framebuffers.
+// Two graphs declared the same have the same ys_graph_hash, so the owner can
+// declare it whenever something may have changed and only rebuild when the
+// hash differs.
+//
+// Compute passes may run on an async compute queue. They are executed in a
+// command buffer of their own, submitted before the main one, which waits on
+// it through a semaphore at ys_graph::async_wait_stages. They must not depend
+// on main queue passes of the same frame, and the resources they access are
+// bound per frame in flight: the frame fence is all that orders them after
+// the main queue uses of the previous frames.
+
+typedef uint32_t	YsGraphHandle;
+
+enum YsGraphQueue : uint32_t
+{
+	YS_GRAPH_QUEUE_MAIN,
+	YS_GRAPH_QUEUE_ASYNC_COMPUTE
+};
+
+// Per graphics pass.
+static const uint32_t	YS_GRAPH_MAX_ATTACHMENTS = 8;
+
+struct YsGraph;
+
+// Records the pass. Graphics passes begin their render pass with
+// ys_graph_begin_render_pass and end it themselves.
+typedef void YsGraphExecute(YsGraph& graph, uint32_t pass, VkCommandBuffer cmd, void* data);
+
+struct YsGraphResource
+{
+	const char*			name;
+	bool				image;
+	bool				imported;
+	VkFormat			format;
+	VkImageAspectFlags	aspect;
+	uint32_t			width;
+	uint32_t			height;
+
+	// Imported resources have one binding per variant, e.g. per swapchain
+	// image, one per frame in flight when per_frame is set, or a single one.
+	// The owner fills those of transient images once they are created.
+	bool							per_frame = false;
+	std::vector<VkImage>			images;
+	std::vector<VkImageView>		views;
+	std::vector<VkBuffer>			buffers;
+	std::vector<YsResourceState*>	states;
+
+	// Compile output for transient images, first_use is UINT32_MAX when every
+	// pass using the image was culled. usage gathers all its accesses.
+	VkImageUsageFlags		usage = 0;
+	uint32_t				first_use = UINT32_MAX;
+	uint32_t				last_use = 0;
+	// Set by the owner from the memory requirements before ys_graph_alias.
+	VkDeviceSize			size = 0;
+	VkDeviceSize			alignment = 1;
+	// Alias output: placement in the shared memory range, and the stages of
+	// the images sharing it, waited for before each first use.
+	VkDeviceSize			offset = 0;
+	VkPipelineStageFlags	alias_stages = 0;
+	YsResourceState			state;
+};
+
+struct YsGraphAccess
+{
+	YsGraphHandle		resource;
+	YsUsage				usage;
+	bool				write;
+	// Attachments only, the load op is CLEAR when set.
+	bool				clear;
+	VkClearValue		clear_value;
+	// Compile output for attachments.
+	VkAttachmentLoadOp	load_op;
+	VkAttachmentStoreOp	store_op;
+};
+
+struct YsGraphPass
+{
+	const char*					name;
+	bool						graphics;
+	// Never culled, e.g. presentation.
+	bool						side_effect = false;
+	YsGraphQueue				queue = YS_GRAPH_QUEUE_MAIN;
+	std::vector<YsGraphAccess>	accesses;
+	YsGraphExecute*				execute;
+	void*						data;
+
+	bool						culled = false;
+	// Set by the owner for graphics passes, one framebuffer per variant.
+	VkRenderPass				render_pass = VK_NULL_HANDLE;
+	std::vector<VkFramebuffer>	framebuffers;
+};
+
+struct YsGraph
+{
+	std::vector<YsGraphResource>	resources;
+	std::vector<YsGraphPass>		passes;
+	uint32_t						variant_count = 1;
+
+	// Compile output: passes kept, in execution order.
+	std::vector<uint32_t>			order;
+	uint64_t						hash = 0;
+	// Stages of the main queue passes using what async passes wrote, 0 when
+	// no async pass is kept.
+	VkPipelineStageFlags			async_wait_stages = 0;
+	// Alias output.
+	VkDeviceSize					memory_size = 0;
+	VkDeviceSize					unaliased_size = 0;
+
+	uint32_t						variant = 0;
+	uint32_t						frame = 0;
+	uint64_t						execute_count = 0;
+	uint64_t						barrier_count = 0;
+};
+
+YsGraphHandle ys_graph_import_image(YsGraph& graph, const char* name, VkFormat format,
+									VkImageAspectFlags aspect, uint32_t width, uint32_t height);
+YsGraphHandle ys_graph_import_buffer(YsGraph& graph, const char* name);
+YsGraphHandle ys_graph_create_image(YsGraph& graph, const char* name, VkFormat format,
+									VkImageAspectFlags aspect, uint32_t width, uint32_t height);
+
+uint32_t ys_graph_add_pass(YsGraph& graph, const char* name, bool graphics,
+						   YsGraphExecute* execute, void* data);
+// Compute passes only.
+void ys_graph_set_queue(YsGraph& graph, uint32_t pass, YsGraphQueue queue);
+void ys_graph_read(YsGraph& graph, uint32_t pass, YsGraphHandle resource, YsUsage usage);
+void ys_graph_write(YsGraph& graph, uint32_t pass, YsGraphHandle resource, YsUsage usage);
+// Writes an attachment, clearing it first.
+void ys_graph_clear(YsGraph& graph, uint32_t pass, YsGraphHandle resource, YsUsage usage,
+					VkClearValue clear_value);
+
+// Covers the declarations and the bindings of the imported resources.
+uint64_t ys_graph_hash(const YsGraph& graph);
+
+void ys_graph_compile(YsGraph& graph);
+// Places the used transient images, see YsGraphResource::size.
+void ys_graph_alias(YsGraph& graph);
+// Prints the passes kept and culled and the transient memory.
+void ys_graph_report(const YsGraph& graph);
+
+bool ys_graph_is_attachment(const YsGraphAccess& access);
+
+// Runs the passes of queue in order, variant and frame select the bindings of
+// the imported resources. The async queue is recorded first.
+void ys_graph_execute(YsGraph& graph, VkCommandBuffer cmd, YsGraphQueue queue,
+					  uint32_t variant, uint32_t frame);
+void ys_graph_begin_render_pass(const YsGraph& graph, uint32_t pass, VkCommandBuffer cmd,
+								VkSubpassContents contents);
+
+// Binding of a resource for the variant being executed.
+YsResourceState& ys_graph_state(YsGraph& graph, YsGraphHandle resource);
+VkFramebuffer ys_graph_framebuffer(const YsGraph& graph, uint32_t pass, uint32_t variant);
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef YS_JOB_H
+#define YS_JOB_H
+
+#include <stdint.h>
+
+#include <atomic>
+
+// Work-stealing job system. A fixed pool of workers runs next to the thread
+// that called ys_job_init, each of them owning a Chase-Lev deque: jobs are
+// pushed and popped at the bottom by their owner and stolen from the top by
+// idle threads. Completion is tracked with counters, waiting on one runs
+// other jobs meanwhile and only sleeps when there is nothing left to steal.
+//
+// Jobs can only be submitted from the thread that called ys_job_init, or
+// from inside a job. Each thread has at most YS_JOB_CAPACITY jobs in flight.
+
+static const uint32_t	YS_JOB_CAPACITY = 4096;
+
+// Runs the items [begin, end) of a job.
+typedef void YsJobFunction(void* data, uint32_t begin, uint32_t end);
+
+struct YsJob;
+
+// Number of unfinished jobs, a counter must outlive the jobs it tracks.
+struct YsJobCounter
+{
+	std::atomic<uint32_t>	pending{ 0 };
+	// Jobs waiting for this counter to reach zero, see ys_job_run_after.
+	YsJob*					continuations = nullptr;
+};
+
+// worker_count 0 uses one worker per hardware thread besides the caller.
+void ys_job_init(uint32_t worker_count = 0);
+// Every job must be finished.
+void ys_job_shutdown();
+
+// Workers plus the calling thread.
+uint32_t ys_job_thread_count();
+
+void ys_job_run(YsJobFunction* function, void* data, uint32_t begin, uint32_t end,
+				YsJobCounter* counter);
+// The job is only queued once dependency reaches zero.
+void ys_job_run_after(const YsJobCounter* dependency, YsJobFunction* function,
+					  void* data, uint32_t begin, uint32_t end, YsJobCounter* counter);
+// Splits [0, count) in chunks of at least min_chunk items, one job each.
+void ys_job_parallel_for(YsJobFunction* function, void* data, uint32_t count,
+						 uint32_t min_chunk, YsJobCounter* counter);
+
+void ys_job_wait(YsJobCounter* counter);
+
+inline bool
+ys_job_done(const YsJobCounter* counter)
+{
+	return counter->pending.load(std::memory_order_acquire) == 0;
+}
+
+// Blocking parallel for over a callable taking (begin, end).
+template <typename F>
+void
+ys_job_parallel_for(uint32_t count, uint32_t min_chunk, const F& body)
+{
+	YsJobCounter counter;
+	ys_job_parallel_for([](void* data, uint32_t begin, uint32_t end) {
+			(*(const F*)data)(begin, end);
+		}, (void*)&body, count, min_chunk, &counter);
+	ys_job_wait(&counter);
+}
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef YS_MATH_H
+#define YS_MATH_H
+
+#include <stdint.h>
+
+// 4x4 matrices and vectors for the CPU side transforms. Matrices are column
+// major like GLSL mat4, m[column * 4 + row], and vectors are columns.
+// SSE paths are used when the target has SSE2 unless YS_MATH_SCALAR is
+// defined, AVX additionally widens ys_mat4_transform_points. The _scalar
+// variants are always available, as a reference for tests and benchmarks.
+
+#if !defined(YS_MATH_SCALAR) && \
+	(defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define YS_MATH_SSE
+#endif
+
+#if defined(YS_MATH_SSE) && defined(__AVX__)
+#define YS_MATH_AVX
+#endif
+
+struct alignas(16) YsVec4
+{
+	float	x, y, z, w;
+
+	constexpr YsVec4() : x(0.f), y(0.f), z(0.f), w(0.f) {}
+	constexpr YsVec4(float _x, float _y, float _z, float _w)
+		: x(_x), y(_y), z(_z), w(_w) {}
+};
+
+struct alignas(16) YsMat4
+{
+	float	m[16];
+
+	// Identity.
+	constexpr YsMat4()
+		: m{ 1.f, 0.f, 0.f, 0.f,
+			 0.f, 1.f, 0.f, 0.f,
+			 0.f, 0.f, 1.f, 0.f,
+			 0.f, 0.f, 0.f, 1.f } {}
+	constexpr YsMat4(const YsVec4& c0, const YsVec4& c1,
+					 const YsVec4& c2, const YsVec4& c3)
+		: m{ c0.x, c0.y, c0.z, c0.w,
+			 c1.x, c1.y, c1.z, c1.w,
+			 c2.x, c2.y, c2.z, c2.w,
+			 c3.x, c3.y, c3.z, c3.w } {}
+};
+
+constexpr YsMat4
+ys_mat4_translation(float x, float y, float z)
+{
+	return YsMat4(YsVec4(1.f, 0.f, 0.f, 0.f), YsVec4(0.f, 1.f, 0.f, 0.f),
+				  YsVec4(0.f, 0.f, 1.f, 0.f), YsVec4(x, y, z, 1.f));
+}
+
+constexpr YsMat4
+ys_mat4_scale(float x, float y, float z)
+{
+	return YsMat4(YsVec4(x, 0.f, 0.f, 0.f), YsVec4(0.f, y, 0.f, 0.f),
+				  YsVec4(0.f, 0.f, z, 0.f), YsVec4(0.f, 0.f, 0.f, 1.f));
+}
+
+// a * b, b is applied first.
+YsMat4 ys_mat4_multiply(const YsMat4& a, const YsMat4& b);
+YsMat4 ys_mat4_multiply_scalar(const YsMat4& a, const YsMat4& b);
+
+// out[i] = lhs * rhs[i], e.g. view_projection * world for every object.
+// out may alias rhs.
+void ys_mat4_multiply_batch(const YsMat4& lhs, const YsMat4* rhs, YsMat4* out,
+							uint32_t count);
+void ys_mat4_multiply_batch_scalar(const YsMat4& lhs, const YsMat4* rhs,
+								   YsMat4* out, uint32_t count);
+
+// Returns false and leaves out untouched when the matrix is singular.
+bool ys_mat4_inverse(const YsMat4& matrix, YsMat4& out);
+bool ys_mat4_inverse_scalar(const YsMat4& matrix, YsMat4& out);
+
+YsVec4 ys_mat4_transform(const YsMat4& matrix, const YsVec4& v);
+
+// out may alias in.
+void ys_mat4_transform_points(const YsMat4& matrix, const YsVec4* in, YsVec4* out,
+							  uint32_t count);
+void ys_mat4_transform_points_scalar(const YsMat4& matrix, const YsVec4* in,
+									 YsVec4* out, uint32_t count);
+
+// GL clip space projection, fov is the full vertical angle in degrees.
+YsMat4 ys_mat4_perspective(float near_plane, float far_plane, float fov,
+						   float aspect_ratio);
+// Right handed view matrix looking from eye to target, w is ignored.
+YsMat4 ys_mat4_look_at(const YsVec4& eye, const YsVec4& target, const YsVec4& up);
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef YS_PROFILER_H
+#define YS_PROFILER_H
+
+#include <stdint.h>
+
+// CPU frame profiler. Scoped zones are recorded into per-thread rings without
+// any lock, and written out as a Chrome trace_event JSON file (chrome://tracing).
+// Everything compiles out unless YS_PROFILER_ENABLED is defined.
+
+#ifdef YS_PROFILER_ENABLED
+
+struct YsProfileEvent
+{
+	const char*	name;
+	uint64_t	begin_ns;
+	uint64_t	end_ns;
+};
+
+// Nanoseconds elapsed since the profiler epoch.
+uint64_t ys_profiler_now();
+
+void ys_profiler_record(const char* name, uint64_t begin_ns, uint64_t end_ns);
+void ys_profiler_set_thread_name(const char* name);
+
+// Spans measured on the GPU, already converted to the CPU timeline. They are
+// shown on a track of their own. Must always be called from the same thread.
+void ys_profiler_record_gpu(const char* name, uint64_t begin_ns, uint64_t end_ns);
+
+// NOTE: Rings are read without synchronization with their writers, the trace
+//		 should be written once the other threads are idle.
+bool ys_profiler_write_trace(const char* path);
+
+struct YsProfileScope
+{
+	const char*	name;
+	uint64_t	begin_ns;
+
+	YsProfileScope(const char* _name) : name(_name), begin_ns(ys_profiler_now()) {}
+	~YsProfileScope() { ys_profiler_record(name, begin_ns, ys_profiler_now()); }
+};
+
+#define YS_PROFILE_CONCAT_IMPL(a, b) a##b
+#define YS_PROFILE_CONCAT(a, b) YS_PROFILE_CONCAT_IMPL(a, b)
+
+#define YS_PROFILE_SCOPE(name) \
+	YsProfileScope YS_PROFILE_CONCAT(ys_profile_scope_, __LINE__)(name)
+#define YS_PROFILE_FUNCTION() YS_PROFILE_SCOPE(__FUNCTION__)
+#define YS_PROFILE_THREAD(name) ys_profiler_set_thread_name(name)
+
+#else
+
+#define YS_PROFILE_SCOPE(name)
+#define YS_PROFILE_FUNCTION()
+#define YS_PROFILE_THREAD(name)
+
+#endif
+
+#endif
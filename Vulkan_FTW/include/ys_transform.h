@@ -0,0 +1,65 @@
+#ifndef YS_TRANSFORM_H
+#define YS_TRANSFORM_H
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "ys_math.h"
+
+// Transform hierarchy stored as structure of arrays. Nodes are kept sorted by
+// depth, so that parents always come before their children and the world
+// matrices are rebuilt in one linear sweep. Only dirty nodes and their
+// descendants are recomputed.
+//
+// Ids are stable, indices into the arrays change whenever the nodes are
+// sorted.
+
+typedef uint32_t YsTransformId;
+static const YsTransformId	YS_TRANSFORM_NONE = UINT32_MAX;
+
+struct YsTransformSystem
+{
+	uint32_t					count = 0;
+	bool						sorted = true;
+
+	// Local TRS, rotations are unit quaternions. Arrays are padded to a
+	// multiple of 4 with identity transforms.
+	std::vector<float>			position_x, position_y, position_z;
+	std::vector<float>			rotation_x, rotation_y, rotation_z, rotation_w;
+	std::vector<float>			scale_x, scale_y, scale_z;
+
+	// Index of the parent node, YS_TRANSFORM_NONE for roots.
+	std::vector<uint32_t>		parent;
+	std::vector<uint32_t>		depth;
+	std::vector<uint8_t>		dirty;
+	std::vector<YsMat4>			world;
+
+	std::vector<uint32_t>		index_of;
+	std::vector<YsTransformId>	id_of;
+};
+
+void ys_transform_reserve(YsTransformSystem& system, uint32_t capacity);
+
+// Parent must already exist, the new node has an identity local transform.
+YsTransformId ys_transform_create(YsTransformSystem& system,
+								  YsTransformId parent = YS_TRANSFORM_NONE);
+
+void ys_transform_set_position(YsTransformSystem& system, YsTransformId id,
+							   float x, float y, float z);
+void ys_transform_set_rotation(YsTransformSystem& system, YsTransformId id,
+							   float x, float y, float z, float w);
+void ys_transform_set_scale(YsTransformSystem& system, YsTransformId id,
+							float x, float y, float z);
+
+// Recomputes the world matrices of the dirty nodes and their descendants.
+// Returns the number of matrices written.
+uint32_t ys_transform_update(YsTransformSystem& system);
+
+inline const YsMat4&
+ys_transform_world(const YsTransformSystem& system, YsTransformId id)
+{
+	return system.world[system.index_of[id]];
+}
+
+#endif
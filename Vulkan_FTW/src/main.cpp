@@ -1,13 +1,34 @@
+#ifdef VK_USE_PLATFORM_WIN32_KHR
 #include <windows.h>
+#endif
 #include <assert.h>
+#include <string.h>
+#include <stddef.h>
+#include <math.h>
 
 #include <vulkan/vulkan.h>
 
+#include "ys_profiler.h"
+#include "ys_math.h"
+#include "ys_transform.h"
+#include "ys_cull.h"
+#include "ys_job.h"
+#include "ys_barrier.h"
+#include "ys_graph.h"
+
 #include <iostream>
 #include <vector>
 #include <unordered_map>
 #include <string>
 #include <fstream>
+#include <iterator>
+#include <chrono>
+#include <deque>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 
 #define ARRAY_SIZE(a) (sizeof(a) / sizeof(a[0]))
 
@@ -16,37 +37,190 @@
 
 #define GET_INSTANCE_PROC_ADDR(inst, entrypoint)\
 	{\
-		fp.##entrypoint = \
+		fp.entrypoint = \
 			(PFN_vk##entrypoint)vkGetInstanceProcAddr(inst, "vk" #entrypoint);\
-		assert(fp.##entrypoint != nullptr);\
+		assert(fp.entrypoint != nullptr);\
 	}
 
 #define GET_DEVICE_PROC_ADDR(dev, entrypoint)\
 	{\
-		fp.##entrypoint = \
+		fp.entrypoint = \
 			(PFN_vk##entrypoint)vkGetDeviceProcAddr(dev, "vk" #entrypoint);\
-		assert(fp.##entrypoint != nullptr);\
+		assert(fp.entrypoint != nullptr);\
 	}
 
 using Bitfield32_t = uint32_t;
 
 
+// Resources placed in a memory block are either linear (buffers) or optimal
+// (images). Neighbours of different kinds must not share a
+// bufferImageGranularity page.
+enum YsResourceKind : uint8_t
+{
+	YS_RESOURCE_FREE = 0,
+	YS_RESOURCE_LINEAR,
+	YS_RESOURCE_OPTIMAL
+};
+
+struct YsMemoryChunk
+{
+	VkDeviceSize	offset;
+	VkDeviceSize	size;
+	VkDeviceSize	alignment;
+	YsResourceKind	kind;
+	// Owner given to ys_memory_alloc, nullptr when the chunk cannot be moved
+	// by ys_memory_defragment.
+	void*			owner;
+};
+
+// One vkAllocateMemory, carved into chunks sorted by offset. Adjacent free
+// chunks are always merged.
+struct YsMemoryBlock
+{
+	VkDeviceMemory				memory;
+	VkDeviceSize				size;
+	VkDeviceSize				used;
+	uint32_t					type_index;
+	uint32_t					allocation_count;
+	// Dedicated blocks hold a single request too large to be shared.
+	bool						dedicated;
+	// Host visible blocks are mapped once for their whole lifetime.
+	uint8_t*					mapped;
+	std::vector<YsMemoryChunk>	chunks;
+};
+
+struct YsAllocation
+{
+	YsMemoryBlock*	block = nullptr;
+	VkDeviceMemory	memory = VK_NULL_HANDLE;
+	VkDeviceSize	offset = 0;
+	VkDeviceSize	size = 0;
+	uint8_t*		mapped = nullptr;
+};
+
+// Called by ys_memory_defragment for each allocation it relocates. The owner
+// must copy its content to the new allocation and rebind its resource; the
+// old allocation is retired with the frames that may still use it.
+typedef void (*YsDefragmentMoveFn)(void* owner, 
+								   const YsAllocation& from, 
+								   const YsAllocation& to);
+
+
 struct SwapchainBuffer
 {
 	uint32_t			index;
 	VkImage				image;
 	VkCommandBuffer		cmd;
 	VkImageView			view;
-	VkFramebuffer		framebuffer;
+	// NOTE: Only used by headless mode, swapchain images are owned by the WSI.
+	YsAllocation		allocation;
+	// Fence of the last frame that rendered to this image, if any.
+	VkFence				in_flight;
+	YsResourceState		state;
+};
+
+// Synchronization objects of one slot of the frames-in-flight ring.
+// They are created once and reused every vk_frames_in_flight frames.
+struct FrameSync
+{
+	VkFence			fence;
+	VkSemaphore		image_acquired;
+	VkSemaphore		render_complete;
+	// Async compute passes of the frame, waited on by the main submission.
+	VkCommandBuffer	compute_cmd;
+	VkSemaphore		compute_done;
+	bool			compute_recorded;
+	// GPU timestamps of the frame, read back once the fence is signaled.
+	VkQueryPool		timestamps;
+	bool			timestamps_written;
+	bool			async_timestamps_written;
+	// CPU time of the submission, used to place GPU spans in the CPU trace.
+	uint64_t		submit_ns;
+	// Arrival of the oldest input shown by the frame, 0 without input.
+	uint64_t		input_ns;
+	// Value of vk_frame_serial for the last submission of this slot.
+	uint64_t		serial;
+};
+
+// Timestamps written by vk_record_command_buffer, in submission order. The
+// async ones are written and reset on the async compute queue.
+enum YsTimestamp : uint32_t
+{
+	YS_TIMESTAMP_FRAME_BEGIN,
+	YS_TIMESTAMP_CULL_END,
+	YS_TIMESTAMP_BARRIER_END,
+	YS_TIMESTAMP_DRAWS_BEGIN,
+	YS_TIMESTAMP_DRAWS_END,
+	YS_TIMESTAMP_RENDER_PASS_END,
+	YS_TIMESTAMP_PRESENT_BARRIER_END,
+	YS_TIMESTAMP_ASYNC_BEGIN,
+	YS_TIMESTAMP_ASYNC_END,
+	YS_TIMESTAMP_COUNT
+};
+
+// Async compute time, and how much of it ran while the main queue was busy
+// with the previous frame or this one.
+struct YsAsyncStats
+{
+	uint32_t	frame_count = 0;
+	double		busy_ms = 0.0;
+	double		overlap_ms = 0.0;
+	// Main queue span of the last frame collected, in timestamp ticks.
+	uint64_t	main_begin = 0;
+	uint64_t	main_end = 0;
+};
+
+// GPU passes measured between two timestamps.
+enum YsGpuPass : uint32_t
+{
+	YS_GPU_PASS_CULL,
+	YS_GPU_PASS_BARRIER,
+	YS_GPU_PASS_RENDER_PASS,
+	YS_GPU_PASS_DRAWS,
+	YS_GPU_PASS_PRESENT_BARRIER,
+	YS_GPU_PASS_FRAME,
+	YS_GPU_PASS_COUNT
+};
+
+// Rolling window of the last samples of each pass, in milliseconds.
+struct YsGpuTimings
+{
+	std::vector<double>	samples[YS_GPU_PASS_COUNT];
+	uint32_t			next = 0;
+	uint32_t			count = 0;
+};
+
+struct FrameStats
+{
+	uint32_t	frame_count = 0;
+	double		total_ms = 0.0;
+	double		min_ms = 1e9;
+	double		max_ms = 0.0;
+};
+
+// Delay between an input event and the end of the GPU work of the first frame
+// showing it. The fence is polled once per frame, which bounds the error.
+struct LatencyStats
+{
+	uint32_t	sample_count = 0;
+	double		total_ms = 0.0;
+	double		max_ms = 0.0;
 };
 
-struct DepthBuffer
+// Objects replaced while frames using them may still be in flight, destroyed
+// once every frame submitted before the replacement is done. The swapchain
+// part is empty when only the frame graph was rebuilt.
+struct RetiredObjects
 {
-	VkFormat				format;
-	VkImage					image;
-	VkImageView				view;
-	VkMemoryAllocateInfo	mem_alloc_info;
-	VkDeviceMemory			memory;
+	uint64_t					serial;
+	VkSwapchainKHR				swapchain = VK_NULL_HANDLE;
+	SwapchainBuffer*			buffers = nullptr;
+	uint32_t					buffer_count = 0;
+	YsGraph						graph;
+	YsAllocation				graph_memory;
+	// Left behind by ys_memory_defragment.
+	std::vector<VkBuffer>		moved_buffers;
+	std::vector<YsAllocation>	moved_ranges;
 };
 
 
@@ -75,22 +249,93 @@ static struct
 
 
 
+#ifdef VK_USE_PLATFORM_WIN32_KHR
 static HINSTANCE	win_instance;
 static LPCSTR		win_class_name = "vulkan_render_window";
 static LPCSTR		win_app_name = APP_NAME;
+static HWND			window_handle;
+// The window thread only pumps messages, everything else happens on
+// ys_render_thread, see WinMain.
+static std::thread			ys_render_thread;
+static std::atomic<bool>	ys_render_quit{ false };
+// Posted by the render thread once Vulkan is shut down, the window is only
+// destroyed then.
+static const UINT			YS_WM_RENDER_DONE = WM_APP;
+#endif
 static uint32_t		win_width = 800;
 static uint32_t		win_height = 600;
-static HWND			window_handle;
+
+// Window input, pushed by WndProc on the window thread and drained by
+// ys_simulate. Single producer and single consumer, events are dropped when
+// the queue is full.
+enum YsInputType : uint32_t
+{
+	YS_INPUT_KEY_DOWN,
+	YS_INPUT_MOUSE_MOVE,
+	YS_INPUT_MOUSE_WHEEL,
+	YS_INPUT_RESIZE
+};
+
+// NOTE: Win32 virtual key codes match ASCII for space, digits and capitals.
+static const uint32_t		YS_INPUT_BUTTON_LEFT = 1;
+
+struct YsInputEvent
+{
+	YsInputType	type;
+	// Key code, or the YS_INPUT_BUTTON_* held during a mouse move.
+	uint32_t	key;
+	// Cursor position, the wheel delta in x, or the new client size.
+	int32_t		x;
+	int32_t		y;
+	uint64_t	time_ns;
+};
+
+static const uint32_t		YS_INPUT_QUEUE_SIZE = 256;
+
+struct YsInputQueue
+{
+	YsInputEvent			events[YS_INPUT_QUEUE_SIZE];
+	// Both only grow, head is written by the producer and tail by the consumer.
+	std::atomic<uint32_t>	head{ 0 };
+	std::atomic<uint32_t>	tail{ 0 };
+};
+
+static YsInputQueue			ys_input_queue;
 
 
 // Tells the application if it should load Vulkan's validation layers.
 static bool			vk_validate = true; 
+// Benchmarks run without validation unless --validation is given.
+static bool			vk_validate_requested = false;
+// Headless mode renders a fixed number of frames into plain VkImages, it needs
+// neither a window nor any WSI extension.
+#ifdef VK_USE_PLATFORM_WIN32_KHR
+static bool			vk_headless = false;
+#else
+static bool			vk_headless = true;
+#endif
+static uint32_t		vk_headless_frame_count = 1000;
+// Name of the benchmark to run instead of the application, see run_bench.
+static std::string	ys_bench_name;
+static uint32_t		ys_bench_count = 4096;
+// Scene benchmark report (.json or .csv) and the baseline it is checked
+// against. A metric worse than the baseline by more than ys_bench_tolerance
+// fails the run.
+static std::string	ys_bench_report_path;
+static std::string	ys_bench_baseline_path;
+static double		ys_bench_tolerance = 0.1;
+// Number of frames the CPU may record ahead of the GPU. 1 serializes CPU and
+// GPU work, which is mostly useful as a point of comparison.
+static const uint32_t	YS_MAX_FRAMES_IN_FLIGHT = 3;
+static uint32_t		vk_frames_in_flight = 2;
 static char*		vk_instance_layers[] = {
 	"VK_LAYER_LUNARG_standard_validation"
 };
 static char*		vk_instance_extensions[] = {
 	"VK_KHR_surface",
+#ifdef VK_USE_PLATFORM_WIN32_KHR
 	"VK_KHR_win32_surface",
+#endif
 	"VK_EXT_debug_report"
 };
 static char*		vk_device_extensions[] = {
@@ -104,31 +349,150 @@ static std::vector<char*>		vk_enabled_extensions;
 static VkInstance				vk_instance;
 
 static VkPhysicalDevice					vk_gpu;
+static VkPhysicalDeviceProperties		vk_gpu_properties;
 static VkPhysicalDeviceMemoryProperties	vk_memory_properties;
 
 static uint32_t					vk_queue_family_count = 0;
 static VkQueueFamilyProperties*	vk_queue_props = nullptr;
 static uint32_t					vk_elected_queue_index;
+// Transfer only family the uploads run on, UINT32_MAX when the device has none
+// or --no-transfer-queue was given.
+static uint32_t					vk_transfer_queue_index = UINT32_MAX;
+static bool						vk_use_transfer_queue = true;
+// Compute family without graphics the async passes run on, UINT32_MAX when the
+// device has none or --no-async-compute was given.
+static uint32_t					vk_compute_queue_index = UINT32_MAX;
+static bool						vk_use_async_compute = true;
+// Distinct families of the queues created, buffers shared between them are
+// created with VK_SHARING_MODE_CONCURRENT.
+static std::vector<uint32_t>	vk_queue_families;
 
 static VkSurfaceKHR				vk_surface;
 static VkFormat					vk_surface_format;
 static VkColorSpaceKHR			vk_color_space;
 
-static VkSwapchainKHR			vk_swapchain;
+static VkSwapchainKHR			vk_swapchain = VK_NULL_HANDLE;
 static uint32_t					vk_swapchain_image_count;
 static SwapchainBuffer*			vk_swapchain_buffers;
 static SwapchainBuffer*			vk_swapchain_current_buffer;
-
-static DepthBuffer				vk_depth_buffer;
+// Set on resize and when the WSI reports the swapchain out of date or
+// suboptimal, the swapchain is rebuilt at the start of the next frame.
+static bool						vk_swapchain_dirty = false;
+static std::deque<RetiredObjects>	vk_retired_objects;
+
+// NOTE: Rebuilt by vk_frame_graph_update whenever its declaration changes.
+static YsGraph					vk_frame_graph;
+static YsAllocation				vk_frame_graph_memory;
+static uint32_t					vk_graph_cull_pass = UINT32_MAX;
+static uint32_t					vk_graph_main_pass;
+static const VkFormat			vk_depth_format = VK_FORMAT_D16_UNORM;
+
+static FrameSync*				vk_frames;
+static uint32_t					vk_frame_index = 0;
+// Frames submitted so far, and the last one known to be done on the GPU.
+static uint64_t					vk_frame_serial = 0;
+static uint64_t					vk_completed_serial = 0;
+static FrameStats				vk_frame_stats;
+static LatencyStats				vk_latency_stats;
+
+static bool						vk_timestamps_enabled = false;
+static double					vk_timestamp_period_ms = 0.0;
+static uint64_t					vk_timestamp_mask = 0;
+static YsGpuTimings				ys_gpu_timings;
+// Whether the async compute family can write timestamps too.
+static bool						vk_async_timestamps_enabled = false;
+static YsAsyncStats				ys_async_stats;
+static uint32_t					ys_gpu_timings_window = 512;
+// When set, the GPU pass statistics are written there as CSV on exit.
+static std::string				ys_gpu_profile_csv;
+static const char*				ys_gpu_pass_names[YS_GPU_PASS_COUNT] = {
+	"cull", "barrier", "render_pass", "draws", "present_barrier", "frame"
+};
+// When set, the CPU profiler trace is written there on exit.
+static std::string				ys_trace_path;
+#ifdef YS_PROFILER_ENABLED
+// GPU clock minus CPU clock, in nanoseconds.
+static int64_t					ys_gpu_clock_offset_ns = 0;
+static bool						ys_gpu_clock_calibrated = false;
+#endif
 
 static VkDevice					vk_device;
 static VkQueue					vk_main_queue;
+static VkQueue					vk_transfer_queue = VK_NULL_HANDLE;
+static VkQueue					vk_compute_queue = VK_NULL_HANDLE;
+static VkCommandPool			vk_compute_cmd_pool = VK_NULL_HANDLE;
 static VkCommandPool			vk_cmd_pool;
-static VkCommandBuffer			vk_cmd_buffer;
 
 static VkPipelineLayout			vk_pipeline_layout;
+// Render pass of the main graph pass, the pipelines are created against it.
 static VkRenderPass				vk_render_pass;
+// Render passes by attachment description. Kept until shutdown, so that
+// pipelines compiled in the background never see theirs destroyed.
+static std::unordered_map<uint64_t, VkRenderPass>	vk_render_passes;
 static VkPipelineCache			vk_pipeline_cache;
+// Pipeline cache data is saved there on shutdown and loaded back on startup.
+static std::string				vk_pipeline_cache_path = "pipeline_cache.bin";
+
+// Full graphics state of a pipeline. Descriptions are hashed and compared as
+// raw bytes, so they must be zero initialized through ys_pipeline_desc_default.
+struct YsPipelineDesc
+{
+	VkShaderModule						vertex_shader;
+	VkShaderModule						fragment_shader;
+	uint32_t							binding_count;
+	VkVertexInputBindingDescription		bindings[4];
+	uint32_t							attribute_count;
+	VkVertexInputAttributeDescription	attributes[8];
+	VkPrimitiveTopology					topology;
+	VkPolygonMode						polygon_mode;
+	VkCullModeFlags						cull_mode;
+	VkFrontFace							front_face;
+	VkBool32							depth_test;
+	VkBool32							depth_write;
+	VkCompareOp							depth_compare;
+	VkPipelineColorBlendAttachmentState	blend;
+	VkRenderPass						render_pass;
+	uint32_t							subpass;
+	VkPipelineLayout					layout;
+	// Specialization constant 0 of the fragment shader.
+	uint32_t							variant;
+};
+
+// Registered pipeline variant. pipeline stays VK_NULL_HANDLE until the
+// background compilation is done.
+struct YsPipelineEntry
+{
+	YsPipelineDesc			desc;
+	uint64_t				hash;
+	std::atomic<VkPipeline>	pipeline;
+};
+
+struct YsPipelineDescHash
+{
+	size_t operator()(const YsPipelineDesc& desc) const;
+};
+
+struct YsPipelineDescEqual
+{
+	bool operator()(const YsPipelineDesc& lhs, const YsPipelineDesc& rhs) const
+	{
+		return !memcmp(&lhs, &rhs, sizeof(YsPipelineDesc));
+	}
+};
+
+// Pipelines are deduplicated on their description and compiled by
+// ys_pipeline_thread_count background threads.
+static std::unordered_map<YsPipelineDesc, YsPipelineEntry*,
+						  YsPipelineDescHash, YsPipelineDescEqual>	ys_pipelines;
+static std::mutex					ys_pipeline_mutex;
+static std::condition_variable		ys_pipeline_cv;
+static std::deque<YsPipelineEntry*>	ys_pipeline_queue;
+static std::vector<std::thread>		ys_pipeline_threads;
+static uint32_t						ys_pipeline_thread_count = 2;
+static uint32_t						ys_pipeline_compiling = 0;
+static std::condition_variable		ys_pipeline_done_cv;
+static bool							ys_pipeline_quit = false;
+static YsPipelineEntry*				ys_default_pipeline = nullptr;
 static VkPipeline				vk_pipeline;
 
 static VkDescriptorSetLayout	vk_desc_set_layout;
@@ -144,15 +508,215 @@ static VkDebugReportCallbackEXT	vk_debug_callback;
 struct YsBuffer
 {
 	VkBuffer		buffer;
-	VkDeviceMemory	memory;
+	YsAllocation	allocation;
 	VkDeviceSize	size = 0;
 	uint32_t		value_count = 0;
+	VkBufferUsageFlags	usage = 0;
+	// Shared between the queue families in vk_queue_families.
+	bool				concurrent = false;
+	// Only kept up to date for buffers written on the GPU, see ys_barrier.h.
+	YsResourceState		state;
+};
+
+// Device memory is sub-allocated from blocks of ys_memory_block_size bytes,
+// one list of blocks per memory type. Requests larger than half a block get a
+// block of their own.
+static VkDeviceSize					ys_memory_block_size = 64 * 1024 * 1024;
+static std::vector<YsMemoryBlock*>	ys_memory_blocks[VK_MAX_MEMORY_TYPES];
+static uint32_t						ys_memory_device_allocation_count = 0;
+static uint32_t						ys_memory_device_allocation_total = 0;
+// Buffers replaced by ys_buffer_defragment_move, retired with their ranges
+// at the end of ys_memory_defragment.
+static std::vector<VkBuffer>		ys_memory_retired_buffers;
+
+// Set when the main device local heap is also host visible (integrated and
+// CPU devices), in which case uploads are plain writes.
+static bool							vk_unified_memory = false;
+
+struct YsUploadCopy
+{
+	VkBuffer		dst;
+	VkBufferCopy	region;
+	// No ownership transfer, see ys_buffer_sharing.
+	bool			concurrent;
+};
+
+// Work submitted together, the staging range [ring_begin, ring_end) is
+// reused once the fence is signaled. With a transfer queue the staging copies
+// go in transfer_cmd, which signals semaphore for cmd on the main queue.
+struct YsUploadBatch
+{
+	VkCommandBuffer	cmd;
+	VkCommandBuffer	transfer_cmd;
+	VkSemaphore		semaphore;
+	VkFence			fence;
+	uint64_t		serial;
+	VkDeviceSize	ring_begin;
+	VkDeviceSize	ring_end;
 };
 
+// Uploads to device local buffers are written to a staging ring and copied
+// by the GPU. Pending copies, and whatever else is recorded in
+// ys_upload_cmd, are batched until ys_upload_flush. Each submission gets
+// the next serial, which callers wait on with ys_upload_wait.
+static YsBuffer						ys_staging_buffer;
+static VkDeviceSize					ys_staging_size = 8 * 1024 * 1024;
+static VkDeviceSize					ys_staging_head = 0;
+static VkDeviceSize					ys_staging_pending_begin = 0;
+static std::vector<YsUploadCopy>	ys_upload_pending;
+static std::deque<YsUploadBatch>	ys_upload_batches;
+static VkCommandPool				ys_upload_cmd_pool;
+static VkCommandBuffer				ys_upload_cmd = VK_NULL_HANDLE;
+static VkCommandPool				ys_upload_transfer_pool = VK_NULL_HANDLE;
+static VkCommandBuffer				ys_upload_transfer_cmd = VK_NULL_HANDLE;
+static std::vector<VkFence>			ys_upload_free_fences;
+static std::vector<VkSemaphore>		ys_upload_free_semaphores;
+static uint64_t						ys_upload_serial = 0;
+static uint64_t						ys_upload_completed_serial = 0;
+static uint32_t						ys_upload_submit_count = 0;
+static VkDeviceSize					ys_upload_bytes = 0;
+
 static YsBuffer		ys_cube_vertex_buffer;
 static YsBuffer		ys_cube_index_buffer;
 
-static YsBuffer		ys_matrix_buffer;
+// Frame constants are bound with a UNIFORM_BUFFER_DYNAMIC descriptor, the
+// layout matches the frame block of vs_test.vert.
+struct YsFrameConstants
+{
+	YsMat4	view_projection;
+};
+
+// Per-instance vertex attributes, fetched from vertex binding 1 at
+// VK_VERTEX_INPUT_RATE_INSTANCE.
+struct YsInstanceData
+{
+	YsMat4		world;
+	uint32_t	material;
+	// Only read by cs_cull.comp: the batch the instance is appended to, and
+	// the bounding sphere radius of its mesh.
+	uint32_t	batch;
+	float		radius;
+	uint32_t	padding;
+};
+
+// Per-frame linear allocator for constants and instance data. The buffer holds
+// one segment of frame_size bytes per frame in flight, a segment is rewritten
+// once the fence of the frame that last used it has been waited on.
+struct YsUniformRing
+{
+	YsBuffer		buffer;
+	VkDeviceSize	frame_size;
+	VkDeviceSize	alignment;
+	VkDeviceSize	frame_begin;
+	VkDeviceSize	head;
+};
+
+static YsUniformRing	ys_uniform_ring;
+static VkDeviceSize		ys_uniform_frame_size = 4 * 1024 * 1024;
+
+struct YsMesh
+{
+	YsBuffer*	vertex_buffer;
+	YsBuffer*	index_buffer;
+	// Bounding sphere centered on the mesh origin.
+	float		radius;
+};
+
+static YsMesh		ys_cube_mesh = { &ys_cube_vertex_buffer, &ys_cube_index_buffer, 0.f };
+
+struct YsObject
+{
+	YsTransformId		transform;
+	const YsMesh*		mesh;
+	// Drawn with vk_pipeline until the variant is compiled.
+	YsPipelineEntry*	pipeline;
+	uint32_t			material;
+};
+
+// Objects sharing a mesh and a pipeline are drawn with a single instanced
+// draw. Instances are laid out batch after batch, ys_instance_objects maps an
+// instance back to its object.
+struct YsDrawBatch
+{
+	const YsMesh*		mesh;
+	YsPipelineEntry*	pipeline;
+	uint32_t			first_instance;
+	uint32_t			instance_count;
+};
+
+static std::vector<YsObject>	ys_objects;
+// Every object is a child of ys_scene_root. With ys_animate, each one spins
+// around its own vertical axis, space toggles it.
+static YsTransformSystem		ys_transforms;
+static YsTransformId			ys_scene_root = YS_TRANSFORM_NONE;
+static bool						ys_animate = false;
+static std::vector<YsDrawBatch>	ys_draw_batches;
+static std::vector<uint32_t>	ys_instance_objects;
+
+// GPU culling. Before the render pass, cs_cull.comp tests the bounding sphere
+// of every instance against the frustum and appends the survivors of each
+// batch to ys_cull_instances, counting them in the instanceCount of the
+// batch's command in ys_cull_commands. Batches are then drawn with
+// vkCmdDrawIndexedIndirect, their commands are reset from
+// ys_cull_command_template at the start of each frame. The outputs exist once
+// per frame in flight, so that the pass can run on the async compute queue
+// while the previous frames still draw from theirs.
+struct YsCullConstants
+{
+	float		planes[6][4];
+	uint32_t	instance_count;
+};
+
+static bool						vk_gpu_cull = true;
+static VkPipeline				vk_cull_pipeline = VK_NULL_HANDLE;
+static VkPipelineLayout			vk_cull_pipeline_layout;
+static VkDescriptorSetLayout	vk_cull_desc_set_layout;
+static VkDescriptorPool			vk_cull_descriptor_pool;
+static VkDescriptorSet			vk_cull_descriptor_sets[YS_MAX_FRAMES_IN_FLIGHT];
+static YsBuffer					ys_cull_instances[YS_MAX_FRAMES_IN_FLIGHT];
+static YsBuffer					ys_cull_commands[YS_MAX_FRAMES_IN_FLIGHT];
+static YsBuffer					ys_cull_command_template;
+
+// CPU culling, used instead of the GPU pass with --cpu-cull. Each recording
+// job gathers the world bounding spheres of its instances in
+// ys_cull_bounds, culls them and only writes and draws the visible ones.
+static bool						ys_cpu_cull = false;
+static YsBoundingSpheres		ys_cull_bounds;
+static std::vector<uint32_t>	ys_cull_visible;
+static YsFrustum				ys_record_frustum;
+static uint32_t					ys_object_count = 1;
+// Synthetic scene parameters: each cube face is split in ys_mesh_subdiv^2
+// quads, and objects cycle through ys_pipeline_variant_count pipelines.
+static uint32_t					ys_mesh_subdiv = 1;
+static uint32_t					ys_pipeline_variant_count = 1;
+
+// Workers of the job system, 0 for one per hardware thread besides the main
+// one.
+static uint32_t					ys_job_worker_count = 0;
+
+// Draws are recorded into secondary command buffers by up to
+// vk_record_thread_count jobs, the first one on the calling thread. Each job
+// owns one command pool per frame in flight, reset as a whole before reuse.
+struct YsRecordContext
+{
+	VkCommandPool*	pools;
+	VkCommandBuffer* cmds;
+	uint32_t		first_instance;
+	uint32_t		instance_count;
+};
+
+static uint32_t					vk_record_thread_count = 0;
+static uint32_t					vk_record_active_threads = 0;
+// NOTE: Below this many instances per job, waking a worker costs more than
+//		 what it writes. Each extra job may also split a batch in two draws.
+static uint32_t					vk_record_min_instances = 4096;
+static YsRecordContext*			vk_record_contexts = nullptr;
+// Recording in progress, written before the jobs are queued.
+static const SwapchainBuffer*	vk_record_target = nullptr;
+static uint32_t					vk_record_used_threads = 0;
+static uint32_t					vk_record_frame_offset;
+static uint32_t					vk_record_instance_offset;
+static YsInstanceData*			vk_record_instance_data;
 
 static float		ys_cube_vertex[] = 
 {
@@ -194,55 +758,164 @@ static uint32_t		ys_cube_indices[] =
 	//3, 7, 2,	2, 7, 6
 };
 
-static float		ys_matrix_view[] =
-{
-	1.f, 0.f, 0.f, 0.f,
-	0.f, 1.f, 0.f, 0.f,
-	0.f, 0.f, 1.f, 0.f,
-	0.f, 0.f, 0.f, 1.f
-};
+static YsMat4		ys_matrix_view;
+static YsMat4		ys_matrix_projection;
 
-static float		ys_matrix_projection[] =
+// Simulation output handed to the renderer. ys_simulate fills one slot as a
+// job while the frame recorded from the other one is being drawn, see vk_run.
+struct YsFrameState
 {
-	1.f, 0.f, 0.f, 0.f,
-	0.f, 1.f, 0.f, 0.f,
-	0.f, 0.f, 1.f, 0.f,
-	0.f, 0.f, 0.f, 1.f
+	YsMat4		view;
+	float		time;
+	bool		animate;
+	// Last client size reported since the previous state, 0 without resize.
+	uint32_t	resize_width;
+	uint32_t	resize_height;
+	// Arrival of the oldest input applied, 0 without input.
+	uint64_t	input_ns;
 };
 
-static float		ys_cube_world[] =
+// Camera driven by the input, only touched by ys_simulate. Dragging with the
+// left button pans, the wheel moves along the view axis.
+struct YsCamera
 {
-	1.f, 0.f, 0.f, 0.f,
-	0.f, 1.f, 0.f, 0.f,
-	0.f, 0.f, 1.f, 0.f,
-	0.f, 0.f, -3.f, 1.f
+	float		pan_x = 0.f;
+	float		pan_y = 0.f;
+	float		dolly = 0.f;
+	int32_t		cursor_x = 0;
+	int32_t		cursor_y = 0;
 };
 
+static YsFrameState	ys_frame_states[2];
+static uint32_t		ys_frame_state_index = 0;
+static YsJobCounter	ys_simulate_counter;
+static YsCamera		ys_camera;
+static YsMat4		ys_cube_world = ys_mat4_translation(0.f, 0.f, -3.f);
+
 
+static void parse_arguments(int, char**);
+#ifdef VK_USE_PLATFORM_WIN32_KHR
 static void create_window();
 LRESULT CALLBACK WndProc(HWND, UINT, WPARAM, LPARAM);
-int main(int, char**);
 int WINAPI WinMain(HINSTANCE, HINSTANCE, LPSTR, int);
+static void ys_render_main();
+static void ys_render_stop();
+#endif
+int main(int, char**);
+static int run_headless();
+static int run_bench();
+static int ys_bench_alloc();
+static int ys_bench_record();
+static int ys_bench_scene();
+static int ys_bench_math();
+static int ys_bench_cull();
+
+static void ys_build_cube_mesh(uint32_t, std::vector<float>&, std::vector<uint32_t>&);
+static void ys_build_draw_batches();
+static void ys_update_objects(const YsFrameState&);
+static void ys_simulate(void*, uint32_t, uint32_t);
+
+static uint64_t ys_time_ns();
+static bool ys_input_push(const YsInputEvent&);
+static bool ys_input_pop(YsInputEvent&);
 
 static void ys_prepare_cube();
-
-static void ys_buffer_allocate(YsBuffer&, VkDeviceSize, VkBufferUsageFlags);
+static void ys_prepare_objects();
+
+static VkDeviceSize ys_uniform_ring_alignment();
+static void ys_uniform_ring_init(VkDeviceSize);
+static void ys_uniform_ring_begin_frame(uint32_t);
+static void* ys_uniform_alloc(VkDeviceSize, uint32_t*);
+static void ys_uniform_ring_end_frame();
+
+static void ys_buffer_allocate(YsBuffer&, VkDeviceSize, VkBufferUsageFlags,
+							   VkFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+										 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+							   bool = false, bool = false);
+static void ys_buffer_sharing(VkBufferCreateInfo&, bool);
 static void ys_buffer_set(YsBuffer&, void*, VkDeviceSize, VkDeviceSize = 0);
+static void ys_buffer_flush(YsBuffer&, VkDeviceSize, VkDeviceSize);
+template <typename T> static T* ys_buffer_data(YsBuffer&, VkDeviceSize = 0);
+template <typename T> static void ys_buffer_write(YsBuffer&, const T&, VkDeviceSize = 0);
+static void ys_buffer_upload(YsBuffer&, const void*, VkDeviceSize, VkDeviceSize = 0);
+static bool ys_buffer_is_host_visible(const YsBuffer&);
+
+static VkDeviceSize ys_align_up(VkDeviceSize, VkDeviceSize);
+static VkDeviceSize ys_staging_alloc(VkDeviceSize);
+
+static void ys_upload_init();
+static VkCommandBuffer ys_upload_command_buffer();
+static void ys_upload_begin_cmd(VkCommandBuffer&, VkCommandPool);
+static void ys_upload_record_pending();
+static uint64_t ys_upload_flush();
+static void ys_upload_wait(uint64_t);
+static void ys_upload_retire(bool);
+static void ys_upload_shutdown();
+static void ys_buffer_free(YsBuffer&);
+static void ys_buffer_defragment_move(void*, const YsAllocation&, 
+									  const YsAllocation&);
+
+static YsAllocation ys_memory_alloc(const VkMemoryRequirements&, VkFlags, 
+									YsResourceKind, void* = nullptr);
+static void ys_memory_free(YsAllocation&);
+static VkDeviceSize ys_memory_defragment(uint32_t, YsDefragmentMoveFn);
+static void ys_memory_report();
+static void ys_memory_shutdown();
 
 static void vk_run();
-static void vk_draw(SwapchainBuffer&);
+static void vk_draw(SwapchainBuffer&, FrameSync&);
+static void vk_print_frame_stats();
+static void vk_poll_input_latency();
+static void vk_write_timestamp(VkCommandBuffer, VkPipelineStageFlagBits, YsTimestamp);
+static void ys_gpu_profile_collect(FrameSync&);
+static void ys_gpu_profile_report();
 
 static void vk_init();
+static void vk_init_surface();
+static void vk_init_swapchain_format();
 static void vk_setup_debug_report_callback();
 static void vk_prepare_resources();
+static void vk_prepare_swapchain();
+static void vk_prepare_offscreen_images();
+static void vk_prepare_swapchain_cmds();
+static bool vk_recreate_swapchain();
+static void vk_destroy_swapchain_buffers(SwapchainBuffer*, uint32_t);
+static void vk_collect_retired_objects();
+static void vk_frame_graph_update();
+static void vk_frame_graph_declare(YsGraph&);
+static void vk_frame_graph_realize(YsGraph&, YsAllocation&);
+static void vk_frame_graph_destroy(YsGraph&, YsAllocation&);
+static VkRenderPass vk_get_render_pass(const YsGraph&, const YsGraphPass&);
+static void vk_graph_cull(YsGraph&, uint32_t, VkCommandBuffer, void*);
+static void vk_graph_main(YsGraph&, uint32_t, VkCommandBuffer, void*);
 static void vk_prepare_pipeline();
+static void vk_pipeline_cache_load(std::vector<char>&);
+static void vk_pipeline_cache_save();
+
+static uint64_t ys_pipeline_hash(const YsPipelineDesc&);
+static void ys_pipeline_desc_default(YsPipelineDesc&);
+static VkPipeline vk_create_pipeline(const YsPipelineDesc&);
+static YsPipelineEntry* ys_pipeline_request(const YsPipelineDesc&, bool = false);
+static VkPipeline ys_pipeline_get(const YsPipelineEntry*);
+static void ys_pipeline_worker();
+static void ys_pipeline_wait_all();
+static void ys_pipeline_init();
+static void ys_pipeline_shutdown();
 static void vk_shutdown();
 
+static bool vk_is_extension_requested(const char*);
+
 static void vk_record_command_buffer(SwapchainBuffer&);
-static void vk_flush_global_command_buffer();
+static void vk_record_init();
+static void vk_record_shutdown();
+static uint32_t vk_record_secondaries(const SwapchainBuffer&);
+static void vk_record_secondary(YsRecordContext&, const SwapchainBuffer&);
+static void vk_record_job(void*, uint32_t, uint32_t);
+static void vk_cull_init();
+static void vk_cull_prepare();
+static void vk_cull_shutdown();
+static void vk_record_cull(VkCommandBuffer);
 
-static void vk_set_image_layout(VkImage, VkImageAspectFlags, VkImageLayout, 
-								VkImageLayout, VkAccessFlagBits);
 
 static VkShaderModule vk_load_shader(const std::string&, const std::string&);
 
@@ -253,11 +926,81 @@ VKAPI_ATTR VkBool32 VKAPI_CALL
 vk_debug_log(VkFlags, VkDebugReportObjectTypeEXT, uint64_t, size_t, int32_t,
 			 const char*, const char*, void*);
 
-#define DEG_TO_RAD 3.1415f / 360.f
-static void ys_compute_perspective(float* _matrix, 
-								   float _near_plane, float _far_plane,
-								   float _fov, float _aspect_ratio);
+static void
+parse_arguments(int argc, char** argv)
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		char* arg = argv[i];
+		bool has_value = (i + 1 < argc);
+
+		if (!strcmp(arg, "--headless"))
+			vk_headless = true;
+		else if (!strcmp(arg, "--no-validation"))
+			vk_validate = false;
+		else if (!strcmp(arg, "--validation"))
+			vk_validate = vk_validate_requested = true;
+		else if (!strcmp(arg, "--frames") && has_value)
+			vk_headless_frame_count = (uint32_t)atoi(argv[++i]);
+		else if (!strcmp(arg, "--bench") && has_value)
+			ys_bench_name = argv[++i];
+		else if (!strcmp(arg, "--bench-count") && has_value)
+			ys_bench_count = (uint32_t)atoi(argv[++i]);
+		else if (!strcmp(arg, "--bench-report") && has_value)
+			ys_bench_report_path = argv[++i];
+		else if (!strcmp(arg, "--bench-baseline") && has_value)
+			ys_bench_baseline_path = argv[++i];
+		else if (!strcmp(arg, "--bench-tolerance") && has_value)
+			ys_bench_tolerance = atof(argv[++i]);
+		else if (!strcmp(arg, "--animate"))
+			ys_animate = true;
+		else if (!strcmp(arg, "--no-gpu-cull"))
+			vk_gpu_cull = false;
+		else if (!strcmp(arg, "--no-transfer-queue"))
+			vk_use_transfer_queue = false;
+		else if (!strcmp(arg, "--no-async-compute"))
+			vk_use_async_compute = false;
+		else if (!strcmp(arg, "--cpu-cull"))
+		{
+			ys_cpu_cull = true;
+			vk_gpu_cull = false;
+		}
+		else if (!strcmp(arg, "--mesh-subdiv") && has_value)
+			ys_mesh_subdiv = (uint32_t)atoi(argv[++i]);
+		else if (!strcmp(arg, "--pipelines") && has_value)
+			ys_pipeline_variant_count = (uint32_t)atoi(argv[++i]);
+		else if (!strcmp(arg, "--frames-in-flight") && has_value)
+			vk_frames_in_flight = (uint32_t)atoi(argv[++i]);
+		else if (!strcmp(arg, "--trace") && has_value)
+			ys_trace_path = argv[++i];
+		else if (!strcmp(arg, "--gpu-profile-csv") && has_value)
+			ys_gpu_profile_csv = argv[++i];
+		else if (!strcmp(arg, "--pipeline-cache") && has_value)
+			vk_pipeline_cache_path = argv[++i];
+		else if (!strcmp(arg, "--pipeline-threads") && has_value)
+			ys_pipeline_thread_count = (uint32_t)atoi(argv[++i]);
+		else if (!strcmp(arg, "--job-threads") && has_value)
+			ys_job_worker_count = (uint32_t)atoi(argv[++i]);
+		else if (!strcmp(arg, "--record-threads") && has_value)
+			vk_record_thread_count = (uint32_t)atoi(argv[++i]);
+		else if (!strcmp(arg, "--objects") && has_value)
+			ys_object_count = (uint32_t)atoi(argv[++i]);
+		else if (!strcmp(arg, "--width") && has_value)
+			win_width = (uint32_t)atoi(argv[++i]);
+		else if (!strcmp(arg, "--height") && has_value)
+			win_height = (uint32_t)atoi(argv[++i]);
+		else
+			std::cout << "[WARNING] Ignored argument " << arg << std::endl;
+	}
+
+	assert(win_width > 0 && win_height > 0);
+	assert(ys_object_count > 0);
+	assert(ys_mesh_subdiv > 0 && ys_pipeline_variant_count > 0);
+	assert(vk_frames_in_flight >= 1 && vk_frames_in_flight <= YS_MAX_FRAMES_IN_FLIGHT);
+}
+
 
+#ifdef VK_USE_PLATFORM_WIN32_KHR
 static void
 create_window()
 {
@@ -302,1526 +1045,5437 @@ WndProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
 {
 	switch (uMsg)
 	{
+	// NOTE: The surface is destroyed by the render thread, the window has to
+	//		 outlive it. Messages keep being pumped meanwhile, presentation may
+	//		 need them.
 	case WM_CLOSE:
+		ys_render_quit.store(true, std::memory_order_release);
+		return 0;
+	case YS_WM_RENDER_DONE:
+		DestroyWindow(hWnd);
 		PostQuitMessage(0);
+		return 0;
+	case WM_SIZE:
+		ys_input_push({ YS_INPUT_RESIZE, 0, (int32_t)LOWORD(lParam), 
+						(int32_t)HIWORD(lParam), ys_time_ns() });
 		break;
-	case WM_PAINT:
-		// DRAW HERE
-		// NEXT
-		vk_run();
-		// NOTE: cube.c:2007
+	case WM_KEYDOWN:
+		ys_input_push({ YS_INPUT_KEY_DOWN, (uint32_t)wParam, 0, 0, ys_time_ns() });
 		break;
-	case WM_SIZE:
-		// RESIZE HERE
+	case WM_MOUSEMOVE:
+	{
+		uint32_t buttons = (wParam & MK_LBUTTON) ? YS_INPUT_BUTTON_LEFT : 0;
+		ys_input_push({ YS_INPUT_MOUSE_MOVE, buttons, (int16_t)LOWORD(lParam), 
+						(int16_t)HIWORD(lParam), ys_time_ns() });
+		break;
+	}
+	case WM_MOUSEWHEEL:
+		ys_input_push({ YS_INPUT_MOUSE_WHEEL, 0, GET_WHEEL_DELTA_WPARAM(wParam), 0, 
+						ys_time_ns() });
 		break;
 	default: break;
 	}
+	// NOTE: Painting happens on the render thread, WM_PAINT is only validated
+	//		 by DefWindowProc.
 	return (DefWindowProc(hWnd, uMsg, wParam, lParam));
 }
 
 
-int
-main(int, char**)
-{
-	return WinMain(GetModuleHandle(nullptr), nullptr, nullptr, SW_SHOW);
-}
-
-
 int WINAPI 
 WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR, int)
 {
-	// LATER: Add an argument parser in order to
-	//		 - enable/disable validation layers
 	MSG		msg;
-	bool	run = true;
 
 	win_instance = hInstance;
 
+	if (vk_headless)
+		return run_headless();
+
+	// NOTE: Messages go to the thread owning the window, it only dispatches
+	//		 them from now on and blocks while there are none.
 	create_window();
+	ys_render_thread = std::thread(ys_render_main);
+
+	while (GetMessage(&msg, NULL, 0, 0) > 0)
+	{
+		YS_PROFILE_SCOPE("dispatch message");
+		TranslateMessage(&msg);
+		DispatchMessage(&msg);
+	}
+
+	ys_render_stop();
+
+	return (int)msg.wParam;
+}
+
+
+// Lets the render thread finish its frame and shut Vulkan down, unless it
+// already has.
+static void
+ys_render_stop()
+{
+	ys_render_quit.store(true, std::memory_order_release);
+	if (ys_render_thread.joinable())
+		ys_render_thread.join();
+}
+
+
+// Owns Vulkan and the job system for the lifetime of the window.
+static void
+ys_render_main()
+{
+	YS_PROFILE_THREAD("render");
+	ys_job_init(ys_job_worker_count);
+
 	vk_init();
 	vk_prepare_resources();
 	vk_prepare_pipeline();
 
 	ys_prepare_cube();
+	ys_prepare_objects();
 
-	for (uint32_t i = 0; i < vk_swapchain_image_count; ++i)
-		vk_record_command_buffer(vk_swapchain_buffers[i]);
+	ys_upload_flush();
 
-	vk_flush_global_command_buffer();
+	while (!ys_render_quit.load(std::memory_order_acquire))
+		vk_run();
 
-	while (run)
-	{
-		PeekMessage(&msg, NULL, 0, 0, PM_REMOVE);
-		if (msg.message == WM_QUIT)
-			run = false;
-		else
-		{
-			TranslateMessage(&msg);
-			DispatchMessage(&msg);
-		}
+	vk_print_frame_stats();
+	vk_shutdown();
+
+	ys_job_shutdown();
+	PostMessage(window_handle, YS_WM_RENDER_DONE, 0, 0);
+}
+#endif
+
+
+int
+main(int argc, char** argv)
+{
+	YS_PROFILE_THREAD("main");
+	parse_arguments(argc, argv);
 
-		RedrawWindow(window_handle, NULL, NULL, RDW_INTERNALPAINT);
+	// NOTE: Benchmarks always run offscreen.
+	if (!ys_bench_name.empty())
+	{
+		vk_headless = true;
+		return run_bench();
 	}
 
+#ifdef VK_USE_PLATFORM_WIN32_KHR
+	return WinMain(GetModuleHandle(nullptr), nullptr, nullptr, SW_SHOW);
+#else
+	// NOTE: Only the headless path exists outside of Win32.
+	return run_headless();
+#endif
+}
+
+
+static int
+run_headless()
+{
+	ys_job_init(ys_job_worker_count);
+	vk_init();
+	vk_prepare_resources();
+	vk_prepare_pipeline();
+
+	ys_prepare_cube();
+	ys_prepare_objects();
+
+	ys_upload_flush();
+
+	using clock = std::chrono::high_resolution_clock;
+	clock::time_point start = clock::now();
+
+	for (uint32_t frame = 0; frame < vk_headless_frame_count; ++frame)
+		vk_run();
+
+	vkDeviceWaitIdle(vk_device);
+	double elapsed_ms = 
+		std::chrono::duration<double, std::milli>(clock::now() - start).count();
+
+	std::cout << "[HEADLESS] " << vk_headless_frame_count << " frames in "
+		<< elapsed_ms << " ms, "
+		<< elapsed_ms / (double)vk_headless_frame_count << " ms/frame, "
+		<< (double)vk_headless_frame_count * 1000.0 / elapsed_ms << " fps"
+		<< std::endl;
+
+	vk_print_frame_stats();
 	vk_shutdown();
+	ys_job_shutdown();
 
-	return (int)msg.wParam;
+	return 0;
 }
 
 
-static void
-ys_prepare_cube()
+static int
+run_bench()
 {
-	// INDEX BUFFER SETUP
+	// NOTE: The layers and the barrier validator would be part of the CPU
+	//		 timings.
+	if (!vk_validate_requested)
+		vk_validate = false;
+
+	ys_job_init(ys_job_worker_count);
+
+	// NOTE: The math and cull benchmarks run on the CPU only.
+	int result = 1;
+	if (ys_bench_name == "math")
+		result = ys_bench_math();
+	else if (ys_bench_name == "cull")
+		result = ys_bench_cull();
+	else
 	{
-		YsBuffer&			ys_buffer_handl = ys_cube_index_buffer;
-		uint32_t			value_count = 36;
-		VkDeviceSize		buffer_size = value_count * sizeof(uint32_t);
-		VkBufferUsageFlags	buffer_usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
-		void*				p_host_memory = ys_cube_indices;
+		vk_init();
+		vk_prepare_resources();
+		vk_prepare_pipeline();
+
+		ys_prepare_cube();
+		ys_prepare_objects();
+
+		if (ys_bench_name == "alloc")
+			result = ys_bench_alloc();
+		else if (ys_bench_name == "record")
+			result = ys_bench_record();
+		else if (ys_bench_name == "scene")
+			result = ys_bench_scene();
+		else
+			std::cout << "[BENCH] Unknown benchmark " << ys_bench_name << std::endl;
 
-		ys_buffer_allocate(ys_buffer_handl, buffer_size, buffer_usage);
-		ys_buffer_set(ys_buffer_handl, p_host_memory, buffer_size);
-		ys_buffer_handl.value_count = value_count;
+		vk_shutdown();
 	}
 
-	// VERTEX BUFFER SETUP
-	{
-		YsBuffer&			ys_buffer_handl = ys_cube_vertex_buffer;
-		uint32_t			value_count = 8 * 3;
-		VkDeviceSize		buffer_size = value_count * sizeof(float);
-		VkBufferUsageFlags	buffer_usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
-		void*				p_host_memory = ys_cube_vertex;
-
-		ys_buffer_allocate(ys_buffer_handl, buffer_size, buffer_usage);
-		ys_buffer_set(ys_buffer_handl, p_host_memory, buffer_size);
-		ys_buffer_handl.value_count = value_count;
-	}
+	ys_job_shutdown();
+	return result;
 }
 
 
-static void	
-ys_buffer_allocate(YsBuffer& buffer_handl, VkDeviceSize buffer_size, VkBufferUsageFlags buffer_usage)
+// Creates and destroys ys_bench_count small buffers with one vkAllocateMemory
+// each, then through the sub-allocator, and reports both timings.
+static int
+ys_bench_alloc()
 {
+	using clock = std::chrono::high_resolution_clock;
 	VkResult error;
 
+	// NOTE: The direct path has to stay under the driver allocation limit.
+	uint32_t direct_count = ys_bench_count;
+	uint32_t allocation_limit = vk_gpu_properties.limits.maxMemoryAllocationCount;
+	if (direct_count + 64 > allocation_limit)
+		direct_count = allocation_limit - 64;
+
+	std::vector<VkDeviceSize> sizes(ys_bench_count);
+	uint32_t seed = 1;
+	for (uint32_t i = 0; i < ys_bench_count; ++i)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		sizes[i] = 256 + (seed >> 8) % (64 * 1024);
+	}
+
 	VkBufferCreateInfo create_info;
 	create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
 	create_info.pNext = nullptr;
 	create_info.flags = 0;
-	create_info.size = buffer_size;
-	create_info.usage = buffer_usage;
+	create_info.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
 	create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 	create_info.queueFamilyIndexCount = 0;
 	create_info.pQueueFamilyIndices = nullptr;
 
-	error = vkCreateBuffer(vk_device, &create_info, nullptr, &buffer_handl.buffer);
-	assert(!error);
+	// DIRECT ALLOCATIONS
+	double direct_alloc_ms, direct_free_ms;
+	{
+		std::vector<VkBuffer>		buffers(direct_count);
+		std::vector<VkDeviceMemory>	memories(direct_count);
 
-	VkMemoryRequirements mem_reqs;
-	vkGetBufferMemoryRequirements(vk_device, buffer_handl.buffer, &mem_reqs);
+		clock::time_point start = clock::now();
+		for (uint32_t i = 0; i < direct_count; ++i)
+		{
+			create_info.size = sizes[i];
+			error = vkCreateBuffer(vk_device, &create_info, nullptr, &buffers[i]);
+			assert(!error);
 
-	VkMemoryAllocateInfo mem_alloc;
-	mem_alloc.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	mem_alloc.pNext = nullptr;
-	mem_alloc.allocationSize = mem_reqs.size;
-	mem_alloc.memoryTypeIndex =
-		vk_get_memory_type_index(vk_memory_properties,
-								 mem_reqs.memoryTypeBits,
-								 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-								 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-	assert(mem_alloc.memoryTypeIndex != UINT32_MAX);
-
-	error = vkAllocateMemory(vk_device, &mem_alloc, nullptr,
-							 &buffer_handl.memory);
-	assert(!error);
+			VkMemoryRequirements mem_reqs;
+			vkGetBufferMemoryRequirements(vk_device, buffers[i], &mem_reqs);
+
+			VkMemoryAllocateInfo mem_alloc;
+			mem_alloc.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+			mem_alloc.pNext = nullptr;
+			mem_alloc.allocationSize = mem_reqs.size;
+			mem_alloc.memoryTypeIndex =
+				vk_get_memory_type_index(vk_memory_properties,
+										 mem_reqs.memoryTypeBits,
+										 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+										 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+			error = vkAllocateMemory(vk_device, &mem_alloc, nullptr, &memories[i]);
+			assert(!error);
 
-	buffer_handl.size = buffer_size;
+			error = vkBindBufferMemory(vk_device, buffers[i], memories[i], 0);
+			assert(!error);
+		}
+		clock::time_point middle = clock::now();
+		for (uint32_t i = 0; i < direct_count; ++i)
+		{
+			vkDestroyBuffer(vk_device, buffers[i], nullptr);
+			vkFreeMemory(vk_device, memories[i], nullptr);
+		}
+		clock::time_point end = clock::now();
 
-	// NOTE: A buffer can be bound to memory at any time.
-	error = vkBindBufferMemory(vk_device, buffer_handl.buffer,
-							   buffer_handl.memory, 0);
-	assert(!error);
+		direct_alloc_ms = std::chrono::duration<double, std::milli>(middle - start).count();
+		direct_free_ms = std::chrono::duration<double, std::milli>(end - middle).count();
+	}
+
+	// SUB-ALLOCATIONS
+	double sub_alloc_ms, sub_free_ms;
+	{
+		std::vector<YsBuffer> buffers(ys_bench_count);
+
+		clock::time_point start = clock::now();
+		for (uint32_t i = 0; i < ys_bench_count; ++i)
+			ys_buffer_allocate(buffers[i], sizes[i], VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+							   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+							   VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, false, true);
+		clock::time_point middle = clock::now();
+
+		ys_memory_report();
+
+		// Free every other buffer to fragment the blocks, then compact them.
+		for (uint32_t i = 0; i < ys_bench_count; i += 2)
+			ys_buffer_free(buffers[i]);
+		ys_memory_report();
+
+		uint32_t type_index = buffers[1].allocation.block->type_index;
+		VkDeviceSize moved = ys_memory_defragment(type_index, ys_buffer_defragment_move);
+		std::cout << "[BENCH] defragmentation moved " << moved << " bytes" << std::endl;
+		ys_memory_report();
+
+		clock::time_point free_start = clock::now();
+		for (uint32_t i = 1; i < ys_bench_count; i += 2)
+			ys_buffer_free(buffers[i]);
+		clock::time_point end = clock::now();
+
+		sub_alloc_ms = std::chrono::duration<double, std::milli>(middle - start).count();
+		sub_free_ms = std::chrono::duration<double, std::milli>(end - free_start).count();
+	}
+
+	std::cout << "[BENCH] alloc: direct " << direct_count << " buffers "
+		<< direct_alloc_ms << " ms alloc, " << direct_free_ms << " ms free ("
+		<< direct_alloc_ms * 1000.0 / direct_count << " us/buffer)" << std::endl;
+	std::cout << "[BENCH] alloc: sub-allocated " << ys_bench_count << " buffers "
+		<< sub_alloc_ms << " ms alloc, " << sub_free_ms << " ms free of half ("
+		<< sub_alloc_ms * 1000.0 / ys_bench_count << " us/buffer)" << std::endl;
+
+	return 0;
 }
 
 
-static void
-ys_buffer_set(YsBuffer& buffer_handl, void* p_host_memory, VkDeviceSize size, VkDeviceSize offset)
+// Records the scene vk_headless_frame_count times with 1 to
+// vk_record_thread_count threads, without submitting, and reports the
+// recording time per frame. Use --objects to size the scene.
+static int
+ys_bench_record()
 {
-	VkResult error;
+	using clock = std::chrono::high_resolution_clock;
 
-	uint8_t*	p_dev_memory_base;
-	uint8_t*	p_dev_memory;
-	error = vkMapMemory(vk_device, buffer_handl.memory,
-						0, VK_WHOLE_SIZE, 0, (void**)&p_dev_memory_base);
-	assert(!error);
+	SwapchainBuffer& buffer = vk_swapchain_buffers[0];
+	double single_thread_ms = 0.0;
+
+	for (uint32_t threads = 1; threads <= vk_record_thread_count; ++threads)
+	{
+		vk_record_active_threads = threads;
+
+		clock::time_point start = clock::now();
+		for (uint32_t frame = 0; frame < vk_headless_frame_count; ++frame)
+		{
+			ys_uniform_ring_begin_frame(vk_frame_index);
+			vk_record_command_buffer(buffer);
+			ys_uniform_ring_end_frame();
+		}
+		double frame_ms = 
+			std::chrono::duration<double, std::milli>(clock::now() - start).count() /
+			(double)vk_headless_frame_count;
 
-	p_dev_memory = p_dev_memory_base + offset;
+		if (threads == 1)
+			single_thread_ms = frame_ms;
 
-	memcpy(p_dev_memory, p_host_memory, size);
-	vkUnmapMemory(vk_device, buffer_handl.memory);
+		std::cout << "[BENCH] record " << ys_objects.size() << " objects, "
+			<< threads << " threads: " << frame_ms << " ms/frame, x"
+			<< single_thread_ms / frame_ms << std::endl;
+	}
+
+	vk_record_active_threads = vk_record_thread_count;
+	return 0;
 }
 
 
-static void
-vk_run()
+struct YsBenchMetrics
 {
-	vkDeviceWaitIdle(vk_device);
+	double	cpu_frame_ms;
+	double	cpu_frame_max_ms;
+	double	gpu_frame_ms;
+	// Draw calls per second, one per instanced batch.
+	double	draws_per_second;
+	double	instances_per_second;
+};
 
-	vk_draw(*vk_swapchain_current_buffer);
-	
-	uint32_t next_buffer = vk_swapchain_current_buffer->index + 1;
-	while (next_buffer >= vk_swapchain_image_count)
-		next_buffer -= vk_swapchain_image_count;
-	vk_swapchain_current_buffer = vk_swapchain_buffers + next_buffer;
 
-	vkDeviceWaitIdle(vk_device);
+// Reads a metric from a flat JSON object as written by ys_bench_write_report.
+static bool
+ys_bench_read_metric(const std::string& json, const char* name, double& value)
+{
+	std::string key = std::string("\"") + name + "\"";
+	size_t position = json.find(key);
+	if (position == std::string::npos)
+		return false;
+	position = json.find(':', position + key.size());
+	if (position == std::string::npos)
+		return false;
+
+	value = atof(json.c_str() + position + 1);
+	return true;
 }
 
 
 static void
-vk_draw(SwapchainBuffer& buffer)
+ys_bench_write_report(const std::string& path, const YsBenchMetrics& metrics)
 {
-	// NEXT: Find why our cube is not drawn.
-	// Possible reasons :
-	//		[x] Matrices
-	//		[x] Cube data
-	//		[x] Shader
-	//		[ ] Pipeline setup
-	//		[ ] ???
+	std::ofstream file(path, std::ios::trunc);
+	if (!file.is_open())
+	{
+		std::cout << "[BENCH] Failed to write " << path << std::endl;
+		return;
+	}
 
-	VkResult error;
-	
-	VkSemaphore present_complete_semaphore;
+	bool json = (path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0);
+	if (json)
 	{
-		VkSemaphoreCreateInfo create_info;
-		create_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-		create_info.pNext = nullptr;
-		create_info.flags = 0;
-	
-		error = vkCreateSemaphore(vk_device, &create_info, nullptr,
-								  &present_complete_semaphore);
-		assert(!error);
+		file << "{\n"
+			<< "\t\"objects\": " << ys_objects.size() << ",\n"
+			<< "\t\"mesh_indices\": " << ys_cube_index_buffer.value_count << ",\n"
+			<< "\t\"pipelines\": " << ys_pipeline_variant_count << ",\n"
+			<< "\t\"draw_calls\": " << ys_draw_batches.size() << ",\n"
+			<< "\t\"frames\": " << vk_frame_stats.frame_count << ",\n"
+			<< "\t\"cpu_frame_ms\": " << metrics.cpu_frame_ms << ",\n"
+			<< "\t\"cpu_frame_max_ms\": " << metrics.cpu_frame_max_ms << ",\n"
+			<< "\t\"gpu_frame_ms\": " << metrics.gpu_frame_ms << ",\n"
+			<< "\t\"draws_per_second\": " << metrics.draws_per_second << ",\n"
+			<< "\t\"instances_per_second\": " << metrics.instances_per_second << "\n"
+			<< "}" << std::endl;
 	}
-
-	error = fp.AcquireNextImageKHR(vk_device, vk_swapchain, UINT64_MAX, 
-								   present_complete_semaphore,
-								   VK_NULL_HANDLE,
-								   &buffer.index);
-	if (error == VK_ERROR_OUT_OF_DATE_KHR)
+	else
 	{
-		// NOTE: This error signals that the swapchain is out of date.
+		file << "objects,mesh_indices,pipelines,draw_calls,frames,cpu_frame_ms,"
+			<< "cpu_frame_max_ms,gpu_frame_ms,draws_per_second,instances_per_second" 
+			<< std::endl;
+		file << ys_objects.size() << "," << ys_cube_index_buffer.value_count << ","
+			<< ys_pipeline_variant_count << "," << ys_draw_batches.size() << ","
+			<< vk_frame_stats.frame_count << ","
+			<< metrics.cpu_frame_ms << "," << metrics.cpu_frame_max_ms << ","
+			<< metrics.gpu_frame_ms << "," << metrics.draws_per_second << ","
+			<< metrics.instances_per_second << std::endl;
 	}
-	else { assert(!error); }
-
-	vk_flush_global_command_buffer();
+}
 
-	VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-	VkSubmitInfo submit_info;
-	submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submit_info.pNext = nullptr;
-	submit_info.waitSemaphoreCount = 1;
-	submit_info.pWaitSemaphores = &present_complete_semaphore;
-	submit_info.pWaitDstStageMask = &wait_stage;
-	submit_info.commandBufferCount = 1;
-	submit_info.pCommandBuffers = &buffer.cmd;
-	submit_info.signalSemaphoreCount = 0;
-	submit_info.pSignalSemaphores = nullptr;
 
-	error = vkQueueSubmit(vk_main_queue, 1, &submit_info, VK_NULL_HANDLE);
-	assert(!error);
+// Returns false when a metric regressed past the baseline by more than
+// ys_bench_tolerance, and when the baseline is missing or describes another
+// scene. Metrics missing from the baseline are not checked.
+static bool
+ys_bench_check_baseline(const std::string& path, const YsBenchMetrics& metrics)
+{
+	std::ifstream file(path);
+	if (!file.is_open())
+	{
+		std::cout << "[BENCH] No baseline at " << path << std::endl;
+		return false;
+	}
+	std::string json((std::istreambuf_iterator<char>(file)), 
+					 std::istreambuf_iterator<char>());
+
+	struct SceneKey { const char* name; double value; };
+	SceneKey keys[] = {
+		{ "objects", (double)ys_objects.size() },
+		{ "mesh_indices", (double)ys_cube_index_buffer.value_count },
+		{ "pipelines", (double)ys_pipeline_variant_count },
+		{ "draw_calls", (double)ys_draw_batches.size() }
+	};
+
+	bool same_scene = true;
+	for (const SceneKey& key : keys)
+	{
+		double baseline;
+		if (!ys_bench_read_metric(json, key.name, baseline) || baseline != key.value)
+		{
+			std::cout << "[BENCH] Baseline " << key.name << " does not match the scene ("
+				<< key.value << ")" << std::endl;
+			same_scene = false;
+		}
+	}
+	if (!same_scene)
+		return false;
+
+	struct Check { const char* name; double value; bool higher_is_better; };
+	Check checks[] = {
+		{ "cpu_frame_ms", metrics.cpu_frame_ms, false },
+		{ "gpu_frame_ms", metrics.gpu_frame_ms, false },
+		{ "draws_per_second", metrics.draws_per_second, true },
+		{ "instances_per_second", metrics.instances_per_second, true }
+	};
+
+	bool passed = true;
+	for (const Check& check : checks)
+	{
+		double baseline;
+		if (!ys_bench_read_metric(json, check.name, baseline) || baseline <= 0.0)
+			continue;
+
+		double ratio = check.value / baseline;
+		bool regressed = check.higher_is_better ? 
+			(ratio < 1.0 - ys_bench_tolerance) : (ratio > 1.0 + ys_bench_tolerance);
+		if (regressed)
+		{
+			std::cout << "[BENCH] REGRESSION " << check.name << ": " << check.value
+				<< " vs baseline " << baseline << std::endl;
+			passed = false;
+		}
+	}
 
-	VkPresentInfoKHR present_info;
-	present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-	present_info.pNext = nullptr;
-	present_info.waitSemaphoreCount = 0;
-	present_info.pWaitSemaphores = nullptr;
-	present_info.swapchainCount = 1;
-	present_info.pSwapchains = &vk_swapchain;
-	present_info.pImageIndices = &buffer.index;
-	present_info.pResults = nullptr;
+	return passed;
+}
 
-	error = fp.QueuePresentKHR(vk_main_queue, &present_info);
-	// NOTE: See the call to AcquireNextImageKHR earlier in this function.
-	assert(!error); 
 
-	error = vkQueueWaitIdle(vk_main_queue);
-	assert(!error);
+// Renders vk_headless_frame_count frames of the synthetic scene described by
+// --objects, --mesh-subdiv and --pipelines, after a short warm-up. Returns 1
+// when a metric regressed past --bench-baseline.
+static int
+ys_bench_scene()
+{
+	using clock = std::chrono::high_resolution_clock;
 
-	vkDestroySemaphore(vk_device, present_complete_semaphore, nullptr);
+	// NOTE: Timings only start once every variant is compiled and the frame
+	//		 ring has been through a few loops.
+	ys_pipeline_wait_all();
+	for (uint32_t frame = 0; frame < 4 * vk_frames_in_flight; ++frame)
+		vk_run();
+	vkDeviceWaitIdle(vk_device);
+	for (uint32_t i = 0; i < vk_frames_in_flight; ++i)
+		ys_gpu_profile_collect(vk_frames[i]);
+	vk_frame_stats = FrameStats();
+	ys_gpu_timings = YsGpuTimings();
+	ys_async_stats = YsAsyncStats();
+
+	clock::time_point start = clock::now();
+	for (uint32_t frame = 0; frame < vk_headless_frame_count; ++frame)
+		vk_run();
+	vkDeviceWaitIdle(vk_device);
+	double elapsed_ms = 
+		std::chrono::duration<double, std::milli>(clock::now() - start).count();
+
+	// Collects the timestamps of the frames still pending.
+	for (uint32_t i = 0; i < vk_frames_in_flight; ++i)
+		ys_gpu_profile_collect(vk_frames[i]);
+
+	YsBenchMetrics metrics;
+	metrics.cpu_frame_ms = vk_frame_stats.total_ms / (double)vk_frame_stats.frame_count;
+	metrics.cpu_frame_max_ms = vk_frame_stats.max_ms;
+	metrics.gpu_frame_ms = 0.0;
+	const std::vector<double>& gpu_samples = ys_gpu_timings.samples[YS_GPU_PASS_FRAME];
+	for (double ms : gpu_samples)
+		metrics.gpu_frame_ms += ms;
+	if (!gpu_samples.empty())
+		metrics.gpu_frame_ms /= (double)gpu_samples.size();
+	double frames_per_second = (double)vk_headless_frame_count * 1000.0 / elapsed_ms;
+	metrics.draws_per_second = (double)ys_draw_batches.size() * frames_per_second;
+	metrics.instances_per_second = (double)ys_objects.size() * frames_per_second;
+
+	std::cout << "[BENCH] scene " << ys_objects.size() << " objects, "
+		<< ys_cube_index_buffer.value_count << " indices, "
+		<< ys_pipeline_variant_count << " pipelines, " << ys_draw_batches.size()
+		<< " draw calls: cpu " << metrics.cpu_frame_ms
+		<< " ms/frame (max " << metrics.cpu_frame_max_ms << "), gpu "
+		<< metrics.gpu_frame_ms << " ms/frame, " << metrics.draws_per_second 
+		<< " draws/s, " << metrics.instances_per_second << " instances/s" << std::endl;
+
+	if (!ys_bench_report_path.empty())
+		ys_bench_write_report(ys_bench_report_path, metrics);
+
+	if (!ys_bench_baseline_path.empty() &&
+		!ys_bench_check_baseline(ys_bench_baseline_path, metrics))
+		return 1;
+
+	return 0;
 }
 
-static void
-vk_init()
+
+// Times the SIMD math routines against their scalar reference on
+// ys_bench_count matrices and points, and checks that both agree.
+static int
+ys_bench_math()
 {
-	VkResult	error;
+	using clock = std::chrono::high_resolution_clock;
+	const uint32_t repeat = 64;
+	uint32_t count = ys_bench_count;
+
+	std::vector<YsMat4> worlds(count);
+	std::vector<YsMat4> results(count);
+	std::vector<YsMat4> reference(count);
+	std::vector<YsVec4> points(count);
+	std::vector<YsVec4> transformed(count);
+	std::vector<YsVec4> transformed_reference(count);
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		float offset = (float)i * 0.01f;
+		worlds[i] = ys_mat4_translation(offset, -offset, -3.f - offset);
+		worlds[i].m[0] = 1.f + offset;
+		worlds[i].m[1] = 0.5f;
+		worlds[i].m[6] = -0.25f;
+		points[i] = YsVec4(offset, 1.f - offset, 2.f * offset, 1.f);
+	}
+	YsMat4 view_projection = ys_mat4_multiply_scalar(
+		ys_mat4_perspective(0.1f, 1000.f, 90.f, 16.f / 9.f),
+		ys_mat4_look_at(YsVec4(0.f, 2.f, 5.f, 1.f), YsVec4(0.f, 0.f, 0.f, 1.f),
+						YsVec4(0.f, 1.f, 0.f, 0.f)));
 
-	// NOTE: If any requested layer or extension is not supported by the driver,
-	//		 an assert is raised. 
+	struct Timing { const char* name; double scalar_ms; double simd_ms; };
+	Timing timings[3] = { { "multiply_batch" }, { "inverse" }, { "transform_points" } };
 
-	// VALIDATION LAYERS CHECK
-	if (vk_validate)
+	for (uint32_t variant = 0; variant < 2; ++variant)
 	{
-		uint32_t	instance_layer_count = 0;
+		bool simd = (variant == 1);
+		std::vector<YsMat4>& matrices = simd ? results : reference;
+		std::vector<YsVec4>& vectors = simd ? transformed : transformed_reference;
 
-		error = vkEnumerateInstanceLayerProperties(&instance_layer_count, nullptr);
-		assert(!error);
-
-		if (instance_layer_count > 0)
+		clock::time_point start = clock::now();
+		for (uint32_t r = 0; r < repeat; ++r)
 		{
-			VkLayerProperties* instance_layers = new VkLayerProperties[instance_layer_count];
-
-			error = vkEnumerateInstanceLayerProperties(&instance_layer_count, instance_layers);
-			assert(!error);
+			if (simd)
+				ys_mat4_multiply_batch(view_projection, worlds.data(), matrices.data(), count);
+			else
+				ys_mat4_multiply_batch_scalar(view_projection, worlds.data(), 
+											  matrices.data(), count);
+		}
+		clock::time_point multiplied = clock::now();
 
-			// Make sure that every validation layer that we want is supported by the ICD.
-			bool validation_ok = true;
+		bool invertible = true;
+		for (uint32_t r = 0; r < repeat; ++r)
+		{
+			for (uint32_t i = 0; i < count; ++i)
 			{
-				for (uint32_t expected = 0; expected < ARRAY_SIZE(vk_instance_layers) && validation_ok; ++expected) 
-				{
-					char*	expected_layer = vk_instance_layers[expected];
-					bool	expected_ok = false;
-					for (uint32_t available = 0; available < instance_layer_count && !expected_ok; ++available)
-					{
-						expected_ok = !strcmp(expected_layer, instance_layers[available].layerName);
-					}
-					if (expected_ok) vk_enabled_layers.push_back(expected_layer);
-					validation_ok &= expected_ok;
-				}
+				invertible &= simd ? 
+					ys_mat4_inverse(worlds[i], matrices[i]) :
+					ys_mat4_inverse_scalar(worlds[i], matrices[i]);
 			}
-			assert(validation_ok);
+		}
+		clock::time_point inverted = clock::now();
+		assert(invertible);
 
-			delete[] instance_layers;
+		for (uint32_t r = 0; r < repeat; ++r)
+		{
+			if (simd)
+				ys_mat4_transform_points(view_projection, points.data(), 
+										 vectors.data(), count);
+			else
+				ys_mat4_transform_points_scalar(view_projection, points.data(), 
+												vectors.data(), count);
 		}
+		clock::time_point end = clock::now();
+
+		double* p_ms[3] = { 
+			simd ? &timings[0].simd_ms : &timings[0].scalar_ms,
+			simd ? &timings[1].simd_ms : &timings[1].scalar_ms,
+			simd ? &timings[2].simd_ms : &timings[2].scalar_ms
+		};
+		*p_ms[0] = std::chrono::duration<double, std::milli>(multiplied - start).count();
+		*p_ms[1] = std::chrono::duration<double, std::milli>(inverted - multiplied).count();
+		*p_ms[2] = std::chrono::duration<double, std::milli>(end - inverted).count();
 	}
 
-	// EXTENSIONS CHECK
+	// NOTE: Only the inverses are left in the matrices, products are checked
+	//		 through the transformed points.
+	float max_error = 0.f;
+	for (uint32_t i = 0; i < count; ++i)
 	{
-		uint32_t	instance_extension_count = 0;
+		for (uint32_t c = 0; c < 16; ++c)
+			max_error = std::max(max_error, fabsf(results[i].m[c] - reference[i].m[c]));
+		const float* a = &transformed[i].x;
+		const float* b = &transformed_reference[i].x;
+		for (uint32_t c = 0; c < 4; ++c)
+			max_error = std::max(max_error, fabsf(a[c] - b[c]));
+	}
 
-		error = vkEnumerateInstanceExtensionProperties(nullptr, &instance_extension_count, nullptr);
-		assert(!error);
+	for (const Timing& timing : timings)
+	{
+		std::cout << "[BENCH] math " << timing.name << " x" << count * repeat 
+			<< ": scalar " << timing.scalar_ms << " ms, simd " << timing.simd_ms 
+			<< " ms (x" << timing.scalar_ms / timing.simd_ms << ")" << std::endl;
+	}
+	std::cout << "[BENCH] math max difference " << max_error << std::endl;
 
-		if (instance_extension_count > 0)
-		{
-			VkExtensionProperties* instance_extensions = new VkExtensionProperties[instance_extension_count];
+	return (max_error < 1e-3f) ? 0 : 1;
+}
 
-			error = vkEnumerateInstanceExtensionProperties(nullptr,
-														   &instance_extension_count, 
-														   instance_extensions);
-			assert(!error);
 
-			bool extensions_ok = true;
+// Culls ys_bench_count spheres and boxes scattered around the frustum with
+// the scalar and SIMD paths, then with the SIMD path split in chunks over the
+// job system, and reports the throughput in objects per millisecond.
+static int
+ys_bench_cull()
+{
+	using clock = std::chrono::high_resolution_clock;
+	const uint32_t repeat = 64;
+	uint32_t count = ys_bench_count;
+
+	YsFrustum frustum;
+	ys_frustum_from_view_projection(ys_mat4_multiply(
+		ys_mat4_perspective(0.1f, 100.f, 90.f, 16.f / 9.f),
+		ys_mat4_look_at(YsVec4(0.f, 0.f, 0.f, 1.f), YsVec4(0.f, 0.f, -1.f, 1.f),
+						YsVec4(0.f, 1.f, 0.f, 0.f))), frustum);
+
+	YsBoundingSpheres spheres;
+	YsBoundingBoxes boxes;
+	ys_bounding_spheres_resize(spheres, count);
+	ys_bounding_boxes_resize(boxes, count);
+	uint32_t seed = 1;
+	auto random = [&seed]() {
+		seed = seed * 1664525u + 1013904223u;
+		return (float)(seed >> 8) / (float)(1u << 24);
+	};
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		float x = random() * 200.f - 100.f;
+		float y = random() * 200.f - 100.f;
+		float z = random() * -120.f + 10.f;
+		float size = 0.1f + random() * 2.f;
+		ys_bounding_sphere_set(spheres, i, x, y, z, size);
+		boxes.center_x[i] = x;
+		boxes.center_y[i] = y;
+		boxes.center_z[i] = z;
+		boxes.extent_x[i] = size;
+		boxes.extent_y[i] = size * 0.5f;
+		boxes.extent_z[i] = size;
+	}
+
+	std::vector<uint32_t> visible(count);
+	std::vector<uint32_t> visible_reference(count);
+
+	struct Timing { const char* name; double ms; uint32_t visible_count; };
+	Timing timings[5] = { { "spheres scalar" }, { "spheres simd" },
+						  { "boxes scalar" }, { "boxes simd" }, { "spheres simd parallel" } };
+
+	for (uint32_t t = 0; t < 4; ++t)
+	{
+		std::vector<uint32_t>& output = (t & 1) ? visible : visible_reference;
+		uint32_t visible_count = 0;
+
+		clock::time_point start = clock::now();
+		for (uint32_t r = 0; r < repeat; ++r)
+		{
+			switch (t)
 			{
-				for (uint32_t expected = 0; expected < ARRAY_SIZE(vk_instance_extensions) && extensions_ok; ++expected)
-				{
-					char*	expected_extension = vk_instance_extensions[expected];
-					bool	expected_ok = false;
-					for (uint32_t available = 0; available < instance_extension_count && !expected_ok; ++available)
-					{
-						expected_ok = !strcmp(expected_extension, instance_extensions[available].extensionName);
-					}
-					if (expected_ok) vk_enabled_extensions.push_back(expected_extension);
-					extensions_ok &= expected_ok;
-				}
+			case 0: visible_count = ys_cull_spheres_scalar(frustum, spheres, 0, count,
+														   output.data()); break;
+			case 1: visible_count = ys_cull_spheres(frustum, spheres, 0, count,
+													output.data()); break;
+			case 2: visible_count = ys_cull_boxes_scalar(frustum, boxes, 0, count,
+														 output.data()); break;
+			case 3: visible_count = ys_cull_boxes(frustum, boxes, 0, count,
+												  output.data()); break;
 			}
-			assert(extensions_ok);
+		}
+		timings[t].ms = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+		timings[t].visible_count = visible_count;
 
-			delete[] instance_extensions;
+		if ((t & 1) && (timings[t].visible_count != timings[t - 1].visible_count ||
+						!std::equal(visible.begin(), visible.begin() + visible_count,
+									visible_reference.begin())))
+		{
+			std::cout << "[BENCH] cull " << timings[t].name 
+				<< " disagrees with the scalar path" << std::endl;
+			return 1;
 		}
 	}
 
-	// INSTANCE
+	// NOTE: Each chunk writes its indices at its own offset, they would be
+	//		 concatenated afterwards.
 	{
-		VkInstanceCreateInfo	instance_info;
-		VkApplicationInfo		app_info;
+		std::atomic<uint32_t> visible_count;
 
-		// VkApplicationInfo
+		clock::time_point start = clock::now();
+		for (uint32_t r = 0; r < repeat; ++r)
 		{
-			app_info.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
-			app_info.pNext = nullptr;
-			app_info.pApplicationName = APP_NAME;
-			app_info.applicationVersion = 1;
-			app_info.pEngineName = ENGINE_NAME;
-			app_info.engineVersion = 1;
-			app_info.apiVersion = VK_API_VERSION_1_0;
+			visible_count = 0;
+			ys_job_parallel_for(count, 1024, [&](uint32_t begin, uint32_t end) {
+				visible_count += ys_cull_spheres(frustum, spheres, begin, end - begin,
+												 &visible[begin]);
+			});
 		}
+		timings[4].ms = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+		timings[4].visible_count = visible_count;
 
-		// VkInstanceCreateInfo
+		if (timings[4].visible_count != timings[1].visible_count)
 		{
-			instance_info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
-			instance_info.pNext = nullptr;
-			instance_info.pApplicationInfo = &app_info;
-			instance_info.enabledLayerCount = (uint32_t)vk_enabled_layers.size();
-			instance_info.ppEnabledLayerNames = vk_enabled_layers.data();
-			instance_info.enabledExtensionCount = (uint32_t)ARRAY_SIZE(vk_instance_extensions);
-			instance_info.ppEnabledExtensionNames = vk_instance_extensions;
+			std::cout << "[BENCH] cull parallel chunks disagree with one pass" << std::endl;
+			return 1;
 		}
+	}
 
-		error = vkCreateInstance(&instance_info, nullptr, &vk_instance);
-		assert(!error);
+	for (const Timing& timing : timings)
+	{
+		std::cout << "[BENCH] cull " << timing.name << " x" << count * repeat << ": "
+			<< timing.ms << " ms, " << (double)count * repeat / timing.ms 
+			<< " objects/ms, " << timing.visible_count << " visible" << std::endl;
 	}
 
-	// PHYSICAL DEVICE
+	return 0;
+}
+
+
+static void
+ys_prepare_cube()
+{
+	std::vector<float>		vertices(ys_cube_vertex, ys_cube_vertex + 8 * 3);
+	std::vector<uint32_t>	indices(ys_cube_indices, ys_cube_indices + 36);
+	if (ys_mesh_subdiv > 1)
+		ys_build_cube_mesh(ys_mesh_subdiv, vertices, indices);
+
+	// INDEX BUFFER SETUP
 	{
-		uint32_t	gpu_count = 0;
+		YsBuffer&			ys_buffer_handl = ys_cube_index_buffer;
+		uint32_t			value_count = (uint32_t)indices.size();
+		VkDeviceSize		buffer_size = value_count * sizeof(uint32_t);
+		VkBufferUsageFlags	buffer_usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+		void*				p_host_memory = indices.data();
 
-		error = vkEnumeratePhysicalDevices(vk_instance, &gpu_count, nullptr);
-		assert(!error && gpu_count);
+		ys_buffer_allocate(ys_buffer_handl, buffer_size, buffer_usage,
+						   VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		ys_buffer_upload(ys_buffer_handl, p_host_memory, buffer_size);
+		ys_buffer_handl.value_count = value_count;
+	}
 
-		VkPhysicalDevice* instance_physical_devices = new VkPhysicalDevice[gpu_count];
-		error = vkEnumeratePhysicalDevices(vk_instance, &gpu_count,
-										   instance_physical_devices);
-		assert(!error);
+	// VERTEX BUFFER SETUP
+	{
+		YsBuffer&			ys_buffer_handl = ys_cube_vertex_buffer;
+		uint32_t			value_count = (uint32_t)vertices.size();
+		VkDeviceSize		buffer_size = value_count * sizeof(float);
+		VkBufferUsageFlags	buffer_usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+		void*				p_host_memory = vertices.data();
 
-		vk_gpu = instance_physical_devices[0];
-		delete[] instance_physical_devices;
+		ys_buffer_allocate(ys_buffer_handl, buffer_size, buffer_usage,
+						   VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		ys_buffer_upload(ys_buffer_handl, p_host_memory, buffer_size);
+		ys_buffer_handl.value_count = value_count;
 	}
 
-	// MAKE SURE THAT INSTANCE LAYER WERE GIVEN TO THE DEVICE
+	for (size_t i = 0; i < vertices.size(); i += 3)
 	{
-		uint32_t	device_layer_count = 0;
+		float radius = sqrtf(vertices[i] * vertices[i] + vertices[i + 1] * vertices[i + 1] +
+							 vertices[i + 2] * vertices[i + 2]);
+		if (radius > ys_cube_mesh.radius)
+			ys_cube_mesh.radius = radius;
+	}
+}
 
-		error = vkEnumerateDeviceLayerProperties(vk_gpu, &device_layer_count, 
-												 nullptr);
-		assert(!error);
 
-		if (device_layer_count)
+// Same unit cube as ys_cube_vertex, with every face split in subdiv * subdiv
+// quads.
+static void
+ys_build_cube_mesh(uint32_t subdiv, std::vector<float>& vertices, 
+				   std::vector<uint32_t>& indices)
+{
+	vertices.clear();
+	indices.clear();
+
+	uint32_t row = subdiv + 1;
+	for (uint32_t face = 0; face < 6; ++face)
+	{
+		uint32_t axis = face / 2;
+		uint32_t u_axis = (axis + 1) % 3;
+		uint32_t v_axis = (axis + 2) % 3;
+		float side = (face & 1) ? .5f : -.5f;
+		uint32_t first_vertex = (uint32_t)(vertices.size() / 3);
+
+		for (uint32_t j = 0; j < row; ++j)
 		{
-			VkLayerProperties* device_layers = 
-				new VkLayerProperties[device_layer_count];
-			error = vkEnumerateDeviceLayerProperties(vk_gpu, 
-													 &device_layer_count, 
-													 device_layers);
-			assert(!error);
+			for (uint32_t i = 0; i < row; ++i)
+			{
+				float position[3];
+				position[axis] = side;
+				position[u_axis] = (float)i / (float)subdiv - .5f;
+				position[v_axis] = (float)j / (float)subdiv - .5f;
+				vertices.insert(vertices.end(), position, position + 3);
+			}
+		}
 
-			bool validation_ok = true;
+		for (uint32_t j = 0; j < subdiv; ++j)
+		{
+			for (uint32_t i = 0; i < subdiv; ++i)
 			{
-				for (uint32_t expected = 0; 
-					 expected < (uint32_t)vk_enabled_layers.size() 
-					 && validation_ok; 
-					 ++expected)
+				uint32_t v00 = first_vertex + j * row + i;
+				uint32_t v10 = v00 + 1;
+				uint32_t v01 = v00 + row;
+				uint32_t v11 = v01 + 1;
+
+				uint32_t quad[6] = { v00, v10, v11, v00, v11, v01 };
+				if (side < 0.f)
 				{
-					char*	expected_layer = vk_enabled_layers[expected];
-					bool	expected_ok = false;
-					for (uint32_t available = 0; 
-						 available < device_layer_count && !expected_ok; 
-						 ++available)
-					{
-						expected_ok = !strcmp(expected_layer, 
-											  device_layers[available].layerName);
-					}
-					validation_ok &= expected_ok;
+					quad[1] = v11; quad[2] = v10;
+					quad[4] = v01; quad[5] = v11;
 				}
+				indices.insert(indices.end(), quad, quad + 6);
 			}
-			assert(validation_ok);
 		}
 	}
+}
 
 
-	// LOOK FOR DEVICE EXPECTED EXTENSION
+// Lays ys_object_count cubes on a square grid centered on ys_cube_world, and
+// pushed back so that the whole grid stays in view. Objects cycle through
+// ys_pipeline_variant_count pipeline variants.
+static void
+ys_prepare_objects()
+{
+	std::vector<YsPipelineEntry*> variants(ys_pipeline_variant_count);
+	variants[0] = ys_default_pipeline;
+	for (uint32_t i = 1; i < ys_pipeline_variant_count; ++i)
 	{
-		vk_enabled_extensions.clear();
-		uint32_t	device_extension_count = 0;
-
-		error = vkEnumerateDeviceExtensionProperties(vk_gpu, nullptr, 
-													 &device_extension_count, 
-													 nullptr);
-		assert(!error);
+		YsPipelineDesc desc;
+		ys_pipeline_desc_default(desc);
+		desc.variant = i;
+		variants[i] = ys_pipeline_request(desc);
+	}
 
-		if (device_extension_count)
-		{
-			VkExtensionProperties* device_extensions = 
-				new VkExtensionProperties[device_extension_count];
-			error = vkEnumerateDeviceExtensionProperties(vk_gpu, nullptr, 
-														 &device_extension_count, 
-														 device_extensions);
-			assert(!error);
+	uint32_t side = (uint32_t)ceilf(sqrtf((float)ys_object_count));
+	float spacing = 3.f;
+	float half_extent = (float)(side - 1) * spacing * .5f;
 
-			bool extensions_ok = true;
-			{
-				for (uint32_t expected = 0; 
-					 expected < ARRAY_SIZE(vk_device_extensions) && extensions_ok; 
-					 ++expected)
-				{
-					char*	expected_extension = vk_device_extensions[expected];
-					bool	expected_ok = false;
-					for (uint32_t available = 0; 
-						 available < device_extension_count && !expected_ok; 
-						 ++available)
-					{
-						expected_ok = !strcmp(expected_extension, 
-											  device_extensions[available].extensionName);
-					}
-					if (expected_ok) vk_enabled_extensions.push_back(expected_extension);
-					extensions_ok &= expected_ok;
-				}
-			}
-			assert(extensions_ok);
+	ys_transform_reserve(ys_transforms, ys_object_count + 1);
+	ys_scene_root = ys_transform_create(ys_transforms);
+	ys_transform_set_position(ys_transforms, ys_scene_root, ys_cube_world.m[12], 
+							  ys_cube_world.m[13], ys_cube_world.m[14] - half_extent * 2.f);
 
-			delete[] device_extensions;																	
-		}
+	ys_objects.resize(ys_object_count);
+	for (uint32_t i = 0; i < ys_object_count; ++i)
+	{
+		YsObject& object = ys_objects[i];
+		object.transform = ys_transform_create(ys_transforms, ys_scene_root);
+		object.mesh = &ys_cube_mesh;
+		object.pipeline = variants[i % ys_pipeline_variant_count];
+		object.material = 0;
+
+		ys_transform_set_position(ys_transforms, object.transform,
+								  (float)(i % side) * spacing - half_extent,
+								  (float)(i / side) * spacing - half_extent, 0.f);
 	}
+	ys_transform_update(ys_transforms);
 
-	// SELECT A QUEUE FROM THE PHYSICAL DEVICE
-	{
-		vkGetPhysicalDeviceQueueFamilyProperties(vk_gpu, &vk_queue_family_count, 
-												 nullptr);
-		assert(vk_queue_family_count > 0);
-
-		vk_queue_props = new VkQueueFamilyProperties[vk_queue_family_count];
-		vkGetPhysicalDeviceQueueFamilyProperties(vk_gpu, &vk_queue_family_count, 
-												 vk_queue_props);
-	}
+	ys_build_draw_batches();
 
-	if (vk_validate)
-		vk_setup_debug_report_callback();
+	// NOTE: The first frame has no state simulated ahead of it.
+	ys_simulate(nullptr, ys_frame_state_index, ys_frame_state_index + 1);
+}
 
-	GET_INSTANCE_PROC_ADDR(vk_instance, GetPhysicalDeviceSurfaceSupportKHR);
-	GET_INSTANCE_PROC_ADDR(vk_instance, GetPhysicalDeviceSurfaceCapabilitiesKHR);
-	GET_INSTANCE_PROC_ADDR(vk_instance, GetPhysicalDeviceSurfaceFormatsKHR);
-	GET_INSTANCE_PROC_ADDR(vk_instance, GetPhysicalDeviceSurfacePresentModesKHR);
-	GET_INSTANCE_PROC_ADDR(vk_instance, GetSwapchainImagesKHR);
 
-	// CREATE VKSURFACE
+// Advances the animation and rebuilds the world matrices that changed.
+// Called once per frame, before recording.
+static void
+ys_update_objects(const YsFrameState& state)
+{
+	YS_PROFILE_FUNCTION();
+	if (state.animate)
 	{
-		VkWin32SurfaceCreateInfoKHR		create_info;
-		create_info.sType = VK_STRUCTURE_TYPE_WIN32_SURFACE_CREATE_INFO_KHR;
-		create_info.pNext = nullptr;
-		create_info.flags = 0;
-		create_info.hinstance = win_instance;
-		create_info.hwnd = window_handle;
-
-		error = vkCreateWin32SurfaceKHR(vk_instance, &create_info, nullptr, &vk_surface);
-		assert(!error);
+		for (uint32_t i = 0; i < (uint32_t)ys_objects.size(); ++i)
+		{
+			float half_angle = state.time * (0.5f + (float)(i % 7) * 0.1f) * 0.5f;
+			ys_transform_set_rotation(ys_transforms, ys_objects[i].transform,
+									  0.f, sinf(half_angle), 0.f, cosf(half_angle));
+		}
 	}
 
-	// PICK A QUEUE INDEX
+	ys_transform_update(ys_transforms);
+}
+
+
+// Applies the pending input and writes the frame state of slot begin. Runs as
+// a job, at most one at a time.
+static void
+ys_simulate(void*, uint32_t begin, uint32_t)
+{
+	YS_PROFILE_FUNCTION();
+	using clock = std::chrono::high_resolution_clock;
+	static const clock::time_point start = clock::now();
+
+	YsFrameState& state = ys_frame_states[begin];
+	YsCamera& camera = ys_camera;
+	state.input_ns = 0;
+	state.resize_width = 0;
+	state.resize_height = 0;
+
+	YsInputEvent event;
+	while (ys_input_pop(event))
 	{
-		VkBool32* supports_present = new VkBool32[vk_queue_family_count];
-		for (uint32_t i = 0; i < vk_queue_family_count; ++i)
-		{
-			fp.GetPhysicalDeviceSurfaceSupportKHR(vk_gpu, i, vk_surface,
-												  &supports_present[i]);
-		}
+		if (state.input_ns == 0)
+			state.input_ns = event.time_ns;
 
-		// Pick a queue that supports graphics and present
-		uint32_t candidate_queue_index = UINT32_MAX;
-		for (uint32_t i = 0; i < vk_queue_family_count; ++i)
+		switch (event.type)
 		{
-			if (vk_queue_props[i].queueFlags & VK_QUEUE_GRAPHICS_BIT &&
-				supports_present[i] == VK_TRUE)
+		case YS_INPUT_KEY_DOWN:
+			if (event.key == ' ')
+				ys_animate = !ys_animate;
+			break;
+		case YS_INPUT_MOUSE_MOVE:
+			if (event.key & YS_INPUT_BUTTON_LEFT)
 			{
-				candidate_queue_index = i;
-				break;
+				camera.pan_x += (float)(event.x - camera.cursor_x) * 0.01f;
+				camera.pan_y -= (float)(event.y - camera.cursor_y) * 0.01f;
 			}
+			camera.cursor_x = event.x;
+			camera.cursor_y = event.y;
+			break;
+		case YS_INPUT_MOUSE_WHEEL:
+			camera.dolly += (float)event.x / 120.f * 0.5f;
+			break;
+		case YS_INPUT_RESIZE:
+			state.resize_width = (uint32_t)event.x;
+			state.resize_height = (uint32_t)event.y;
+			break;
 		}
-		assert(candidate_queue_index != UINT32_MAX);
+	}
 
-		vk_elected_queue_index = candidate_queue_index;
+	state.view = ys_mat4_translation(camera.pan_x, camera.pan_y, camera.dolly);
+	state.time = std::chrono::duration<float>(clock::now() - start).count();
+	state.animate = ys_animate;
+}
 
-		delete[] supports_present;
-	}
 
-	// CREATE DEVICE
-	{
-		float queue_priorities[1] = { 0.0 };
+static uint64_t
+ys_time_ns()
+{
+	using clock = std::chrono::steady_clock;
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+		clock::now().time_since_epoch()).count();
+}
 
-		VkDeviceQueueCreateInfo queue_info;
-		queue_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-		queue_info.pNext = nullptr;
-		queue_info.flags = 0;
-		queue_info.queueFamilyIndex = vk_elected_queue_index;
-		queue_info.queueCount = 1;
-		queue_info.pQueuePriorities = queue_priorities;
 
-		VkDeviceCreateInfo device_info;
-		device_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-		device_info.pNext = nullptr;
-		device_info.flags = 0;
-		device_info.queueCreateInfoCount = 1;
-		device_info.pQueueCreateInfos = &queue_info;
-		device_info.enabledLayerCount = (uint32_t)vk_enabled_layers.size();
-		device_info.ppEnabledLayerNames = vk_enabled_layers.data();
-		device_info.enabledExtensionCount = (uint32_t)vk_enabled_extensions.size();
-		device_info.ppEnabledExtensionNames = vk_enabled_extensions.data();
-		device_info.pEnabledFeatures = nullptr;
+static bool
+ys_input_push(const YsInputEvent& event)
+{
+	YsInputQueue& queue = ys_input_queue;
+	uint32_t head = queue.head.load(std::memory_order_relaxed);
+	if (head - queue.tail.load(std::memory_order_acquire) == YS_INPUT_QUEUE_SIZE)
+		return false;
+
+	queue.events[head % YS_INPUT_QUEUE_SIZE] = event;
+	queue.head.store(head + 1, std::memory_order_release);
+	return true;
+}
 
-		error = vkCreateDevice(vk_gpu, &device_info, nullptr, &vk_device);
-		assert(!error);
-	}
 
-	GET_DEVICE_PROC_ADDR(vk_device, CreateSwapchainKHR);
-	GET_DEVICE_PROC_ADDR(vk_device, DestroySwapchainKHR);
-	GET_DEVICE_PROC_ADDR(vk_device, GetSwapchainImagesKHR);
-	GET_DEVICE_PROC_ADDR(vk_device, AcquireNextImageKHR);
-	GET_DEVICE_PROC_ADDR(vk_device, QueuePresentKHR);
+static bool
+ys_input_pop(YsInputEvent& event)
+{
+	YsInputQueue& queue = ys_input_queue;
+	uint32_t tail = queue.tail.load(std::memory_order_relaxed);
+	if (tail == queue.head.load(std::memory_order_acquire))
+		return false;
+
+	event = queue.events[tail % YS_INPUT_QUEUE_SIZE];
+	queue.tail.store(tail + 1, std::memory_order_release);
+	return true;
+}
 
-	// GET SURFACE FORMAT AND COLOR SPACE
-	{
-		uint32_t	format_count;
-		error = fp.GetPhysicalDeviceSurfaceFormatsKHR(vk_gpu, vk_surface,
-													  &format_count, nullptr);
-		assert(!error);
 
-		if (format_count)
+// Groups the objects by mesh and pipeline. Must be called again whenever an
+// object is added or changes mesh or pipeline.
+static void
+ys_build_draw_batches()
+{
+	uint32_t object_count = (uint32_t)ys_objects.size();
+	ys_instance_objects.resize(object_count);
+	for (uint32_t i = 0; i < object_count; ++i)
+		ys_instance_objects[i] = i;
+
+	std::stable_sort(ys_instance_objects.begin(), ys_instance_objects.end(),
+		[](uint32_t lhs, uint32_t rhs) {
+			const YsObject& a = ys_objects[lhs];
+			const YsObject& b = ys_objects[rhs];
+			if (a.mesh != b.mesh)
+				return a.mesh < b.mesh;
+			return a.pipeline < b.pipeline;
+		});
+
+	ys_bounding_spheres_resize(ys_cull_bounds, object_count);
+	ys_cull_visible.resize(object_count);
+
+	ys_draw_batches.clear();
+	for (uint32_t i = 0; i < object_count; ++i)
+	{
+		const YsObject& object = ys_objects[ys_instance_objects[i]];
+		if (ys_draw_batches.empty() ||
+			ys_draw_batches.back().mesh != object.mesh ||
+			ys_draw_batches.back().pipeline != object.pipeline)
 		{
-			VkSurfaceFormatKHR* surface_formats = new VkSurfaceFormatKHR[format_count];
-			error = fp.GetPhysicalDeviceSurfaceFormatsKHR(vk_gpu, vk_surface,
-														  &format_count, surface_formats);
-			assert(!error && format_count);
+			YsDrawBatch batch;
+			batch.mesh = object.mesh;
+			batch.pipeline = object.pipeline;
+			batch.first_instance = i;
+			batch.instance_count = 0;
+			ys_draw_batches.push_back(batch);
+		}
+		ys_draw_batches.back().instance_count++;
+	}
 
-			if (surface_formats[0].format == VK_FORMAT_UNDEFINED)
-				vk_surface_format = VK_FORMAT_B8G8R8A8_UNORM;
-			else
-				vk_surface_format = surface_formats[0].format;
+	std::cout << "[BATCH] " << object_count << " objects in " 
+		<< ys_draw_batches.size() << " draws" << std::endl;
 
-			vk_color_space = surface_formats[0].colorSpace;
+	if (vk_gpu_cull)
+		vk_cull_prepare();
+}
 
-			delete[] surface_formats;
-		}
-	}
 
-	vkGetDeviceQueue(vk_device, vk_elected_queue_index, 0, &vk_main_queue);
-	vkGetPhysicalDeviceMemoryProperties(vk_gpu, &vk_memory_properties);
+static void	
+ys_buffer_allocate(YsBuffer& buffer_handl, VkDeviceSize buffer_size, VkBufferUsageFlags buffer_usage,
+				   VkFlags memory_properties, bool concurrent, bool movable)
+{
+	VkResult error;
+
+	VkBufferCreateInfo create_info;
+	create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	create_info.pNext = nullptr;
+	create_info.flags = 0;
+	// NOTE: Transfer usages let ys_memory_defragment relocate the buffer.
+	buffer_usage |= 
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+	create_info.size = buffer_size;
+	create_info.usage = buffer_usage;
+	ys_buffer_sharing(create_info, concurrent);
+
+	error = vkCreateBuffer(vk_device, &create_info, nullptr, &buffer_handl.buffer);
+	assert(!error);
+	buffer_handl.state = YsResourceState();
+	buffer_handl.concurrent = concurrent;
+
+	VkMemoryRequirements mem_reqs;
+	vkGetBufferMemoryRequirements(vk_device, buffer_handl.buffer, &mem_reqs);
+
+	// NOTE: On unified memory, device local buffers are made host visible so
+	//		 that ys_buffer_upload can skip the staging copy.
+	if (vk_unified_memory && 
+		(memory_properties & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT))
+		memory_properties |= VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+							 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+	// NOTE: Only movable buffers are registered with ys_memory_defragment,
+	//		 nothing else may keep their handle, e.g. a descriptor set.
+	buffer_handl.allocation = 
+		ys_memory_alloc(mem_reqs, memory_properties,
+						YS_RESOURCE_LINEAR, movable ? &buffer_handl : nullptr);
+
+	buffer_handl.size = buffer_size;
+	buffer_handl.usage = buffer_usage;
+
+	// NOTE: A buffer can be bound to memory at any time.
+	error = vkBindBufferMemory(vk_device, buffer_handl.buffer,
+							   buffer_handl.allocation.memory, 
+							   buffer_handl.allocation.offset);
+	assert(!error);
 }
 
 
 static void
-vk_setup_debug_report_callback()
+ys_buffer_set(YsBuffer& buffer_handl, void* p_host_memory, VkDeviceSize size, VkDeviceSize offset)
+{
+	memcpy(ys_buffer_data<uint8_t>(buffer_handl, offset), p_host_memory, size);
+	ys_buffer_flush(buffer_handl, offset, size);
+}
+
+
+// Returns a pointer into the persistent mapping of a host visible buffer.
+// Writes through it must be followed by ys_buffer_flush.
+template <typename T>
+static T*
+ys_buffer_data(YsBuffer& buffer_handl, VkDeviceSize offset)
+{
+	assert(buffer_handl.allocation.mapped);
+	return (T*)(buffer_handl.allocation.mapped + offset);
+}
+
+
+template <typename T>
+static void
+ys_buffer_write(YsBuffer& buffer_handl, const T& value, VkDeviceSize offset)
+{
+	*ys_buffer_data<T>(buffer_handl, offset) = value;
+	ys_buffer_flush(buffer_handl, offset, sizeof(T));
+}
+
+
+// Makes host writes to [offset, offset + size) visible to the device. This
+// is a no-op on coherent memory.
+static void
+ys_buffer_flush(YsBuffer& buffer_handl, VkDeviceSize offset, VkDeviceSize size)
 {
 	VkResult error;
 
-	GET_INSTANCE_PROC_ADDR(vk_instance, CreateDebugReportCallbackEXT);
-	GET_INSTANCE_PROC_ADDR(vk_instance, DestroyDebugReportCallbackEXT);
-	GET_INSTANCE_PROC_ADDR(vk_instance, DebugReportMessageEXT);
+	const YsMemoryBlock* block = buffer_handl.allocation.block;
+	VkFlags type_flags = vk_memory_properties.memoryTypes[block->type_index].propertyFlags;
+	if (type_flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)
+		return;
 
-	VkDebugReportCallbackCreateInfoEXT debug_callback_info;
-	debug_callback_info.sType = VK_STRUCTURE_TYPE_DEBUG_REPORT_CREATE_INFO_EXT;
-	debug_callback_info.pNext = nullptr;
-	debug_callback_info.pfnCallback = vk_debug_log;
-	debug_callback_info.pUserData = nullptr;
-	debug_callback_info.flags = 
-		VK_DEBUG_REPORT_ERROR_BIT_EXT | VK_DEBUG_REPORT_WARNING_BIT_EXT;
-	error = fp.CreateDebugReportCallbackEXT(vk_instance, &debug_callback_info,
-											nullptr, &vk_debug_callback);
+	// NOTE: Flushed ranges are expressed relative to the whole VkDeviceMemory
+	//		 and must be multiples of nonCoherentAtomSize, or end at its size.
+	VkDeviceSize atom = vk_gpu_properties.limits.nonCoherentAtomSize;
+	VkDeviceSize begin = buffer_handl.allocation.offset + offset;
+	VkDeviceSize end = ys_align_up(begin + size, atom);
+	begin = begin / atom * atom;
+	if (end > block->size)
+		end = block->size;
+
+	VkMappedMemoryRange range;
+	range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+	range.pNext = nullptr;
+	range.memory = block->memory;
+	range.offset = begin;
+	range.size = end - begin;
+
+	error = vkFlushMappedMemoryRanges(vk_device, 1, &range);
 	assert(!error);
 }
 
 
+static bool
+ys_buffer_is_host_visible(const YsBuffer& buffer_handl)
+{
+	uint32_t type_index = buffer_handl.allocation.block->type_index;
+	return (vk_memory_properties.memoryTypes[type_index].propertyFlags &
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != 0;
+}
+
+
+// Writes to a buffer wherever it lives. Device local buffers go through the
+// staging ring, the copy is only recorded once ys_upload_flush is called.
 static void
-vk_prepare_resources()
+ys_buffer_upload(YsBuffer& buffer_handl, const void* p_host_memory, 
+				 VkDeviceSize size, VkDeviceSize offset)
 {
-	VkResult error;
-	
-	// CREATE COMMAND POOL
+	if (ys_buffer_is_host_visible(buffer_handl))
 	{
-		VkCommandPoolCreateInfo cmd_pool_info;
-		cmd_pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-		cmd_pool_info.pNext = nullptr;
-		cmd_pool_info.flags = 0;
-		cmd_pool_info.queueFamilyIndex = vk_elected_queue_index;
-	
-		error = vkCreateCommandPool(vk_device, &cmd_pool_info, nullptr, &vk_cmd_pool);
-		assert(!error);
+		ys_buffer_set(buffer_handl, (void*)p_host_memory, size, offset);
+		return;
 	}
 
-	// CREATE SWAPCHAIN
-	// NOTE: We assume that no swapchain is destroyed. If it turns out that we do see cube.c:890
+	// NOTE: Large uploads are split so that the ring is never asked for more
+	//		 than half its size at once.
+	const uint8_t* p_src = (const uint8_t*)p_host_memory;
+	VkDeviceSize max_piece = ys_staging_size / 2;
+	while (size > 0)
 	{
+		VkDeviceSize piece = (size < max_piece) ? size : max_piece;
+
+		VkDeviceSize ring_offset = ys_staging_alloc(piece);
+		ys_buffer_set(ys_staging_buffer, (void*)p_src, piece, ring_offset);
+
+		YsUploadCopy copy;
+		copy.dst = buffer_handl.buffer;
+		copy.concurrent = buffer_handl.concurrent;
+		copy.region.srcOffset = ring_offset;
+		copy.region.dstOffset = offset;
+		copy.region.size = piece;
+		ys_upload_pending.push_back(copy);
+		ys_upload_bytes += piece;
+
+		p_src += piece;
+		offset += piece;
+		size -= piece;
+	}
+}
 
-		VkSurfaceCapabilitiesKHR surface_capabilities;
-		error = fp.GetPhysicalDeviceSurfaceCapabilitiesKHR(vk_gpu, vk_surface,
-														   &surface_capabilities);
-		assert(!error);
 
-		VkExtent2D swapchain_extent;
-		if (surface_capabilities.currentExtent.width == (uint32_t)-1)
+// Concurrent buffers are used from several queue families without ownership
+// transfers, e.g. by the main and the async compute queue in the same frame.
+static void
+ys_buffer_sharing(VkBufferCreateInfo& create_info, bool concurrent)
+{
+	if (concurrent && vk_queue_families.size() > 1)
+	{
+		create_info.sharingMode = VK_SHARING_MODE_CONCURRENT;
+		create_info.queueFamilyIndexCount = (uint32_t)vk_queue_families.size();
+		create_info.pQueueFamilyIndices = vk_queue_families.data();
+	}
+	else
+	{
+		create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		create_info.queueFamilyIndexCount = 0;
+		create_info.pQueueFamilyIndices = nullptr;
+	}
+}
+
+
+static void
+ys_buffer_free(YsBuffer& buffer_handl)
+{
+	vkDestroyBuffer(vk_device, buffer_handl.buffer, nullptr);
+	ys_memory_free(buffer_handl.allocation);
+
+	buffer_handl.buffer = VK_NULL_HANDLE;
+	buffer_handl.size = 0;
+	buffer_handl.value_count = 0;
+}
+
+
+// Defragmentation hook for YsBuffer: the buffer is recreated on top of the new
+// allocation and its content copied in the pending upload batch.
+static void
+ys_buffer_defragment_move(void* owner, const YsAllocation&, const YsAllocation& to)
+{
+	VkResult error;
+
+	YsBuffer& buffer_handl = *(YsBuffer*)owner;
+	VkBuffer old_buffer = buffer_handl.buffer;
+
+	VkBufferCreateInfo create_info;
+	create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	create_info.pNext = nullptr;
+	create_info.flags = 0;
+	create_info.size = buffer_handl.size;
+	create_info.usage = buffer_handl.usage;
+	ys_buffer_sharing(create_info, buffer_handl.concurrent);
+
+	error = vkCreateBuffer(vk_device, &create_info, nullptr, &buffer_handl.buffer);
+	assert(!error);
+
+	error = vkBindBufferMemory(vk_device, buffer_handl.buffer, to.memory, to.offset);
+	assert(!error);
+
+	VkBufferCopy region;
+	region.srcOffset = 0;
+	region.dstOffset = 0;
+	region.size = buffer_handl.size;
+
+	vkCmdCopyBuffer(ys_upload_command_buffer(), old_buffer, 
+					buffer_handl.buffer, 1, &region);
+
+	buffer_handl.allocation = to;
+	ys_memory_retired_buffers.push_back(old_buffer);
+}
+
+
+static VkDeviceSize
+ys_align_up(VkDeviceSize value, VkDeviceSize alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+
+static void
+ys_upload_init()
+{
+	VkResult error;
+
+	// NOTE: Memory is considered unified when the largest device local heap
+	//		 also exposes a host visible and coherent memory type.
+	{
+		uint32_t		main_heap = UINT32_MAX;
+		VkDeviceSize	main_heap_size = 0;
+		for (uint32_t i = 0; i < vk_memory_properties.memoryHeapCount; ++i)
 		{
-			swapchain_extent.width = win_width;
-			swapchain_extent.height = win_height;
+			const VkMemoryHeap& heap = vk_memory_properties.memoryHeaps[i];
+			if ((heap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) &&
+				heap.size > main_heap_size)
+			{
+				main_heap = i;
+				main_heap_size = heap.size;
+			}
 		}
-		else
+
+		VkFlags unified_flags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT |
+								VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+								VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+		vk_unified_memory = false;
+		for (uint32_t i = 0; i < vk_memory_properties.memoryTypeCount; ++i)
 		{
-			swapchain_extent = surface_capabilities.currentExtent;
-			win_width = swapchain_extent.width;
-			win_height = swapchain_extent.height;
+			const VkMemoryType& type = vk_memory_properties.memoryTypes[i];
+			if (type.heapIndex == main_heap &&
+				(type.propertyFlags & unified_flags) == unified_flags)
+				vk_unified_memory = true;
 		}
+	}
 
-		uint32_t present_mode_count = 0;
-		error = fp.GetPhysicalDeviceSurfacePresentModesKHR(vk_gpu, vk_surface,
-														   &present_mode_count,
-														   nullptr);
-		assert(!error && present_mode_count);
+	VkCommandPoolCreateInfo cmd_pool_info;
+	cmd_pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	cmd_pool_info.pNext = nullptr;
+	cmd_pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+	cmd_pool_info.queueFamilyIndex = vk_elected_queue_index;
 
-		VkPresentModeKHR* present_modes = new VkPresentModeKHR[present_mode_count];
-		error = fp.GetPhysicalDeviceSurfacePresentModesKHR(vk_gpu, vk_surface,
-														   &present_mode_count,
-														   present_modes);
+	error = vkCreateCommandPool(vk_device, &cmd_pool_info, nullptr, 
+								&ys_upload_cmd_pool);
+	assert(!error);
+
+	if (vk_transfer_queue_index != UINT32_MAX)
+	{
+		cmd_pool_info.queueFamilyIndex = vk_transfer_queue_index;
+		error = vkCreateCommandPool(vk_device, &cmd_pool_info, nullptr, 
+									&ys_upload_transfer_pool);
 		assert(!error);
+	}
 
-		// NOTE: VK_PRESENT_MODE_FIFO_KHR is the default mode for any driver.
-		//		 Also MAILBOX mode has v-sync. IMMEDIATE does not.
-		VkPresentModeKHR expected_present_mode = VK_PRESENT_MODE_FIFO_KHR;
-		for (uint32_t i = 0; i < present_mode_count; ++i)
+	ys_buffer_allocate(ys_staging_buffer, ys_staging_size, 
+					   VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+	ys_staging_head = 0;
+	ys_staging_pending_begin = 0;
+}
+
+
+// Returns an offset in the staging ring where size bytes can be written.
+// Blocks on the oldest batch in flight when the ring is full.
+static VkDeviceSize
+ys_staging_alloc(VkDeviceSize size)
+{
+	assert(size <= ys_staging_size / 2);
+
+	for (;;)
+	{
+		// NOTE: Pending copies may already be recorded in ys_upload_cmd, the
+		//		 range written since the last flush tells whether any is.
+		bool empty = ys_upload_batches.empty() && 
+					 ys_staging_head == ys_staging_pending_begin;
+		if (empty)
 		{
-			if (present_modes[i] == VK_PRESENT_MODE_MAILBOX_KHR)
+			ys_staging_head = 0;
+			ys_staging_pending_begin = 0;
+		}
+
+		VkDeviceSize tail = ys_upload_batches.empty() ? 
+			ys_staging_pending_begin : ys_upload_batches.front().ring_begin;
+		VkDeviceSize offset = ys_align_up(ys_staging_head, 16);
+
+		// NOTE: head == tail always means that the ring is empty, so the
+		//		 head never catches up with the tail.
+		if (empty || ys_staging_head > tail)
+		{
+			if (offset + size <= ys_staging_size)
 			{
-				expected_present_mode = VK_PRESENT_MODE_MAILBOX_KHR;
-				break;
+				ys_staging_head = offset + size;
+				return offset;
 			}
-			if (present_modes[i] == VK_PRESENT_MODE_IMMEDIATE_KHR)
-				expected_present_mode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+			if (size < tail)
+			{
+				ys_staging_head = size;
+				return 0;
+			}
+		}
+		else if (offset + size < tail)
+		{
+			ys_staging_head = offset + size;
+			return offset;
 		}
 
-		delete[] present_modes;
+		// The ring is full, submit what is pending and wait for the oldest batch.
+		if (ys_staging_head != ys_staging_pending_begin)
+			ys_upload_flush();
+		ys_upload_retire(true);
+	}
+}
 
-		// NOTE: We need an additional image because reasons.
-		uint32_t expected_swapchain_images_count = surface_capabilities.minImageCount + 1;
-		if (surface_capabilities.maxImageCount > 0 &&
-			expected_swapchain_images_count > surface_capabilities.maxImageCount)
-			expected_swapchain_images_count = surface_capabilities.maxImageCount;
 
-		VkSurfaceTransformFlagBitsKHR pre_transform;
-		if (surface_capabilities.supportedTransforms & VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR)
-			pre_transform = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR;
+// Returns the command buffer of the batch being gathered, begun on first use,
+// for transfers and transitions recorded outside of ys_buffer_upload. The
+// staging copies made so far are recorded first, the order of the calls is
+// the order on the GPU.
+static VkCommandBuffer
+ys_upload_command_buffer()
+{
+	ys_upload_record_pending();
+	return ys_upload_cmd;
+}
+
+
+// Stages and accesses of the reads that uploaded data is made visible to.
+static const VkPipelineStageFlags	ys_upload_dst_stages = 
+	VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+	VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+	VK_PIPELINE_STAGE_TRANSFER_BIT;
+static const VkAccessFlags			ys_upload_dst_access = 
+	VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT |
+	VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+
+
+static void
+ys_upload_begin_cmd(VkCommandBuffer& cmd, VkCommandPool pool)
+{
+	VkResult error;
+
+	if (cmd != VK_NULL_HANDLE)
+		return;
+
+	VkCommandBufferAllocateInfo cmd_info;
+	cmd_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	cmd_info.pNext = nullptr;
+	cmd_info.commandPool = pool;
+	cmd_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	cmd_info.commandBufferCount = 1;
+
+	error = vkAllocateCommandBuffers(vk_device, &cmd_info, &cmd);
+	assert(!error);
+
+	VkCommandBufferBeginInfo begin_info;
+	begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	begin_info.pNext = nullptr;
+	begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	begin_info.pInheritanceInfo = nullptr;
+
+	error = vkBeginCommandBuffer(cmd, &begin_info);
+	assert(!error);
+}
+
+
+// Records the pending staging copies. With a transfer queue they go in
+// ys_upload_transfer_cmd, and the buffers written are handed over to the main
+// queue family: released there, acquired in ys_upload_cmd.
+static void
+ys_upload_record_pending()
+{
+	ys_upload_begin_cmd(ys_upload_cmd, ys_upload_cmd_pool);
+	if (ys_upload_pending.empty())
+		return;
+
+	bool transfer_queue = (vk_transfer_queue_index != UINT32_MAX);
+	VkCommandBuffer copy_cmd = ys_upload_cmd;
+	if (transfer_queue)
+	{
+		ys_upload_begin_cmd(ys_upload_transfer_cmd, ys_upload_transfer_pool);
+		copy_cmd = ys_upload_transfer_cmd;
+	}
+
+	// NOTE: Consecutive copies to the same buffer share one vkCmdCopyBuffer,
+	//		 and every buffer one ownership transfer covering what was written.
+	std::vector<VkBufferCopy> regions;
+	std::vector<VkBufferMemoryBarrier> ownership;
+	for (size_t i = 0; i < ys_upload_pending.size(); ++i)
+	{
+		const YsUploadCopy& copy = ys_upload_pending[i];
+		regions.push_back(copy.region);
+
+		bool last = (i + 1 == ys_upload_pending.size()) ||
+					(ys_upload_pending[i + 1].dst != copy.dst);
+		if (last)
+		{
+			vkCmdCopyBuffer(copy_cmd, ys_staging_buffer.buffer, copy.dst,
+							(uint32_t)regions.size(), regions.data());
+			regions.clear();
+		}
+
+		if (!transfer_queue || copy.concurrent)
+			continue;
+
+		VkDeviceSize begin = copy.region.dstOffset;
+		VkDeviceSize end = copy.region.dstOffset + copy.region.size;
+		VkBufferMemoryBarrier* p_barrier = nullptr;
+		for (VkBufferMemoryBarrier& barrier : ownership)
+		{
+			if (barrier.buffer == copy.dst)
+				p_barrier = &barrier;
+		}
+		if (p_barrier)
+		{
+			VkDeviceSize barrier_end = p_barrier->offset + p_barrier->size;
+			if (begin > p_barrier->offset)
+				begin = p_barrier->offset;
+			if (end < barrier_end)
+				end = barrier_end;
+		}
 		else
-			pre_transform = surface_capabilities.currentTransform;
+		{
+			ownership.emplace_back();
+			p_barrier = &ownership.back();
+			p_barrier->sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+			p_barrier->pNext = nullptr;
+			p_barrier->srcQueueFamilyIndex = vk_transfer_queue_index;
+			p_barrier->dstQueueFamilyIndex = vk_elected_queue_index;
+			p_barrier->buffer = copy.dst;
+		}
+		p_barrier->offset = begin;
+		p_barrier->size = end - begin;
+	}
+	ys_upload_pending.clear();
 
-		VkSwapchainCreateInfoKHR swapchain_info;
-		swapchain_info.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
-		swapchain_info.pNext = nullptr;
-		swapchain_info.flags = 0;
-		swapchain_info.surface = vk_surface;
-		swapchain_info.minImageCount = expected_swapchain_images_count;
-		swapchain_info.imageFormat = vk_surface_format;
-		swapchain_info.imageColorSpace = vk_color_space;
-		swapchain_info.imageExtent = swapchain_extent;
-		swapchain_info.imageArrayLayers = 1;
-		swapchain_info.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
-		swapchain_info.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
-		swapchain_info.queueFamilyIndexCount = 0;
-		swapchain_info.pQueueFamilyIndices = nullptr;
-		swapchain_info.preTransform = pre_transform;
-		swapchain_info.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
-		swapchain_info.presentMode = expected_present_mode;
-		swapchain_info.clipped = VK_TRUE;
-		swapchain_info.oldSwapchain = nullptr;
+	if (ownership.empty())
+		return;
 
-		error = fp.CreateSwapchainKHR(vk_device, &swapchain_info, nullptr, &vk_swapchain);
-		assert(!error);
+	// NOTE: The semaphore the main queue waits on orders the acquire after
+	//		 the release, both barriers describe the same transfer.
+	for (VkBufferMemoryBarrier& barrier : ownership)
+	{
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = 0;
 	}
+	vkCmdPipelineBarrier(ys_upload_transfer_cmd, 
+						 VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+						 0, 0, nullptr, (uint32_t)ownership.size(), ownership.data(),
+						 0, nullptr);
 
-	// CREATE SWAPCHAIN IMAGES
+	for (VkBufferMemoryBarrier& barrier : ownership)
 	{
-		error = fp.GetSwapchainImagesKHR(vk_device, vk_swapchain, 
-										 &vk_swapchain_image_count, nullptr);  
-		assert(!error && vk_swapchain_image_count);
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = ys_upload_dst_access;
+	}
+	vkCmdPipelineBarrier(ys_upload_cmd, 
+						 VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, ys_upload_dst_stages,
+						 0, 0, nullptr, (uint32_t)ownership.size(), ownership.data(),
+						 0, nullptr);
+}
 
-		VkImage* swapchain_images = new VkImage[vk_swapchain_image_count];
-		error = fp.GetSwapchainImagesKHR(vk_device, vk_swapchain,
-										 &vk_swapchain_image_count, swapchain_images);
+
+// Submits the batch being gathered, if any. Returns the serial to wait on for
+// everything recorded so far, the GPU side needs no wait: later submissions
+// to the queue see the results.
+static uint64_t
+ys_upload_flush()
+{
+	YS_PROFILE_FUNCTION();
+	VkResult error;
+
+	ys_upload_retire(false);
+
+	if (ys_upload_cmd == VK_NULL_HANDLE && ys_upload_pending.empty())
+		return ys_upload_serial;
+
+	ys_upload_record_pending();
+
+	YsUploadBatch batch;
+	batch.cmd = ys_upload_cmd;
+	batch.transfer_cmd = ys_upload_transfer_cmd;
+	batch.semaphore = VK_NULL_HANDLE;
+	batch.serial = ++ys_upload_serial;
+	batch.ring_begin = ys_staging_pending_begin;
+	batch.ring_end = ys_staging_head;
+
+	if (!ys_upload_free_fences.empty())
+	{
+		batch.fence = ys_upload_free_fences.back();
+		ys_upload_free_fences.pop_back();
+	}
+	else
+	{
+		VkFenceCreateInfo fence_info;
+		fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+		fence_info.pNext = nullptr;
+		fence_info.flags = 0;
+
+		error = vkCreateFence(vk_device, &fence_info, nullptr, &batch.fence);
 		assert(!error);
+	}
 
-		vk_swapchain_buffers = new SwapchainBuffer[vk_swapchain_image_count];
-		vk_swapchain_current_buffer = vk_swapchain_buffers;
-		
-		for (uint32_t i = 0; i < vk_swapchain_image_count; ++i)
+	// TRANSFER QUEUE
+	// NOTE: Only the main queue submission has a fence, it waits for this one.
+	if (batch.transfer_cmd != VK_NULL_HANDLE)
+	{
+		if (!ys_upload_free_semaphores.empty())
 		{
-			vk_swapchain_buffers[i].index = i;
-			vk_swapchain_buffers[i].image = swapchain_images[i];
+			batch.semaphore = ys_upload_free_semaphores.back();
+			ys_upload_free_semaphores.pop_back();
+		}
+		else
+		{
+			VkSemaphoreCreateInfo semaphore_info;
+			semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+			semaphore_info.pNext = nullptr;
+			semaphore_info.flags = 0;
 
-			VkImageViewCreateInfo image_view_info;
-			image_view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-			image_view_info.pNext = nullptr;
-			image_view_info.flags = 0;
-			image_view_info.image = vk_swapchain_buffers[i].image;
-			image_view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
-			image_view_info.format = vk_surface_format;
-			image_view_info.components = {
-				VK_COMPONENT_SWIZZLE_R,
-				VK_COMPONENT_SWIZZLE_G,
-				VK_COMPONENT_SWIZZLE_B,
-				VK_COMPONENT_SWIZZLE_A
-			};
-			image_view_info.subresourceRange = {
-				VK_IMAGE_ASPECT_COLOR_BIT,
-				0, 1, 0, 1
-			};
+			error = vkCreateSemaphore(vk_device, &semaphore_info, nullptr, 
+									  &batch.semaphore);
+			assert(!error);
+		}
 
-			error = vkCreateImageView(vk_device, &image_view_info, nullptr, 
-									  &vk_swapchain_buffers[i].view);
+		error = vkEndCommandBuffer(batch.transfer_cmd);
+		assert(!error);
+
+		VkSubmitInfo submit_info;
+		submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submit_info.pNext = nullptr;
+		submit_info.waitSemaphoreCount = 0;
+		submit_info.pWaitSemaphores = nullptr;
+		submit_info.pWaitDstStageMask = nullptr;
+		submit_info.commandBufferCount = 1;
+		submit_info.pCommandBuffers = &batch.transfer_cmd;
+		submit_info.signalSemaphoreCount = 1;
+		submit_info.pSignalSemaphores = &batch.semaphore;
+
+		error = vkQueueSubmit(vk_transfer_queue, 1, &submit_info, VK_NULL_HANDLE);
+		assert(!error);
+	}
+
+	// MAIN QUEUE
+	// NOTE: Makes the copies visible to any later read of the uploaded data,
+	//		 including those of later submissions. Only the submissions made
+	//		 after this one wait for the transfer queue, the frames already in
+	//		 flight overlap with it.
+	{
+		VkMemoryBarrier barrier;
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.pNext = nullptr;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = ys_upload_dst_access;
+		vkCmdPipelineBarrier(batch.cmd, 
+							 VK_PIPELINE_STAGE_TRANSFER_BIT, ys_upload_dst_stages,
+							 0,
+							 1, &barrier,
+							 0, nullptr,
+							 0, nullptr);
+
+		error = vkEndCommandBuffer(batch.cmd);
+		assert(!error);
+
+		VkPipelineStageFlags wait_stages = ys_upload_dst_stages;
+		VkSubmitInfo submit_info;
+		submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submit_info.pNext = nullptr;
+		submit_info.waitSemaphoreCount = (batch.semaphore != VK_NULL_HANDLE) ? 1 : 0;
+		submit_info.pWaitSemaphores = &batch.semaphore;
+		submit_info.pWaitDstStageMask = &wait_stages;
+		submit_info.commandBufferCount = 1;
+		submit_info.pCommandBuffers = &batch.cmd;
+		submit_info.signalSemaphoreCount = 0;
+		submit_info.pSignalSemaphores = nullptr;
+
+		error = vkQueueSubmit(vk_main_queue, 1, &submit_info, batch.fence);
+		assert(!error);
+	}
+
+	ys_upload_batches.push_back(batch);
+	ys_upload_cmd = VK_NULL_HANDLE;
+	ys_upload_transfer_cmd = VK_NULL_HANDLE;
+	ys_staging_pending_begin = ys_staging_head;
+	ys_upload_submit_count++;
+	return batch.serial;
+}
+
+
+// Blocks until the batch of the given serial is done on the GPU, the batches
+// submitted after it are not waited for.
+static void
+ys_upload_wait(uint64_t serial)
+{
+	assert(serial <= ys_upload_serial);
+	while (ys_upload_completed_serial < serial)
+		ys_upload_retire(true);
+}
+
+
+// Releases the batches the GPU is done with. When wait is set, blocks until
+// at least the oldest batch is done.
+static void
+ys_upload_retire(bool wait)
+{
+	VkResult error;
+
+	while (!ys_upload_batches.empty())
+	{
+		YsUploadBatch& batch = ys_upload_batches.front();
+
+		if (wait)
+		{
+			error = vkWaitForFences(vk_device, 1, &batch.fence, VK_TRUE, UINT64_MAX);
 			assert(!error);
+			wait = false;
+		}
+		else if (vkGetFenceStatus(vk_device, batch.fence) != VK_SUCCESS)
+		{
+			break;
+		}
+
+		error = vkResetFences(vk_device, 1, &batch.fence);
+		assert(!error);
+		ys_upload_free_fences.push_back(batch.fence);
+		vkFreeCommandBuffers(vk_device, ys_upload_cmd_pool, 1, &batch.cmd);
+		if (batch.transfer_cmd != VK_NULL_HANDLE)
+			vkFreeCommandBuffers(vk_device, ys_upload_transfer_pool, 1, &batch.transfer_cmd);
+		if (batch.semaphore != VK_NULL_HANDLE)
+			ys_upload_free_semaphores.push_back(batch.semaphore);
+		ys_upload_completed_serial = batch.serial;
+		ys_upload_batches.pop_front();
+	}
+}
+
+
+static void
+ys_upload_shutdown()
+{
+	ys_upload_wait(ys_upload_flush());
+
+	std::cout << "[UPLOAD] " << ys_upload_bytes / 1024 << " KiB staged in " 
+		<< ys_upload_submit_count << " submissions" << std::endl;
+
+	for (VkFence fence : ys_upload_free_fences)
+		vkDestroyFence(vk_device, fence, nullptr);
+	ys_upload_free_fences.clear();
+	for (VkSemaphore semaphore : ys_upload_free_semaphores)
+		vkDestroySemaphore(vk_device, semaphore, nullptr);
+	ys_upload_free_semaphores.clear();
+
+	ys_buffer_free(ys_staging_buffer);
+	vkDestroyCommandPool(vk_device, ys_upload_cmd_pool, nullptr);
+	if (ys_upload_transfer_pool != VK_NULL_HANDLE)
+		vkDestroyCommandPool(vk_device, ys_upload_transfer_pool, nullptr);
+}
+
+
+// Every ring allocation is padded to it, segments must be sized with it.
+static VkDeviceSize
+ys_uniform_ring_alignment()
+{
+	// NOTE: Allocations are also aligned to nonCoherentAtomSize so that the
+	//		 flush of a segment never overlaps another one.
+	VkDeviceSize alignment = vk_gpu_properties.limits.minUniformBufferOffsetAlignment;
+	if (alignment < vk_gpu_properties.limits.minStorageBufferOffsetAlignment)
+		alignment = vk_gpu_properties.limits.minStorageBufferOffsetAlignment;
+	VkDeviceSize atom = vk_gpu_properties.limits.nonCoherentAtomSize;
+	if (alignment < atom)
+		alignment = atom;
+	return alignment;
+}
+
+
+static void
+ys_uniform_ring_init(VkDeviceSize frame_size)
+{
+	YsUniformRing& ring = ys_uniform_ring;
+
+	ring.alignment = ys_uniform_ring_alignment();
+	ring.frame_size = ys_align_up(frame_size, ring.alignment);
+	ring.frame_begin = 0;
+	ring.head = 0;
+
+	// NOTE: The cull pass reads the instances from the async compute queue.
+	ys_buffer_allocate(ring.buffer, ring.frame_size * vk_frames_in_flight,
+					   VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT |
+					   VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
+					   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+					   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+					   VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+					   vk_compute_queue_index != UINT32_MAX);
+}
+
+
+static void
+ys_uniform_ring_begin_frame(uint32_t frame_index)
+{
+	YsUniformRing& ring = ys_uniform_ring;
+	ring.frame_begin = ring.frame_size * frame_index;
+	ring.head = ring.frame_begin;
+}
+
+
+// Returns a pointer to size bytes in the current frame segment, and the
+// matching dynamic offset.
+static void*
+ys_uniform_alloc(VkDeviceSize size, uint32_t* p_dynamic_offset)
+{
+	YsUniformRing& ring = ys_uniform_ring;
+
+	VkDeviceSize offset = ring.head;
+	VkDeviceSize end = ys_align_up(offset + size, ring.alignment);
+	assert(end <= ring.frame_begin + ring.frame_size);
+
+	ring.head = end;
+	*p_dynamic_offset = (uint32_t)offset;
+	return ys_buffer_data<uint8_t>(ring.buffer, offset);
+}
+
+
+static void
+ys_uniform_ring_end_frame()
+{
+	YsUniformRing& ring = ys_uniform_ring;
+	if (ring.head > ring.frame_begin)
+		ys_buffer_flush(ring.buffer, ring.frame_begin, ring.head - ring.frame_begin);
+}
+
+
+// Finds room for the request in a block, honoring the alignment and the
+// bufferImageGranularity with respect to both neighbours. Returns false if
+// no free chunk fits.
+static bool
+ys_memory_block_alloc(YsMemoryBlock& block, const VkMemoryRequirements& mem_reqs,
+					  YsResourceKind kind, void* owner, YsAllocation& allocation)
+{
+	VkDeviceSize granularity = vk_gpu_properties.limits.bufferImageGranularity;
+
+	for (size_t i = 0; i < block.chunks.size(); ++i)
+	{
+		YsMemoryChunk& chunk = block.chunks[i];
+		if (chunk.kind != YS_RESOURCE_FREE || chunk.size < mem_reqs.size)
+			continue;
+
+		VkDeviceSize offset = ys_align_up(chunk.offset, mem_reqs.alignment);
+		if (i > 0)
+		{
+			const YsMemoryChunk& prev = block.chunks[i - 1];
+			VkDeviceSize prev_page = (prev.offset + prev.size - 1) / granularity;
+			if (prev.kind != kind && prev_page == offset / granularity)
+				offset = ys_align_up(offset, granularity);
+		}
+
+		VkDeviceSize end = offset + mem_reqs.size;
+		if (end > chunk.offset + chunk.size)
+			continue;
+
+		if (i + 1 < block.chunks.size())
+		{
+			const YsMemoryChunk& next = block.chunks[i + 1];
+			if (next.kind != kind && (end - 1) / granularity == next.offset / granularity)
+				continue;
+		}
+
+		// Split the free chunk into [padding][allocation][remainder].
+		YsMemoryChunk padding = { chunk.offset, offset - chunk.offset, 1,
+								  YS_RESOURCE_FREE, nullptr };
+		YsMemoryChunk remainder = { end, chunk.offset + chunk.size - end, 1,
+									YS_RESOURCE_FREE, nullptr };
+
+		chunk.offset = offset;
+		chunk.size = mem_reqs.size;
+		chunk.alignment = mem_reqs.alignment;
+		chunk.kind = kind;
+		chunk.owner = owner;
+
+		if (remainder.size > 0)
+			block.chunks.insert(block.chunks.begin() + i + 1, remainder);
+		if (padding.size > 0)
+			block.chunks.insert(block.chunks.begin() + i, padding);
+
+		block.used += mem_reqs.size;
+		block.allocation_count++;
+
+		allocation.block = &block;
+		allocation.memory = block.memory;
+		allocation.offset = offset;
+		allocation.size = mem_reqs.size;
+		allocation.mapped = block.mapped ? block.mapped + offset : nullptr;
+		return true;
+	}
+
+	return false;
+}
+
+
+static YsMemoryBlock*
+ys_memory_block_create(uint32_t type_index, VkDeviceSize size, bool dedicated)
+{
+	VkResult error;
+
+	YsMemoryBlock* block = new YsMemoryBlock;
+	block->size = size;
+	block->used = 0;
+	block->type_index = type_index;
+	block->allocation_count = 0;
+	block->dedicated = dedicated;
+	block->mapped = nullptr;
+	block->chunks.push_back({ 0, size, 1, YS_RESOURCE_FREE, nullptr });
+
+	VkMemoryAllocateInfo mem_alloc;
+	mem_alloc.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	mem_alloc.pNext = nullptr;
+	mem_alloc.allocationSize = size;
+	mem_alloc.memoryTypeIndex = type_index;
+
+	error = vkAllocateMemory(vk_device, &mem_alloc, nullptr, &block->memory);
+	assert(!error);
+
+	// NOTE: A VkDeviceMemory can only be mapped once at a time, so host visible
+	//		 blocks are mapped as a whole and allocations point into it.
+	if (vk_memory_properties.memoryTypes[type_index].propertyFlags &
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+	{
+		error = vkMapMemory(vk_device, block->memory, 0, VK_WHOLE_SIZE, 0,
+							(void**)&block->mapped);
+		assert(!error);
+	}
+
+	ys_memory_device_allocation_count++;
+	ys_memory_device_allocation_total++;
+
+	ys_memory_blocks[type_index].push_back(block);
+	return block;
+}
+
+
+static void
+ys_memory_block_destroy(YsMemoryBlock* block)
+{
+	std::vector<YsMemoryBlock*>& blocks = ys_memory_blocks[block->type_index];
+	for (size_t i = 0; i < blocks.size(); ++i)
+	{
+		if (blocks[i] == block)
+		{
+			blocks.erase(blocks.begin() + i);
+			break;
+		}
+	}
+
+	if (block->mapped)
+		vkUnmapMemory(vk_device, block->memory);
+	vkFreeMemory(vk_device, block->memory, nullptr);
+	ys_memory_device_allocation_count--;
+	delete block;
+}
+
+
+static YsAllocation
+ys_memory_alloc(const VkMemoryRequirements& mem_reqs, VkFlags properties,
+				YsResourceKind kind, void* owner)
+{
+	YsAllocation allocation;
+
+	uint32_t type_index = vk_get_memory_type_index(vk_memory_properties,
+												   mem_reqs.memoryTypeBits,
+												   properties);
+	assert(type_index != UINT32_MAX);
+
+	// NOTE: Non coherent allocations are padded to whole atoms so that flushing
+	//		 one of them never touches its neighbours.
+	VkMemoryRequirements padded_reqs = mem_reqs;
+	VkFlags type_flags = vk_memory_properties.memoryTypes[type_index].propertyFlags;
+	if ((type_flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) &&
+		!(type_flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+	{
+		VkDeviceSize atom = vk_gpu_properties.limits.nonCoherentAtomSize;
+		if (padded_reqs.alignment < atom)
+			padded_reqs.alignment = atom;
+		padded_reqs.size = ys_align_up(padded_reqs.size, atom);
+	}
+
+	std::vector<YsMemoryBlock*>& blocks = ys_memory_blocks[type_index];
+
+	// NOTE: A block is never larger than a quarter of its heap, so that small
+	//		 heaps (e.g. host visible device local ones) are not exhausted at once.
+	VkDeviceSize heap_size = 
+		vk_memory_properties.memoryHeaps[
+			vk_memory_properties.memoryTypes[type_index].heapIndex].size;
+	VkDeviceSize block_size = ys_memory_block_size;
+	if (block_size > heap_size / 4)
+		block_size = heap_size / 4;
+
+	bool dedicated = (padded_reqs.size > block_size / 2);
+	if (!dedicated)
+	{
+		for (size_t i = 0; i < blocks.size(); ++i)
+		{
+			if (!blocks[i]->dedicated &&
+				ys_memory_block_alloc(*blocks[i], padded_reqs, kind, owner, allocation))
+				return allocation;
+		}
+	}
+	else
+	{
+		block_size = padded_reqs.size;
+	}
+
+	YsMemoryBlock* block = ys_memory_block_create(type_index, block_size, dedicated);
+	bool allocated = ys_memory_block_alloc(*block, padded_reqs, kind, owner, allocation);
+	assert(allocated);
+
+	return allocation;
+}
+
+
+static void
+ys_memory_free(YsAllocation& allocation)
+{
+	YsMemoryBlock* block = allocation.block;
+	if (!block)
+		return;
+
+	// NOTE: Chunks are sorted by offset.
+	size_t lo = 0, hi = block->chunks.size();
+	while (lo + 1 < hi)
+	{
+		size_t mid = (lo + hi) / 2;
+		if (block->chunks[mid].offset <= allocation.offset)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	YsMemoryChunk& chunk = block->chunks[lo];
+	assert(chunk.offset == allocation.offset && chunk.kind != YS_RESOURCE_FREE);
+
+	chunk.kind = YS_RESOURCE_FREE;
+	chunk.owner = nullptr;
+	block->used -= chunk.size;
+	block->allocation_count--;
+
+	// Merge with the free neighbours.
+	if (lo + 1 < block->chunks.size() && 
+		block->chunks[lo + 1].kind == YS_RESOURCE_FREE)
+	{
+		chunk.size += block->chunks[lo + 1].size;
+		block->chunks.erase(block->chunks.begin() + lo + 1);
+	}
+	if (lo > 0 && block->chunks[lo - 1].kind == YS_RESOURCE_FREE)
+	{
+		block->chunks[lo - 1].size += block->chunks[lo].size;
+		block->chunks.erase(block->chunks.begin() + lo);
+	}
+
+	// NOTE: Empty blocks are released, except for the last regular block of a
+	//		 memory type which is kept around to avoid reallocation churn.
+	if (block->allocation_count == 0)
+	{
+		uint32_t regular_block_count = 0;
+		for (YsMemoryBlock* other : ys_memory_blocks[block->type_index])
+			regular_block_count += !other->dedicated;
+
+		if (block->dedicated || regular_block_count > 1)
+			ys_memory_block_destroy(block);
+	}
+
+	allocation = YsAllocation();
+}
+
+
+// Empties the least used block of a memory type by moving its movable
+// allocations into the other blocks. The copies are recorded by the move
+// callback and flushed before returning. Returns the number of bytes moved.
+static VkDeviceSize
+ys_memory_defragment(uint32_t type_index, YsDefragmentMoveFn move_fn)
+{
+	std::vector<YsMemoryBlock*>& blocks = ys_memory_blocks[type_index];
+	if (blocks.size() < 2)
+		return 0;
+
+	YsMemoryBlock* source = blocks[0];
+	for (YsMemoryBlock* block : blocks)
+	{
+		if (block->used < source->used)
+			source = block;
+	}
+
+	VkDeviceSize				moved_bytes = 0;
+	std::vector<YsAllocation>	moved_from;
+
+	// NOTE: Moves never target the source block, so no copy can overwrite a
+	//		 range that another copy of this pass still has to read.
+	for (const YsMemoryChunk& chunk : source->chunks)
+	{
+		if (chunk.kind == YS_RESOURCE_FREE || chunk.owner == nullptr)
+			continue;
+
+		VkMemoryRequirements mem_reqs;
+		mem_reqs.size = chunk.size;
+		mem_reqs.alignment = chunk.alignment;
+		mem_reqs.memoryTypeBits = 1u << type_index;
+
+		YsAllocation to;
+		bool found = false;
+		for (YsMemoryBlock* block : blocks)
+		{
+			if (block == source || block->dedicated)
+				continue;
+			if (ys_memory_block_alloc(*block, mem_reqs, chunk.kind, chunk.owner, to))
+			{
+				found = true;
+				break;
+			}
+		}
+		if (!found)
+			continue;
+
+		YsAllocation from;
+		from.block = source;
+		from.memory = source->memory;
+		from.offset = chunk.offset;
+		from.size = chunk.size;
+
+		move_fn(chunk.owner, from, to);
+		moved_bytes += chunk.size;
+		moved_from.push_back(from);
+	}
+
+	// NOTE: The source ranges are only released once the copies have run,
+	//		 which only waits for the batch holding them, and once the frames
+	//		 submitted so far, which may still use the old buffers, are done.
+	ys_upload_wait(ys_upload_flush());
+
+	vk_retired_objects.emplace_back();
+	RetiredObjects& retired = vk_retired_objects.back();
+	retired.serial = vk_frame_serial;
+	retired.moved_buffers.swap(ys_memory_retired_buffers);
+	retired.moved_ranges = std::move(moved_from);
+	vk_collect_retired_objects();
+
+	return moved_bytes;
+}
+
+
+static void
+ys_memory_report()
+{
+	std::cout << "[MEMORY] " << ys_memory_device_allocation_count 
+		<< " live device allocations (" << ys_memory_device_allocation_total 
+		<< " made so far, driver limit " 
+		<< vk_gpu_properties.limits.maxMemoryAllocationCount << ")" << std::endl;
+
+	for (uint32_t type = 0; type < vk_memory_properties.memoryTypeCount; ++type)
+	{
+		std::vector<YsMemoryBlock*>& blocks = ys_memory_blocks[type];
+		if (blocks.empty())
+			continue;
+
+		uint32_t		allocation_count = 0;
+		VkDeviceSize	reserved = 0, used = 0;
+		VkDeviceSize	free_total = 0, largest_free = 0;
+		for (YsMemoryBlock* block : blocks)
+		{
+			allocation_count += block->allocation_count;
+			reserved += block->size;
+			used += block->used;
+			for (const YsMemoryChunk& chunk : block->chunks)
+			{
+				if (chunk.kind != YS_RESOURCE_FREE)
+					continue;
+				free_total += chunk.size;
+				if (chunk.size > largest_free)
+					largest_free = chunk.size;
+			}
+		}
+
+		// NOTE: 0% means that all the free space is one contiguous range.
+		double fragmentation = free_total ? 
+			100.0 * (1.0 - (double)largest_free / (double)free_total) : 0.0;
+
+		std::cout << "[MEMORY] type " << type << ": " << blocks.size() 
+			<< " blocks, " << allocation_count << " allocations, "
+			<< used << "/" << reserved << " bytes used, largest free range "
+			<< largest_free << " bytes, fragmentation " << fragmentation << "%"
+			<< std::endl;
+	}
+}
+
+
+static void
+ys_memory_shutdown()
+{
+	for (uint32_t type = 0; type < VK_MAX_MEMORY_TYPES; ++type)
+	{
+		for (YsMemoryBlock* block : ys_memory_blocks[type])
+		{
+			vkFreeMemory(vk_device, block->memory, nullptr);
+			delete block;
+		}
+		ys_memory_blocks[type].clear();
+	}
+	ys_memory_device_allocation_count = 0;
+}
+
+
+static void
+vk_run()
+{
+	YS_PROFILE_FUNCTION();
+	using clock = std::chrono::high_resolution_clock;
+	clock::time_point start = clock::now();
+
+	VkResult error;
+
+	FrameSync& frame = vk_frames[vk_frame_index];
+
+	// NOTE: The state of this frame was simulated during the previous one, the
+	//		 next one is simulated while this one is recorded.
+	ys_job_wait(&ys_simulate_counter);
+	const YsFrameState& state = ys_frame_states[ys_frame_state_index];
+	ys_frame_state_index ^= 1;
+	ys_job_run(ys_simulate, nullptr, ys_frame_state_index, ys_frame_state_index + 1,
+			   &ys_simulate_counter);
+
+	vk_poll_input_latency();
+
+	// NOTE: Scene updates do not touch GPU resources, they overlap the frames
+	//		 still in flight.
+	ys_matrix_view = state.view;
+	ys_update_objects(state);
+	// NOTE: WM_SIZE is also sent when the window is shown, at the current size.
+	if (state.resize_width != 0 &&
+		(state.resize_width != win_width || state.resize_height != win_height))
+		vk_swapchain_dirty = true;
+
+	// NOTE: This only blocks when the CPU is vk_frames_in_flight frames ahead.
+	{
+		YS_PROFILE_SCOPE("wait frame fence");
+		error = vkWaitForFences(vk_device, 1, &frame.fence, VK_TRUE, UINT64_MAX);
+		assert(!error);
+	}
+
+	// NOTE: The fence guarantees the queries are available, nothing waits here.
+	ys_gpu_profile_collect(frame);
+
+	// NOTE: Submissions complete in order, everything up to this frame is done.
+	if (frame.serial > vk_completed_serial)
+		vk_completed_serial = frame.serial;
+	vk_collect_retired_objects();
+
+	// NOTE: Nothing is drawn while the window is minimized.
+	if (vk_swapchain_dirty && !vk_headless && !vk_recreate_swapchain())
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		return;
+	}
+
+	uint32_t image_index;
+	if (vk_headless)
+	{
+		image_index = vk_swapchain_current_buffer->index + 1;
+		while (image_index >= vk_swapchain_image_count)
+			image_index -= vk_swapchain_image_count;
+	}
+	else
+	{
+		error = fp.AcquireNextImageKHR(vk_device, vk_swapchain, UINT64_MAX, 
+									   frame.image_acquired,
+									   VK_NULL_HANDLE,
+									   &image_index);
+		// NOTE: Out of date acquires signal nothing, the frame is skipped and
+		//		 the fence left signaled. Suboptimal images are still drawn.
+		if (error == VK_ERROR_OUT_OF_DATE_KHR)
+		{
+			vk_swapchain_dirty = true;
+			return;
+		}
+		if (error == VK_SUBOPTIMAL_KHR)
+			vk_swapchain_dirty = true;
+		else
+			assert(!error);
+	}
+
+	vk_swapchain_current_buffer = vk_swapchain_buffers + image_index;
+	SwapchainBuffer& buffer = *vk_swapchain_current_buffer;
+
+	// NOTE: The image may still be used by another slot of the ring when there
+	//		 are more swapchain images than frames in flight.
+	if (buffer.in_flight != VK_NULL_HANDLE && buffer.in_flight != frame.fence)
+	{
+		error = vkWaitForFences(vk_device, 1, &buffer.in_flight, VK_TRUE, 
+								UINT64_MAX);
+		assert(!error);
+	}
+	buffer.in_flight = frame.fence;
+
+	error = vkResetFences(vk_device, 1, &frame.fence);
+	assert(!error);
+
+	// NOTE: Command buffers are recorded every frame, the constants they point
+	//		 to live in the uniform ring segment of this frame.
+	ys_uniform_ring_begin_frame(vk_frame_index);
+	vk_record_command_buffer(buffer);
+	ys_uniform_ring_end_frame();
+
+	vk_draw(buffer, frame);
+	frame.timestamps_written = vk_timestamps_enabled;
+	frame.async_timestamps_written = vk_async_timestamps_enabled && frame.compute_recorded;
+	frame.input_ns = state.input_ns;
+
+	vk_frame_index = (vk_frame_index + 1) % vk_frames_in_flight;
+
+	double frame_ms = 
+		std::chrono::duration<double, std::milli>(clock::now() - start).count();
+	vk_frame_stats.frame_count++;
+	vk_frame_stats.total_ms += frame_ms;
+	if (frame_ms < vk_frame_stats.min_ms) vk_frame_stats.min_ms = frame_ms;
+	if (frame_ms > vk_frame_stats.max_ms) vk_frame_stats.max_ms = frame_ms;
+}
+
+
+static void
+vk_draw(SwapchainBuffer& buffer, FrameSync& frame)
+{
+	YS_PROFILE_FUNCTION();
+	VkResult error;
+
+	// NOTE: Uploads gathered during the frame go first on the queue, the frame
+	//		 does not wait for them on the CPU.
+	ys_upload_flush();
+
+	// NOTE: The async passes only wait for the host, which wrote their inputs
+	//		 and waited for the frame fence of their outputs.
+	if (frame.compute_recorded)
+	{
+		VkSubmitInfo submit_info;
+		submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submit_info.pNext = nullptr;
+		submit_info.waitSemaphoreCount = 0;
+		submit_info.pWaitSemaphores = nullptr;
+		submit_info.pWaitDstStageMask = nullptr;
+		submit_info.commandBufferCount = 1;
+		submit_info.pCommandBuffers = &frame.compute_cmd;
+		submit_info.signalSemaphoreCount = 1;
+		submit_info.pSignalSemaphores = &frame.compute_done;
+
+		error = vkQueueSubmit(vk_compute_queue, 1, &submit_info, VK_NULL_HANDLE);
+		assert(!error);
+	}
+
+	// NOTE: Headless frames have no presentation engine to synchronize with.
+	VkSemaphore wait_semaphores[2];
+	VkPipelineStageFlags wait_stages[2];
+	uint32_t wait_count = 0;
+	if (!vk_headless)
+	{
+		wait_semaphores[wait_count] = frame.image_acquired;
+		wait_stages[wait_count++] = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	}
+	if (frame.compute_recorded)
+	{
+		wait_semaphores[wait_count] = frame.compute_done;
+		wait_stages[wait_count++] = vk_frame_graph.async_wait_stages;
+	}
+
+	VkSubmitInfo submit_info;
+	submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submit_info.pNext = nullptr;
+	submit_info.waitSemaphoreCount = wait_count;
+	submit_info.pWaitSemaphores = wait_semaphores;
+	submit_info.pWaitDstStageMask = wait_stages;
+	submit_info.commandBufferCount = 1;
+	submit_info.pCommandBuffers = &buffer.cmd;
+	submit_info.signalSemaphoreCount = vk_headless ? 0 : 1;
+	submit_info.pSignalSemaphores = &frame.render_complete;
+
+#ifdef YS_PROFILER_ENABLED
+	frame.submit_ns = ys_profiler_now();
+#endif
+	error = vkQueueSubmit(vk_main_queue, 1, &submit_info, frame.fence);
+	assert(!error);
+	frame.serial = ++vk_frame_serial;
+
+	if (vk_headless)
+		return;
+
+	VkPresentInfoKHR present_info;
+	present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+	present_info.pNext = nullptr;
+	present_info.waitSemaphoreCount = 1;
+	present_info.pWaitSemaphores = &frame.render_complete;
+	present_info.swapchainCount = 1;
+	present_info.pSwapchains = &vk_swapchain;
+	present_info.pImageIndices = &buffer.index;
+	present_info.pResults = nullptr;
+
+	error = fp.QueuePresentKHR(vk_main_queue, &present_info);
+	// NOTE: See the call to AcquireNextImageKHR in vk_run.
+	if (error == VK_ERROR_OUT_OF_DATE_KHR || error == VK_SUBOPTIMAL_KHR)
+		vk_swapchain_dirty = true;
+	else
+		assert(!error);
+}
+
+
+static void
+vk_print_frame_stats()
+{
+	if (vk_frame_stats.frame_count == 0)
+		return;
+
+	std::cout << "[FRAME] " << vk_frame_stats.frame_count << " frames, "
+		<< vk_frames_in_flight << " in flight, cpu frame time avg "
+		<< vk_frame_stats.total_ms / (double)vk_frame_stats.frame_count
+		<< " ms, min " << vk_frame_stats.min_ms
+		<< " ms, max " << vk_frame_stats.max_ms << " ms" << std::endl;
+
+	if (vk_latency_stats.sample_count > 0)
+	{
+		std::cout << "[LATENCY] " << vk_latency_stats.sample_count 
+			<< " frames with input, input to GPU done avg "
+			<< vk_latency_stats.total_ms / (double)vk_latency_stats.sample_count
+			<< " ms, max " << vk_latency_stats.max_ms << " ms" << std::endl;
+	}
+
+	const YsBarrierStats& barrier_stats = ys_barrier_stats();
+	double frame_count = (double)vk_frame_stats.frame_count;
+	std::cout << "[BARRIER] " << barrier_stats.flush_count / frame_count 
+		<< " pipeline barriers per frame, " 
+		<< barrier_stats.image_barriers / frame_count << " image and "
+		<< barrier_stats.buffer_barriers / frame_count << " buffer barriers, "
+		<< barrier_stats.elided / frame_count << " transitions elided";
+	if (vk_validate)
+		std::cout << ", " << barrier_stats.redundant << " redundant, " 
+			<< barrier_stats.missing << " missing";
+	std::cout << std::endl;
+
+	if (vk_frame_graph.execute_count > 0)
+		std::cout << "[GRAPH] " << vk_frame_graph.order.size() 
+			<< " passes, " << vk_frame_graph.barrier_count / 
+			(double)vk_frame_graph.execute_count << " pipeline barriers per frame" 
+			<< std::endl;
+
+	ys_gpu_profile_report();
+}
+
+
+// Records the latency of every frame with input whose GPU work is done.
+static void
+vk_poll_input_latency()
+{
+	for (uint32_t i = 0; i < vk_frames_in_flight; ++i)
+	{
+		FrameSync& frame = vk_frames[i];
+		if (frame.input_ns == 0 || vkGetFenceStatus(vk_device, frame.fence) != VK_SUCCESS)
+			continue;
+
+		double latency_ms = (double)(ys_time_ns() - frame.input_ns) / 1000000.0;
+		frame.input_ns = 0;
+
+		vk_latency_stats.sample_count++;
+		vk_latency_stats.total_ms += latency_ms;
+		if (latency_ms > vk_latency_stats.max_ms) vk_latency_stats.max_ms = latency_ms;
+	}
+}
+
+
+static void
+vk_write_timestamp(VkCommandBuffer cmd, VkPipelineStageFlagBits stage, YsTimestamp query)
+{
+	if (vk_timestamps_enabled)
+		vkCmdWriteTimestamp(cmd, stage, vk_frames[vk_frame_index].timestamps, query);
+}
+
+
+// Converts the timestamps of the last submission of this slot into pass
+// durations.
+static void
+ys_gpu_profile_collect(FrameSync& frame)
+{
+	YS_PROFILE_FUNCTION();
+	if (!frame.timestamps_written)
+		return;
+	frame.timestamps_written = false;
+
+	bool async_written = frame.async_timestamps_written;
+	frame.async_timestamps_written = false;
+
+	// NOTE: The async queries are only written on frames with async passes.
+	uint64_t timestamps[YS_TIMESTAMP_COUNT];
+	VkResult error = vkGetQueryPoolResults(vk_device, frame.timestamps, 0, 
+										   YS_TIMESTAMP_ASYNC_BEGIN, sizeof(timestamps),
+										   timestamps, sizeof(uint64_t),
+										   VK_QUERY_RESULT_64_BIT);
+	if (error == VK_NOT_READY)
+		return;
+	assert(!error);
+
+	if (async_written)
+	{
+		error = vkGetQueryPoolResults(vk_device, frame.timestamps, YS_TIMESTAMP_ASYNC_BEGIN,
+									  YS_TIMESTAMP_COUNT - YS_TIMESTAMP_ASYNC_BEGIN,
+									  sizeof(uint64_t) * 2, 
+									  timestamps + YS_TIMESTAMP_ASYNC_BEGIN,
+									  sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+		if (error == VK_NOT_READY)
+			async_written = false;
+		else
+			assert(!error);
+	}
+
+	// NOTE: Both queues timestamp with the same device clock. The async
+	//		 passes of a frame overlap with the tail of the previous frame and
+	//		 with the start of their own.
+	uint64_t main_begin = timestamps[YS_TIMESTAMP_FRAME_BEGIN] & vk_timestamp_mask;
+	uint64_t main_end = timestamps[YS_TIMESTAMP_PRESENT_BARRIER_END] & vk_timestamp_mask;
+	if (async_written)
+	{
+		YsAsyncStats& stats = ys_async_stats;
+		uint64_t async_begin = timestamps[YS_TIMESTAMP_ASYNC_BEGIN] & vk_timestamp_mask;
+		uint64_t async_end = timestamps[YS_TIMESTAMP_ASYNC_END] & vk_timestamp_mask;
+
+		uint64_t overlap = 0;
+		uint64_t spans[2][2] = { { stats.main_begin, stats.main_end }, 
+								 { main_begin, main_end } };
+		for (uint32_t i = 0; i < 2; ++i)
+		{
+			uint64_t begin = std::max(async_begin, spans[i][0]);
+			uint64_t end = std::min(async_end, spans[i][1]);
+			if (end > begin)
+				overlap += end - begin;
+		}
+
+		stats.frame_count++;
+		stats.busy_ms += (double)(async_end - async_begin) * vk_timestamp_period_ms;
+		stats.overlap_ms += (double)overlap * vk_timestamp_period_ms;
+	}
+	ys_async_stats.main_begin = main_begin;
+	ys_async_stats.main_end = main_end;
+
+	static const YsTimestamp pass_bounds[YS_GPU_PASS_COUNT][2] = {
+		{ YS_TIMESTAMP_FRAME_BEGIN, YS_TIMESTAMP_CULL_END },
+		{ YS_TIMESTAMP_CULL_END, YS_TIMESTAMP_BARRIER_END },
+		{ YS_TIMESTAMP_BARRIER_END, YS_TIMESTAMP_RENDER_PASS_END },
+		{ YS_TIMESTAMP_DRAWS_BEGIN, YS_TIMESTAMP_DRAWS_END },
+		{ YS_TIMESTAMP_RENDER_PASS_END, YS_TIMESTAMP_PRESENT_BARRIER_END },
+		{ YS_TIMESTAMP_FRAME_BEGIN, YS_TIMESTAMP_PRESENT_BARRIER_END }
+	};
+
+	YsGpuTimings& timings = ys_gpu_timings;
+	for (uint32_t pass = 0; pass < YS_GPU_PASS_COUNT; ++pass)
+	{
+		uint64_t begin = timestamps[pass_bounds[pass][0]];
+		uint64_t end = timestamps[pass_bounds[pass][1]];
+		double ms = (double)((end - begin) & vk_timestamp_mask) * vk_timestamp_period_ms;
+
+		if (timings.samples[pass].size() < ys_gpu_timings_window)
+			timings.samples[pass].push_back(ms);
+		else
+			timings.samples[pass][timings.next] = ms;
+	}
+	timings.next = (timings.next + 1) % ys_gpu_timings_window;
+	timings.count++;
+
+#ifdef YS_PROFILER_ENABLED
+	// NOTE: Vulkan 1.0 has no way to sample both clocks at once. The offset is
+	//		 taken from the shortest submit to frame begin delay seen so far,
+	//		 which is assumed to be zero.
+	{
+		double period_ns = vk_timestamp_period_ms * 1000000.0;
+		int64_t frame_begin_ns = (int64_t)(
+			(double)(timestamps[YS_TIMESTAMP_FRAME_BEGIN] & vk_timestamp_mask) * period_ns);
+		int64_t offset_ns = frame_begin_ns - (int64_t)frame.submit_ns;
+		if (!ys_gpu_clock_calibrated || offset_ns < ys_gpu_clock_offset_ns)
+		{
+			ys_gpu_clock_offset_ns = offset_ns;
+			ys_gpu_clock_calibrated = true;
+		}
+
+		for (uint32_t pass = 0; pass < YS_GPU_PASS_COUNT; ++pass)
+		{
+			uint64_t begin = timestamps[pass_bounds[pass][0]] & vk_timestamp_mask;
+			uint64_t end = timestamps[pass_bounds[pass][1]] & vk_timestamp_mask;
+			ys_profiler_record_gpu(ys_gpu_pass_names[pass],
+				(uint64_t)((int64_t)((double)begin * period_ns) - ys_gpu_clock_offset_ns),
+				(uint64_t)((int64_t)((double)end * period_ns) - ys_gpu_clock_offset_ns));
+		}
+
+		if (async_written)
+		{
+			uint64_t begin = timestamps[YS_TIMESTAMP_ASYNC_BEGIN] & vk_timestamp_mask;
+			uint64_t end = timestamps[YS_TIMESTAMP_ASYNC_END] & vk_timestamp_mask;
+			ys_profiler_record_gpu("async compute",
+				(uint64_t)((int64_t)((double)begin * period_ns) - ys_gpu_clock_offset_ns),
+				(uint64_t)((int64_t)((double)end * period_ns) - ys_gpu_clock_offset_ns));
+		}
+	}
+#endif
+}
+
+
+// Prints min/avg/p99 of each pass over the rolling window, and writes them to
+// ys_gpu_profile_csv when set.
+static void
+ys_gpu_profile_report()
+{
+	YsGpuTimings& timings = ys_gpu_timings;
+	if (timings.count == 0)
+		return;
+
+	std::ofstream csv;
+	if (!ys_gpu_profile_csv.empty())
+	{
+		csv.open(ys_gpu_profile_csv, std::ios::trunc);
+		csv << "pass,samples,min_ms,avg_ms,p99_ms" << std::endl;
+	}
+
+	for (uint32_t pass = 0; pass < YS_GPU_PASS_COUNT; ++pass)
+	{
+		std::vector<double> sorted = timings.samples[pass];
+		std::sort(sorted.begin(), sorted.end());
+
+		double total = 0.0;
+		for (double ms : sorted)
+			total += ms;
+
+		size_t sample_count = sorted.size();
+		double min_ms = sorted.front();
+		double avg_ms = total / (double)sample_count;
+		double p99_ms = sorted[(sample_count - 1) * 99 / 100];
+
+		std::cout << "[GPU] " << ys_gpu_pass_names[pass] << " avg " << avg_ms 
+			<< " ms, min " << min_ms << " ms, p99 " << p99_ms << " ms" << std::endl;
+		if (csv.is_open())
+			csv << ys_gpu_pass_names[pass] << "," << sample_count << "," << min_ms << ","
+				<< avg_ms << "," << p99_ms << std::endl;
+	}
+
+	const YsAsyncStats& async = ys_async_stats;
+	if (async.frame_count > 0)
+	{
+		double overlap_pct = async.busy_ms > 0.0 ? 
+			100.0 * async.overlap_ms / async.busy_ms : 0.0;
+		std::cout << "[ASYNC] compute avg " << async.busy_ms / async.frame_count
+			<< " ms, " << overlap_pct << "% overlapped with graphics over " 
+			<< async.frame_count << " frames" << std::endl;
+	}
+}
+
+
+static void
+vk_init()
+{
+	VkResult	error;
+
+	// NOTE: If any requested layer or extension is not supported by the driver,
+	//		 an assert is raised. 
+	ys_barrier_set_validation(vk_validate);
+
+	// VALIDATION LAYERS CHECK
+	if (vk_validate)
+	{
+		uint32_t	instance_layer_count = 0;
+
+		error = vkEnumerateInstanceLayerProperties(&instance_layer_count, nullptr);
+		assert(!error);
+
+		if (instance_layer_count > 0)
+		{
+			VkLayerProperties* instance_layers = new VkLayerProperties[instance_layer_count];
+
+			error = vkEnumerateInstanceLayerProperties(&instance_layer_count, instance_layers);
+			assert(!error);
+
+			// Make sure that every validation layer that we want is supported by the ICD.
+			bool validation_ok = true;
+			{
+				for (uint32_t expected = 0; expected < ARRAY_SIZE(vk_instance_layers) && validation_ok; ++expected) 
+				{
+					char*	expected_layer = vk_instance_layers[expected];
+					bool	expected_ok = false;
+					for (uint32_t available = 0; available < instance_layer_count && !expected_ok; ++available)
+					{
+						expected_ok = !strcmp(expected_layer, instance_layers[available].layerName);
+					}
+					if (expected_ok) vk_enabled_layers.push_back(expected_layer);
+					validation_ok &= expected_ok;
+				}
+			}
+			assert(validation_ok);
+
+			delete[] instance_layers;
+		}
+	}
+
+	// EXTENSIONS CHECK
+	{
+		uint32_t	instance_extension_count = 0;
+
+		error = vkEnumerateInstanceExtensionProperties(nullptr, &instance_extension_count, nullptr);
+		assert(!error);
+
+		if (instance_extension_count > 0)
+		{
+			VkExtensionProperties* instance_extensions = new VkExtensionProperties[instance_extension_count];
+
+			error = vkEnumerateInstanceExtensionProperties(nullptr,
+														   &instance_extension_count, 
+														   instance_extensions);
+			assert(!error);
+
+			bool extensions_ok = true;
+			{
+				for (uint32_t expected = 0; expected < ARRAY_SIZE(vk_instance_extensions) && extensions_ok; ++expected)
+				{
+					char*	expected_extension = vk_instance_extensions[expected];
+					bool	expected_ok = false;
+					if (!vk_is_extension_requested(expected_extension))
+						continue;
+					for (uint32_t available = 0; available < instance_extension_count && !expected_ok; ++available)
+					{
+						expected_ok = !strcmp(expected_extension, instance_extensions[available].extensionName);
+					}
+					if (expected_ok) vk_enabled_extensions.push_back(expected_extension);
+					extensions_ok &= expected_ok;
+				}
+			}
+			assert(extensions_ok);
+
+			delete[] instance_extensions;
+		}
+	}
+
+	// INSTANCE
+	{
+		VkInstanceCreateInfo	instance_info;
+		VkApplicationInfo		app_info;
+
+		// VkApplicationInfo
+		{
+			app_info.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+			app_info.pNext = nullptr;
+			app_info.pApplicationName = APP_NAME;
+			app_info.applicationVersion = 1;
+			app_info.pEngineName = ENGINE_NAME;
+			app_info.engineVersion = 1;
+			app_info.apiVersion = VK_API_VERSION_1_0;
+		}
+
+		// VkInstanceCreateInfo
+		{
+			instance_info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+			instance_info.pNext = nullptr;
+			instance_info.pApplicationInfo = &app_info;
+			instance_info.enabledLayerCount = (uint32_t)vk_enabled_layers.size();
+			instance_info.ppEnabledLayerNames = vk_enabled_layers.data();
+			instance_info.enabledExtensionCount = (uint32_t)vk_enabled_extensions.size();
+			instance_info.ppEnabledExtensionNames = vk_enabled_extensions.data();
+		}
+
+		error = vkCreateInstance(&instance_info, nullptr, &vk_instance);
+		assert(!error);
+	}
+
+	// PHYSICAL DEVICE
+	{
+		uint32_t	gpu_count = 0;
+
+		error = vkEnumeratePhysicalDevices(vk_instance, &gpu_count, nullptr);
+		assert(!error && gpu_count);
+
+		VkPhysicalDevice* instance_physical_devices = new VkPhysicalDevice[gpu_count];
+		error = vkEnumeratePhysicalDevices(vk_instance, &gpu_count,
+										   instance_physical_devices);
+		assert(!error);
+
+		vk_gpu = instance_physical_devices[0];
+		delete[] instance_physical_devices;
+	}
+
+	// MAKE SURE THAT INSTANCE LAYER WERE GIVEN TO THE DEVICE
+	{
+		uint32_t	device_layer_count = 0;
+
+		error = vkEnumerateDeviceLayerProperties(vk_gpu, &device_layer_count, 
+												 nullptr);
+		assert(!error);
+
+		if (device_layer_count)
+		{
+			VkLayerProperties* device_layers = 
+				new VkLayerProperties[device_layer_count];
+			error = vkEnumerateDeviceLayerProperties(vk_gpu, 
+													 &device_layer_count, 
+													 device_layers);
+			assert(!error);
+
+			bool validation_ok = true;
+			{
+				for (uint32_t expected = 0; 
+					 expected < (uint32_t)vk_enabled_layers.size() 
+					 && validation_ok; 
+					 ++expected)
+				{
+					char*	expected_layer = vk_enabled_layers[expected];
+					bool	expected_ok = false;
+					for (uint32_t available = 0; 
+						 available < device_layer_count && !expected_ok; 
+						 ++available)
+					{
+						expected_ok = !strcmp(expected_layer, 
+											  device_layers[available].layerName);
+					}
+					validation_ok &= expected_ok;
+				}
+			}
+			assert(validation_ok);
+		}
+	}
+
+
+	// LOOK FOR DEVICE EXPECTED EXTENSION
+	{
+		vk_enabled_extensions.clear();
+		uint32_t	device_extension_count = 0;
+
+		error = vkEnumerateDeviceExtensionProperties(vk_gpu, nullptr, 
+													 &device_extension_count, 
+													 nullptr);
+		assert(!error);
+
+		if (device_extension_count)
+		{
+			VkExtensionProperties* device_extensions = 
+				new VkExtensionProperties[device_extension_count];
+			error = vkEnumerateDeviceExtensionProperties(vk_gpu, nullptr, 
+														 &device_extension_count, 
+														 device_extensions);
+			assert(!error);
+
+			bool extensions_ok = true;
+			{
+				for (uint32_t expected = 0; 
+					 expected < ARRAY_SIZE(vk_device_extensions) && extensions_ok; 
+					 ++expected)
+				{
+					char*	expected_extension = vk_device_extensions[expected];
+					bool	expected_ok = false;
+					if (!vk_is_extension_requested(expected_extension))
+						continue;
+					for (uint32_t available = 0; 
+						 available < device_extension_count && !expected_ok; 
+						 ++available)
+					{
+						expected_ok = !strcmp(expected_extension, 
+											  device_extensions[available].extensionName);
+					}
+					if (expected_ok) vk_enabled_extensions.push_back(expected_extension);
+					extensions_ok &= expected_ok;
+				}
+			}
+			assert(extensions_ok);
+
+			delete[] device_extensions;																	
+		}
+	}
+
+	// SELECT A QUEUE FROM THE PHYSICAL DEVICE
+	{
+		vkGetPhysicalDeviceQueueFamilyProperties(vk_gpu, &vk_queue_family_count, 
+												 nullptr);
+		assert(vk_queue_family_count > 0);
+
+		vk_queue_props = new VkQueueFamilyProperties[vk_queue_family_count];
+		vkGetPhysicalDeviceQueueFamilyProperties(vk_gpu, &vk_queue_family_count, 
+												 vk_queue_props);
+	}
+
+	if (vk_validate)
+		vk_setup_debug_report_callback();
+
+	// NOTE: Headless mode only needs a graphics queue, there is nothing to
+	//		 present to.
+	if (vk_headless)
+	{
+		uint32_t candidate_queue_index = UINT32_MAX;
+		for (uint32_t i = 0; i < vk_queue_family_count; ++i)
+		{
+			if (vk_queue_props[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)
+			{
+				candidate_queue_index = i;
+				break;
+			}
+		}
+		assert(candidate_queue_index != UINT32_MAX);
+
+		vk_elected_queue_index = candidate_queue_index;
+	}
+	else
+	{
+		vk_init_surface();
+	}
+
+	// SELECT A TRANSFER QUEUE
+	// NOTE: A family with neither graphics nor compute is a copy engine, it
+	//		 runs the uploads while the graphics queue renders. Every other
+	//		 family shares its hardware with the graphics queue, uploads then
+	//		 stay on the main queue.
+	{
+		vk_transfer_queue_index = UINT32_MAX;
+		for (uint32_t i = 0; i < vk_queue_family_count && vk_use_transfer_queue; ++i)
+		{
+			VkQueueFlags flags = vk_queue_props[i].queueFlags;
+			if ((flags & VK_QUEUE_TRANSFER_BIT) &&
+				!(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)))
+			{
+				vk_transfer_queue_index = i;
+				break;
+			}
+		}
+
+		if (vk_transfer_queue_index != UINT32_MAX)
+			std::cout << "[QUEUE] Uploads on the transfer family " 
+				<< vk_transfer_queue_index << std::endl;
+		else
+			std::cout << "[QUEUE] No dedicated transfer family, uploads on the main queue"
+				<< std::endl;
+	}
+
+	// SELECT AN ASYNC COMPUTE QUEUE
+	// NOTE: Compute families without graphics are scheduled next to the
+	//		 graphics queue, their work fills the gaps it leaves.
+	{
+		vk_compute_queue_index = UINT32_MAX;
+		for (uint32_t i = 0; i < vk_queue_family_count && vk_use_async_compute; ++i)
+		{
+			VkQueueFlags flags = vk_queue_props[i].queueFlags;
+			if ((flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT))
+			{
+				vk_compute_queue_index = i;
+				break;
+			}
+		}
+
+		if (vk_compute_queue_index != UINT32_MAX)
+			std::cout << "[QUEUE] Async compute on family " 
+				<< vk_compute_queue_index << std::endl;
+		else
+			std::cout << "[QUEUE] No async compute family, compute passes on the main queue"
+				<< std::endl;
+	}
+
+	vk_queue_families.clear();
+	for (uint32_t family : { vk_elected_queue_index, vk_transfer_queue_index, 
+							 vk_compute_queue_index })
+	{
+		if (family != UINT32_MAX &&
+			std::find(vk_queue_families.begin(), vk_queue_families.end(), family) == 
+			vk_queue_families.end())
+			vk_queue_families.push_back(family);
+	}
+
+	// CREATE DEVICE
+	{
+		float queue_priorities[1] = { 0.0 };
+
+		VkDeviceQueueCreateInfo queue_infos[3];
+		uint32_t queue_info_count = 0;
+
+		for (uint32_t family : vk_queue_families)
+		{
+			VkDeviceQueueCreateInfo& queue_info = queue_infos[queue_info_count++];
+			queue_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+			queue_info.pNext = nullptr;
+			queue_info.flags = 0;
+			queue_info.queueFamilyIndex = family;
+			queue_info.queueCount = 1;
+			queue_info.pQueuePriorities = queue_priorities;
+		}
+
+		VkDeviceCreateInfo device_info;
+		device_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+		device_info.pNext = nullptr;
+		device_info.flags = 0;
+		device_info.queueCreateInfoCount = queue_info_count;
+		device_info.pQueueCreateInfos = queue_infos;
+		device_info.enabledLayerCount = (uint32_t)vk_enabled_layers.size();
+		device_info.ppEnabledLayerNames = vk_enabled_layers.data();
+		device_info.enabledExtensionCount = (uint32_t)vk_enabled_extensions.size();
+		device_info.ppEnabledExtensionNames = vk_enabled_extensions.data();
+		device_info.pEnabledFeatures = nullptr;
+
+		error = vkCreateDevice(vk_gpu, &device_info, nullptr, &vk_device);
+		assert(!error);
+	}
+
+	if (vk_headless)
+	{
+		// NOTE: R8G8B8A8_UNORM is required to support color attachments,
+		//		 B8G8R8A8_UNORM is only preferred to match the windowed path.
+		VkFormatProperties format_props;
+		vkGetPhysicalDeviceFormatProperties(vk_gpu, VK_FORMAT_B8G8R8A8_UNORM,
+											&format_props);
+		if (format_props.optimalTilingFeatures & 
+			VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT)
+			vk_surface_format = VK_FORMAT_B8G8R8A8_UNORM;
+		else
+			vk_surface_format = VK_FORMAT_R8G8B8A8_UNORM;
+
+		vk_color_space = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR;
+	}
+	else
+	{
+		vk_init_swapchain_format();
+	}
+
+	vkGetDeviceQueue(vk_device, vk_elected_queue_index, 0, &vk_main_queue);
+	if (vk_transfer_queue_index != UINT32_MAX)
+		vkGetDeviceQueue(vk_device, vk_transfer_queue_index, 0, &vk_transfer_queue);
+	if (vk_compute_queue_index != UINT32_MAX)
+		vkGetDeviceQueue(vk_device, vk_compute_queue_index, 0, &vk_compute_queue);
+	vkGetPhysicalDeviceProperties(vk_gpu, &vk_gpu_properties);
+	vkGetPhysicalDeviceMemoryProperties(vk_gpu, &vk_memory_properties);
+}
+
+
+static void
+vk_init_surface()
+{
+	VkResult	error;
+
+	GET_INSTANCE_PROC_ADDR(vk_instance, GetPhysicalDeviceSurfaceSupportKHR);
+	GET_INSTANCE_PROC_ADDR(vk_instance, GetPhysicalDeviceSurfaceCapabilitiesKHR);
+	GET_INSTANCE_PROC_ADDR(vk_instance, GetPhysicalDeviceSurfaceFormatsKHR);
+	GET_INSTANCE_PROC_ADDR(vk_instance, GetPhysicalDeviceSurfacePresentModesKHR);
+	GET_INSTANCE_PROC_ADDR(vk_instance, GetSwapchainImagesKHR);
+
+	// CREATE VKSURFACE
+#ifdef VK_USE_PLATFORM_WIN32_KHR
+	{
+		VkWin32SurfaceCreateInfoKHR		create_info;
+		create_info.sType = VK_STRUCTURE_TYPE_WIN32_SURFACE_CREATE_INFO_KHR;
+		create_info.pNext = nullptr;
+		create_info.flags = 0;
+		create_info.hinstance = win_instance;
+		create_info.hwnd = window_handle;
+
+		error = vkCreateWin32SurfaceKHR(vk_instance, &create_info, nullptr, &vk_surface);
+		assert(!error);
+	}
+#endif
+
+	// PICK A QUEUE INDEX
+	{
+		VkBool32* supports_present = new VkBool32[vk_queue_family_count];
+		for (uint32_t i = 0; i < vk_queue_family_count; ++i)
+		{
+			fp.GetPhysicalDeviceSurfaceSupportKHR(vk_gpu, i, vk_surface,
+												  &supports_present[i]);
+		}
+
+		// Pick a queue that supports graphics and present
+		uint32_t candidate_queue_index = UINT32_MAX;
+		for (uint32_t i = 0; i < vk_queue_family_count; ++i)
+		{
+			if (vk_queue_props[i].queueFlags & VK_QUEUE_GRAPHICS_BIT &&
+				supports_present[i] == VK_TRUE)
+			{
+				candidate_queue_index = i;
+				break;
+			}
+		}
+		assert(candidate_queue_index != UINT32_MAX);
+
+		vk_elected_queue_index = candidate_queue_index;
+
+		delete[] supports_present;
+	}
+}
+
+
+static void
+vk_init_swapchain_format()
+{
+	VkResult	error;
+
+	GET_DEVICE_PROC_ADDR(vk_device, CreateSwapchainKHR);
+	GET_DEVICE_PROC_ADDR(vk_device, DestroySwapchainKHR);
+	GET_DEVICE_PROC_ADDR(vk_device, GetSwapchainImagesKHR);
+	GET_DEVICE_PROC_ADDR(vk_device, AcquireNextImageKHR);
+	GET_DEVICE_PROC_ADDR(vk_device, QueuePresentKHR);
+
+	// GET SURFACE FORMAT AND COLOR SPACE
+	{
+		uint32_t	format_count;
+		error = fp.GetPhysicalDeviceSurfaceFormatsKHR(vk_gpu, vk_surface,
+													  &format_count, nullptr);
+		assert(!error);
+
+		if (format_count)
+		{
+			VkSurfaceFormatKHR* surface_formats = new VkSurfaceFormatKHR[format_count];
+			error = fp.GetPhysicalDeviceSurfaceFormatsKHR(vk_gpu, vk_surface,
+														  &format_count, surface_formats);
+			assert(!error && format_count);
+
+			if (surface_formats[0].format == VK_FORMAT_UNDEFINED)
+				vk_surface_format = VK_FORMAT_B8G8R8A8_UNORM;
+			else
+				vk_surface_format = surface_formats[0].format;
+
+			vk_color_space = surface_formats[0].colorSpace;
+
+			delete[] surface_formats;
+		}
+	}
+}
+
+
+// Filters out the WSI extensions in headless mode, and the debug report
+// extension when validation is disabled.
+static bool
+vk_is_extension_requested(const char* extension)
+{
+	bool is_wsi = !strcmp(extension, "VK_KHR_surface") ||
+				  !strcmp(extension, "VK_KHR_win32_surface") ||
+				  !strcmp(extension, "VK_KHR_swapchain");
+	bool is_debug = !strcmp(extension, "VK_EXT_debug_report");
+
+	if (is_wsi && vk_headless)
+		return false;
+	if (is_debug && !vk_validate)
+		return false;
+	return true;
+}
+
+
+static void
+vk_setup_debug_report_callback()
+{
+	VkResult error;
+
+	GET_INSTANCE_PROC_ADDR(vk_instance, CreateDebugReportCallbackEXT);
+	GET_INSTANCE_PROC_ADDR(vk_instance, DestroyDebugReportCallbackEXT);
+	GET_INSTANCE_PROC_ADDR(vk_instance, DebugReportMessageEXT);
+
+	VkDebugReportCallbackCreateInfoEXT debug_callback_info;
+	debug_callback_info.sType = VK_STRUCTURE_TYPE_DEBUG_REPORT_CREATE_INFO_EXT;
+	debug_callback_info.pNext = nullptr;
+	debug_callback_info.pfnCallback = vk_debug_log;
+	debug_callback_info.pUserData = nullptr;
+	debug_callback_info.flags = 
+		VK_DEBUG_REPORT_ERROR_BIT_EXT | VK_DEBUG_REPORT_WARNING_BIT_EXT;
+	error = fp.CreateDebugReportCallbackEXT(vk_instance, &debug_callback_info,
+											nullptr, &vk_debug_callback);
+	assert(!error);
+}
+
+
+static void
+vk_prepare_resources()
+{
+	VkResult error;
+	
+	// CREATE COMMAND POOL
+	{
+		VkCommandPoolCreateInfo cmd_pool_info;
+		cmd_pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		cmd_pool_info.pNext = nullptr;
+		cmd_pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+		cmd_pool_info.queueFamilyIndex = vk_elected_queue_index;
+	
+		error = vkCreateCommandPool(vk_device, &cmd_pool_info, nullptr, &vk_cmd_pool);
+		assert(!error);
+
+		if (vk_compute_queue != VK_NULL_HANDLE)
+		{
+			cmd_pool_info.queueFamilyIndex = vk_compute_queue_index;
+			error = vkCreateCommandPool(vk_device, &cmd_pool_info, nullptr, 
+										&vk_compute_cmd_pool);
+			assert(!error);
+		}
+	}
+
+	ys_upload_init();
+
+	if (vk_headless)
+		vk_prepare_offscreen_images();
+	else
+		vk_prepare_swapchain();
+
+	// CREATE FRAME SYNC OBJECTS
+	{
+		VkFenceCreateInfo fence_info;
+		fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+		fence_info.pNext = nullptr;
+		// NOTE: Signaled so that the first wait of each slot returns at once.
+		fence_info.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+		VkSemaphoreCreateInfo semaphore_info;
+		semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		semaphore_info.pNext = nullptr;
+		semaphore_info.flags = 0;
+
+		vk_frames = new FrameSync[vk_frames_in_flight];
+		for (uint32_t i = 0; i < vk_frames_in_flight; ++i)
+		{
+			error = vkCreateFence(vk_device, &fence_info, nullptr, 
+								  &vk_frames[i].fence);
+			assert(!error);
+			error = vkCreateSemaphore(vk_device, &semaphore_info, nullptr,
+									  &vk_frames[i].image_acquired);
+			assert(!error);
+			error = vkCreateSemaphore(vk_device, &semaphore_info, nullptr,
+									  &vk_frames[i].render_complete);
+			assert(!error);
+
+			vk_frames[i].compute_cmd = VK_NULL_HANDLE;
+			vk_frames[i].compute_done = VK_NULL_HANDLE;
+			vk_frames[i].compute_recorded = false;
+			if (vk_compute_queue != VK_NULL_HANDLE)
+			{
+				VkCommandBufferAllocateInfo cmd_info;
+				cmd_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+				cmd_info.pNext = nullptr;
+				cmd_info.commandPool = vk_compute_cmd_pool;
+				cmd_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+				cmd_info.commandBufferCount = 1;
+
+				error = vkAllocateCommandBuffers(vk_device, &cmd_info, 
+												 &vk_frames[i].compute_cmd);
+				assert(!error);
+				error = vkCreateSemaphore(vk_device, &semaphore_info, nullptr,
+										  &vk_frames[i].compute_done);
+				assert(!error);
+			}
+
+			vk_frames[i].timestamps = VK_NULL_HANDLE;
+			vk_frames[i].timestamps_written = false;
+			vk_frames[i].async_timestamps_written = false;
+			vk_frames[i].submit_ns = 0;
+			vk_frames[i].input_ns = 0;
+			vk_frames[i].serial = 0;
+		}
+	}
+
+	// CREATE TIMESTAMP QUERY POOLS
+	// NOTE: Queues without valid timestamp bits cannot be profiled.
+	{
+		uint32_t valid_bits = vk_queue_props[vk_elected_queue_index].timestampValidBits;
+		vk_timestamps_enabled = (valid_bits > 0);
+		vk_timestamp_mask = (valid_bits >= 64) ? ~0ull : ((1ull << valid_bits) - 1);
+		// NOTE: The async queries share the mask of the main queue, the
+		//		 compute family must count at least as many bits.
+		vk_async_timestamps_enabled = vk_timestamps_enabled && 
+			vk_compute_queue != VK_NULL_HANDLE &&
+			vk_queue_props[vk_compute_queue_index].timestampValidBits >= valid_bits;
+		vk_timestamp_period_ms = 
+			(double)vk_gpu_properties.limits.timestampPeriod / 1000000.0;
+
+		VkQueryPoolCreateInfo query_pool_info;
+		query_pool_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		query_pool_info.pNext = nullptr;
+		query_pool_info.flags = 0;
+		query_pool_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		query_pool_info.queryCount = YS_TIMESTAMP_COUNT;
+		query_pool_info.pipelineStatistics = 0;
+
+		for (uint32_t i = 0; vk_timestamps_enabled && i < vk_frames_in_flight; ++i)
+		{
+			error = vkCreateQueryPool(vk_device, &query_pool_info, nullptr,
+									  &vk_frames[i].timestamps);
+			assert(!error);
+		}
+	}
+
+	vk_prepare_swapchain_cmds();
+
+	// NOTE: The ring segment has to hold the frame constants and the instance
+	//		 data of every object.
+	{
+		VkDeviceSize alignment = ys_uniform_ring_alignment();
+		VkDeviceSize frame_size = 
+			ys_align_up(sizeof(YsFrameConstants), alignment) +
+			ys_align_up(sizeof(YsInstanceData) * ys_object_count, alignment);
+		if (frame_size < ys_uniform_frame_size)
+			frame_size = ys_uniform_frame_size;
+		ys_uniform_ring_init(frame_size);
+	}
+
+	vk_record_init();
+
+	ys_matrix_projection = ys_mat4_perspective(0.1f, 1000.f, 90.f, 
+											   (float)win_width / (float)win_height);
+}
+
+
+static void
+vk_prepare_swapchain()
+{
+	VkResult error;
+
+	// CREATE SWAPCHAIN
+	// NOTE: The previous swapchain, if any, is handed over to the new one and
+	//		 retired by vk_recreate_swapchain.
+	{
+
+		VkSurfaceCapabilitiesKHR surface_capabilities;
+		error = fp.GetPhysicalDeviceSurfaceCapabilitiesKHR(vk_gpu, vk_surface,
+														   &surface_capabilities);
+		assert(!error);
+
+		VkExtent2D swapchain_extent;
+		if (surface_capabilities.currentExtent.width == (uint32_t)-1)
+		{
+			swapchain_extent.width = win_width;
+			swapchain_extent.height = win_height;
+		}
+		else
+		{
+			swapchain_extent = surface_capabilities.currentExtent;
+			win_width = swapchain_extent.width;
+			win_height = swapchain_extent.height;
+		}
+
+		uint32_t present_mode_count = 0;
+		error = fp.GetPhysicalDeviceSurfacePresentModesKHR(vk_gpu, vk_surface,
+														   &present_mode_count,
+														   nullptr);
+		assert(!error && present_mode_count);
+
+		VkPresentModeKHR* present_modes = new VkPresentModeKHR[present_mode_count];
+		error = fp.GetPhysicalDeviceSurfacePresentModesKHR(vk_gpu, vk_surface,
+														   &present_mode_count,
+														   present_modes);
+		assert(!error);
+
+		// NOTE: VK_PRESENT_MODE_FIFO_KHR is the default mode for any driver.
+		//		 Also MAILBOX mode has v-sync. IMMEDIATE does not.
+		VkPresentModeKHR expected_present_mode = VK_PRESENT_MODE_FIFO_KHR;
+		for (uint32_t i = 0; i < present_mode_count; ++i)
+		{
+			if (present_modes[i] == VK_PRESENT_MODE_MAILBOX_KHR)
+			{
+				expected_present_mode = VK_PRESENT_MODE_MAILBOX_KHR;
+				break;
+			}
+			if (present_modes[i] == VK_PRESENT_MODE_IMMEDIATE_KHR)
+				expected_present_mode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+		}
+
+		delete[] present_modes;
+
+		// NOTE: We need an additional image because reasons.
+		uint32_t expected_swapchain_images_count = surface_capabilities.minImageCount + 1;
+		if (surface_capabilities.maxImageCount > 0 &&
+			expected_swapchain_images_count > surface_capabilities.maxImageCount)
+			expected_swapchain_images_count = surface_capabilities.maxImageCount;
+
+		VkSurfaceTransformFlagBitsKHR pre_transform;
+		if (surface_capabilities.supportedTransforms & VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR)
+			pre_transform = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR;
+		else
+			pre_transform = surface_capabilities.currentTransform;
+
+		VkSwapchainCreateInfoKHR swapchain_info;
+		swapchain_info.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+		swapchain_info.pNext = nullptr;
+		swapchain_info.flags = 0;
+		swapchain_info.surface = vk_surface;
+		swapchain_info.minImageCount = expected_swapchain_images_count;
+		swapchain_info.imageFormat = vk_surface_format;
+		swapchain_info.imageColorSpace = vk_color_space;
+		swapchain_info.imageExtent = swapchain_extent;
+		swapchain_info.imageArrayLayers = 1;
+		swapchain_info.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+		swapchain_info.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		swapchain_info.queueFamilyIndexCount = 0;
+		swapchain_info.pQueueFamilyIndices = nullptr;
+		swapchain_info.preTransform = pre_transform;
+		swapchain_info.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+		swapchain_info.presentMode = expected_present_mode;
+		swapchain_info.clipped = VK_TRUE;
+		swapchain_info.oldSwapchain = vk_swapchain;
+
+		error = fp.CreateSwapchainKHR(vk_device, &swapchain_info, nullptr, &vk_swapchain);
+		assert(!error);
+	}
+
+	// CREATE SWAPCHAIN IMAGES
+	{
+		error = fp.GetSwapchainImagesKHR(vk_device, vk_swapchain, 
+										 &vk_swapchain_image_count, nullptr);  
+		assert(!error && vk_swapchain_image_count);
+
+		VkImage* swapchain_images = new VkImage[vk_swapchain_image_count];
+		error = fp.GetSwapchainImagesKHR(vk_device, vk_swapchain,
+										 &vk_swapchain_image_count, swapchain_images);
+		assert(!error);
+
+		vk_swapchain_buffers = new SwapchainBuffer[vk_swapchain_image_count];
+		vk_swapchain_current_buffer = vk_swapchain_buffers;
+		
+		for (uint32_t i = 0; i < vk_swapchain_image_count; ++i)
+		{
+			vk_swapchain_buffers[i].index = i;
+			vk_swapchain_buffers[i].image = swapchain_images[i];
+			vk_swapchain_buffers[i].in_flight = VK_NULL_HANDLE;
+
+			VkImageViewCreateInfo image_view_info;
+			image_view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+			image_view_info.pNext = nullptr;
+			image_view_info.flags = 0;
+			image_view_info.image = vk_swapchain_buffers[i].image;
+			image_view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+			image_view_info.format = vk_surface_format;
+			image_view_info.components = {
+				VK_COMPONENT_SWIZZLE_R,
+				VK_COMPONENT_SWIZZLE_G,
+				VK_COMPONENT_SWIZZLE_B,
+				VK_COMPONENT_SWIZZLE_A
+			};
+			image_view_info.subresourceRange = {
+				VK_IMAGE_ASPECT_COLOR_BIT,
+				0, 1, 0, 1
+			};
+
+			error = vkCreateImageView(vk_device, &image_view_info, nullptr, 
+									  &vk_swapchain_buffers[i].view);
+			assert(!error);
+		}
+
+		delete[] swapchain_images;
+	}
+}
+
+
+static void
+vk_prepare_offscreen_images()
+{
+	VkResult error;
+
+	// NOTE: One image per frame in flight is enough for the ring to never
+	//		 wait on an image.
+	vk_swapchain_image_count = vk_frames_in_flight;
+	vk_swapchain_buffers = new SwapchainBuffer[vk_swapchain_image_count];
+	vk_swapchain_current_buffer = vk_swapchain_buffers;
+
+	for (uint32_t i = 0; i < vk_swapchain_image_count; ++i)
+	{
+		SwapchainBuffer& buffer = vk_swapchain_buffers[i];
+		buffer.index = i;
+		buffer.in_flight = VK_NULL_HANDLE;
+
+		VkImageCreateInfo	image_info;
+		image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		image_info.pNext = nullptr;
+		image_info.flags = 0;
+		image_info.imageType = VK_IMAGE_TYPE_2D;
+		image_info.format = vk_surface_format;
+		image_info.extent = { win_width, win_height, 1 };
+		image_info.mipLevels = 1;
+		image_info.arrayLayers = 1;
+		image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+		image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+		// NOTE: TRANSFER_SRC lets a frame be read back for inspection.
+		image_info.usage = 
+			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+		image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		image_info.queueFamilyIndexCount = 0;
+		image_info.pQueueFamilyIndices = nullptr;
+		image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+		error = vkCreateImage(vk_device, &image_info, nullptr, &buffer.image);
+		assert(!error);
+
+		VkMemoryRequirements image_mem_reqs;
+		vkGetImageMemoryRequirements(vk_device, buffer.image, &image_mem_reqs);
+
+		buffer.allocation = 
+			ys_memory_alloc(image_mem_reqs, 0, YS_RESOURCE_OPTIMAL);
+
+		error = vkBindImageMemory(vk_device, buffer.image, 
+								  buffer.allocation.memory, 
+								  buffer.allocation.offset);
+		assert(!error);
+
+		VkImageViewCreateInfo image_view_info;
+		image_view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		image_view_info.pNext = nullptr;
+		image_view_info.flags = 0;
+		image_view_info.image = buffer.image;
+		image_view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		image_view_info.format = vk_surface_format;
+		image_view_info.components = {
+			VK_COMPONENT_SWIZZLE_R,
+			VK_COMPONENT_SWIZZLE_G,
+			VK_COMPONENT_SWIZZLE_B,
+			VK_COMPONENT_SWIZZLE_A
+		};
+		image_view_info.subresourceRange = {
+			VK_IMAGE_ASPECT_COLOR_BIT,
+			0, 1, 0, 1
+		};
+
+		error = vkCreateImageView(vk_device, &image_view_info, nullptr, 
+								  &buffer.view);
+		assert(!error);
+	}
+}
+
+
+// One primary command buffer per swapchain image.
+static void
+vk_prepare_swapchain_cmds()
+{
+	VkResult error;
+
+	VkCommandBufferAllocateInfo cmd_info;
+	cmd_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	cmd_info.pNext = nullptr;
+	cmd_info.commandPool = vk_cmd_pool;
+	cmd_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	cmd_info.commandBufferCount = 1;
+
+	for (uint32_t i = 0; i < vk_swapchain_image_count; ++i)
+	{
+		error = vkAllocateCommandBuffers(vk_device, &cmd_info,
+										&vk_swapchain_buffers[i].cmd);
+		assert(!error);
+	}
+}
+
+
+// Rebuilds the swapchain and the objects sized after it. The previous ones
+// may still be used by frames in flight, they are retired instead of waiting
+// for the device. Returns false while the window has no area.
+static bool
+vk_recreate_swapchain()
+{
+	YS_PROFILE_FUNCTION();
+	VkResult error;
+
+	VkSurfaceCapabilitiesKHR surface_capabilities;
+	error = fp.GetPhysicalDeviceSurfaceCapabilitiesKHR(vk_gpu, vk_surface,
+													   &surface_capabilities);
+	assert(!error);
+	if (surface_capabilities.currentExtent.width == 0 ||
+		surface_capabilities.currentExtent.height == 0)
+		return false;
+
+	vk_retired_objects.emplace_back();
+	RetiredObjects& retired = vk_retired_objects.back();
+	retired.serial = vk_frame_serial;
+	retired.swapchain = vk_swapchain;
+	retired.buffers = vk_swapchain_buffers;
+	retired.buffer_count = vk_swapchain_image_count;
+
+	vk_prepare_swapchain();
+	vk_prepare_swapchain_cmds();
+	vk_frame_graph_update();
+
+	ys_matrix_projection = ys_mat4_perspective(0.1f, 1000.f, 90.f, 
+											   (float)win_width / (float)win_height);
+	vk_swapchain_dirty = false;
+
+	std::cout << "[SWAPCHAIN] Recreated at " << win_width << "x" << win_height 
+		<< ", " << vk_retired_objects.size() << " retired" << std::endl;
+	return true;
+}
+
+
+static void
+vk_destroy_swapchain_buffers(SwapchainBuffer* buffers, uint32_t count)
+{
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		vkDestroyImageView(vk_device, buffers[i].view, nullptr);
+		vkFreeCommandBuffers(vk_device, vk_cmd_pool, 1, &buffers[i].cmd);
+
+		// NOTE: Swapchain images belong to the swapchain.
+		if (vk_headless)
+		{
+			vkDestroyImage(vk_device, buffers[i].image, nullptr);
+			ys_memory_free(buffers[i].allocation);
+		}
+	}
+	delete[] buffers;
+}
+
+
+// Destroys the retired objects whose last frame is done on the GPU.
+static void
+vk_collect_retired_objects()
+{
+	while (!vk_retired_objects.empty() &&
+		   vk_retired_objects.front().serial <= vk_completed_serial)
+	{
+		RetiredObjects& retired = vk_retired_objects.front();
+		vk_frame_graph_destroy(retired.graph, retired.graph_memory);
+		if (retired.buffers)
+			vk_destroy_swapchain_buffers(retired.buffers, retired.buffer_count);
+		if (retired.swapchain != VK_NULL_HANDLE)
+			fp.DestroySwapchainKHR(vk_device, retired.swapchain, nullptr);
+		for (VkBuffer buffer : retired.moved_buffers)
+			vkDestroyBuffer(vk_device, buffer, nullptr);
+		for (YsAllocation& allocation : retired.moved_ranges)
+			ys_memory_free(allocation);
+		vk_retired_objects.pop_front();
+	}
+}
+
+
+// Declares the frame graph and rebuilds it when the declaration changed, the
+// previous one is retired.
+static void
+vk_frame_graph_update()
+{
+	YS_PROFILE_FUNCTION();
+
+	YsGraph graph;
+	vk_frame_graph_declare(graph);
+	if (ys_graph_hash(graph) == vk_frame_graph.hash)
+		return;
+
+	ys_graph_compile(graph);
+	graph.execute_count = vk_frame_graph.execute_count;
+	graph.barrier_count = vk_frame_graph.barrier_count;
+
+	if (vk_frame_graph.hash != 0)
+	{
+		vk_retired_objects.emplace_back();
+		RetiredObjects& retired = vk_retired_objects.back();
+		retired.serial = vk_frame_serial;
+		retired.graph = std::move(vk_frame_graph);
+		retired.graph_memory = vk_frame_graph_memory;
+	}
+
+	// NOTE: Realized in place, transient images point at their state in
+	//		 vk_frame_graph.resources.
+	vk_frame_graph = std::move(graph);
+	vk_frame_graph_realize(vk_frame_graph, vk_frame_graph_memory);
+	vk_render_pass = vk_frame_graph.passes[vk_graph_main_pass].render_pass;
+
+	ys_graph_report(vk_frame_graph);
+}
+
+
+// Cull, main and present passes. The cull pass only exists once the cull
+// buffers do, and is culled when the main pass draws without it.
+static void
+vk_frame_graph_declare(YsGraph& graph)
+{
+	graph.variant_count = vk_swapchain_image_count;
+
+	YsGraphHandle backbuffer = ys_graph_import_image(graph, "backbuffer", vk_surface_format,
+													 VK_IMAGE_ASPECT_COLOR_BIT, 
+													 win_width, win_height);
+	for (uint32_t i = 0; i < vk_swapchain_image_count; ++i)
+	{
+		YsGraphResource& resource = graph.resources[backbuffer];
+		resource.images.push_back(vk_swapchain_buffers[i].image);
+		resource.views.push_back(vk_swapchain_buffers[i].view);
+		resource.states.push_back(&vk_swapchain_buffers[i].state);
+	}
+
+	YsGraphHandle depth = ys_graph_create_image(graph, "depth", vk_depth_format,
+												VK_IMAGE_ASPECT_DEPTH_BIT, 
+												win_width, win_height);
+
+	YsGraphHandle cull_commands = 0;
+	YsGraphHandle cull_instances = 0;
+	vk_graph_cull_pass = UINT32_MAX;
+	if (ys_cull_commands[0].buffer != VK_NULL_HANDLE)
+	{
+		cull_commands = ys_graph_import_buffer(graph, "cull commands");
+		cull_instances = ys_graph_import_buffer(graph, "cull instances");
+		graph.resources[cull_commands].per_frame = true;
+		graph.resources[cull_instances].per_frame = true;
+		for (uint32_t i = 0; i < vk_frames_in_flight; ++i)
+		{
+			graph.resources[cull_commands].buffers.push_back(ys_cull_commands[i].buffer);
+			graph.resources[cull_commands].states.push_back(&ys_cull_commands[i].state);
+			graph.resources[cull_instances].buffers.push_back(ys_cull_instances[i].buffer);
+			graph.resources[cull_instances].states.push_back(&ys_cull_instances[i].state);
+		}
+
+		// NOTE: The commands are reset by a copy, then incremented by the
+		//		 dispatch, see vk_record_cull.
+		vk_graph_cull_pass = ys_graph_add_pass(graph, "cull", false, vk_graph_cull, nullptr);
+		ys_graph_write(graph, vk_graph_cull_pass, cull_commands, YS_USAGE_TRANSFER_DST);
+		ys_graph_write(graph, vk_graph_cull_pass, cull_instances, YS_USAGE_COMPUTE_WRITE);
+		if (vk_compute_queue != VK_NULL_HANDLE)
+			ys_graph_set_queue(graph, vk_graph_cull_pass, YS_GRAPH_QUEUE_ASYNC_COMPUTE);
+	}
+
+	VkClearValue clear_color;
+	clear_color.color = { { 0.2f, 0.2f, 0.2f, 0.2f } };
+	VkClearValue clear_depth;
+	clear_depth.depthStencil = { 1.0f, 0 };
+
+	vk_graph_main_pass = ys_graph_add_pass(graph, "main", true, vk_graph_main, nullptr);
+	ys_graph_clear(graph, vk_graph_main_pass, backbuffer, YS_USAGE_COLOR_ATTACHMENT, 
+				   clear_color);
+	ys_graph_clear(graph, vk_graph_main_pass, depth, YS_USAGE_DEPTH_ATTACHMENT, 
+				   clear_depth);
+	if (vk_graph_cull_pass != UINT32_MAX && vk_gpu_cull)
+	{
+		ys_graph_read(graph, vk_graph_main_pass, cull_commands, YS_USAGE_INDIRECT_BUFFER);
+		ys_graph_read(graph, vk_graph_main_pass, cull_instances, YS_USAGE_VERTEX_BUFFER);
+	}
+
+	// NOTE: PRESENT_SRC_KHR requires VK_KHR_swapchain, offscreen images are
+	//		 left ready for a readback instead.
+	uint32_t present_pass = ys_graph_add_pass(graph, "present", false, nullptr, nullptr);
+	graph.passes[present_pass].side_effect = true;
+	ys_graph_read(graph, present_pass, backbuffer, 
+				  vk_headless ? YS_USAGE_TRANSFER_SRC : YS_USAGE_PRESENT);
+}
+
+
+// Creates the transient images in one shared allocation, then the render
+// passes and framebuffers of the graphics passes kept.
+static void
+vk_frame_graph_realize(YsGraph& graph, YsAllocation& memory)
+{
+	VkResult error;
+
+	// TRANSIENT IMAGES
+	VkMemoryRequirements memory_reqs;
+	memory_reqs.size = 0;
+	memory_reqs.alignment = 1;
+	memory_reqs.memoryTypeBits = ~0u;
+	for (YsGraphResource& resource : graph.resources)
+	{
+		if (!resource.image || resource.imported || resource.first_use == UINT32_MAX)
+			continue;
+
+		VkImageCreateInfo	image_info;
+		image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		image_info.pNext = nullptr;
+		image_info.flags = 0;
+		image_info.imageType = VK_IMAGE_TYPE_2D;
+		image_info.format = resource.format;
+		image_info.extent = { resource.width, resource.height, 1 };
+		image_info.mipLevels = 1;
+		image_info.arrayLayers = 1;
+		image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+		image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+		image_info.usage = resource.usage;
+		image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		image_info.queueFamilyIndexCount = 0;
+		image_info.pQueueFamilyIndices = nullptr;
+		image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+		VkImage image;
+		error = vkCreateImage(vk_device, &image_info, nullptr, &image);
+		assert(!error);
+
+		VkMemoryRequirements image_mem_reqs;
+		vkGetImageMemoryRequirements(vk_device, image, &image_mem_reqs);
+		resource.size = image_mem_reqs.size;
+		resource.alignment = image_mem_reqs.alignment;
+		if (image_mem_reqs.alignment > memory_reqs.alignment)
+			memory_reqs.alignment = image_mem_reqs.alignment;
+		memory_reqs.memoryTypeBits &= image_mem_reqs.memoryTypeBits;
+
+		resource.images.push_back(image);
+		resource.states.push_back(&resource.state);
+	}
+
+	ys_graph_alias(graph);
+
+	memory = YsAllocation();
+	if (graph.memory_size > 0)
+	{
+		assert(memory_reqs.memoryTypeBits != 0);
+		memory_reqs.size = graph.memory_size;
+		memory = ys_memory_alloc(memory_reqs, 0, YS_RESOURCE_OPTIMAL);
+	}
+
+	for (YsGraphResource& resource : graph.resources)
+	{
+		if (resource.images.empty() || resource.imported)
+			continue;
+
+		error = vkBindImageMemory(vk_device, resource.images[0], memory.memory,
+								  memory.offset + resource.offset);
+		assert(!error);
+
+		VkImageViewCreateInfo	view_info;
+		view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		view_info.pNext = nullptr;
+		view_info.flags = 0;
+		view_info.image = resource.images[0];
+		view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		view_info.format = resource.format;
+		view_info.components = {
+			VK_COMPONENT_SWIZZLE_IDENTITY,
+			VK_COMPONENT_SWIZZLE_IDENTITY,
+			VK_COMPONENT_SWIZZLE_IDENTITY,
+			VK_COMPONENT_SWIZZLE_IDENTITY
+		};
+		view_info.subresourceRange = { resource.aspect, 0, 1, 0, 1 };
+
+		VkImageView view;
+		error = vkCreateImageView(vk_device, &view_info, nullptr, &view);
+		assert(!error);
+		resource.views.push_back(view);
+	}
+
+	// RENDER PASSES AND FRAMEBUFFERS
+	for (YsGraphPass& pass : graph.passes)
+	{
+		if (!pass.graphics || pass.culled)
+			continue;
+
+		pass.render_pass = vk_get_render_pass(graph, pass);
+
+		for (uint32_t variant = 0; variant < graph.variant_count; ++variant)
+		{
+			VkImageView attachments[YS_GRAPH_MAX_ATTACHMENTS];
+			uint32_t attachment_count = 0;
+			uint32_t width = 0;
+			uint32_t height = 0;
+			for (const YsGraphAccess& access : pass.accesses)
+			{
+				if (!ys_graph_is_attachment(access))
+					continue;
+				const YsGraphResource& resource = graph.resources[access.resource];
+				attachments[attachment_count++] = 
+					resource.views[(resource.views.size() > 1) ? variant : 0];
+				width = resource.width;
+				height = resource.height;
+			}
+
+			VkFramebufferCreateInfo framebuffer_info;
+			framebuffer_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+			framebuffer_info.pNext = nullptr;
+			framebuffer_info.flags = 0;
+			framebuffer_info.renderPass = pass.render_pass;
+			framebuffer_info.attachmentCount = attachment_count;
+			framebuffer_info.pAttachments = attachments;
+			framebuffer_info.width = width;
+			framebuffer_info.height = height;
+			framebuffer_info.layers = 1;
+
+			VkFramebuffer framebuffer;
+			error = vkCreateFramebuffer(vk_device, &framebuffer_info, nullptr, &framebuffer);
+			assert(!error);
+			pass.framebuffers.push_back(framebuffer);
+		}
+	}
+}
+
+
+// Render passes are shared through vk_render_passes and not destroyed here.
+static void
+vk_frame_graph_destroy(YsGraph& graph, YsAllocation& memory)
+{
+	for (YsGraphPass& pass : graph.passes)
+	{
+		for (VkFramebuffer framebuffer : pass.framebuffers)
+			vkDestroyFramebuffer(vk_device, framebuffer, nullptr);
+		pass.framebuffers.clear();
+	}
+
+	for (YsGraphResource& resource : graph.resources)
+	{
+		if (resource.imported)
+			continue;
+		for (VkImageView view : resource.views)
+			vkDestroyImageView(vk_device, view, nullptr);
+		for (VkImage image : resource.images)
+			vkDestroyImage(vk_device, image, nullptr);
+		resource.views.clear();
+		resource.images.clear();
+	}
+
+	ys_memory_free(memory);
+}
+
+
+// Attachments come in the order the pass declares them, the layouts do not
+// change within the render pass, the graph barriers handle transitions.
+static VkRenderPass
+vk_get_render_pass(const YsGraph& graph, const YsGraphPass& pass)
+{
+	VkAttachmentDescription attachments[YS_GRAPH_MAX_ATTACHMENTS];
+	VkAttachmentReference color_references[YS_GRAPH_MAX_ATTACHMENTS];
+	VkAttachmentReference depth_reference;
+	uint32_t attachment_count = 0;
+	uint32_t color_count = 0;
+	bool has_depth = false;
+
+	// NOTE: Zeroed, the descriptions are hashed as raw bytes.
+	memset(attachments, 0, sizeof(attachments));
+	for (const YsGraphAccess& access : pass.accesses)
+	{
+		if (!ys_graph_is_attachment(access))
+			continue;
+
+		VkImageLayout layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+		if (access.usage == YS_USAGE_DEPTH_ATTACHMENT)
+			layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+		else if (access.usage == YS_USAGE_DEPTH_READ)
+			layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+
+		VkAttachmentDescription& attachment = attachments[attachment_count];
+		attachment.flags = 0;
+		attachment.format = graph.resources[access.resource].format;
+		attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+		attachment.loadOp = access.load_op;
+		attachment.storeOp = access.store_op;
+		attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		attachment.initialLayout = layout;
+		attachment.finalLayout = layout;
+
+		if (access.usage == YS_USAGE_COLOR_ATTACHMENT)
+		{
+			color_references[color_count++] = { attachment_count, layout };
+		}
+		else
+		{
+			depth_reference = { attachment_count, layout };
+			has_depth = true;
+		}
+		attachment_count++;
+	}
+
+	// NOTE: 64 bit FNV-1a over the attachment descriptions.
+	const uint8_t* p_bytes = (const uint8_t*)attachments;
+	uint64_t key = 14695981039346656037ull;
+	for (size_t i = 0; i < attachment_count * sizeof(VkAttachmentDescription); ++i)
+	{
+		key ^= p_bytes[i];
+		key *= 1099511628211ull;
+	}
+
+	auto found = vk_render_passes.find(key);
+	if (found != vk_render_passes.end())
+		return found->second;
+
+	VkSubpassDescription subpass;
+	subpass.flags = 0;
+	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	subpass.inputAttachmentCount = 0;
+	subpass.pInputAttachments = nullptr;
+	subpass.colorAttachmentCount = color_count;
+	subpass.pColorAttachments = color_references;
+	subpass.pResolveAttachments = nullptr;
+	subpass.pDepthStencilAttachment = has_depth ? &depth_reference : nullptr;
+	subpass.preserveAttachmentCount = 0;
+	subpass.pPreserveAttachments = nullptr;
+
+	VkRenderPassCreateInfo renderpass_info;
+	renderpass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+	renderpass_info.pNext = nullptr;
+	renderpass_info.flags = 0;
+	renderpass_info.attachmentCount = attachment_count;
+	renderpass_info.pAttachments = attachments;
+	renderpass_info.subpassCount = 1;
+	renderpass_info.pSubpasses = &subpass;
+	renderpass_info.dependencyCount = 0;
+	renderpass_info.pDependencies = nullptr;
+
+	VkRenderPass render_pass;
+	VkResult error = vkCreateRenderPass(vk_device, &renderpass_info, nullptr, &render_pass);
+	assert(!error);
+
+	vk_render_passes[key] = render_pass;
+	return render_pass;
+}
+
+
+static void
+vk_prepare_pipeline()
+{
+	VkResult error;
+
+	// DESCRIPTOR SET LAYOUT
+	{
+		// NOTE: Binding 0 holds the frame constants, offset into
+		//		 ys_uniform_ring at bind time. Object transforms come in as
+		//		 instance attributes.
+		VkDescriptorSetLayoutBinding layout_bindings[1];
+		layout_bindings[0].binding = 0;
+		layout_bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+		layout_bindings[0].descriptorCount = 1;
+		layout_bindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+		layout_bindings[0].pImmutableSamplers = nullptr;
+	
+		VkDescriptorSetLayoutCreateInfo desc_layout_info;
+		desc_layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		desc_layout_info.pNext = nullptr;
+		desc_layout_info.flags = 0;
+		desc_layout_info.bindingCount = 1;
+		desc_layout_info.pBindings = layout_bindings;
+
+		error = vkCreateDescriptorSetLayout(vk_device, &desc_layout_info,
+											nullptr, &vk_desc_set_layout);
+		assert(!error);
+
+		// NOTE: vk_pipeline_layout is not used before the pipeline creation,
+		//		 so it could be created later.
+		VkPipelineLayoutCreateInfo pipeline_layout_info;
+		pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		pipeline_layout_info.pNext = nullptr;
+		pipeline_layout_info.flags = 0;
+		pipeline_layout_info.setLayoutCount = 1;
+		pipeline_layout_info.pSetLayouts = &vk_desc_set_layout;
+		pipeline_layout_info.pushConstantRangeCount = 0;
+		pipeline_layout_info.pPushConstantRanges = nullptr;
+
+		error = vkCreatePipelineLayout(vk_device, &pipeline_layout_info, nullptr,
+									   &vk_pipeline_layout);
+		assert(!error);
+	}
+
+	// CREATE DESCRIPTOR POOL
+	{
+		VkDescriptorPoolSize desc_counts[1];
+		desc_counts[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+		desc_counts[0].descriptorCount = 1;
+
+		VkDescriptorPoolCreateInfo desc_pool_info;
+		desc_pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		desc_pool_info.pNext = nullptr;
+		desc_pool_info.flags = 0;
+		desc_pool_info.maxSets = 1;
+		desc_pool_info.poolSizeCount = 1;
+		desc_pool_info.pPoolSizes = desc_counts;
+
+		error = vkCreateDescriptorPool(vk_device, &desc_pool_info, nullptr,
+									   &vk_descriptor_pool);
+		assert(!error);
+	}
+
+	// ALLOCATE DESCRIPTOR SET
+	{
+		VkDescriptorSetAllocateInfo alloc_info;
+		alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		alloc_info.pNext = nullptr;
+		alloc_info.descriptorPool = vk_descriptor_pool;
+		alloc_info.descriptorSetCount = 1;
+		alloc_info.pSetLayouts = &vk_desc_set_layout;
+		
+		error = vkAllocateDescriptorSets(vk_device, &alloc_info, 
+										 &vk_descriptor_set);
+		assert(!error);
+
+		// NOTE: See cube:demo_prepare_descriptor_set:1737 for texture handling.
+		// NOTE: Dynamic offsets are added to the descriptor offset, so the
+		//		 descriptor starts at the beginning of the ring.
+		VkDescriptorBufferInfo buffer_desc_infos[1];
+		buffer_desc_infos[0].buffer = ys_uniform_ring.buffer.buffer;
+		buffer_desc_infos[0].offset = 0;
+		buffer_desc_infos[0].range = sizeof(YsFrameConstants);
+
+		VkWriteDescriptorSet desc_set_writes[1];
+		for (uint32_t i = 0; i < 1; ++i)
+		{
+			desc_set_writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			desc_set_writes[i].pNext = nullptr;
+			desc_set_writes[i].dstSet = vk_descriptor_set;
+			desc_set_writes[i].dstBinding = i;
+			desc_set_writes[i].dstArrayElement = 0;
+			desc_set_writes[i].descriptorCount = 1;
+			desc_set_writes[i].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+			desc_set_writes[i].pImageInfo = nullptr;
+			desc_set_writes[i].pBufferInfo = &buffer_desc_infos[i];
+			desc_set_writes[i].pTexelBufferView = nullptr;
+		}
+
+		vkUpdateDescriptorSets(vk_device, 1, desc_set_writes, 0, nullptr);
+	}
+
+
+	vk_frame_graph_update();
+
+	// PIPELINE
+	{
+		std::vector<char> cache_data;
+		vk_pipeline_cache_load(cache_data);
+
+		VkPipelineCacheCreateInfo pipeline_cache_info;
+		pipeline_cache_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+		pipeline_cache_info.pNext = nullptr;
+		pipeline_cache_info.flags = 0;
+		pipeline_cache_info.initialDataSize = cache_data.size();
+		pipeline_cache_info.pInitialData = cache_data.empty() ? nullptr : cache_data.data();
+		error = vkCreatePipelineCache(vk_device, &pipeline_cache_info, nullptr,
+									  &vk_pipeline_cache);
+		// NOTE: The header checks out but the driver refused the data, start
+		//		 from an empty cache instead.
+		if (error && !cache_data.empty())
+		{
+			std::cout << "[PIPELINE CACHE] Rejected by the driver, discarded" << std::endl;
+			cache_data.clear();
+			pipeline_cache_info.initialDataSize = 0;
+			pipeline_cache_info.pInitialData = nullptr;
+			error = vkCreatePipelineCache(vk_device, &pipeline_cache_info, nullptr,
+										  &vk_pipeline_cache);
+		}
+		assert(!error);
+
+		ys_pipeline_init();
+
+		using clock = std::chrono::high_resolution_clock;
+		clock::time_point start = clock::now();
+
+		// NOTE: The default pipeline is compiled right away, it is the fallback
+		//		 for every variant that is still compiling.
+		YsPipelineDesc desc;
+		ys_pipeline_desc_default(desc);
+		ys_default_pipeline = ys_pipeline_request(desc, true);
+		vk_pipeline = ys_default_pipeline->pipeline;
+
+		double elapsed_ms = 
+			std::chrono::duration<double, std::milli>(clock::now() - start).count();
+		std::cout << "[PIPELINE CACHE] " << (cache_data.empty() ? "Cold" : "Warm")
+			<< " start, pipeline created in " << elapsed_ms << " ms" << std::endl;
+
+		// NOTE: Once the graphics pipeline has been created, the shader modules
+		//		 should be destroyable.
+	}
+
+	vk_cull_init();
+}
+
+
+static uint64_t
+ys_pipeline_hash(const YsPipelineDesc& desc)
+{
+	// NOTE: 64 bit FNV-1a over the raw description.
+	const uint8_t* p_bytes = (const uint8_t*)&desc;
+	uint64_t hash = 14695981039346656037ull;
+	for (size_t i = 0; i < sizeof(YsPipelineDesc); ++i)
+	{
+		hash ^= p_bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+
+size_t
+YsPipelineDescHash::operator()(const YsPipelineDesc& desc) const
+{
+	return (size_t)ys_pipeline_hash(desc);
+}
+
+
+// State of the cube pipeline, variants start from it.
+static void
+ys_pipeline_desc_default(YsPipelineDesc& desc)
+{
+	memset(&desc, 0, sizeof(YsPipelineDesc));
+
+	desc.vertex_shader = vk_load_shader("vs_test", "Resources/vs_test.spv");
+	desc.fragment_shader = vk_load_shader("fs_test", "Resources/fs_test.spv");
+
+	desc.binding_count = 2;
+	desc.bindings[0].binding = 0;
+	desc.bindings[0].stride = 3 * sizeof(float);
+	desc.bindings[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+	desc.bindings[1].binding = 1;
+	desc.bindings[1].stride = sizeof(YsInstanceData);
+	desc.bindings[1].inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+
+	desc.attribute_count = 6;
+	desc.attributes[0].location = 0;
+	desc.attributes[0].binding = 0;
+	desc.attributes[0].format = VK_FORMAT_R32G32B32_SFLOAT;
+	desc.attributes[0].offset = 0;
+	// NOTE: The world matrix takes one location per column.
+	for (uint32_t column = 0; column < 4; ++column)
+	{
+		VkVertexInputAttributeDescription& attribute = desc.attributes[1 + column];
+		attribute.location = 1 + column;
+		attribute.binding = 1;
+		attribute.format = VK_FORMAT_R32G32B32A32_SFLOAT;
+		attribute.offset = column * 4 * sizeof(float);
+	}
+	desc.attributes[5].location = 5;
+	desc.attributes[5].binding = 1;
+	desc.attributes[5].format = VK_FORMAT_R32_UINT;
+	desc.attributes[5].offset = offsetof(YsInstanceData, material);
+
+	desc.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+	desc.polygon_mode = VK_POLYGON_MODE_LINE;
+	desc.cull_mode = VK_CULL_MODE_NONE;//	VK_CULL_MODE_FRONT_BIT;
+	desc.front_face = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+	desc.depth_test = VK_TRUE;
+	desc.depth_write = VK_TRUE;
+	desc.depth_compare = VK_COMPARE_OP_LESS_OR_EQUAL;
+
+	desc.blend.blendEnable = VK_FALSE;
+	desc.blend.srcColorBlendFactor = VK_BLEND_FACTOR_ZERO;
+	desc.blend.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO;
+	desc.blend.colorBlendOp = VK_BLEND_OP_ADD;
+	desc.blend.srcAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+	desc.blend.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+	desc.blend.alphaBlendOp = VK_BLEND_OP_ADD;
+	desc.blend.colorWriteMask =
+		VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+		VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+
+	desc.render_pass = vk_render_pass;
+	desc.subpass = 0;
+	desc.layout = vk_pipeline_layout;
+}
+
+
+// Builds the create infos from a description. Called from the background
+// compilation threads, vk_pipeline_cache is internally synchronized.
+static VkPipeline
+vk_create_pipeline(const YsPipelineDesc& desc)
+{
+	VkResult error;
+
+	VkPipelineVertexInputStateCreateInfo	vi_info;
+	VkPipelineInputAssemblyStateCreateInfo	ia_info;
+	VkPipelineViewportStateCreateInfo		vp_info;
+	VkPipelineRasterizationStateCreateInfo	rs_info;
+	VkPipelineMultisampleStateCreateInfo	ms_info;
+	VkPipelineDepthStencilStateCreateInfo	ds_info;
+	VkPipelineColorBlendStateCreateInfo		cb_info;
+	VkPipelineDynamicStateCreateInfo		dy_info;
+
+	vi_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+	vi_info.pNext = nullptr;
+	vi_info.flags = 0;
+	vi_info.vertexBindingDescriptionCount = desc.binding_count;
+	vi_info.pVertexBindingDescriptions = desc.bindings;
+	vi_info.vertexAttributeDescriptionCount = desc.attribute_count;
+	vi_info.pVertexAttributeDescriptions = desc.attributes;
+
+	ia_info.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+	ia_info.pNext = nullptr;
+	ia_info.flags = 0;
+	ia_info.topology = desc.topology;
+	ia_info.primitiveRestartEnable = VK_FALSE;
+
+	vp_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+	vp_info.pNext = nullptr;
+	vp_info.flags = 0;
+	vp_info.viewportCount = 1;
+	vp_info.pViewports = nullptr;
+	vp_info.scissorCount = 1;
+	vp_info.pScissors = nullptr;
+
+	// NOTE: There used to be a memset(0) here.
+	rs_info.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+	rs_info.pNext = nullptr;
+	rs_info.flags = 0;
+	rs_info.depthClampEnable = VK_FALSE;
+	rs_info.rasterizerDiscardEnable = VK_FALSE;
+	rs_info.polygonMode = desc.polygon_mode;
+	rs_info.cullMode = desc.cull_mode;
+	rs_info.frontFace = desc.front_face;
+	rs_info.depthBiasEnable = VK_FALSE;
+	rs_info.depthBiasConstantFactor = 0.f;
+	rs_info.depthBiasClamp = 0.f;
+	rs_info.depthBiasSlopeFactor = 0.f;
+	rs_info.lineWidth = 1.0f;
+
+	ms_info.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+	ms_info.pNext = nullptr;
+	ms_info.flags = 0;
+	ms_info.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+	ms_info.sampleShadingEnable = VK_FALSE;
+	ms_info.minSampleShading = 0.f;
+	ms_info.pSampleMask = nullptr;
+	ms_info.alphaToCoverageEnable = VK_FALSE;
+	ms_info.alphaToOneEnable = VK_FALSE;
+
+	ds_info.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+	ds_info.pNext = nullptr;
+	ds_info.flags = 0;
+	ds_info.depthTestEnable = desc.depth_test;
+	ds_info.depthWriteEnable = desc.depth_write;
+	ds_info.depthCompareOp = desc.depth_compare;
+	ds_info.depthBoundsTestEnable = VK_FALSE;
+	ds_info.stencilTestEnable = VK_FALSE;
+	ds_info.front.failOp = VK_STENCIL_OP_KEEP;
+	ds_info.front.passOp = VK_STENCIL_OP_KEEP;
+	ds_info.front.compareOp = VK_COMPARE_OP_NEVER;
+	ds_info.front.depthFailOp = VK_STENCIL_OP_KEEP;
+	ds_info.front.compareMask = 0;
+	ds_info.front.writeMask = 0;
+	ds_info.front.reference = 0;
+	ds_info.back = ds_info.front;
+	ds_info.minDepthBounds = 0.f;
+	ds_info.maxDepthBounds = 0.f;
+
+	cb_info.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+	cb_info.pNext = nullptr;
+	cb_info.flags = 0;
+	cb_info.logicOpEnable = VK_FALSE;
+	cb_info.logicOp = VK_LOGIC_OP_CLEAR;
+	cb_info.attachmentCount = 1;
+	cb_info.pAttachments = &desc.blend;
+	cb_info.blendConstants[0] = 0;
+	cb_info.blendConstants[1] = 0;
+	cb_info.blendConstants[2] = 0;
+	cb_info.blendConstants[3] = 0;
+
+	VkDynamicState dynamic_states[VK_DYNAMIC_STATE_RANGE_SIZE];
+	dynamic_states[0] = VK_DYNAMIC_STATE_VIEWPORT;
+	dynamic_states[1] = VK_DYNAMIC_STATE_SCISSOR;
+	dy_info.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+	dy_info.pNext = nullptr;
+	dy_info.flags = 0;
+	dy_info.dynamicStateCount = 2;
+	dy_info.pDynamicStates = dynamic_states;
+
+	VkSpecializationMapEntry specialization_entry;
+	specialization_entry.constantID = 0;
+	specialization_entry.offset = 0;
+	specialization_entry.size = sizeof(uint32_t);
+	VkSpecializationInfo specialization_info;
+	specialization_info.mapEntryCount = 1;
+	specialization_info.pMapEntries = &specialization_entry;
+	specialization_info.dataSize = sizeof(uint32_t);
+	specialization_info.pData = &desc.variant;
+
+	VkPipelineShaderStageCreateInfo pipeline_stages[2];
+	pipeline_stages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipeline_stages[0].pNext = nullptr;
+	pipeline_stages[0].flags = 0;
+	pipeline_stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+	pipeline_stages[0].module = desc.vertex_shader;
+	pipeline_stages[0].pName = "main";
+	pipeline_stages[0].pSpecializationInfo = nullptr;
+	pipeline_stages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipeline_stages[1].pNext = nullptr;
+	pipeline_stages[1].flags = 0;
+	pipeline_stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+	pipeline_stages[1].module = desc.fragment_shader;
+	pipeline_stages[1].pName = "main";
+	pipeline_stages[1].pSpecializationInfo = &specialization_info;
+	VkGraphicsPipelineCreateInfo pipeline_info;
+	pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+	pipeline_info.pNext = nullptr;
+	pipeline_info.flags = 0;
+	pipeline_info.stageCount = 2;
+	pipeline_info.pStages = pipeline_stages;
+	pipeline_info.pVertexInputState = &vi_info;
+	pipeline_info.pInputAssemblyState = &ia_info;
+	pipeline_info.pTessellationState = nullptr;
+	pipeline_info.pViewportState = &vp_info;
+	pipeline_info.pRasterizationState = &rs_info;
+	pipeline_info.pMultisampleState = &ms_info;
+	pipeline_info.pDepthStencilState = &ds_info;
+	pipeline_info.pColorBlendState = &cb_info;
+	pipeline_info.pDynamicState = &dy_info;
+	pipeline_info.layout = desc.layout;
+	pipeline_info.renderPass = desc.render_pass;
+	pipeline_info.subpass = desc.subpass;
+	pipeline_info.basePipelineHandle = VK_NULL_HANDLE;
+	pipeline_info.basePipelineIndex = -1;
+
+	VkPipeline pipeline;
+	error = vkCreateGraphicsPipelines(vk_device, vk_pipeline_cache, 1, 
+									  &pipeline_info, nullptr,
+									  &pipeline);
+	assert(!error);
+
+	return pipeline;
+}
+
+
+// Returns the entry matching desc, registering it if needed. New variants are
+// compiled in the background unless blocking is set.
+static YsPipelineEntry*
+ys_pipeline_request(const YsPipelineDesc& desc, bool blocking)
+{
+	YsPipelineEntry* entry;
+	{
+		std::lock_guard<std::mutex> lock(ys_pipeline_mutex);
+
+		auto it = ys_pipelines.find(desc);
+		if (it != ys_pipelines.end())
+			return it->second;
+
+		entry = new YsPipelineEntry;
+		entry->desc = desc;
+		entry->hash = ys_pipeline_hash(desc);
+		entry->pipeline = VK_NULL_HANDLE;
+		ys_pipelines[desc] = entry;
+
+		if (!blocking)
+			ys_pipeline_queue.push_back(entry);
+	}
+
+	if (blocking)
+		entry->pipeline = vk_create_pipeline(desc);
+	else
+		ys_pipeline_cv.notify_one();
+
+	return entry;
+}
+
+
+// Pipeline to bind for a variant, vk_pipeline while it is not ready.
+static VkPipeline
+ys_pipeline_get(const YsPipelineEntry* entry)
+{
+	if (!entry)
+		return vk_pipeline;
+
+	VkPipeline pipeline = entry->pipeline.load(std::memory_order_acquire);
+	return (pipeline != VK_NULL_HANDLE) ? pipeline : vk_pipeline;
+}
+
+
+static void
+ys_pipeline_worker()
+{
+	YS_PROFILE_THREAD("pipeline compiler");
+	using clock = std::chrono::high_resolution_clock;
+
+	for (;;)
+	{
+		YsPipelineEntry* entry;
+		{
+			std::unique_lock<std::mutex> lock(ys_pipeline_mutex);
+			ys_pipeline_cv.wait(lock, []{ 
+				return ys_pipeline_quit || !ys_pipeline_queue.empty();
+			});
+			if (ys_pipeline_queue.empty())
+				return;
+
+			entry = ys_pipeline_queue.front();
+			ys_pipeline_queue.pop_front();
+			ys_pipeline_compiling++;
+		}
+
+		clock::time_point start = clock::now();
+		VkPipeline pipeline = vk_create_pipeline(entry->desc);
+		entry->pipeline.store(pipeline, std::memory_order_release);
+
+		double elapsed_ms = 
+			std::chrono::duration<double, std::milli>(clock::now() - start).count();
+		std::cout << "[PIPELINE] Variant " << std::hex << entry->hash << std::dec
+			<< " compiled in " << elapsed_ms << " ms" << std::endl;
+
+		{
+			std::lock_guard<std::mutex> lock(ys_pipeline_mutex);
+			ys_pipeline_compiling--;
+		}
+		ys_pipeline_done_cv.notify_all();
+	}
+}
+
+
+// Blocks until every requested variant has been compiled.
+static void
+ys_pipeline_wait_all()
+{
+	std::unique_lock<std::mutex> lock(ys_pipeline_mutex);
+	ys_pipeline_done_cv.wait(lock, []{
+		return ys_pipeline_queue.empty() && ys_pipeline_compiling == 0;
+	});
+}
+
+
+static void
+ys_pipeline_init()
+{
+	ys_pipeline_quit = false;
+	for (uint32_t i = 0; i < ys_pipeline_thread_count; ++i)
+		ys_pipeline_threads.push_back(std::thread(ys_pipeline_worker));
+}
+
+
+// Finishes the queued compilations and destroys every registered pipeline.
+static void
+ys_pipeline_shutdown()
+{
+	{
+		std::lock_guard<std::mutex> lock(ys_pipeline_mutex);
+		ys_pipeline_quit = true;
+	}
+	ys_pipeline_cv.notify_all();
+
+	for (std::thread& thread : ys_pipeline_threads)
+		thread.join();
+	ys_pipeline_threads.clear();
+
+	for (auto& it : ys_pipelines)
+	{
+		vkDestroyPipeline(vk_device, it.second->pipeline, nullptr);
+		delete it.second;
+	}
+	ys_pipelines.clear();
+	ys_default_pipeline = nullptr;
+	vk_pipeline = VK_NULL_HANDLE;
+}
+
+
+// Reads the cache file into data, which is left empty when the file is missing
+// or was written by another driver or device.
+static void
+vk_pipeline_cache_load(std::vector<char>& data)
+{
+	data.clear();
+
+	std::ifstream file(vk_pipeline_cache_path, std::ios::binary | std::ios::ate);
+	if (!file.is_open())
+		return;
+
+	std::streamoff size = file.tellg();
+	file.seekg(0);
+
+	// NOTE: Header layout is given by VK_PIPELINE_CACHE_HEADER_VERSION_ONE:
+	//		 length, version, vendorID, deviceID, pipelineCacheUUID.
+	uint32_t header[4];
+	uint8_t uuid[VK_UUID_SIZE];
+	const std::streamoff header_size = sizeof(header) + VK_UUID_SIZE;
+
+	bool valid = (size >= header_size);
+	if (valid)
+	{
+		file.read((char*)header, sizeof(header));
+		file.read((char*)uuid, VK_UUID_SIZE);
+		valid = file.good() &&
+			header[0] >= header_size && header[0] <= size &&
+			header[1] == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+			header[2] == vk_gpu_properties.vendorID &&
+			header[3] == vk_gpu_properties.deviceID &&
+			!memcmp(uuid, vk_gpu_properties.pipelineCacheUUID, VK_UUID_SIZE);
+	}
+
+	if (!valid)
+	{
+		std::cout << "[PIPELINE CACHE] " << vk_pipeline_cache_path 
+			<< " is stale or corrupt, discarded" << std::endl;
+		return;
+	}
+
+	data.resize((size_t)size);
+	file.seekg(0);
+	file.read(data.data(), size);
+	if (!file.good())
+		data.clear();
+}
+
+
+// Writes the cache next to its destination first, then moves it in place so
+// that an interrupted write never leaves a truncated cache behind.
+static void
+vk_pipeline_cache_save()
+{
+	VkResult error;
+
+	size_t size = 0;
+	error = vkGetPipelineCacheData(vk_device, vk_pipeline_cache, &size, nullptr);
+	assert(!error);
+
+	std::vector<char> data(size);
+	error = vkGetPipelineCacheData(vk_device, vk_pipeline_cache, &size, data.data());
+	assert(!error);
+
+	std::string temp_path = vk_pipeline_cache_path + ".tmp";
+	{
+		std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+		file.write(data.data(), size);
+		file.flush();
+		if (!file.good())
+		{
+			std::cout << "[PIPELINE CACHE] Failed to write " << temp_path << std::endl;
+			return;
+		}
+	}
+
+#ifdef VK_USE_PLATFORM_WIN32_KHR
+	bool moved = MoveFileExA(temp_path.c_str(), vk_pipeline_cache_path.c_str(),
+							 MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	bool moved = rename(temp_path.c_str(), vk_pipeline_cache_path.c_str()) == 0;
+#endif
+	if (!moved)
+	{
+		std::cout << "[PIPELINE CACHE] Failed to replace " 
+			<< vk_pipeline_cache_path << std::endl;
+		remove(temp_path.c_str());
+		return;
+	}
+
+	std::cout << "[PIPELINE CACHE] Saved " << size << " bytes to "
+		<< vk_pipeline_cache_path << std::endl;
+}
+
+
+static void
+vk_shutdown()
+{
+	ys_job_wait(&ys_simulate_counter);
+	vkDeviceWaitIdle(vk_device);
+
+	// NOTE: Queued descriptions are still compiled on shutdown, the render
+	//		 passes and shaders they refer to are destroyed afterwards. Saved
+	//		 once the compilations are done, so that the cache holds every
+	//		 variant.
+	ys_pipeline_shutdown();
+	vk_pipeline_cache_save();
+
+	for (uint32_t i = 0; i < vk_frames_in_flight; ++i)
+	{
+		vkDestroyFence(vk_device, vk_frames[i].fence, nullptr);
+		vkDestroySemaphore(vk_device, vk_frames[i].image_acquired, nullptr);
+		vkDestroySemaphore(vk_device, vk_frames[i].render_complete, nullptr);
+		if (vk_frames[i].compute_done != VK_NULL_HANDLE)
+			vkDestroySemaphore(vk_device, vk_frames[i].compute_done, nullptr);
+		if (vk_frames[i].timestamps != VK_NULL_HANDLE)
+			vkDestroyQueryPool(vk_device, vk_frames[i].timestamps, nullptr);
+	}
+	delete[] vk_frames;
+
+	vk_completed_serial = vk_frame_serial;
+	vk_collect_retired_objects();
+
+	vk_frame_graph_destroy(vk_frame_graph, vk_frame_graph_memory);
+	for (auto& entry : vk_render_passes)
+		vkDestroyRenderPass(vk_device, entry.second, nullptr);
+	vk_render_passes.clear();
+
+	vk_destroy_swapchain_buffers(vk_swapchain_buffers, vk_swapchain_image_count);
+	if (!vk_headless)
+		fp.DestroySwapchainKHR(vk_device, vk_swapchain, nullptr);
+	delete[] vk_queue_props;
+
+	ys_buffer_free(ys_cube_vertex_buffer);
+	ys_buffer_free(ys_cube_index_buffer);
+	ys_buffer_free(ys_uniform_ring.buffer);
+	vk_cull_shutdown();
+	vk_record_shutdown();
+	ys_upload_shutdown();
+
+	ys_memory_report();
+	ys_memory_shutdown();
+
+	vkDestroyPipelineCache(vk_device, vk_pipeline_cache, nullptr);
+	for (auto& entry : vk_shaders)
+		vkDestroyShaderModule(vk_device, entry.second, nullptr);
+	vk_shaders.clear();
+
+	vkDestroyCommandPool(vk_device, vk_cmd_pool, nullptr);
+	if (vk_compute_cmd_pool != VK_NULL_HANDLE)
+		vkDestroyCommandPool(vk_device, vk_compute_cmd_pool, nullptr);
+	vkDestroyDevice(vk_device, nullptr);
+
+	if (vk_validate)
+		fp.DestroyDebugReportCallbackEXT(vk_instance, 
+										 vk_debug_callback, nullptr);
+
+	if (!vk_headless)
+		vkDestroySurfaceKHR(vk_instance, vk_surface, nullptr);
+	vkDestroyInstance(vk_instance, nullptr);
+
+	// NOTE: Written last, every other thread has been joined or is an idle job
+	//		 worker by now.
+#ifdef YS_PROFILER_ENABLED
+	if (!ys_trace_path.empty())
+	{
+		if (ys_profiler_write_trace(ys_trace_path.c_str()))
+			std::cout << "[PROFILER] Trace written to " << ys_trace_path << std::endl;
+		else
+			std::cout << "[PROFILER] Failed to write " << ys_trace_path << std::endl;
+	}
+#else
+	if (!ys_trace_path.empty())
+		std::cout << "[PROFILER] Built without YS_PROFILER_ENABLED, no trace written" 
+			<< std::endl;
+#endif
+}
+
+
+static void
+vk_record_command_buffer(SwapchainBuffer& buffer)
+{
+	YS_PROFILE_FUNCTION();
+	// NEXT: use vertex and index buffer to draw a cube, then actually use the cmd buffer
+	VkResult error;
+
+	{
+		VkCommandBufferInheritanceInfo inherit_info;
+		inherit_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+		inherit_info.pNext = nullptr;
+		inherit_info.renderPass = VK_NULL_HANDLE;
+		inherit_info.subpass = 0;
+		inherit_info.framebuffer = VK_NULL_HANDLE;
+		inherit_info.occlusionQueryEnable = VK_FALSE;
+		inherit_info.queryFlags = 0;
+		inherit_info.pipelineStatistics = 0;
+		VkCommandBufferBeginInfo begin_info;
+		begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		begin_info.pNext = nullptr;
+		begin_info.flags = 0;
+		begin_info.pInheritanceInfo = &inherit_info;
+
+		error = vkBeginCommandBuffer(buffer.cmd, &begin_info);
+		assert(!error);
+	}
+
+	if (vk_timestamps_enabled)
+	{
+		vkCmdResetQueryPool(buffer.cmd, vk_frames[vk_frame_index].timestamps, 
+							0, YS_TIMESTAMP_ASYNC_BEGIN);
+		vk_write_timestamp(buffer.cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+						   YS_TIMESTAMP_FRAME_BEGIN);
+	}
+
+	// NOTE: Secondaries are recorded first, they write the instance data read
+	//		 by the cull pass.
+	vk_record_secondaries(buffer);
+
+	// NOTE: Swapchain contents are discarded every frame. The acquire semaphore
+	//		 is waited at COLOR_ATTACHMENT_OUTPUT, offscreen images only have
+	//		 to wait for the readback of their previous frame.
+	ys_barrier_discard(buffer.state, 
+					   vk_headless ? 0 : VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+
+	// NOTE: The async passes go first, the main queue waits for them at
+	//		 vk_frame_graph.async_wait_stages, see vk_draw.
+	FrameSync& frame = vk_frames[vk_frame_index];
+	frame.compute_recorded = (vk_frame_graph.async_wait_stages != 0);
+	if (frame.compute_recorded)
+	{
+		VkCommandBufferBeginInfo begin_info;
+		begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		begin_info.pNext = nullptr;
+		begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		begin_info.pInheritanceInfo = nullptr;
+
+		error = vkBeginCommandBuffer(frame.compute_cmd, &begin_info);
+		assert(!error);
+
+		if (vk_async_timestamps_enabled)
+		{
+			vkCmdResetQueryPool(frame.compute_cmd, frame.timestamps, YS_TIMESTAMP_ASYNC_BEGIN,
+								YS_TIMESTAMP_COUNT - YS_TIMESTAMP_ASYNC_BEGIN);
+			vkCmdWriteTimestamp(frame.compute_cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+								frame.timestamps, YS_TIMESTAMP_ASYNC_BEGIN);
+		}
+
+		ys_graph_execute(vk_frame_graph, frame.compute_cmd, YS_GRAPH_QUEUE_ASYNC_COMPUTE, 
+						 buffer.index, vk_frame_index);
+
+		if (vk_async_timestamps_enabled)
+			vkCmdWriteTimestamp(frame.compute_cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+								frame.timestamps, YS_TIMESTAMP_ASYNC_END);
+
+		error = vkEndCommandBuffer(frame.compute_cmd);
+		assert(!error);
+	}
+
+	ys_graph_execute(vk_frame_graph, buffer.cmd, YS_GRAPH_QUEUE_MAIN, 
+					 buffer.index, vk_frame_index);
+
+	vk_write_timestamp(buffer.cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+					   YS_TIMESTAMP_PRESENT_BARRIER_END);
+
+	error = vkEndCommandBuffer(buffer.cmd);
+	assert(!error);
+}
+
+
+// NOTE: The main queue queries are reset after the async submission, the
+//		 async cull leaves YS_TIMESTAMP_CULL_END to vk_graph_main.
+static void
+vk_graph_cull(YsGraph& graph, uint32_t pass, VkCommandBuffer cmd, void*)
+{
+	vk_record_cull(cmd);
+	if (graph.passes[pass].queue == YS_GRAPH_QUEUE_MAIN)
+		vk_write_timestamp(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, YS_TIMESTAMP_CULL_END);
+}
+
+
+// Draws the secondary command buffers recorded by vk_record_secondaries.
+static void
+vk_graph_main(YsGraph& graph, uint32_t pass, VkCommandBuffer cmd, void*)
+{
+	if (vk_graph_cull_pass == UINT32_MAX || graph.passes[vk_graph_cull_pass].culled ||
+		graph.passes[vk_graph_cull_pass].queue != YS_GRAPH_QUEUE_MAIN)
+		vk_write_timestamp(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, YS_TIMESTAMP_CULL_END);
+	vk_write_timestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, YS_TIMESTAMP_BARRIER_END);
+
+	if (vk_gpu_cull && !ys_instance_objects.empty())
+	{
+		ys_barrier_check(ys_cull_commands[vk_frame_index].state, YS_USAGE_INDIRECT_BUFFER);
+		ys_barrier_check(ys_cull_instances[vk_frame_index].state, YS_USAGE_VERTEX_BUFFER);
+	}
+
+	ys_graph_begin_render_pass(graph, pass, cmd, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+	// EXECUTE SECONDARY COMMAND BUFFERS
+	{
+		std::vector<VkCommandBuffer> secondaries(vk_record_used_threads);
+		for (uint32_t i = 0; i < vk_record_used_threads; ++i)
+			secondaries[i] = vk_record_contexts[i].cmds[vk_frame_index];
+
+		vkCmdExecuteCommands(cmd, vk_record_used_threads, secondaries.data());
+	}
+
+	vkCmdEndRenderPass(cmd);
+	vk_write_timestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+					   YS_TIMESTAMP_RENDER_PASS_END);
+}
+
+
+// Splits the instances between the recording jobs and waits for all of
+// them. Returns the number of secondary command buffers recorded.
+static uint32_t
+vk_record_secondaries(const SwapchainBuffer& buffer)
+{
+	uint32_t instance_count = (uint32_t)ys_instance_objects.size();
+
+	uint32_t used_threads = 
+		(instance_count + vk_record_min_instances - 1) / vk_record_min_instances;
+	if (used_threads > vk_record_active_threads)
+		used_threads = vk_record_active_threads;
+	if (used_threads == 0)
+		used_threads = 1;
+
+	// NOTE: Constants and instance data are allocated here once for the whole
+	//		 frame, each thread then writes the instances it draws.
+	{
+		YsFrameConstants* p_frame = (YsFrameConstants*)
+			ys_uniform_alloc(sizeof(YsFrameConstants), &vk_record_frame_offset);
+		p_frame->view_projection = ys_mat4_multiply(ys_matrix_projection, ys_matrix_view);
+		if (ys_cpu_cull)
+			ys_frustum_from_view_projection(p_frame->view_projection, ys_record_frustum);
+
+		vk_record_instance_data = (YsInstanceData*)
+			ys_uniform_alloc(sizeof(YsInstanceData) * instance_count, 
+							 &vk_record_instance_offset);
+	}
+
+	uint32_t first_instance = 0;
+	for (uint32_t i = 0; i < used_threads; ++i)
+	{
+		uint32_t count = instance_count / used_threads + 
+			((i < instance_count % used_threads) ? 1 : 0);
+		vk_record_contexts[i].first_instance = first_instance;
+		vk_record_contexts[i].instance_count = count;
+		first_instance += count;
+	}
+
+	vk_record_target = &buffer;
+	vk_record_used_threads = used_threads;
+
+	YsJobCounter counter;
+	for (uint32_t i = 1; i < used_threads; ++i)
+		ys_job_run(vk_record_job, nullptr, i, i + 1, &counter);
+
+	vk_record_secondary(vk_record_contexts[0], buffer);
+	ys_job_wait(&counter);
+
+	return used_threads;
+}
+
+
+static void
+vk_record_secondary(YsRecordContext& context, const SwapchainBuffer& buffer)
+{
+	YS_PROFILE_FUNCTION();
+	VkResult error;
+
+	VkCommandBuffer cmd = context.cmds[vk_frame_index];
+
+	// NOTE: The pool of this frame slot was last used by the frame whose fence
+	//		 has just been waited on.
+	error = vkResetCommandPool(vk_device, context.pools[vk_frame_index], 0);
+	assert(!error);
+
+	{
+		VkCommandBufferInheritanceInfo inherit_info;
+		inherit_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+		inherit_info.pNext = nullptr;
+		inherit_info.renderPass = vk_render_pass;
+		inherit_info.subpass = 0;
+		inherit_info.framebuffer = 
+			ys_graph_framebuffer(vk_frame_graph, vk_graph_main_pass, buffer.index);
+		inherit_info.occlusionQueryEnable = VK_FALSE;
+		inherit_info.queryFlags = 0;
+		inherit_info.pipelineStatistics = 0;
+		VkCommandBufferBeginInfo begin_info;
+		begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		begin_info.pNext = nullptr;
+		begin_info.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT |
+						   VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		begin_info.pInheritanceInfo = &inherit_info;
+
+		error = vkBeginCommandBuffer(cmd, &begin_info);
+		assert(!error);
+	}
+
+	// NOTE: The draws span from the start of the first secondary command buffer
+	//		 to the end of the last one.
+	uint32_t context_index = (uint32_t)(&context - vk_record_contexts);
+	if (context_index == 0)
+		vk_write_timestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 
+						   YS_TIMESTAMP_DRAWS_BEGIN);
+
+	{
+		VkViewport viewport;
+		viewport.x = 0.f;
+		viewport.y = 0.f;
+		viewport.width = (float)win_width;
+		viewport.height = (float)win_height;
+		viewport.minDepth = 0.f;
+		viewport.maxDepth = 1.f;
+
+		vkCmdSetViewport(cmd, 0, 1, &viewport);
+	}
+
+	{
+		VkRect2D scissor;
+		scissor.offset.x = 0;
+		scissor.offset.y = 0;
+		scissor.extent.width = win_width;
+		scissor.extent.height = win_height;
+
+		vkCmdSetScissor(cmd, 0, 1, &scissor);
+	}
+
+	uint32_t first_instance = context.first_instance;
+	uint32_t end_instance = context.first_instance + context.instance_count;
+
+	// BIND INSTANCE BUFFER
+	{
+		// NOTE: Draws address their instances with firstInstance, relative to
+		//		 the start of this frame's instance data, or of the culled
+		//		 instances.
+		if (vk_gpu_cull)
+		{
+			VkDeviceSize offset = 0;
+			vkCmdBindVertexBuffers(cmd, 1, 1, &ys_cull_instances[vk_frame_index].buffer, 
+								   &offset);
+		}
+		else
+		{
+			VkDeviceSize offset = vk_record_instance_offset;
+			vkCmdBindVertexBuffers(cmd, 1, 1, &ys_uniform_ring.buffer.buffer, &offset);
+		}
+	}
+
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+							vk_pipeline_layout, 0, 1, &vk_descriptor_set,
+							1, &vk_record_frame_offset);
+
+	// DRAW BATCHES
+	if (first_instance < end_instance)
+	{
+		// NOTE: Batch ranges may straddle two threads, each one draws its part.
+		std::vector<YsDrawBatch>::const_iterator batch = std::upper_bound(
+			ys_draw_batches.begin(), ys_draw_batches.end(), first_instance,
+			[](uint32_t instance, const YsDrawBatch& batch) {
+				return instance < batch.first_instance;
+			}) - 1;
+
+		VkPipeline bound_pipeline = VK_NULL_HANDLE;
+		const YsMesh* bound_mesh = nullptr;
+
+		for (; batch != ys_draw_batches.end() && batch->first_instance < end_instance;
+			 ++batch)
+		{
+			VkPipeline pipeline = ys_pipeline_get(batch->pipeline);
+			if (pipeline != bound_pipeline)
+			{
+				vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+				bound_pipeline = pipeline;
+			}
+
+			if (batch->mesh != bound_mesh)
+			{
+				VkDeviceSize offset = 0;
+				vkCmdBindVertexBuffers(cmd, 0, 1, &batch->mesh->vertex_buffer->buffer, 
+									   &offset);
+				vkCmdBindIndexBuffer(cmd, batch->mesh->index_buffer->buffer, 0, 
+									 VK_INDEX_TYPE_UINT32);
+				bound_mesh = batch->mesh;
+			}
+
+			uint32_t begin = std::max(batch->first_instance, first_instance);
+			uint32_t end = std::min(batch->first_instance + batch->instance_count,
+									end_instance);
+			uint32_t batch_index = (uint32_t)(batch - ys_draw_batches.begin());
+
+			// NOTE: Without CPU culling every instance is visible and written
+			//		 in place, otherwise the visible ones are packed at the start
+			//		 of the range.
+			uint32_t draw_count = end - begin;
+			const uint32_t* visible = nullptr;
+			if (ys_cpu_cull)
+			{
+				for (uint32_t i = begin; i < end; ++i)
+				{
+					const YsObject& object = ys_objects[ys_instance_objects[i]];
+					const float* m = ys_transform_world(ys_transforms, object.transform).m;
+					float scale = std::max(m[0] * m[0] + m[1] * m[1] + m[2] * m[2],
+										   std::max(m[4] * m[4] + m[5] * m[5] + m[6] * m[6],
+													m[8] * m[8] + m[9] * m[9] + m[10] * m[10]));
+					ys_bounding_sphere_set(ys_cull_bounds, i, m[12], m[13], m[14],
+										   object.mesh->radius * sqrtf(scale));
+				}
+
+				visible = &ys_cull_visible[begin];
+				draw_count = ys_cull_spheres(ys_record_frustum, ys_cull_bounds, begin,
+											 end - begin, &ys_cull_visible[begin]);
+			}
+
+			// WRITE INSTANCE DATA
+			for (uint32_t slot = 0; slot < draw_count; ++slot)
+			{
+				uint32_t i = visible ? visible[slot] : begin + slot;
+				const YsObject& object = ys_objects[ys_instance_objects[i]];
+				YsInstanceData& instance = vk_record_instance_data[begin + slot];
+				instance.world = ys_transform_world(ys_transforms, object.transform);
+				instance.material = object.material;
+				instance.batch = batch_index;
+				instance.radius = object.mesh->radius;
+			}
+
+			// NOTE: With GPU culling the instance count is only known on the
+			//		 GPU, a batch is drawn whole by the thread it starts in.
+			if (vk_gpu_cull)
+			{
+				if (batch->first_instance >= first_instance)
+					vkCmdDrawIndexedIndirect(cmd, ys_cull_commands[vk_frame_index].buffer, 
+						batch_index * sizeof(VkDrawIndexedIndirectCommand), 1,
+						sizeof(VkDrawIndexedIndirectCommand));
+			}
+			else if (draw_count > 0)
+			{
+				vkCmdDrawIndexed(cmd, batch->mesh->index_buffer->value_count, 
+								 draw_count, 0, 0, begin);
+			}
 		}
-
-		delete[] swapchain_images;
 	}
 
-	// CREATE DEPTH BUFFER
-	{
-		VkFormat			depth_format = VK_FORMAT_D16_UNORM;
-		vk_depth_buffer.format = depth_format;
-
-		VkImageCreateInfo	image_info;
-		image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-		image_info.pNext = nullptr;
-		image_info.flags = 0;
-		image_info.imageType = VK_IMAGE_TYPE_2D;
-		image_info.format = depth_format;
-		image_info.extent = { win_width, win_height, 1 };
-		image_info.mipLevels = 1;
-		image_info.arrayLayers = 1;
-		image_info.samples = VK_SAMPLE_COUNT_1_BIT;
-		image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
-		image_info.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
-		image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-		image_info.queueFamilyIndexCount = 0;
-		image_info.pQueueFamilyIndices = nullptr;
-		// NOTE: There might be some better options out there
-		image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED; 
+	if (context_index + 1 == vk_record_used_threads)
+		vk_write_timestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 
+						   YS_TIMESTAMP_DRAWS_END);
 
-		error = vkCreateImage(vk_device, &image_info, nullptr, &vk_depth_buffer.image);
-		assert(!error);
+	error = vkEndCommandBuffer(cmd);
+	assert(!error);
+}
 
-		VkMemoryRequirements image_mem_reqs;
-		vkGetImageMemoryRequirements(vk_device, vk_depth_buffer.image, &image_mem_reqs);
-
-		// DEPTH BUFFER MEMORY ALLOCATION
-		vk_depth_buffer.mem_alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-		vk_depth_buffer.mem_alloc_info.pNext = nullptr;
-		vk_depth_buffer.mem_alloc_info.allocationSize = image_mem_reqs.size;
-		vk_depth_buffer.mem_alloc_info.memoryTypeIndex =
-			vk_get_memory_type_index(vk_memory_properties,
-									 image_mem_reqs.memoryTypeBits,
-									 0);
-		assert(vk_depth_buffer.mem_alloc_info.memoryTypeIndex != UINT32_MAX);
-
-		error = vkAllocateMemory(vk_device, &vk_depth_buffer.mem_alloc_info,
-								 nullptr, &vk_depth_buffer.memory);
-		assert(!error);
 
-		error = vkBindImageMemory(vk_device, vk_depth_buffer.image, 
-								  vk_depth_buffer.memory, 0);
-		assert(!error);
+static void
+vk_record_job(void*, uint32_t begin, uint32_t end)
+{
+	for (uint32_t i = begin; i < end; ++i)
+		vk_record_secondary(vk_record_contexts[i], *vk_record_target);
+}
 
-		vk_set_image_layout(vk_depth_buffer.image, VK_IMAGE_ASPECT_DEPTH_BIT,
-							VK_IMAGE_LAYOUT_UNDEFINED,
-							VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
-							(VkAccessFlagBits)0);
 
-		VkImageViewCreateInfo	view_info;
-		view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-		view_info.pNext = nullptr;
-		view_info.flags = 0;
-		view_info.image = vk_depth_buffer.image;
-		view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
-		view_info.format = depth_format;
-		view_info.components = {
-			VK_COMPONENT_SWIZZLE_IDENTITY,
-			VK_COMPONENT_SWIZZLE_IDENTITY,
-			VK_COMPONENT_SWIZZLE_IDENTITY,
-			VK_COMPONENT_SWIZZLE_IDENTITY
-		};
-		view_info.subresourceRange = { 
-			VK_IMAGE_ASPECT_DEPTH_BIT,
-			0, 1, 0, 1
-		};
+static void
+vk_record_init()
+{
+	VkResult error;
 
-		error = vkCreateImageView(vk_device, &view_info, nullptr, 
-								  &vk_depth_buffer.view);
-		assert(!error);
-	}
+	if (vk_record_thread_count == 0)
+		vk_record_thread_count = ys_job_thread_count();
+	vk_record_active_threads = vk_record_thread_count;
 
-	// CREATE SWAPCHAIN CMD BUFFERS
+	vk_record_contexts = new YsRecordContext[vk_record_thread_count];
+	for (uint32_t i = 0; i < vk_record_thread_count; ++i)
 	{
-		VkCommandBufferAllocateInfo cmd_info;
-		cmd_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-		cmd_info.pNext = nullptr;
-		cmd_info.commandPool = vk_cmd_pool;
-		cmd_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-		cmd_info.commandBufferCount = 1;
-	
-		for (uint32_t i = 0; i < vk_swapchain_image_count; ++i)
+		YsRecordContext& context = vk_record_contexts[i];
+		context.pools = new VkCommandPool[vk_frames_in_flight];
+		context.cmds = new VkCommandBuffer[vk_frames_in_flight];
+		context.first_instance = 0;
+		context.instance_count = 0;
+
+		for (uint32_t f = 0; f < vk_frames_in_flight; ++f)
 		{
-			error = vkAllocateCommandBuffers(vk_device, &cmd_info,
-											&vk_swapchain_buffers[i].cmd);
+			VkCommandPoolCreateInfo cmd_pool_info;
+			cmd_pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+			cmd_pool_info.pNext = nullptr;
+			cmd_pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+			cmd_pool_info.queueFamilyIndex = vk_elected_queue_index;
+
+			error = vkCreateCommandPool(vk_device, &cmd_pool_info, nullptr, 
+										&context.pools[f]);
 			assert(!error);
-		}
-	}
 
-	// CREATE UNIFORM BUFFER
-	{
-		YsBuffer&			ys_buffer_handl = ys_matrix_buffer;
-		uint32_t			value_count = 16 * 3;
-		VkDeviceSize		buffer_size = value_count * sizeof(float);
-		VkBufferUsageFlags	buffer_usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+			VkCommandBufferAllocateInfo cmd_info;
+			cmd_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			cmd_info.pNext = nullptr;
+			cmd_info.commandPool = context.pools[f];
+			cmd_info.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+			cmd_info.commandBufferCount = 1;
 
-		ys_buffer_allocate(ys_buffer_handl, buffer_size, buffer_usage);
-		ys_buffer_handl.value_count = value_count;
+			error = vkAllocateCommandBuffers(vk_device, &cmd_info, &context.cmds[f]);
+			assert(!error);
+		}
 	}
+}
 
-	// SET BUFFER TO ZERO
-	{
-		uint8_t* p_data;
-		error = vkMapMemory(vk_device, ys_matrix_buffer.memory, 0,
-							VK_WHOLE_SIZE, 0,
-							(void**)&p_data);
-		assert(!error);
-
-		memset(p_data, 0, ys_matrix_buffer.size);
-
-		vkUnmapMemory(vk_device, ys_matrix_buffer.memory);
-	}
 
-	// NOTE: This part will eventually move out in a transform utility function
+static void
+vk_record_shutdown()
+{
+	for (uint32_t i = 0; i < vk_record_thread_count; ++i)
 	{
-		YsBuffer&		ys_buffer_handl = ys_matrix_buffer;
-		VkDeviceSize	matrix_size = 16 * sizeof(float);
-
-		void*			p_host_memory = ys_cube_world;
-		ys_buffer_set(ys_buffer_handl, p_host_memory, matrix_size, 0);
-		
-		p_host_memory = ys_matrix_view;
-		ys_buffer_set(ys_buffer_handl, p_host_memory, matrix_size, matrix_size);
-
-		ys_compute_perspective(ys_matrix_projection, 0.1f, 1000.f, 90.f, 800.f/600.f);
-		p_host_memory = ys_matrix_projection;
-		ys_buffer_set(ys_buffer_handl, p_host_memory, matrix_size, matrix_size * 2);
+		YsRecordContext& context = vk_record_contexts[i];
+		for (uint32_t f = 0; f < vk_frames_in_flight; ++f)
+			vkDestroyCommandPool(vk_device, context.pools[f], nullptr);
+		delete[] context.pools;
+		delete[] context.cmds;
 	}
+	delete[] vk_record_contexts;
 }
 
 
+// Creates the cull compute pipeline. The buffers depend on the draw batches
+// and are created by vk_cull_prepare.
 static void
-vk_prepare_pipeline()
+vk_cull_init()
 {
 	VkResult error;
 
+	if (!(vk_queue_props[vk_elected_queue_index].queueFlags & VK_QUEUE_COMPUTE_BIT) &&
+		vk_compute_queue == VK_NULL_HANDLE)
+	{
+		std::cout << "[CULL] Queue has no compute support, GPU culling disabled" 
+			<< std::endl;
+		vk_gpu_cull = false;
+	}
+	if (!vk_gpu_cull)
+		return;
+
 	// DESCRIPTOR SET LAYOUT
 	{
-		VkDescriptorSetLayoutBinding layout_bindings[2];
-		layout_bindings[0].binding = 0;
-		layout_bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-		layout_bindings[0].descriptorCount = 1;
-		layout_bindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-		layout_bindings[0].pImmutableSamplers = nullptr;
+		// NOTE: Binding 0 reads the instances of the frame from ys_uniform_ring,
+		//		 binding 1 receives the survivors and binding 2 holds the
+		//		 indirect commands.
+		VkDescriptorSetLayoutBinding layout_bindings[3];
+		for (uint32_t i = 0; i < 3; ++i)
+		{
+			layout_bindings[i].binding = i;
+			layout_bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			layout_bindings[i].descriptorCount = 1;
+			layout_bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+			layout_bindings[i].pImmutableSamplers = nullptr;
+		}
+		layout_bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
 
-		// NOTE: This one is unused
-		layout_bindings[1].binding = 1;
-		layout_bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-		layout_bindings[1].descriptorCount = 1;
-		layout_bindings[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-		layout_bindings[1].pImmutableSamplers = nullptr;
-	
 		VkDescriptorSetLayoutCreateInfo desc_layout_info;
 		desc_layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
 		desc_layout_info.pNext = nullptr;
 		desc_layout_info.flags = 0;
-		desc_layout_info.bindingCount = 1;
+		desc_layout_info.bindingCount = 3;
 		desc_layout_info.pBindings = layout_bindings;
 
 		error = vkCreateDescriptorSetLayout(vk_device, &desc_layout_info,
-											nullptr, &vk_desc_set_layout);
+											nullptr, &vk_cull_desc_set_layout);
 		assert(!error);
 
-		// NOTE: vk_pipeline_layout is not used before the pipeline creation,
-		//		 so it could be created later.
+		VkPushConstantRange push_range;
+		push_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		push_range.offset = 0;
+		push_range.size = sizeof(YsCullConstants);
+
 		VkPipelineLayoutCreateInfo pipeline_layout_info;
 		pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
 		pipeline_layout_info.pNext = nullptr;
 		pipeline_layout_info.flags = 0;
 		pipeline_layout_info.setLayoutCount = 1;
-		pipeline_layout_info.pSetLayouts = &vk_desc_set_layout;
-		pipeline_layout_info.pushConstantRangeCount = 0;
-		pipeline_layout_info.pPushConstantRanges = nullptr;
+		pipeline_layout_info.pSetLayouts = &vk_cull_desc_set_layout;
+		pipeline_layout_info.pushConstantRangeCount = 1;
+		pipeline_layout_info.pPushConstantRanges = &push_range;
 
 		error = vkCreatePipelineLayout(vk_device, &pipeline_layout_info, nullptr,
-									   &vk_pipeline_layout);
+									   &vk_cull_pipeline_layout);
 		assert(!error);
 	}
 
-	// CREATE DESCRIPTOR POOL
+	// DESCRIPTOR SETS
+	// NOTE: One per frame in flight, pointing at the outputs of that slot.
 	{
 		VkDescriptorPoolSize desc_counts[2];
-		desc_counts[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-		desc_counts[0].descriptorCount = 1;
-
-		// NOTE: No image sampling for now.
-		desc_counts[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-		desc_counts[1].descriptorCount = 1;
+		desc_counts[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+		desc_counts[0].descriptorCount = vk_frames_in_flight;
+		desc_counts[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		desc_counts[1].descriptorCount = 2 * vk_frames_in_flight;
 
 		VkDescriptorPoolCreateInfo desc_pool_info;
 		desc_pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
 		desc_pool_info.pNext = nullptr;
 		desc_pool_info.flags = 0;
-		desc_pool_info.maxSets = 1;
-		desc_pool_info.poolSizeCount = 1;
+		desc_pool_info.maxSets = vk_frames_in_flight;
+		desc_pool_info.poolSizeCount = 2;
 		desc_pool_info.pPoolSizes = desc_counts;
 
 		error = vkCreateDescriptorPool(vk_device, &desc_pool_info, nullptr,
-									   &vk_descriptor_pool);
+									   &vk_cull_descriptor_pool);
 		assert(!error);
-	}
 
-	// ALLOCATE DESCRIPTOR SET
-	{
+		VkDescriptorSetLayout set_layouts[YS_MAX_FRAMES_IN_FLIGHT];
+		for (uint32_t i = 0; i < vk_frames_in_flight; ++i)
+			set_layouts[i] = vk_cull_desc_set_layout;
+
 		VkDescriptorSetAllocateInfo alloc_info;
 		alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
 		alloc_info.pNext = nullptr;
-		alloc_info.descriptorPool = vk_descriptor_pool;
-		alloc_info.descriptorSetCount = 1;
-		alloc_info.pSetLayouts = &vk_desc_set_layout;
-		
-		error = vkAllocateDescriptorSets(vk_device, &alloc_info, 
-										 &vk_descriptor_set);
-		assert(!error);
-
-		// NOTE: See cube:demo_prepare_descriptor_set:1737 for texture handling.
-		VkDescriptorBufferInfo buffer_desc_info;
-		buffer_desc_info.buffer = ys_matrix_buffer.buffer;
-		buffer_desc_info.offset = 0;
-		buffer_desc_info.range = VK_WHOLE_SIZE;
-		VkWriteDescriptorSet desc_set_writes[1];
-		desc_set_writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		desc_set_writes[0].pNext = nullptr;
-		desc_set_writes[0].dstSet = vk_descriptor_set;
-		desc_set_writes[0].dstBinding = 0;
-		desc_set_writes[0].dstArrayElement = 0;
-		desc_set_writes[0].descriptorCount = 1;
-		// NOTE: Remember to look into VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC
-		desc_set_writes[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-		desc_set_writes[0].pImageInfo = nullptr;
-		desc_set_writes[0].pBufferInfo = &buffer_desc_info;
-		desc_set_writes[0].pTexelBufferView = nullptr;
-
-		vkUpdateDescriptorSets(vk_device, 1, desc_set_writes, 0, nullptr);
-	}
+		alloc_info.descriptorPool = vk_cull_descriptor_pool;
+		alloc_info.descriptorSetCount = vk_frames_in_flight;
+		alloc_info.pSetLayouts = set_layouts;
 
-
-	// RENDER PASS
-	{
-		VkAttachmentDescription attachments[2];
-		attachments[0].flags = 0;
-		attachments[0].format = vk_surface_format;
-		attachments[0].samples = VK_SAMPLE_COUNT_1_BIT;
-		attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-		attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-		attachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-		attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-		attachments[0].initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-		attachments[0].finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-		attachments[1].flags = 0;
-		attachments[1].format = vk_depth_buffer.format;
-		attachments[1].samples = VK_SAMPLE_COUNT_1_BIT;
-		attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-		attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-		attachments[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-		attachments[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-		attachments[1].initialLayout = 
-			VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-		attachments[1].finalLayout = 
-			VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-
-		VkAttachmentReference color_reference;
-		color_reference.attachment = 0;
-		color_reference.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-		VkAttachmentReference depth_reference;
-		depth_reference.attachment = 1;
-		depth_reference.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-
-		VkSubpassDescription subpass;
-		subpass.flags = 0;
-		subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-		subpass.inputAttachmentCount = 0;
-		subpass.pInputAttachments = nullptr;
-		subpass.colorAttachmentCount = 1;
-		subpass.pColorAttachments = &color_reference;
-		subpass.pResolveAttachments = nullptr;
-		subpass.pDepthStencilAttachment = &depth_reference;
-		subpass.preserveAttachmentCount = 0;
-		subpass.pPreserveAttachments = nullptr;
-
-		VkRenderPassCreateInfo renderpass_info;
-		renderpass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-		renderpass_info.pNext = nullptr;
-		renderpass_info.flags = 0;
-		renderpass_info.attachmentCount = 2;
-		renderpass_info.pAttachments = attachments;
-		renderpass_info.subpassCount = 1;
-		renderpass_info.pSubpasses = &subpass;
-		renderpass_info.dependencyCount = 0;
-		renderpass_info.pDependencies = nullptr;
-
-		error = vkCreateRenderPass(vk_device, &renderpass_info, nullptr,
-								   &vk_render_pass);
+		error = vkAllocateDescriptorSets(vk_device, &alloc_info, 
+										 vk_cull_descriptor_sets);
 		assert(!error);
 	}
 
-	// CREATE FRAMEBUFFERS
-	{
-		VkImageView attachments[2];
-		attachments[1] = vk_depth_buffer.view;
-
-		VkFramebufferCreateInfo framebuffer_info;
-		framebuffer_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-		framebuffer_info.pNext = nullptr;
-		framebuffer_info.flags = 0;
-		framebuffer_info.renderPass = vk_render_pass;
-		framebuffer_info.attachmentCount = 2;
-		framebuffer_info.pAttachments = attachments;
-		framebuffer_info.width = win_width;
-		framebuffer_info.height = win_height;
-		framebuffer_info.layers = 1;
-
-		for (uint32_t i = 0; i < vk_swapchain_image_count; ++i)
-		{
-			attachments[0] = vk_swapchain_buffers[i].view;
-			error = vkCreateFramebuffer(vk_device, &framebuffer_info, nullptr,
-										&vk_swapchain_buffers[i].framebuffer);
-			assert(!error);
-		}
-	}
-	
-	// PIPELINE
+	// COMPUTE PIPELINE
 	{
-		VkPipelineVertexInputStateCreateInfo	vi_info;
-		VkPipelineInputAssemblyStateCreateInfo	ia_info;
-		VkPipelineViewportStateCreateInfo		vp_info;
-		VkPipelineRasterizationStateCreateInfo	rs_info;
-		VkPipelineMultisampleStateCreateInfo	ms_info;
-		VkPipelineDepthStencilStateCreateInfo	ds_info;
-		VkPipelineColorBlendStateCreateInfo		cb_info;
-		VkPipelineDynamicStateCreateInfo		dy_info;
-
-		VkVertexInputBindingDescription input_binding;
-		input_binding.binding = 0;
-		input_binding.stride = 3 * sizeof(float);
-		input_binding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-		VkVertexInputAttributeDescription input_attribute;
-		input_attribute.location = 0;
-		input_attribute.binding = input_binding.binding;
-		input_attribute.format = VK_FORMAT_R32G32B32_SFLOAT;
-		input_attribute.offset = 0;
-		vi_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-		vi_info.pNext = nullptr;
-		vi_info.flags = 0;
-		vi_info.vertexBindingDescriptionCount = 1;
-		vi_info.pVertexBindingDescriptions = &input_binding;
-		vi_info.vertexAttributeDescriptionCount = 1;
-		vi_info.pVertexAttributeDescriptions = &input_attribute;
-
-		ia_info.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-		ia_info.pNext = nullptr;
-		ia_info.flags = 0;
-		ia_info.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-		ia_info.primitiveRestartEnable = VK_FALSE;
-
-		vp_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-		vp_info.pNext = nullptr;
-		vp_info.flags = 0;
-		vp_info.viewportCount = 1;
-		vp_info.pViewports = nullptr;
-		vp_info.scissorCount = 1;
-		vp_info.pScissors = nullptr;
-
-		// NOTE: There used to be a memset(0) here.
-		rs_info.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-		rs_info.pNext = nullptr;
-		rs_info.flags = 0;
-		rs_info.depthClampEnable = VK_FALSE;
-		rs_info.rasterizerDiscardEnable = VK_FALSE;
-		rs_info.polygonMode = VK_POLYGON_MODE_LINE;
-		rs_info.cullMode = VK_CULL_MODE_NONE;//	VK_CULL_MODE_FRONT_BIT;
-		rs_info.frontFace =	VK_FRONT_FACE_COUNTER_CLOCKWISE;
-		rs_info.depthBiasEnable = VK_FALSE;
-		rs_info.depthBiasConstantFactor = 0.f;
-		rs_info.depthBiasClamp = 0.f;
-		rs_info.depthBiasSlopeFactor = 0.f;
-		rs_info.lineWidth = 1.0f;
-
-		ms_info.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-		ms_info.pNext = nullptr;
-		ms_info.flags = 0;
-		ms_info.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-		ms_info.sampleShadingEnable = VK_FALSE;
-		ms_info.minSampleShading = 0.f;
-		ms_info.pSampleMask = nullptr;
-		ms_info.alphaToCoverageEnable = VK_FALSE;
-		ms_info.alphaToOneEnable = VK_FALSE;
-
-		ds_info.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
-		ds_info.pNext = nullptr;
-		ds_info.flags = 0;
-		ds_info.depthTestEnable = VK_TRUE;
-		ds_info.depthWriteEnable = VK_TRUE;
-		ds_info.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
-		ds_info.depthBoundsTestEnable = VK_FALSE;
-		ds_info.stencilTestEnable = VK_FALSE;
-		ds_info.front.failOp = VK_STENCIL_OP_KEEP;
-		ds_info.front.passOp = VK_STENCIL_OP_KEEP;
-		ds_info.front.compareOp = VK_COMPARE_OP_NEVER;
-		ds_info.front.depthFailOp = VK_STENCIL_OP_KEEP;
-		ds_info.front.compareMask = 0;
-		ds_info.front.writeMask = 0;
-		ds_info.front.reference = 0;
-		ds_info.back = ds_info.front;
-		ds_info.minDepthBounds = 0.f;
-		ds_info.maxDepthBounds = 0.f;
-
-		VkPipelineColorBlendAttachmentState attachment_state;
-		attachment_state.blendEnable = VK_FALSE;
-		attachment_state.srcColorBlendFactor = VK_BLEND_FACTOR_ZERO;
-		attachment_state.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO;
-		attachment_state.colorBlendOp = VK_BLEND_OP_ADD;
-		attachment_state.srcAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
-		attachment_state.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
-		attachment_state.alphaBlendOp = VK_BLEND_OP_ADD;
-		attachment_state.colorWriteMask =
-			VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
-			VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-		cb_info.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-		cb_info.pNext = nullptr;
-		cb_info.flags = 0;
-		cb_info.logicOpEnable = VK_FALSE;
-		cb_info.logicOp = VK_LOGIC_OP_CLEAR;
-		cb_info.attachmentCount = 1;
-		cb_info.pAttachments = &attachment_state;
-		cb_info.blendConstants[0] = 0;
-		cb_info.blendConstants[1] = 0;
-		cb_info.blendConstants[2] = 0;
-		cb_info.blendConstants[3] = 0;
-
-		VkDynamicState dynamic_states[VK_DYNAMIC_STATE_RANGE_SIZE];
-		dynamic_states[0] = VK_DYNAMIC_STATE_VIEWPORT;
-		dynamic_states[1] = VK_DYNAMIC_STATE_SCISSOR;
-		dy_info.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-		dy_info.pNext = nullptr;
-		dy_info.flags = 0;
-		dy_info.dynamicStateCount = 2;
-		dy_info.pDynamicStates = dynamic_states;
-
-		VkPipelineShaderStageCreateInfo pipeline_stages[2];
-		pipeline_stages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-		pipeline_stages[0].pNext = nullptr;
-		pipeline_stages[0].flags = 0;
-		pipeline_stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
-		pipeline_stages[0].module = vk_load_shader("vs_test", 
-												   "Resources/vs_test.spv");
-		pipeline_stages[0].pName = "main";
-		pipeline_stages[0].pSpecializationInfo = nullptr;
-		pipeline_stages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-		pipeline_stages[1].pNext = nullptr;
-		pipeline_stages[1].flags = 0;
-		pipeline_stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-		pipeline_stages[1].module = vk_load_shader("fs_test", 
-												   "Resources/fs_test.spv");
-		pipeline_stages[1].pName = "main";
-		pipeline_stages[1].pSpecializationInfo = nullptr;
-		VkGraphicsPipelineCreateInfo pipeline_info;
-		pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+		VkComputePipelineCreateInfo pipeline_info;
+		pipeline_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
 		pipeline_info.pNext = nullptr;
 		pipeline_info.flags = 0;
-		pipeline_info.stageCount = 2;
-		pipeline_info.pStages = pipeline_stages;
-		pipeline_info.pVertexInputState = &vi_info;
-		pipeline_info.pInputAssemblyState = &ia_info;
-		pipeline_info.pTessellationState = nullptr;
-		pipeline_info.pViewportState = &vp_info;
-		pipeline_info.pRasterizationState = &rs_info;
-		pipeline_info.pMultisampleState = &ms_info;
-		pipeline_info.pDepthStencilState = &ds_info;
-		pipeline_info.pColorBlendState = &cb_info;
-		pipeline_info.pDynamicState = &dy_info;
-		pipeline_info.layout = vk_pipeline_layout;
-		pipeline_info.renderPass = vk_render_pass;
-		pipeline_info.subpass = 0;
+		pipeline_info.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		pipeline_info.stage.pNext = nullptr;
+		pipeline_info.stage.flags = 0;
+		pipeline_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		pipeline_info.stage.module = vk_load_shader("cs_cull", "Resources/cs_cull.spv");
+		pipeline_info.stage.pName = "main";
+		pipeline_info.stage.pSpecializationInfo = nullptr;
+		pipeline_info.layout = vk_cull_pipeline_layout;
 		pipeline_info.basePipelineHandle = VK_NULL_HANDLE;
-		pipeline_info.basePipelineIndex = -1;
-
-		VkPipelineCacheCreateInfo pipeline_cache_info;
-		pipeline_cache_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
-		pipeline_cache_info.pNext = nullptr;
-		pipeline_cache_info.flags = 0;
-		pipeline_cache_info.initialDataSize = 0;
-		pipeline_cache_info.pInitialData = nullptr;
-		error = vkCreatePipelineCache(vk_device, &pipeline_cache_info, nullptr,
-									  &vk_pipeline_cache);
-		assert(!error);
+		pipeline_info.basePipelineIndex = 0;
 
-		error = vkCreateGraphicsPipelines(vk_device, vk_pipeline_cache, 1, 
-										  &pipeline_info, nullptr,
-										  &vk_pipeline);
+		error = vkCreateComputePipelines(vk_device, vk_pipeline_cache, 1, 
+										 &pipeline_info, nullptr, &vk_cull_pipeline);
 		assert(!error);
-
-		// NOTE: Once the graphics pipeline has been created, the shader modules
-		//		 should be destroyable.
-	}
-}
-
-
-static void
-vk_shutdown()
-{
-	for (uint32_t i = 0; i < vk_swapchain_image_count; ++i)
-	{
-		vkDestroyFramebuffer(vk_device, vk_swapchain_buffers[i].framebuffer, nullptr);
 	}
-	
-	delete[] vk_swapchain_buffers;
-	delete[] vk_queue_props;
-
-	vkDestroyCommandPool(vk_device, vk_cmd_pool, nullptr);
-	vkDestroyDevice(vk_device, nullptr);
-
-	if (vk_validate)
-		fp.DestroyDebugReportCallbackEXT(vk_instance, 
-										 vk_debug_callback, nullptr);
-
-	vkDestroySurfaceKHR(vk_instance, vk_surface, nullptr);
-	vkDestroyInstance(vk_instance, nullptr);
 }
 
 
+// (Re)creates the cull buffers of every frame slot for the current batches and
+// points the descriptor sets at them. The device must be idle.
 static void
-vk_record_command_buffer(SwapchainBuffer& buffer)
+vk_cull_prepare()
 {
-	// NEXT: use vertex and index buffer to draw a cube, then actually use the cmd buffer
 	VkResult error;
 
-	{
-		VkCommandBufferInheritanceInfo inherit_info;
-		inherit_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
-		inherit_info.pNext = nullptr;
-		inherit_info.renderPass = VK_NULL_HANDLE;
-		inherit_info.subpass = 0;
-		inherit_info.framebuffer = VK_NULL_HANDLE;
-		inherit_info.occlusionQueryEnable = VK_FALSE;
-		inherit_info.queryFlags = 0;
-		inherit_info.pipelineStatistics = 0;
-		VkCommandBufferBeginInfo begin_info;
-		begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-		begin_info.pNext = nullptr;
-		begin_info.flags = 0;
-		begin_info.pInheritanceInfo = &inherit_info;
+	error = vkDeviceWaitIdle(vk_device);
+	assert(!error);
 
-		error = vkBeginCommandBuffer(buffer.cmd, &begin_info);
-		assert(!error);
-	}
+	uint32_t instance_count = (uint32_t)ys_instance_objects.size();
+	uint32_t batch_count = (uint32_t)ys_draw_batches.size();
+	if (instance_count == 0)
+		return;
 
+	if (ys_cull_instances[0].buffer != VK_NULL_HANDLE)
 	{
-		VkImageMemoryBarrier image_memory_barrier;
-		image_memory_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-		image_memory_barrier.pNext = nullptr;
-		image_memory_barrier.srcAccessMask = 0;
-		image_memory_barrier.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-		image_memory_barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		image_memory_barrier.newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-		image_memory_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-		image_memory_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-		image_memory_barrier.image = buffer.image;
-		image_memory_barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
-
-		vkCmdPipelineBarrier(buffer.cmd, 
-							 VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
-							 VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 
-							 0, nullptr,
-							 0, nullptr,
-							 1, &image_memory_barrier);
+		for (uint32_t i = 0; i < vk_frames_in_flight; ++i)
+		{
+			ys_buffer_free(ys_cull_instances[i]);
+			ys_buffer_free(ys_cull_commands[i]);
+		}
+		ys_buffer_free(ys_cull_command_template);
 	}
 
-	{
-		float clear_color[4] = { 0.2f, 0.2f, 0.2f, 0.2f };
-
-		VkClearValue clear_values[2];
-		memcpy(clear_values[0].color.float32, clear_color, sizeof(float) * 4);
-		clear_values[1].depthStencil = { 1.0f, 0 };
-
-		VkRenderPassBeginInfo begin_info;
-		begin_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-		begin_info.pNext = nullptr;
-		begin_info.renderPass = vk_render_pass;
-		begin_info.framebuffer = buffer.framebuffer;
-		begin_info.renderArea = { {0, 0}, {win_width, win_height} };
-		begin_info.clearValueCount = 2;
-		begin_info.pClearValues = clear_values;
-
-		vkCmdBeginRenderPass(buffer.cmd, &begin_info, 
-							 VK_SUBPASS_CONTENTS_INLINE);
-
-		vkCmdBindPipeline(buffer.cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, 
-						  vk_pipeline);
-		vkCmdBindDescriptorSets(buffer.cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
-								vk_pipeline_layout, 0, 1, &vk_descriptor_set,
-								0, nullptr);
-	}
+	VkDeviceSize instances_size = instance_count * sizeof(YsInstanceData);
+	VkDeviceSize commands_size = batch_count * sizeof(VkDrawIndexedIndirectCommand);
 
+	// NOTE: Written on the async compute queue and drawn from on the main one.
+	bool concurrent = (vk_compute_queue != VK_NULL_HANDLE);
+	for (uint32_t i = 0; i < vk_frames_in_flight; ++i)
 	{
-		VkViewport viewport;
-		viewport.x = 0.f;
-		viewport.y = 0.f;
-		viewport.width = (float)win_width;
-		viewport.height = (float)win_height;
-		viewport.minDepth = 0.f;
-		viewport.maxDepth = 1.f;
-
-		vkCmdSetViewport(buffer.cmd, 0, 1, &viewport);
+		ys_buffer_allocate(ys_cull_instances[i], instances_size,
+						   VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+						   VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, concurrent);
+		ys_buffer_allocate(ys_cull_commands[i], commands_size,
+						   VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+						   VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, concurrent);
+		ys_cull_instances[i].state.name = "cull instances";
+		ys_cull_commands[i].state.name = "cull commands";
 	}
+	ys_buffer_allocate(ys_cull_command_template, commands_size, 0,
+					   VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, concurrent);
 
+	// NOTE: Survivors of a batch are packed from its first instance on, the
+	//		 cull pass only increments instanceCount.
+	std::vector<VkDrawIndexedIndirectCommand> commands(batch_count);
+	for (uint32_t i = 0; i < batch_count; ++i)
 	{
-		VkRect2D scissor;
-		scissor.offset.x = 0;
-		scissor.offset.y = 0;
-		scissor.extent.width = win_width;
-		scissor.extent.height = win_height;
-
-		vkCmdSetScissor(buffer.cmd, 0, 1, &scissor);
+		commands[i].indexCount = ys_draw_batches[i].mesh->index_buffer->value_count;
+		commands[i].instanceCount = 0;
+		commands[i].firstIndex = 0;
+		commands[i].vertexOffset = 0;
+		commands[i].firstInstance = ys_draw_batches[i].first_instance;
 	}
+	ys_buffer_upload(ys_cull_command_template, commands.data(), commands_size);
 
-	// BIND VERTEX BUFFER
+	for (uint32_t slot = 0; slot < vk_frames_in_flight; ++slot)
 	{
-		VkDeviceSize offset = 0;
-		vkCmdBindVertexBuffers(buffer.cmd, 0, 1, &ys_cube_vertex_buffer.buffer, &offset);
-	}
+		VkDescriptorBufferInfo buffer_desc_infos[3];
+		buffer_desc_infos[0].buffer = ys_uniform_ring.buffer.buffer;
+		buffer_desc_infos[0].offset = 0;
+		buffer_desc_infos[0].range = instances_size;
+		buffer_desc_infos[1].buffer = ys_cull_instances[slot].buffer;
+		buffer_desc_infos[1].offset = 0;
+		buffer_desc_infos[1].range = VK_WHOLE_SIZE;
+		buffer_desc_infos[2].buffer = ys_cull_commands[slot].buffer;
+		buffer_desc_infos[2].offset = 0;
+		buffer_desc_infos[2].range = VK_WHOLE_SIZE;
+
+		VkWriteDescriptorSet desc_set_writes[3];
+		for (uint32_t i = 0; i < 3; ++i)
+		{
+			desc_set_writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			desc_set_writes[i].pNext = nullptr;
+			desc_set_writes[i].dstSet = vk_cull_descriptor_sets[slot];
+			desc_set_writes[i].dstBinding = i;
+			desc_set_writes[i].dstArrayElement = 0;
+			desc_set_writes[i].descriptorCount = 1;
+			desc_set_writes[i].descriptorType = (i == 0) ?
+				VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			desc_set_writes[i].pImageInfo = nullptr;
+			desc_set_writes[i].pBufferInfo = &buffer_desc_infos[i];
+			desc_set_writes[i].pTexelBufferView = nullptr;
+		}
 
-	// BIND INDEX BUFFER
-	{
-		vkCmdBindIndexBuffer(buffer.cmd, ys_cube_index_buffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+		vkUpdateDescriptorSets(vk_device, 3, desc_set_writes, 0, nullptr);
 	}
 
-	vkCmdDrawIndexed(buffer.cmd, ys_cube_index_buffer.value_count, 1, 0, 0, 0);
-	vkCmdEndRenderPass(buffer.cmd);
-	
-	{
-		VkImageMemoryBarrier pre_present_barrier;
-		pre_present_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-		pre_present_barrier.pNext = nullptr;
-		pre_present_barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-		pre_present_barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-		pre_present_barrier.oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-		pre_present_barrier.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-		pre_present_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-		pre_present_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-		pre_present_barrier.image = buffer.image;
-		pre_present_barrier.subresourceRange = {
-			VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1
-		};
-	
-		vkCmdPipelineBarrier(buffer.cmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
-							 VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
-							 0, nullptr,
-							 0, nullptr,
-							 1, &pre_present_barrier);
-	}
+	// NOTE: The async queue does not wait on the upload batches, the template
+	//		 has to be on the GPU before its first copy.
+	if (concurrent)
+		ys_upload_wait(ys_upload_flush());
 
-	error = vkEndCommandBuffer(buffer.cmd);
-	assert(!error);
+	// NOTE: Adds the cull pass, or rebinds it to the new buffers.
+	vk_frame_graph_update();
 }
 
 
 static void
-vk_flush_global_command_buffer()
+vk_cull_shutdown()
 {
-	VkResult error;
-
-	if (vk_cmd_buffer == VK_NULL_HANDLE)
+	if (vk_cull_pipeline == VK_NULL_HANDLE)
 		return;
 
-	error = vkEndCommandBuffer(vk_cmd_buffer);
-	assert(!error);
-
-	VkSubmitInfo submit_info;
-	submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submit_info.pNext = nullptr;
-	submit_info.waitSemaphoreCount = 0;
-	submit_info.pWaitSemaphores = nullptr;
-	submit_info.pWaitDstStageMask = nullptr;
-	submit_info.commandBufferCount = 1;
-	submit_info.pCommandBuffers = &vk_cmd_buffer;
-	submit_info.signalSemaphoreCount = 0;
-	submit_info.pSignalSemaphores = nullptr;
-
-	error = vkQueueSubmit(vk_main_queue, 1, &submit_info, VK_NULL_HANDLE);
-	assert(!error);
-
-	error = vkQueueWaitIdle(vk_main_queue);
-	assert(!error);
+	if (ys_cull_instances[0].buffer != VK_NULL_HANDLE)
+	{
+		for (uint32_t i = 0; i < vk_frames_in_flight; ++i)
+		{
+			ys_buffer_free(ys_cull_instances[i]);
+			ys_buffer_free(ys_cull_commands[i]);
+		}
+		ys_buffer_free(ys_cull_command_template);
+	}
 
-	vkFreeCommandBuffers(vk_device, vk_cmd_pool, 1, &vk_cmd_buffer);
-	vk_cmd_buffer = VK_NULL_HANDLE;
+	vkDestroyPipeline(vk_device, vk_cull_pipeline, nullptr);
+	vkDestroyPipelineLayout(vk_device, vk_cull_pipeline_layout, nullptr);
+	vkDestroyDescriptorPool(vk_device, vk_cull_descriptor_pool, nullptr);
+	vkDestroyDescriptorSetLayout(vk_device, vk_cull_desc_set_layout, nullptr);
+	vk_cull_pipeline = VK_NULL_HANDLE;
 }
 
 
-static void 
-vk_set_image_layout(VkImage image, VkImageAspectFlags aspect_mask, 
-					VkImageLayout old_layout, VkImageLayout new_layout,
-					VkAccessFlagBits access_mask)
+// Resets the indirect commands and dispatches the cull pass. Must be recorded
+// after vk_record_secondaries, which allocates and writes the instances. Runs
+// as the cull pass of the frame graph, on the outputs of the frame slot.
+static void
+vk_record_cull(VkCommandBuffer cmd)
 {
-	VkResult error;
-
-	if (vk_cmd_buffer == VK_NULL_HANDLE)
-	{
-		VkCommandBufferAllocateInfo cmd_allocate_info;
-		cmd_allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-		cmd_allocate_info.pNext = nullptr;
-		cmd_allocate_info.commandPool = vk_cmd_pool;
-		cmd_allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-		cmd_allocate_info.commandBufferCount = 1;
-
-		error = vkAllocateCommandBuffers(vk_device, 
-										 &cmd_allocate_info, 
-										 &vk_cmd_buffer);
-		assert(!error);
+	uint32_t instance_count = (uint32_t)ys_instance_objects.size();
+	if (instance_count == 0)
+		return;
 
-		VkCommandBufferBeginInfo cmd_begin_info;
-		cmd_begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-		cmd_begin_info.pNext = nullptr;
-		cmd_begin_info.flags = 0;
-		cmd_begin_info.pInheritanceInfo = nullptr;
+	YsBuffer& cull_commands = ys_cull_commands[vk_frame_index];
 
-		error = vkBeginCommandBuffer(vk_cmd_buffer, &cmd_begin_info);
-		assert(!error);
+	{
+		VkBufferCopy region;
+		region.srcOffset = 0;
+		region.dstOffset = 0;
+		region.size = cull_commands.size;
+		vkCmdCopyBuffer(cmd, ys_cull_command_template.buffer, cull_commands.buffer,
+						1, &region);
 	}
 
-	VkImageMemoryBarrier image_memory_barrier;
-	image_memory_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-	image_memory_barrier.pNext = nullptr;
-	image_memory_barrier.srcAccessMask = access_mask;
-	image_memory_barrier.dstAccessMask = 0;
-	image_memory_barrier.oldLayout = old_layout;
-	image_memory_barrier.newLayout = new_layout;
-	image_memory_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	image_memory_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	image_memory_barrier.image = image;
-	image_memory_barrier.subresourceRange = { aspect_mask, 0, 1, 0, 1 };
+	// NOTE: Only the transition within the pass, the frame graph handles the
+	//		 ones around it.
+	YsBarrierBatch barriers;
+	ys_barrier_buffer(barriers, cull_commands.state, cull_commands.buffer,
+					  YS_USAGE_COMPUTE_WRITE);
+	ys_barrier_flush(barriers, cmd);
 
-	switch (new_layout)
 	{
-	case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL:
-		image_memory_barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-		break;
-	case VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL:
-		image_memory_barrier.dstAccessMask = 
-			VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-		break;
-	case VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL:
-		image_memory_barrier.dstAccessMask =
-			VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-		break;
-	case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL:
-		image_memory_barrier.dstAccessMask = 
-			VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_INPUT_ATTACHMENT_READ_BIT;
-		break;
-	default: break;
+		YsCullConstants constants;
+		YsFrustum frustum;
+		ys_frustum_from_view_projection(
+			ys_mat4_multiply(ys_matrix_projection, ys_matrix_view), frustum);
+		memcpy(constants.planes, frustum.planes, sizeof(constants.planes));
+		constants.instance_count = instance_count;
+
+		vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, vk_cull_pipeline);
+		vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+								vk_cull_pipeline_layout, 0, 1, 
+								&vk_cull_descriptor_sets[vk_frame_index],
+								1, &vk_record_instance_offset);
+		vkCmdPushConstants(cmd, vk_cull_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT,
+						   0, sizeof(YsCullConstants), &constants);
+
+		// NOTE: Matches local_size_x in cs_cull.comp.
+		vkCmdDispatch(cmd, (instance_count + 63) / 64, 1, 1);
 	}
-
-	vkCmdPipelineBarrier(vk_cmd_buffer, 
-						 VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-						 VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-						 0, 
-						 0, nullptr, 
-						 0, nullptr, 
-						 1, &image_memory_barrier);
 }
 
 
@@ -1832,6 +6486,12 @@ vk_load_shader(const std::string& _name, const std::string& _path)
 	size_t retval;
 	char* buffer;
 
+	// NOTE: Pipeline descriptions are compared byte for byte, the same shader
+	//		 must always give the same module.
+	auto it = vk_shaders.find(_name);
+	if (it != vk_shaders.end())
+		return it->second;
+
 	FILE *fp = fopen(_path.c_str(), "rb");
 	if (!fp)
 		return NULL;
@@ -1861,6 +6521,7 @@ vk_load_shader(const std::string& _name, const std::string& _path)
 	error = vkCreateShaderModule(vk_device, &shader_info, nullptr, 
 								 &shader_module);
 	assert(!error);
+	delete[] buffer;
 
 	vk_shaders.emplace(_name, shader_module);
 	return shader_module;
@@ -1921,27 +6582,3 @@ vk_debug_log(VkFlags msg_flags,
 	*/
 	return false;
 }
-
-
-static void ys_compute_perspective(float* _matrix,
-								   float _near_plane, float _far_plane,
-								   float _fov, float _aspect_ratio)
-{
-	float xymax = _near_plane * (float)tan(_fov * (DEG_TO_RAD));
-	float width = 2 * xymax;
-
-	float depth = _far_plane - _near_plane;
-	float q = -(_far_plane + _near_plane) / depth;
-	float qn = -2 * (_far_plane * _near_plane) / depth;
-
-	float w = (2 * _near_plane / width) / _aspect_ratio;
-	float h = 2 * _near_plane / width;
-
-	_matrix[0] = w;
-	_matrix[5] = h;
-	_matrix[10] = q;
-	_matrix[11] = -1.f;
-	_matrix[14] = qn;
-	_matrix[15] = 0.f;
-}
-
@@ -0,0 +1,328 @@
+#include "ys_barrier.h"
+
+#include <assert.h>
+
+#include <iostream>
+
+
+struct YsUsageInfo
+{
+	const char*				name;
+	VkPipelineStageFlags	stages;
+	VkAccessFlags			access;
+	// Only used for images.
+	VkImageLayout			layout;
+	bool					write;
+};
+
+static const YsUsageInfo	ys_usage_infos[YS_USAGE_COUNT] =
+{
+	{ "color attachment",
+	  VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+	  VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+	  VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, true },
+	{ "depth attachment",
+	  VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+	  VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+	  VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+	  VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, true },
+	{ "depth read",
+	  VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT |
+	  VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+	  VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_SHADER_READ_BIT,
+	  VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, false },
+	{ "sampled in fragment",
+	  VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+	  VK_ACCESS_SHADER_READ_BIT,
+	  VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, false },
+	{ "sampled in compute",
+	  VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+	  VK_ACCESS_SHADER_READ_BIT,
+	  VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, false },
+	{ "compute read",
+	  VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+	  VK_ACCESS_SHADER_READ_BIT,
+	  VK_IMAGE_LAYOUT_GENERAL, false },
+	{ "compute write",
+	  VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+	  VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+	  VK_IMAGE_LAYOUT_GENERAL, true },
+	{ "transfer source",
+	  VK_PIPELINE_STAGE_TRANSFER_BIT,
+	  VK_ACCESS_TRANSFER_READ_BIT,
+	  VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, false },
+	{ "transfer destination",
+	  VK_PIPELINE_STAGE_TRANSFER_BIT,
+	  VK_ACCESS_TRANSFER_WRITE_BIT,
+	  VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, true },
+	{ "vertex buffer",
+	  VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+	  VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT,
+	  VK_IMAGE_LAYOUT_UNDEFINED, false },
+	{ "index buffer",
+	  VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+	  VK_ACCESS_INDEX_READ_BIT,
+	  VK_IMAGE_LAYOUT_UNDEFINED, false },
+	{ "indirect buffer",
+	  VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+	  VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+	  VK_IMAGE_LAYOUT_UNDEFINED, false },
+	{ "uniform buffer",
+	  VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+	  VK_ACCESS_UNIFORM_READ_BIT,
+	  VK_IMAGE_LAYOUT_UNDEFINED, false },
+	// NOTE: The present semaphore makes the image visible to the engine.
+	{ "present",
+	  VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+	  0,
+	  VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, false },
+};
+
+// Only these need to be made available, read bits in a source scope are ignored.
+static const VkAccessFlags	YS_WRITE_ACCESS =
+	VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+	VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT |
+	VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+// NOTE: Reports stop after a few, the counters keep going.
+static const uint32_t	YS_BARRIER_REPORT_LIMIT = 16;
+
+static bool				ys_barrier_validation = false;
+static uint32_t			ys_barrier_report_count = 0;
+static YsBarrierStats	ys_barrier_stats_current;
+
+
+static void
+ys_barrier_report(const char* what, const YsResourceState& state, YsUsage usage)
+{
+	if (ys_barrier_report_count >= YS_BARRIER_REPORT_LIMIT)
+		return;
+	ys_barrier_report_count++;
+
+	std::cout << "[BARRIER] " << what << " transition of " << state.name << " to "
+		<< ys_usage_infos[usage].name << std::endl;
+}
+
+
+// Moves state to usage. Returns false when no barrier is needed, otherwise
+// the source access of the barrier and whether it needs a memory barrier at
+// all, the stage masks of the batch being enough for execution dependencies.
+static bool
+ys_barrier_transition(YsBarrierBatch& batch, YsResourceState& state, YsUsage usage,
+					  VkAccessFlags& src_access, bool& memory)
+{
+	const YsUsageInfo& info = ys_usage_infos[usage];
+
+	if (ys_barrier_validation)
+	{
+		for (uint32_t i = 0; i < batch.state_count; ++i)
+		{
+			if (batch.states[i] == &state)
+			{
+				ys_barrier_stats_current.redundant++;
+				ys_barrier_report("Redundant", state, usage);
+				break;
+			}
+		}
+		assert(batch.state_count < YS_BARRIER_BATCH_SIZE * 2);
+		batch.states[batch.state_count++] = &state;
+	}
+
+	bool layout_change = state.image && state.layout != info.layout;
+	VkPipelineStageFlags src_stages = 0;
+	src_access = 0;
+	bool needed = false;
+	memory = layout_change;
+
+	if (layout_change || info.write)
+	{
+		// NOTE: Waits for every previous use, only the last write has to be
+		//		 made available. Without any, this is an execution dependency.
+		src_stages = state.write_stages | state.read_stages;
+		src_access = state.write_access;
+		needed = layout_change || src_stages != 0;
+		memory |= (src_access != 0);
+
+		state.layout = info.layout;
+		state.write_stages = info.stages;
+		state.write_access = info.access & YS_WRITE_ACCESS;
+		state.read_stages = 0;
+		state.visible_stages = info.stages;
+		state.visible_access = info.access;
+	}
+	else
+	{
+		// NOTE: Reads after reads never need a barrier, reads after a write
+		//		 only when the write has not been made visible to them yet.
+		//		 Every such barrier makes the write available again: one at
+		//		 other stages does not chain on the previous barrier, whose
+		//		 availability operation it does not wait for.
+		if (state.write_stages != 0 &&
+			((info.stages & ~state.visible_stages) != 0 ||
+			 (info.access & ~state.visible_access) != 0))
+		{
+			src_stages = state.write_stages;
+			src_access = state.write_access;
+			needed = true;
+			memory = true;
+		}
+
+		state.read_stages |= info.stages;
+		state.visible_stages |= info.stages;
+		state.visible_access |= info.access;
+	}
+
+	if (!needed)
+	{
+		ys_barrier_stats_current.elided++;
+		return false;
+	}
+
+	batch.src_stages |= src_stages ? src_stages :
+		(VkPipelineStageFlags)VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+	batch.dst_stages |= info.stages;
+	return true;
+}
+
+
+void
+ys_barrier_set_validation(bool enabled)
+{
+	ys_barrier_validation = enabled;
+}
+
+
+void
+ys_barrier_image(YsBarrierBatch& batch, YsResourceState& state, VkImage image,
+				 VkImageAspectFlags aspect, YsUsage usage)
+{
+	state.image = true;
+	VkImageLayout old_layout = state.layout;
+
+	VkAccessFlags src_access;
+	bool memory;
+	if (!ys_barrier_transition(batch, state, usage, src_access, memory) || !memory)
+		return;
+
+	assert(batch.image_count < YS_BARRIER_BATCH_SIZE);
+	VkImageMemoryBarrier& barrier = batch.images[batch.image_count++];
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.pNext = nullptr;
+	barrier.srcAccessMask = src_access;
+	barrier.dstAccessMask = ys_usage_infos[usage].access;
+	barrier.oldLayout = old_layout;
+	barrier.newLayout = ys_usage_infos[usage].layout;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = image;
+	barrier.subresourceRange = { aspect, 0, VK_REMAINING_MIP_LEVELS,
+								 0, VK_REMAINING_ARRAY_LAYERS };
+}
+
+
+void
+ys_barrier_buffer(YsBarrierBatch& batch, YsResourceState& state, VkBuffer buffer,
+				  YsUsage usage)
+{
+	VkAccessFlags src_access;
+	bool memory;
+	if (!ys_barrier_transition(batch, state, usage, src_access, memory) || !memory)
+		return;
+
+	assert(batch.buffer_count < YS_BARRIER_BATCH_SIZE);
+	VkBufferMemoryBarrier& barrier = batch.buffers[batch.buffer_count++];
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.pNext = nullptr;
+	barrier.srcAccessMask = src_access;
+	barrier.dstAccessMask = ys_usage_infos[usage].access;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.buffer = buffer;
+	barrier.offset = 0;
+	barrier.size = VK_WHOLE_SIZE;
+}
+
+
+void
+ys_barrier_flush(YsBarrierBatch& batch, VkCommandBuffer cmd)
+{
+	if (batch.dst_stages != 0)
+	{
+		vkCmdPipelineBarrier(cmd, batch.src_stages, batch.dst_stages, 0,
+							 0, nullptr,
+							 batch.buffer_count, batch.buffers,
+							 batch.image_count, batch.images);
+
+		ys_barrier_stats_current.flush_count++;
+		ys_barrier_stats_current.image_barriers += batch.image_count;
+		ys_barrier_stats_current.buffer_barriers += batch.buffer_count;
+	}
+
+	batch.src_stages = 0;
+	batch.dst_stages = 0;
+	batch.image_count = 0;
+	batch.buffer_count = 0;
+	batch.state_count = 0;
+}
+
+
+void
+ys_barrier_discard(YsResourceState& state, VkPipelineStageFlags wait_stages)
+{
+	state.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+	state.read_stages |= state.write_stages | wait_stages;
+	state.write_stages = 0;
+	state.write_access = 0;
+	state.visible_stages = 0;
+	state.visible_access = 0;
+}
+
+
+void
+ys_barrier_complete(YsResourceState& state, VkPipelineStageFlags wait_stages)
+{
+	state.write_stages = wait_stages;
+	state.write_access = 0;
+	state.read_stages = 0;
+	state.visible_stages = wait_stages;
+	state.visible_access = wait_stages ? ~(VkAccessFlags)0 : 0;
+}
+
+
+bool
+ys_barrier_check(const YsResourceState& state, YsUsage usage)
+{
+	const YsUsageInfo& info = ys_usage_infos[usage];
+	bool ready =
+		(!state.image || state.layout == info.layout) &&
+		(info.stages & ~state.visible_stages) == 0 &&
+		(info.access & ~state.visible_access) == 0;
+
+	if (!ready && ys_barrier_validation)
+	{
+		ys_barrier_stats_current.missing++;
+		ys_barrier_report("Missing", state, usage);
+	}
+	return ready;
+}
+
+
+VkPipelineStageFlags
+ys_usage_stages(YsUsage usage)
+{
+	return ys_usage_infos[usage].stages;
+}
+
+
+const YsBarrierStats&
+ys_barrier_stats()
+{
+	return ys_barrier_stats_current;
+}
+
+
+void
+ys_barrier_reset_stats()
+{
+	ys_barrier_stats_current = YsBarrierStats();
+}
@@ -0,0 +1,343 @@
+#include "ys_cull.h"
+
+#include <math.h>
+
+#ifdef YS_MATH_SSE
+#include <xmmintrin.h>
+#endif
+#ifdef YS_MATH_AVX
+#include <immintrin.h>
+#endif
+
+
+void
+ys_frustum_from_view_projection(const YsMat4& view_projection, YsFrustum& frustum)
+{
+	// NOTE: Rows of the column major matrix, the planes are combinations of
+	//		 the last row with each of the others (Gribb & Hartmann).
+	float rows[4][4];
+	for (uint32_t r = 0; r < 4; ++r)
+	{
+		for (uint32_t c = 0; c < 4; ++c)
+			rows[r][c] = view_projection.m[c * 4 + r];
+	}
+
+	for (uint32_t i = 0; i < 6; ++i)
+	{
+		float sign = (i & 1) ? -1.f : 1.f;
+		const float* row = rows[i / 2];
+		float* plane = frustum.planes[i];
+		for (uint32_t c = 0; c < 4; ++c)
+			plane[c] = rows[3][c] + sign * row[c];
+
+		float length = sqrtf(plane[0] * plane[0] + plane[1] * plane[1] +
+							 plane[2] * plane[2]);
+		for (uint32_t c = 0; c < 4; ++c)
+			plane[c] /= length;
+	}
+}
+
+
+void
+ys_bounding_spheres_resize(YsBoundingSpheres& spheres, uint32_t count)
+{
+	spheres.count = count;
+	spheres.center_x.resize(count);
+	spheres.center_y.resize(count);
+	spheres.center_z.resize(count);
+	spheres.radius.resize(count);
+}
+
+
+void
+ys_bounding_boxes_resize(YsBoundingBoxes& boxes, uint32_t count)
+{
+	boxes.count = count;
+	boxes.center_x.resize(count);
+	boxes.center_y.resize(count);
+	boxes.center_z.resize(count);
+	boxes.extent_x.resize(count);
+	boxes.extent_y.resize(count);
+	boxes.extent_z.resize(count);
+}
+
+
+// SCALAR
+
+static inline bool
+ys_sphere_visible(const YsFrustum& frustum, float x, float y, float z, float radius)
+{
+	for (uint32_t p = 0; p < 6; ++p)
+	{
+		const float* plane = frustum.planes[p];
+		if (plane[0] * x + plane[1] * y + plane[2] * z + plane[3] < -radius)
+			return false;
+	}
+	return true;
+}
+
+
+static inline bool
+ys_box_visible(const YsFrustum& frustum, float x, float y, float z,
+			   float ex, float ey, float ez)
+{
+	for (uint32_t p = 0; p < 6; ++p)
+	{
+		const float* plane = frustum.planes[p];
+		float distance = plane[0] * x + plane[1] * y + plane[2] * z + plane[3];
+		float reach = fabsf(plane[0]) * ex + fabsf(plane[1]) * ey + fabsf(plane[2]) * ez;
+		if (distance < -reach)
+			return false;
+	}
+	return true;
+}
+
+
+uint32_t
+ys_cull_spheres_scalar(const YsFrustum& frustum, const YsBoundingSpheres& spheres,
+					   uint32_t first, uint32_t count, uint32_t* visible)
+{
+	uint32_t visible_count = 0;
+	for (uint32_t i = first; i < first + count; ++i)
+	{
+		if (ys_sphere_visible(frustum, spheres.center_x[i], spheres.center_y[i],
+							  spheres.center_z[i], spheres.radius[i]))
+			visible[visible_count++] = i;
+	}
+	return visible_count;
+}
+
+
+uint32_t
+ys_cull_boxes_scalar(const YsFrustum& frustum, const YsBoundingBoxes& boxes,
+					 uint32_t first, uint32_t count, uint32_t* visible)
+{
+	uint32_t visible_count = 0;
+	for (uint32_t i = first; i < first + count; ++i)
+	{
+		if (ys_box_visible(frustum, boxes.center_x[i], boxes.center_y[i],
+						   boxes.center_z[i], boxes.extent_x[i], boxes.extent_y[i],
+						   boxes.extent_z[i]))
+			visible[visible_count++] = i;
+	}
+	return visible_count;
+}
+
+
+// NOTE: Appends the set lanes of mask without branching, the index is always
+//		 written and only kept when its bit is set.
+static inline uint32_t
+ys_cull_compact(uint32_t mask, uint32_t lane_count, uint32_t first,
+				uint32_t* visible, uint32_t visible_count)
+{
+	for (uint32_t lane = 0; lane < lane_count; ++lane)
+	{
+		visible[visible_count] = first + lane;
+		visible_count += (mask >> lane) & 1;
+	}
+	return visible_count;
+}
+
+
+#if defined(YS_MATH_AVX)
+
+// AVX
+
+uint32_t
+ys_cull_spheres(const YsFrustum& frustum, const YsBoundingSpheres& spheres,
+				uint32_t first, uint32_t count, uint32_t* visible)
+{
+	__m256 planes[6][4];
+	for (uint32_t p = 0; p < 6; ++p)
+	{
+		for (uint32_t c = 0; c < 4; ++c)
+			planes[p][c] = _mm256_set1_ps(frustum.planes[p][c]);
+	}
+
+	uint32_t visible_count = 0;
+	uint32_t end = first + count;
+	uint32_t i = first;
+	for (; i + 8 <= end; i += 8)
+	{
+		__m256 x = _mm256_loadu_ps(&spheres.center_x[i]);
+		__m256 y = _mm256_loadu_ps(&spheres.center_y[i]);
+		__m256 z = _mm256_loadu_ps(&spheres.center_z[i]);
+		__m256 negative_radius = _mm256_sub_ps(_mm256_setzero_ps(),
+											   _mm256_loadu_ps(&spheres.radius[i]));
+
+		__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+		for (uint32_t p = 0; p < 6; ++p)
+		{
+			__m256 distance = _mm256_add_ps(
+				_mm256_add_ps(_mm256_mul_ps(planes[p][0], x), _mm256_mul_ps(planes[p][1], y)),
+				_mm256_add_ps(_mm256_mul_ps(planes[p][2], z), planes[p][3]));
+			inside = _mm256_and_ps(inside,
+								   _mm256_cmp_ps(distance, negative_radius, _CMP_GE_OQ));
+		}
+
+		uint32_t mask = (uint32_t)_mm256_movemask_ps(inside);
+		visible_count = ys_cull_compact(mask, 8, i, visible, visible_count);
+	}
+
+	return visible_count +
+		ys_cull_spheres_scalar(frustum, spheres, i, end - i, visible + visible_count);
+}
+
+
+uint32_t
+ys_cull_boxes(const YsFrustum& frustum, const YsBoundingBoxes& boxes,
+			  uint32_t first, uint32_t count, uint32_t* visible)
+{
+	__m256 planes[6][4];
+	__m256 abs_planes[6][3];
+	for (uint32_t p = 0; p < 6; ++p)
+	{
+		for (uint32_t c = 0; c < 4; ++c)
+			planes[p][c] = _mm256_set1_ps(frustum.planes[p][c]);
+		for (uint32_t c = 0; c < 3; ++c)
+			abs_planes[p][c] = _mm256_set1_ps(fabsf(frustum.planes[p][c]));
+	}
+
+	uint32_t visible_count = 0;
+	uint32_t end = first + count;
+	uint32_t i = first;
+	for (; i + 8 <= end; i += 8)
+	{
+		__m256 x = _mm256_loadu_ps(&boxes.center_x[i]);
+		__m256 y = _mm256_loadu_ps(&boxes.center_y[i]);
+		__m256 z = _mm256_loadu_ps(&boxes.center_z[i]);
+		__m256 ex = _mm256_loadu_ps(&boxes.extent_x[i]);
+		__m256 ey = _mm256_loadu_ps(&boxes.extent_y[i]);
+		__m256 ez = _mm256_loadu_ps(&boxes.extent_z[i]);
+
+		__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+		for (uint32_t p = 0; p < 6; ++p)
+		{
+			__m256 distance = _mm256_add_ps(
+				_mm256_add_ps(_mm256_mul_ps(planes[p][0], x), _mm256_mul_ps(planes[p][1], y)),
+				_mm256_add_ps(_mm256_mul_ps(planes[p][2], z), planes[p][3]));
+			__m256 reach = _mm256_add_ps(
+				_mm256_add_ps(_mm256_mul_ps(abs_planes[p][0], ex),
+							  _mm256_mul_ps(abs_planes[p][1], ey)),
+				_mm256_mul_ps(abs_planes[p][2], ez));
+			inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(distance, reach),
+														 _mm256_setzero_ps(), _CMP_GE_OQ));
+		}
+
+		uint32_t mask = (uint32_t)_mm256_movemask_ps(inside);
+		visible_count = ys_cull_compact(mask, 8, i, visible, visible_count);
+	}
+
+	return visible_count +
+		ys_cull_boxes_scalar(frustum, boxes, i, end - i, visible + visible_count);
+}
+
+#elif defined(YS_MATH_SSE)
+
+// SSE
+
+uint32_t
+ys_cull_spheres(const YsFrustum& frustum, const YsBoundingSpheres& spheres,
+				uint32_t first, uint32_t count, uint32_t* visible)
+{
+	__m128 planes[6][4];
+	for (uint32_t p = 0; p < 6; ++p)
+	{
+		for (uint32_t c = 0; c < 4; ++c)
+			planes[p][c] = _mm_set1_ps(frustum.planes[p][c]);
+	}
+
+	uint32_t visible_count = 0;
+	uint32_t end = first + count;
+	uint32_t i = first;
+	for (; i + 4 <= end; i += 4)
+	{
+		__m128 x = _mm_loadu_ps(&spheres.center_x[i]);
+		__m128 y = _mm_loadu_ps(&spheres.center_y[i]);
+		__m128 z = _mm_loadu_ps(&spheres.center_z[i]);
+		__m128 negative_radius = _mm_sub_ps(_mm_setzero_ps(),
+											_mm_loadu_ps(&spheres.radius[i]));
+
+		__m128 inside = _mm_cmpeq_ps(x, x);
+		for (uint32_t p = 0; p < 6; ++p)
+		{
+			__m128 distance = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(planes[p][0], x), _mm_mul_ps(planes[p][1], y)),
+				_mm_add_ps(_mm_mul_ps(planes[p][2], z), planes[p][3]));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negative_radius));
+		}
+
+		uint32_t mask = (uint32_t)_mm_movemask_ps(inside);
+		visible_count = ys_cull_compact(mask, 4, i, visible, visible_count);
+	}
+
+	return visible_count +
+		ys_cull_spheres_scalar(frustum, spheres, i, end - i, visible + visible_count);
+}
+
+
+uint32_t
+ys_cull_boxes(const YsFrustum& frustum, const YsBoundingBoxes& boxes,
+			  uint32_t first, uint32_t count, uint32_t* visible)
+{
+	__m128 planes[6][4];
+	__m128 abs_planes[6][3];
+	for (uint32_t p = 0; p < 6; ++p)
+	{
+		for (uint32_t c = 0; c < 4; ++c)
+			planes[p][c] = _mm_set1_ps(frustum.planes[p][c]);
+		for (uint32_t c = 0; c < 3; ++c)
+			abs_planes[p][c] = _mm_set1_ps(fabsf(frustum.planes[p][c]));
+	}
+
+	uint32_t visible_count = 0;
+	uint32_t end = first + count;
+	uint32_t i = first;
+	for (; i + 4 <= end; i += 4)
+	{
+		__m128 x = _mm_loadu_ps(&boxes.center_x[i]);
+		__m128 y = _mm_loadu_ps(&boxes.center_y[i]);
+		__m128 z = _mm_loadu_ps(&boxes.center_z[i]);
+		__m128 ex = _mm_loadu_ps(&boxes.extent_x[i]);
+		__m128 ey = _mm_loadu_ps(&boxes.extent_y[i]);
+		__m128 ez = _mm_loadu_ps(&boxes.extent_z[i]);
+
+		__m128 inside = _mm_cmpeq_ps(x, x);
+		for (uint32_t p = 0; p < 6; ++p)
+		{
+			__m128 distance = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(planes[p][0], x), _mm_mul_ps(planes[p][1], y)),
+				_mm_add_ps(_mm_mul_ps(planes[p][2], z), planes[p][3]));
+			__m128 reach = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(abs_planes[p][0], ex), _mm_mul_ps(abs_planes[p][1], ey)),
+				_mm_mul_ps(abs_planes[p][2], ez));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(distance, reach),
+													 _mm_setzero_ps()));
+		}
+
+		uint32_t mask = (uint32_t)_mm_movemask_ps(inside);
+		visible_count = ys_cull_compact(mask, 4, i, visible, visible_count);
+	}
+
+	return visible_count +
+		ys_cull_boxes_scalar(frustum, boxes, i, end - i, visible + visible_count);
+}
+
+#else
+
+uint32_t
+ys_cull_spheres(const YsFrustum& frustum, const YsBoundingSpheres& spheres,
+				uint32_t first, uint32_t count, uint32_t* visible)
+{
+	return ys_cull_spheres_scalar(frustum, spheres, first, count, visible);
+}
+
+
+uint32_t
+ys_cull_boxes(const YsFrustum& frustum, const YsBoundingBoxes& boxes,
+			  uint32_t first, uint32_t count, uint32_t* visible)
+{
+	return ys_cull_boxes_scalar(frustum, boxes, first, count, visible);
+}
+
+#endif
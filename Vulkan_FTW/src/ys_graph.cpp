@@ -0,0 +1,659 @@
+#include "ys_graph.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include <iostream>
+#include <algorithm>
+
+
+static YsGraphHandle
+ys_graph_add_resource(YsGraph& graph, const char* name, bool image, bool imported,
+					  VkFormat format, VkImageAspectFlags aspect, uint32_t width,
+					  uint32_t height)
+{
+	YsGraphResource resource;
+	resource.name = name;
+	resource.image = image;
+	resource.imported = imported;
+	resource.format = format;
+	resource.aspect = aspect;
+	resource.width = width;
+	resource.height = height;
+	resource.state.name = name;
+
+	graph.resources.push_back(resource);
+	return (YsGraphHandle)(graph.resources.size() - 1);
+}
+
+
+YsGraphHandle
+ys_graph_import_image(YsGraph& graph, const char* name, VkFormat format,
+					  VkImageAspectFlags aspect, uint32_t width, uint32_t height)
+{
+	return ys_graph_add_resource(graph, name, true, true, format, aspect, width, height);
+}
+
+
+YsGraphHandle
+ys_graph_import_buffer(YsGraph& graph, const char* name)
+{
+	return ys_graph_add_resource(graph, name, false, true, VK_FORMAT_UNDEFINED, 0, 0, 0);
+}
+
+
+YsGraphHandle
+ys_graph_create_image(YsGraph& graph, const char* name, VkFormat format,
+					  VkImageAspectFlags aspect, uint32_t width, uint32_t height)
+{
+	return ys_graph_add_resource(graph, name, true, false, format, aspect, width, height);
+}
+
+
+uint32_t
+ys_graph_add_pass(YsGraph& graph, const char* name, bool graphics,
+				  YsGraphExecute* execute, void* data)
+{
+	YsGraphPass pass;
+	pass.name = name;
+	pass.graphics = graphics;
+	pass.execute = execute;
+	pass.data = data;
+
+	graph.passes.push_back(pass);
+	return (uint32_t)(graph.passes.size() - 1);
+}
+
+
+void
+ys_graph_set_queue(YsGraph& graph, uint32_t pass, YsGraphQueue queue)
+{
+	assert(!graph.passes[pass].graphics || queue == YS_GRAPH_QUEUE_MAIN);
+	graph.passes[pass].queue = queue;
+}
+
+
+static void
+ys_graph_add_access(YsGraph& graph, uint32_t pass, YsGraphHandle resource, YsUsage usage,
+					bool write, const VkClearValue* clear_value)
+{
+	assert(resource < graph.resources.size());
+
+	YsGraphAccess access;
+	memset(&access, 0, sizeof(access));
+	access.resource = resource;
+	access.usage = usage;
+	access.write = write;
+	access.clear = (clear_value != nullptr);
+	if (clear_value)
+		access.clear_value = *clear_value;
+
+	graph.passes[pass].accesses.push_back(access);
+}
+
+
+void
+ys_graph_read(YsGraph& graph, uint32_t pass, YsGraphHandle resource, YsUsage usage)
+{
+	ys_graph_add_access(graph, pass, resource, usage, false, nullptr);
+}
+
+
+void
+ys_graph_write(YsGraph& graph, uint32_t pass, YsGraphHandle resource, YsUsage usage)
+{
+	ys_graph_add_access(graph, pass, resource, usage, true, nullptr);
+}
+
+
+void
+ys_graph_clear(YsGraph& graph, uint32_t pass, YsGraphHandle resource, YsUsage usage,
+			   VkClearValue clear_value)
+{
+	ys_graph_add_access(graph, pass, resource, usage, true, &clear_value);
+}
+
+
+bool
+ys_graph_is_attachment(const YsGraphAccess& access)
+{
+	return access.usage == YS_USAGE_COLOR_ATTACHMENT ||
+		   access.usage == YS_USAGE_DEPTH_ATTACHMENT ||
+		   access.usage == YS_USAGE_DEPTH_READ;
+}
+
+
+// FNV-1a.
+static void
+ys_graph_hash_bytes(uint64_t& hash, const void* data, size_t size)
+{
+	const uint8_t* bytes = (const uint8_t*)data;
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+}
+
+
+template <typename T>
+static void
+ys_graph_hash_value(uint64_t& hash, const T& value)
+{
+	ys_graph_hash_bytes(hash, &value, sizeof(value));
+}
+
+
+uint64_t
+ys_graph_hash(const YsGraph& graph)
+{
+	uint64_t hash = 14695981039346656037ull;
+	ys_graph_hash_value(hash, graph.variant_count);
+
+	for (const YsGraphResource& resource : graph.resources)
+	{
+		ys_graph_hash_bytes(hash, resource.name, strlen(resource.name));
+		ys_graph_hash_value(hash, resource.image);
+		ys_graph_hash_value(hash, resource.imported);
+		ys_graph_hash_value(hash, resource.format);
+		ys_graph_hash_value(hash, resource.aspect);
+		ys_graph_hash_value(hash, resource.width);
+		ys_graph_hash_value(hash, resource.height);
+		ys_graph_hash_value(hash, resource.per_frame);
+
+		// NOTE: Only imported bindings are declared, transient ones are the
+		//		 result of a build.
+		if (!resource.imported)
+			continue;
+		for (VkImage image : resource.images)
+			ys_graph_hash_value(hash, image);
+		for (VkImageView view : resource.views)
+			ys_graph_hash_value(hash, view);
+		for (VkBuffer buffer : resource.buffers)
+			ys_graph_hash_value(hash, buffer);
+		for (YsResourceState* state : resource.states)
+			ys_graph_hash_value(hash, state);
+	}
+
+	for (const YsGraphPass& pass : graph.passes)
+	{
+		ys_graph_hash_bytes(hash, pass.name, strlen(pass.name));
+		ys_graph_hash_value(hash, pass.graphics);
+		ys_graph_hash_value(hash, pass.side_effect);
+		ys_graph_hash_value(hash, pass.queue);
+		ys_graph_hash_value(hash, pass.execute);
+		ys_graph_hash_value(hash, pass.data);
+		for (const YsGraphAccess& access : pass.accesses)
+		{
+			ys_graph_hash_value(hash, access.resource);
+			ys_graph_hash_value(hash, access.usage);
+			ys_graph_hash_value(hash, access.write);
+			ys_graph_hash_value(hash, access.clear);
+			ys_graph_hash_value(hash, access.clear_value);
+		}
+	}
+	return hash;
+}
+
+
+static VkImageUsageFlags
+ys_graph_image_usage(YsUsage usage)
+{
+	switch (usage)
+	{
+	case YS_USAGE_COLOR_ATTACHMENT:	return VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+	case YS_USAGE_DEPTH_ATTACHMENT:	return VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+	case YS_USAGE_DEPTH_READ:
+		return VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	case YS_USAGE_SAMPLED_FRAGMENT:
+	case YS_USAGE_SAMPLED_COMPUTE:	return VK_IMAGE_USAGE_SAMPLED_BIT;
+	case YS_USAGE_COMPUTE_READ:
+	case YS_USAGE_COMPUTE_WRITE:	return VK_IMAGE_USAGE_STORAGE_BIT;
+	case YS_USAGE_TRANSFER_SRC:		return VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+	case YS_USAGE_TRANSFER_DST:		return VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	default:						return 0;
+	}
+}
+
+
+// An attachment written without a clear keeps the previous content.
+static bool
+ys_graph_access_reads(const YsGraphAccess& access)
+{
+	return !access.write || (ys_graph_is_attachment(access) && !access.clear);
+}
+
+
+void
+ys_graph_compile(YsGraph& graph)
+{
+	uint32_t pass_count = (uint32_t)graph.passes.size();
+	uint32_t resource_count = (uint32_t)graph.resources.size();
+
+	std::vector<std::vector<uint32_t>> writers(resource_count);
+	for (uint32_t p = 0; p < pass_count; ++p)
+	{
+		for (const YsGraphAccess& access : graph.passes[p].accesses)
+		{
+			std::vector<uint32_t>& list = writers[access.resource];
+			if (access.write && (list.empty() || list.back() != p))
+				list.push_back(p);
+		}
+	}
+
+	// DEPENDENCIES
+	// NOTE: A pass reading a resource runs after every other pass writing it,
+	//		 writers of the same resource run in declaration order. Only the
+	//		 first kind carries data and keeps its writers alive.
+	std::vector<std::vector<uint32_t>> inputs(pass_count);
+	std::vector<std::vector<uint32_t>> after(pass_count);
+	for (uint32_t p = 0; p < pass_count; ++p)
+	{
+		for (const YsGraphAccess& access : graph.passes[p].accesses)
+		{
+			bool reads = ys_graph_access_reads(access);
+			for (uint32_t writer : writers[access.resource])
+			{
+				if (writer == p)
+					continue;
+				if (reads)
+					inputs[p].push_back(writer);
+				if (reads || (access.write && writer < p))
+					after[p].push_back(writer);
+			}
+		}
+	}
+
+	// CULLING
+	{
+		std::vector<uint32_t> pending;
+		for (uint32_t p = 0; p < pass_count; ++p)
+		{
+			graph.passes[p].culled = !graph.passes[p].side_effect;
+			if (graph.passes[p].side_effect)
+				pending.push_back(p);
+		}
+
+		while (!pending.empty())
+		{
+			uint32_t p = pending.back();
+			pending.pop_back();
+			for (uint32_t input : inputs[p])
+			{
+				if (graph.passes[input].culled)
+				{
+					graph.passes[input].culled = false;
+					pending.push_back(input);
+				}
+			}
+		}
+	}
+
+	// ORDER
+	// NOTE: Among the passes ready to run, the first declared goes first.
+	{
+		graph.order.clear();
+		std::vector<bool> scheduled(pass_count, false);
+		uint32_t kept_count = 0;
+		for (uint32_t p = 0; p < pass_count; ++p)
+			kept_count += graph.passes[p].culled ? 0 : 1;
+
+		while (graph.order.size() < kept_count)
+		{
+			uint32_t next = UINT32_MAX;
+			for (uint32_t p = 0; p < pass_count && next == UINT32_MAX; ++p)
+			{
+				if (graph.passes[p].culled || scheduled[p])
+					continue;
+
+				bool ready = true;
+				for (uint32_t dependency : after[p])
+				{
+					if (!graph.passes[dependency].culled && !scheduled[dependency])
+						ready = false;
+				}
+				if (ready)
+					next = p;
+			}
+
+			// NOTE: No pass is ready, the dependencies form a cycle.
+			assert(next != UINT32_MAX);
+			if (next == UINT32_MAX)
+				break;
+			scheduled[next] = true;
+			graph.order.push_back(next);
+		}
+	}
+
+	// ASYNC PASSES
+	// NOTE: The async command buffer is submitted first, its passes cannot
+	//		 wait for main queue passes of the same frame.
+	{
+		bool has_async = false;
+		std::vector<bool> async_resources(resource_count, false);
+		for (uint32_t p : graph.order)
+		{
+			const YsGraphPass& pass = graph.passes[p];
+			if (pass.queue != YS_GRAPH_QUEUE_ASYNC_COMPUTE)
+				continue;
+			has_async = true;
+
+			for (uint32_t dependency : after[p])
+			{
+				assert(graph.passes[dependency].culled ||
+					   graph.passes[dependency].queue == YS_GRAPH_QUEUE_ASYNC_COMPUTE);
+			}
+			for (const YsGraphAccess& access : pass.accesses)
+			{
+				assert(graph.resources[access.resource].per_frame);
+				async_resources[access.resource] = true;
+			}
+		}
+
+		graph.async_wait_stages = 0;
+		for (uint32_t p : graph.order)
+		{
+			const YsGraphPass& pass = graph.passes[p];
+			if (pass.queue != YS_GRAPH_QUEUE_MAIN)
+				continue;
+			for (const YsGraphAccess& access : pass.accesses)
+			{
+				if (async_resources[access.resource])
+					graph.async_wait_stages |= ys_usage_stages(access.usage);
+			}
+		}
+		// NOTE: Nothing on the main queue reads the results of a side effect.
+		if (has_async && graph.async_wait_stages == 0)
+			graph.async_wait_stages = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+	}
+
+	// LIFETIMES
+	for (YsGraphResource& resource : graph.resources)
+	{
+		resource.usage = 0;
+		resource.first_use = UINT32_MAX;
+		resource.last_use = 0;
+	}
+	for (uint32_t position = 0; position < graph.order.size(); ++position)
+	{
+		for (const YsGraphAccess& access : graph.passes[graph.order[position]].accesses)
+		{
+			YsGraphResource& resource = graph.resources[access.resource];
+			resource.usage |= ys_graph_image_usage(access.usage);
+			if (resource.first_use == UINT32_MAX)
+				resource.first_use = position;
+			resource.last_use = position;
+		}
+	}
+
+	// ATTACHMENT OPS
+	// NOTE: Transient content is only loaded when an earlier pass wrote it and
+	//		 only stored when a later pass uses it.
+	for (uint32_t position = 0; position < graph.order.size(); ++position)
+	{
+		for (YsGraphAccess& access : graph.passes[graph.order[position]].accesses)
+		{
+			const YsGraphResource& resource = graph.resources[access.resource];
+			if (access.clear)
+				access.load_op = VK_ATTACHMENT_LOAD_OP_CLEAR;
+			else if (!resource.imported && resource.first_use == position)
+				access.load_op = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+			else
+				access.load_op = VK_ATTACHMENT_LOAD_OP_LOAD;
+
+			if (resource.imported || resource.last_use > position)
+				access.store_op = VK_ATTACHMENT_STORE_OP_STORE;
+			else
+				access.store_op = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		}
+	}
+
+	graph.hash = ys_graph_hash(graph);
+}
+
+
+static VkDeviceSize
+ys_graph_align_up(VkDeviceSize value, VkDeviceSize alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+
+void
+ys_graph_alias(YsGraph& graph)
+{
+	std::vector<uint32_t> images;
+	for (uint32_t r = 0; r < graph.resources.size(); ++r)
+	{
+		const YsGraphResource& resource = graph.resources[r];
+		if (resource.image && !resource.imported && resource.first_use != UINT32_MAX)
+			images.push_back(r);
+	}
+
+	// NOTE: Largest first, each image goes at the lowest offset that does not
+	//		 overlap an image placed before it and alive at the same time.
+	std::stable_sort(images.begin(), images.end(), [&](uint32_t a, uint32_t b) {
+		return graph.resources[a].size > graph.resources[b].size;
+	});
+
+	auto alive_together = [](const YsGraphResource& a, const YsGraphResource& b) {
+		return a.first_use <= b.last_use && b.first_use <= a.last_use;
+	};
+
+	graph.memory_size = 0;
+	graph.unaliased_size = 0;
+	std::vector<uint32_t> placed;
+	for (uint32_t r : images)
+	{
+		YsGraphResource& resource = graph.resources[r];
+		graph.unaliased_size =
+			ys_graph_align_up(graph.unaliased_size, resource.alignment) + resource.size;
+
+		std::vector<VkDeviceSize> candidates(1, 0);
+		for (uint32_t q : placed)
+		{
+			const YsGraphResource& other = graph.resources[q];
+			if (alive_together(resource, other))
+				candidates.push_back(
+					ys_graph_align_up(other.offset + other.size, resource.alignment));
+		}
+		std::sort(candidates.begin(), candidates.end());
+
+		for (VkDeviceSize offset : candidates)
+		{
+			bool free = true;
+			for (uint32_t q : placed)
+			{
+				const YsGraphResource& other = graph.resources[q];
+				if (alive_together(resource, other) &&
+					offset < other.offset + other.size && other.offset < offset + resource.size)
+					free = false;
+			}
+			if (free)
+			{
+				resource.offset = offset;
+				break;
+			}
+		}
+
+		placed.push_back(r);
+		if (resource.offset + resource.size > graph.memory_size)
+			graph.memory_size = resource.offset + resource.size;
+	}
+
+	// ALIAS STAGES
+	std::vector<VkPipelineStageFlags> stages(graph.resources.size(), 0);
+	for (uint32_t p : graph.order)
+	{
+		for (const YsGraphAccess& access : graph.passes[p].accesses)
+			stages[access.resource] |= ys_usage_stages(access.usage);
+	}
+	for (uint32_t r : images)
+	{
+		YsGraphResource& resource = graph.resources[r];
+		resource.alias_stages = 0;
+		for (uint32_t q : images)
+		{
+			const YsGraphResource& other = graph.resources[q];
+			if (q != r && resource.offset < other.offset + other.size &&
+				other.offset < resource.offset + resource.size)
+				resource.alias_stages |= stages[q];
+		}
+	}
+}
+
+
+void
+ys_graph_report(const YsGraph& graph)
+{
+	std::cout << "[GRAPH] " << graph.order.size() << " passes:";
+	for (uint32_t p : graph.order)
+		std::cout << " " << graph.passes[p].name;
+	std::cout << ", culled:";
+	for (const YsGraphPass& pass : graph.passes)
+	{
+		if (pass.culled)
+			std::cout << " " << pass.name;
+	}
+	std::cout << std::endl;
+
+	std::cout << "[GRAPH] Peak attachment memory " << graph.memory_size / 1024
+		<< " KiB, " << graph.unaliased_size / 1024 << " KiB without aliasing"
+		<< std::endl;
+}
+
+
+static uint32_t
+ys_graph_binding(const YsGraph& graph, const YsGraphResource& resource)
+{
+	if (resource.per_frame)
+		return graph.frame;
+	return (resource.states.size() > 1) ? graph.variant : 0;
+}
+
+
+YsResourceState&
+ys_graph_state(YsGraph& graph, YsGraphHandle resource)
+{
+	YsGraphResource& r = graph.resources[resource];
+	return *r.states[ys_graph_binding(graph, r)];
+}
+
+
+VkFramebuffer
+ys_graph_framebuffer(const YsGraph& graph, uint32_t pass, uint32_t variant)
+{
+	const YsGraphPass& p = graph.passes[pass];
+	return p.framebuffers[(p.framebuffers.size() > 1) ? variant : 0];
+}
+
+
+// Resources accessed by the kept async passes.
+static void
+ys_graph_async_resources(const YsGraph& graph, std::vector<bool>& async_resources)
+{
+	async_resources.assign(graph.resources.size(), false);
+	for (uint32_t p : graph.order)
+	{
+		if (graph.passes[p].queue != YS_GRAPH_QUEUE_ASYNC_COMPUTE)
+			continue;
+		for (const YsGraphAccess& access : graph.passes[p].accesses)
+			async_resources[access.resource] = true;
+	}
+}
+
+
+void
+ys_graph_execute(YsGraph& graph, VkCommandBuffer cmd, YsGraphQueue queue, 
+				 uint32_t variant, uint32_t frame)
+{
+	graph.variant = variant;
+	graph.frame = frame;
+	uint32_t flushes = ys_barrier_stats().flush_count;
+
+	// NOTE: Async resources were last used by the main queue a whole frame
+	//		 ring ago, the host has waited for it. The main queue then waits
+	//		 for the async queue through the semaphore.
+	if (graph.async_wait_stages != 0)
+	{
+		std::vector<bool> async_resources;
+		ys_graph_async_resources(graph, async_resources);
+		for (uint32_t r = 0; r < graph.resources.size(); ++r)
+		{
+			if (async_resources[r])
+				ys_barrier_complete(ys_graph_state(graph, r), 
+									(queue == YS_GRAPH_QUEUE_MAIN) ? graph.async_wait_stages : 0);
+		}
+	}
+
+	YsBarrierBatch barriers;
+	for (uint32_t position = 0; position < graph.order.size(); ++position)
+	{
+		uint32_t p = graph.order[position];
+		YsGraphPass& pass = graph.passes[p];
+		if (pass.queue != queue)
+			continue;
+
+		// NOTE: Transient content does not survive from one frame to the next,
+		//		 nor from the images sharing its memory.
+		for (YsGraphResource& resource : graph.resources)
+		{
+			if (!resource.imported && resource.first_use == position)
+				ys_barrier_discard(resource.state, resource.alias_stages);
+		}
+
+		for (const YsGraphAccess& access : pass.accesses)
+		{
+			YsGraphResource& resource = graph.resources[access.resource];
+			uint32_t binding = ys_graph_binding(graph, resource);
+			if (resource.image)
+				ys_barrier_image(barriers, *resource.states[binding], resource.images[binding],
+								 resource.aspect, access.usage);
+			else
+				ys_barrier_buffer(barriers, *resource.states[binding],
+								  resource.buffers[binding], access.usage);
+		}
+		ys_barrier_flush(barriers, cmd);
+
+		if (pass.execute)
+			pass.execute(graph, p, cmd, pass.data);
+	}
+
+	if (queue == YS_GRAPH_QUEUE_MAIN)
+		graph.execute_count++;
+	graph.barrier_count += ys_barrier_stats().flush_count - flushes;
+}
+
+
+void
+ys_graph_begin_render_pass(const YsGraph& graph, uint32_t pass, VkCommandBuffer cmd,
+						   VkSubpassContents contents)
+{
+	const YsGraphPass& p = graph.passes[pass];
+	assert(p.graphics && p.render_pass != VK_NULL_HANDLE);
+
+	VkClearValue clear_values[YS_GRAPH_MAX_ATTACHMENTS];
+	uint32_t attachment_count = 0;
+	VkExtent2D extent = { 0, 0 };
+	for (const YsGraphAccess& access : p.accesses)
+	{
+		if (!ys_graph_is_attachment(access))
+			continue;
+		assert(attachment_count < YS_GRAPH_MAX_ATTACHMENTS);
+		clear_values[attachment_count++] = access.clear_value;
+
+		const YsGraphResource& resource = graph.resources[access.resource];
+		extent = { resource.width, resource.height };
+	}
+
+	VkRenderPassBeginInfo begin_info;
+	begin_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	begin_info.pNext = nullptr;
+	begin_info.renderPass = p.render_pass;
+	begin_info.framebuffer = ys_graph_framebuffer(graph, pass, graph.variant);
+	begin_info.renderArea = { { 0, 0 }, extent };
+	begin_info.clearValueCount = attachment_count;
+	begin_info.pClearValues = clear_values;
+
+	vkCmdBeginRenderPass(cmd, &begin_info, contents);
+}
@@ -0,0 +1,386 @@
+#include "ys_job.h"
+
+#include <assert.h>
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "ys_profiler.h"
+
+
+struct YsJob
+{
+	YsJobFunction*	function;
+	void*			data;
+	uint32_t		begin;
+	uint32_t		end;
+	YsJobCounter*	counter;
+	YsJob*			next;
+};
+
+// Chase-Lev deque with a fixed capacity, see "Correct and Efficient
+// Work-Stealing for Weak Memory Models" (Le et al.) for the orderings.
+struct YsJobDeque
+{
+	std::atomic<int64_t>	top{ 0 };
+	std::atomic<int64_t>	bottom{ 0 };
+	std::atomic<YsJob*>		jobs[YS_JOB_CAPACITY];
+};
+
+// NOTE: Jobs are never freed, each thread allocates from its own ring and a
+//		 slot is reused YS_JOB_CAPACITY allocations later.
+struct YsJobThread
+{
+	YsJobDeque		deque;
+	YsJob			pool[YS_JOB_CAPACITY];
+	uint32_t		pool_index = 0;
+	uint32_t		victim = 0;
+	std::thread		thread;
+};
+
+static YsJobThread*				ys_job_threads = nullptr;
+static uint32_t					ys_job_thread_total = 0;
+static thread_local uint32_t	ys_job_thread_index = UINT32_MAX;
+
+// Idle threads sleep on ys_job_cv until ys_job_generation changes, which
+// happens when jobs are queued while someone sleeps, or when a counter
+// reaches zero.
+static std::mutex				ys_job_mutex;
+static std::condition_variable	ys_job_cv;
+static std::atomic<uint64_t>	ys_job_generation{ 0 };
+static std::atomic<uint32_t>	ys_job_sleeping{ 0 };
+static std::atomic<bool>		ys_job_quit{ false };
+
+
+static bool
+ys_job_push(YsJobDeque& deque, YsJob* job)
+{
+	int64_t bottom = deque.bottom.load(std::memory_order_relaxed);
+	int64_t top = deque.top.load(std::memory_order_acquire);
+	if (bottom - top >= (int64_t)YS_JOB_CAPACITY)
+		return false;
+
+	deque.jobs[bottom & (YS_JOB_CAPACITY - 1)].store(job, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	deque.bottom.store(bottom + 1, std::memory_order_relaxed);
+	return true;
+}
+
+
+static YsJob*
+ys_job_pop(YsJobDeque& deque)
+{
+	int64_t bottom = deque.bottom.load(std::memory_order_relaxed) - 1;
+	deque.bottom.store(bottom, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	int64_t top = deque.top.load(std::memory_order_relaxed);
+
+	if (top > bottom)
+	{
+		deque.bottom.store(bottom + 1, std::memory_order_relaxed);
+		return nullptr;
+	}
+
+	YsJob* job = deque.jobs[bottom & (YS_JOB_CAPACITY - 1)].load(std::memory_order_relaxed);
+	if (top == bottom)
+	{
+		// NOTE: Last job, thieves may race for it.
+		if (!deque.top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+											   std::memory_order_relaxed))
+			job = nullptr;
+		deque.bottom.store(bottom + 1, std::memory_order_relaxed);
+	}
+	return job;
+}
+
+
+static YsJob*
+ys_job_steal(YsJobDeque& deque)
+{
+	int64_t top = deque.top.load(std::memory_order_acquire);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	int64_t bottom = deque.bottom.load(std::memory_order_acquire);
+	if (top >= bottom)
+		return nullptr;
+
+	YsJob* job = deque.jobs[top & (YS_JOB_CAPACITY - 1)].load(std::memory_order_relaxed);
+	if (!deque.top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+										   std::memory_order_relaxed))
+		return nullptr;
+	return job;
+}
+
+
+// Own deque first, then the others in turn starting after the last victim.
+static YsJob*
+ys_job_find()
+{
+	YsJobThread& self = ys_job_threads[ys_job_thread_index];
+	YsJob* job = ys_job_pop(self.deque);
+	if (job)
+		return job;
+
+	for (uint32_t i = 1; i < ys_job_thread_total; ++i)
+	{
+		uint32_t victim = (self.victim + i) % ys_job_thread_total;
+		if (victim == ys_job_thread_index)
+			continue;
+		job = ys_job_steal(ys_job_threads[victim].deque);
+		if (job)
+		{
+			self.victim = victim;
+			return job;
+		}
+	}
+	return nullptr;
+}
+
+
+static void
+ys_job_wake()
+{
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (ys_job_sleeping.load(std::memory_order_relaxed) == 0)
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(ys_job_mutex);
+		ys_job_generation++;
+	}
+	ys_job_cv.notify_all();
+}
+
+
+static void ys_job_execute(YsJob* job);
+
+static void
+ys_job_enqueue(YsJob* job)
+{
+	assert(ys_job_thread_index != UINT32_MAX);
+	if (!ys_job_push(ys_job_threads[ys_job_thread_index].deque, job))
+	{
+		// NOTE: The deque is full, the job runs right away instead.
+		ys_job_execute(job);
+		return;
+	}
+	ys_job_wake();
+}
+
+
+static void
+ys_job_finish(YsJobCounter* counter)
+{
+	// NOTE: Decrements that cannot be the last one do not lock, they never
+	//		 take the counter below one.
+	uint32_t pending = counter->pending.load(std::memory_order_relaxed);
+	while (pending > 1)
+	{
+		if (counter->pending.compare_exchange_weak(pending, pending - 1,
+												   std::memory_order_acq_rel,
+												   std::memory_order_relaxed))
+			return;
+	}
+
+	// NOTE: A waiter may destroy the counter as soon as it reads zero, the
+	//		 continuations are detached before the last decrement.
+	YsJob* continuations = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(ys_job_mutex);
+		bool last = (counter->pending.load(std::memory_order_relaxed) == 1);
+		if (last)
+		{
+			continuations = counter->continuations;
+			counter->continuations = nullptr;
+		}
+		counter->pending.fetch_sub(1, std::memory_order_acq_rel);
+		if (!last)
+			return;
+		ys_job_generation++;
+	}
+	ys_job_cv.notify_all();
+
+	while (continuations)
+	{
+		YsJob* next = continuations->next;
+		ys_job_enqueue(continuations);
+		continuations = next;
+	}
+}
+
+
+static void
+ys_job_execute(YsJob* job)
+{
+	job->function(job->data, job->begin, job->end);
+	ys_job_finish(job->counter);
+}
+
+
+// Runs one job if any can be found, otherwise sleeps until new jobs are
+// queued, a counter finishes or stop returns true.
+template <typename Stop>
+static void
+ys_job_run_or_sleep(const Stop& stop)
+{
+	uint64_t generation = ys_job_generation.load(std::memory_order_acquire);
+	YsJob* job = ys_job_find();
+	if (!job)
+	{
+		// NOTE: Announcing the sleep before looking again makes sure that a
+		//		 job pushed in between either is found or wakes this thread.
+		ys_job_sleeping.fetch_add(1, std::memory_order_seq_cst);
+		job = ys_job_find();
+		if (!job && !stop())
+		{
+			std::unique_lock<std::mutex> lock(ys_job_mutex);
+			ys_job_cv.wait(lock, [&]{
+				return ys_job_generation.load(std::memory_order_relaxed) != generation ||
+					stop();
+			});
+		}
+		ys_job_sleeping.fetch_sub(1, std::memory_order_relaxed);
+	}
+
+	if (job)
+		ys_job_execute(job);
+}
+
+
+static void
+ys_job_worker(uint32_t thread_index)
+{
+	YS_PROFILE_THREAD("job worker");
+	ys_job_thread_index = thread_index;
+
+	auto quit = []{ return ys_job_quit.load(std::memory_order_relaxed); };
+	while (!quit())
+		ys_job_run_or_sleep(quit);
+}
+
+
+void
+ys_job_init(uint32_t worker_count)
+{
+	if (worker_count == 0)
+	{
+		uint32_t hardware_threads = std::thread::hardware_concurrency();
+		worker_count = (hardware_threads > 1) ? hardware_threads - 1 : 1;
+	}
+
+	ys_job_quit = false;
+	ys_job_thread_total = worker_count + 1;
+	ys_job_threads = new YsJobThread[ys_job_thread_total];
+
+	// NOTE: Slot 0 belongs to the calling thread.
+	ys_job_thread_index = 0;
+	for (uint32_t i = 1; i < ys_job_thread_total; ++i)
+		ys_job_threads[i].thread = std::thread(ys_job_worker, i);
+}
+
+
+void
+ys_job_shutdown()
+{
+	{
+		std::lock_guard<std::mutex> lock(ys_job_mutex);
+		ys_job_quit = true;
+		ys_job_generation++;
+	}
+	ys_job_cv.notify_all();
+
+	for (uint32_t i = 1; i < ys_job_thread_total; ++i)
+		ys_job_threads[i].thread.join();
+
+	delete[] ys_job_threads;
+	ys_job_threads = nullptr;
+	ys_job_thread_total = 0;
+	ys_job_thread_index = UINT32_MAX;
+}
+
+
+uint32_t
+ys_job_thread_count()
+{
+	return ys_job_thread_total;
+}
+
+
+static YsJob*
+ys_job_allocate(YsJobFunction* function, void* data, uint32_t begin, uint32_t end,
+				YsJobCounter* counter)
+{
+	assert(ys_job_thread_index != UINT32_MAX);
+	YsJobThread& self = ys_job_threads[ys_job_thread_index];
+	YsJob* job = &self.pool[self.pool_index++ & (YS_JOB_CAPACITY - 1)];
+	job->function = function;
+	job->data = data;
+	job->begin = begin;
+	job->end = end;
+	job->counter = counter;
+	job->next = nullptr;
+
+	counter->pending.fetch_add(1, std::memory_order_relaxed);
+	return job;
+}
+
+
+void
+ys_job_run(YsJobFunction* function, void* data, uint32_t begin, uint32_t end,
+		   YsJobCounter* counter)
+{
+	ys_job_enqueue(ys_job_allocate(function, data, begin, end, counter));
+}
+
+
+void
+ys_job_run_after(const YsJobCounter* dependency, YsJobFunction* function,
+				 void* data, uint32_t begin, uint32_t end, YsJobCounter* counter)
+{
+	YsJob* job = ys_job_allocate(function, data, begin, end, counter);
+	{
+		// NOTE: ys_job_finish takes the continuations under the same lock,
+		//		 after the counter has reached zero.
+		std::lock_guard<std::mutex> lock(ys_job_mutex);
+		if (!ys_job_done(dependency))
+		{
+			YsJobCounter* mutable_dependency = const_cast<YsJobCounter*>(dependency);
+			job->next = mutable_dependency->continuations;
+			mutable_dependency->continuations = job;
+			return;
+		}
+	}
+	ys_job_enqueue(job);
+}
+
+
+void
+ys_job_parallel_for(YsJobFunction* function, void* data, uint32_t count,
+					uint32_t min_chunk, YsJobCounter* counter)
+{
+	if (count == 0)
+		return;
+
+	// NOTE: A few chunks per thread leave room for stealing when some chunks
+	//		 are slower than others.
+	uint32_t chunk_count = ys_job_thread_total * 4;
+	uint32_t chunk = (count + chunk_count - 1) / chunk_count;
+	if (chunk < min_chunk)
+		chunk = min_chunk;
+
+	for (uint32_t begin = 0; begin < count; begin += chunk)
+	{
+		uint32_t end = (count - begin > chunk) ? begin + chunk : count;
+		ys_job_run(function, data, begin, end, counter);
+	}
+}
+
+
+void
+ys_job_wait(YsJobCounter* counter)
+{
+	YS_PROFILE_FUNCTION();
+	auto done = [counter]{ return ys_job_done(counter); };
+	while (!done())
+		ys_job_run_or_sleep(done);
+}
@@ -0,0 +1,397 @@
+#include "ys_math.h"
+
+#include <math.h>
+
+#ifdef YS_MATH_SSE
+#include <emmintrin.h>
+#endif
+#ifdef YS_MATH_AVX
+#include <immintrin.h>
+#endif
+
+
+// SCALAR
+
+YsMat4
+ys_mat4_multiply_scalar(const YsMat4& a, const YsMat4& b)
+{
+	YsMat4 result;
+	for (uint32_t column = 0; column < 4; ++column)
+	{
+		for (uint32_t row = 0; row < 4; ++row)
+		{
+			float sum = 0.f;
+			for (uint32_t k = 0; k < 4; ++k)
+				sum += a.m[k * 4 + row] * b.m[column * 4 + k];
+			result.m[column * 4 + row] = sum;
+		}
+	}
+	return result;
+}
+
+
+void
+ys_mat4_multiply_batch_scalar(const YsMat4& lhs, const YsMat4* rhs, YsMat4* out,
+							  uint32_t count)
+{
+	for (uint32_t i = 0; i < count; ++i)
+		out[i] = ys_mat4_multiply_scalar(lhs, rhs[i]);
+}
+
+
+// NOTE: Cofactor expansion, as in the MESA implementation of gluInvertMatrix.
+bool
+ys_mat4_inverse_scalar(const YsMat4& matrix, YsMat4& out)
+{
+	const float* m = matrix.m;
+	float inv[16];
+
+	inv[0] = m[5] * m[10] * m[15] - m[5] * m[11] * m[14] - m[9] * m[6] * m[15] +
+			 m[9] * m[7] * m[14] + m[13] * m[6] * m[11] - m[13] * m[7] * m[10];
+	inv[4] = -m[4] * m[10] * m[15] + m[4] * m[11] * m[14] + m[8] * m[6] * m[15] -
+			 m[8] * m[7] * m[14] - m[12] * m[6] * m[11] + m[12] * m[7] * m[10];
+	inv[8] = m[4] * m[9] * m[15] - m[4] * m[11] * m[13] - m[8] * m[5] * m[15] +
+			 m[8] * m[7] * m[13] + m[12] * m[5] * m[11] - m[12] * m[7] * m[9];
+	inv[12] = -m[4] * m[9] * m[14] + m[4] * m[10] * m[13] + m[8] * m[5] * m[14] -
+			  m[8] * m[6] * m[13] - m[12] * m[5] * m[10] + m[12] * m[6] * m[9];
+	inv[1] = -m[1] * m[10] * m[15] + m[1] * m[11] * m[14] + m[9] * m[2] * m[15] -
+			 m[9] * m[3] * m[14] - m[13] * m[2] * m[11] + m[13] * m[3] * m[10];
+	inv[5] = m[0] * m[10] * m[15] - m[0] * m[11] * m[14] - m[8] * m[2] * m[15] +
+			 m[8] * m[3] * m[14] + m[12] * m[2] * m[11] - m[12] * m[3] * m[10];
+	inv[9] = -m[0] * m[9] * m[15] + m[0] * m[11] * m[13] + m[8] * m[1] * m[15] -
+			 m[8] * m[3] * m[13] - m[12] * m[1] * m[11] + m[12] * m[3] * m[9];
+	inv[13] = m[0] * m[9] * m[14] - m[0] * m[10] * m[13] - m[8] * m[1] * m[14] +
+			  m[8] * m[2] * m[13] + m[12] * m[1] * m[10] - m[12] * m[2] * m[9];
+	inv[2] = m[1] * m[6] * m[15] - m[1] * m[7] * m[14] - m[5] * m[2] * m[15] +
+			 m[5] * m[3] * m[14] + m[13] * m[2] * m[7] - m[13] * m[3] * m[6];
+	inv[6] = -m[0] * m[6] * m[15] + m[0] * m[7] * m[14] + m[4] * m[2] * m[15] -
+			 m[4] * m[3] * m[14] - m[12] * m[2] * m[7] + m[12] * m[3] * m[6];
+	inv[10] = m[0] * m[5] * m[15] - m[0] * m[7] * m[13] - m[4] * m[1] * m[15] +
+			  m[4] * m[3] * m[13] + m[12] * m[1] * m[7] - m[12] * m[3] * m[5];
+	inv[14] = -m[0] * m[5] * m[14] + m[0] * m[6] * m[13] + m[4] * m[1] * m[14] -
+			  m[4] * m[2] * m[13] - m[12] * m[1] * m[6] + m[12] * m[2] * m[5];
+	inv[3] = -m[1] * m[6] * m[11] + m[1] * m[7] * m[10] + m[5] * m[2] * m[11] -
+			 m[5] * m[3] * m[10] - m[9] * m[2] * m[7] + m[9] * m[3] * m[6];
+	inv[7] = m[0] * m[6] * m[11] - m[0] * m[7] * m[10] - m[4] * m[2] * m[11] +
+			 m[4] * m[3] * m[10] + m[8] * m[2] * m[7] - m[8] * m[3] * m[6];
+	inv[11] = -m[0] * m[5] * m[11] + m[0] * m[7] * m[9] + m[4] * m[1] * m[11] -
+			  m[4] * m[3] * m[9] - m[8] * m[1] * m[7] + m[8] * m[3] * m[5];
+	inv[15] = m[0] * m[5] * m[10] - m[0] * m[6] * m[9] - m[4] * m[1] * m[10] +
+			  m[4] * m[2] * m[9] + m[8] * m[1] * m[6] - m[8] * m[2] * m[5];
+
+	float det = m[0] * inv[0] + m[1] * inv[4] + m[2] * inv[8] + m[3] * inv[12];
+	if (det == 0.f)
+		return false;
+
+	float inv_det = 1.f / det;
+	for (uint32_t i = 0; i < 16; ++i)
+		out.m[i] = inv[i] * inv_det;
+	return true;
+}
+
+
+void
+ys_mat4_transform_points_scalar(const YsMat4& matrix, const YsVec4* in, YsVec4* out,
+								uint32_t count)
+{
+	const float* m = matrix.m;
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		YsVec4 v = in[i];
+		out[i].x = m[0] * v.x + m[4] * v.y + m[8] * v.z + m[12] * v.w;
+		out[i].y = m[1] * v.x + m[5] * v.y + m[9] * v.z + m[13] * v.w;
+		out[i].z = m[2] * v.x + m[6] * v.y + m[10] * v.z + m[14] * v.w;
+		out[i].w = m[3] * v.x + m[7] * v.y + m[11] * v.z + m[15] * v.w;
+	}
+}
+
+
+#ifdef YS_MATH_SSE
+
+// SSE
+
+#define YS_SHUFFLE_MASK(x, y, z, w) ((x) | ((y) << 2) | ((z) << 4) | ((w) << 6))
+#define YS_SWIZZLE(v, x, y, z, w) \
+	_mm_shuffle_ps(v, v, YS_SHUFFLE_MASK(x, y, z, w))
+#define YS_SHUFFLE(a, b, x, y, z, w) \
+	_mm_shuffle_ps(a, b, YS_SHUFFLE_MASK(x, y, z, w))
+
+// Columns of a times (x, y, z, w).
+static inline __m128
+ys_sse_transform(const __m128 columns[4], __m128 v)
+{
+	__m128 result = _mm_mul_ps(columns[0], YS_SWIZZLE(v, 0, 0, 0, 0));
+	result = _mm_add_ps(result, _mm_mul_ps(columns[1], YS_SWIZZLE(v, 1, 1, 1, 1)));
+	result = _mm_add_ps(result, _mm_mul_ps(columns[2], YS_SWIZZLE(v, 2, 2, 2, 2)));
+	result = _mm_add_ps(result, _mm_mul_ps(columns[3], YS_SWIZZLE(v, 3, 3, 3, 3)));
+	return result;
+}
+
+
+static inline void
+ys_sse_load_columns(const YsMat4& matrix, __m128 columns[4])
+{
+	columns[0] = _mm_load_ps(&matrix.m[0]);
+	columns[1] = _mm_load_ps(&matrix.m[4]);
+	columns[2] = _mm_load_ps(&matrix.m[8]);
+	columns[3] = _mm_load_ps(&matrix.m[12]);
+}
+
+
+YsMat4
+ys_mat4_multiply(const YsMat4& a, const YsMat4& b)
+{
+	__m128 columns[4];
+	ys_sse_load_columns(a, columns);
+
+	YsMat4 result;
+	for (uint32_t i = 0; i < 4; ++i)
+		_mm_store_ps(&result.m[i * 4], ys_sse_transform(columns, _mm_load_ps(&b.m[i * 4])));
+	return result;
+}
+
+
+void
+ys_mat4_multiply_batch(const YsMat4& lhs, const YsMat4* rhs, YsMat4* out, uint32_t count)
+{
+	__m128 columns[4];
+	ys_sse_load_columns(lhs, columns);
+
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		// NOTE: All of rhs[i] is loaded before writing, out may alias rhs.
+		__m128 c0 = _mm_load_ps(&rhs[i].m[0]);
+		__m128 c1 = _mm_load_ps(&rhs[i].m[4]);
+		__m128 c2 = _mm_load_ps(&rhs[i].m[8]);
+		__m128 c3 = _mm_load_ps(&rhs[i].m[12]);
+		_mm_store_ps(&out[i].m[0], ys_sse_transform(columns, c0));
+		_mm_store_ps(&out[i].m[4], ys_sse_transform(columns, c1));
+		_mm_store_ps(&out[i].m[8], ys_sse_transform(columns, c2));
+		_mm_store_ps(&out[i].m[12], ys_sse_transform(columns, c3));
+	}
+}
+
+
+// 2x2 blocks are stored row major in one register: (x, y, z, w) is
+// | x y |
+// | z w |
+static inline __m128
+ys_sse_mat2_mul(__m128 a, __m128 b)
+{
+	return _mm_add_ps(_mm_mul_ps(a, YS_SWIZZLE(b, 0, 3, 0, 3)),
+					  _mm_mul_ps(YS_SWIZZLE(a, 1, 0, 3, 2), YS_SWIZZLE(b, 2, 1, 2, 1)));
+}
+
+// adj(a) * b
+static inline __m128
+ys_sse_mat2_adj_mul(__m128 a, __m128 b)
+{
+	return _mm_sub_ps(_mm_mul_ps(YS_SWIZZLE(a, 3, 3, 0, 0), b),
+					  _mm_mul_ps(YS_SWIZZLE(a, 1, 1, 2, 2), YS_SWIZZLE(b, 2, 3, 0, 1)));
+}
+
+// a * adj(b)
+static inline __m128
+ys_sse_mat2_mul_adj(__m128 a, __m128 b)
+{
+	return _mm_sub_ps(_mm_mul_ps(a, YS_SWIZZLE(b, 3, 0, 3, 0)),
+					  _mm_mul_ps(YS_SWIZZLE(a, 1, 0, 3, 2), YS_SWIZZLE(b, 2, 1, 2, 1)));
+}
+
+
+// NOTE: Block inversion over the four 2x2 sub-matrices. It is written for
+//		 rows, feeding it columns inverts the transpose, whose rows are the
+//		 columns of the inverse.
+bool
+ys_mat4_inverse(const YsMat4& matrix, YsMat4& out)
+{
+	__m128 r0 = _mm_load_ps(&matrix.m[0]);
+	__m128 r1 = _mm_load_ps(&matrix.m[4]);
+	__m128 r2 = _mm_load_ps(&matrix.m[8]);
+	__m128 r3 = _mm_load_ps(&matrix.m[12]);
+
+	__m128 a = _mm_movelh_ps(r0, r1);
+	__m128 b = _mm_movehl_ps(r1, r0);
+	__m128 c = _mm_movelh_ps(r2, r3);
+	__m128 d = _mm_movehl_ps(r3, r2);
+
+	// (|A|, |B|, |C|, |D|)
+	__m128 det_sub = _mm_sub_ps(
+		_mm_mul_ps(YS_SHUFFLE(r0, r2, 0, 2, 0, 2), YS_SHUFFLE(r1, r3, 1, 3, 1, 3)),
+		_mm_mul_ps(YS_SHUFFLE(r0, r2, 1, 3, 1, 3), YS_SHUFFLE(r1, r3, 0, 2, 0, 2)));
+	__m128 det_a = YS_SWIZZLE(det_sub, 0, 0, 0, 0);
+	__m128 det_b = YS_SWIZZLE(det_sub, 1, 1, 1, 1);
+	__m128 det_c = YS_SWIZZLE(det_sub, 2, 2, 2, 2);
+	__m128 det_d = YS_SWIZZLE(det_sub, 3, 3, 3, 3);
+
+	__m128 d_c = ys_sse_mat2_adj_mul(d, c);
+	__m128 a_b = ys_sse_mat2_adj_mul(a, b);
+
+	__m128 x = _mm_sub_ps(_mm_mul_ps(det_d, a), ys_sse_mat2_mul(b, d_c));
+	__m128 w = _mm_sub_ps(_mm_mul_ps(det_a, d), ys_sse_mat2_mul(c, a_b));
+	__m128 y = _mm_sub_ps(_mm_mul_ps(det_b, c), ys_sse_mat2_mul_adj(d, a_b));
+	__m128 z = _mm_sub_ps(_mm_mul_ps(det_c, b), ys_sse_mat2_mul_adj(a, d_c));
+
+	// |M| = |A||D| + |B||C| - tr(adj(A)B adj(D)C)
+	__m128 trace = _mm_mul_ps(a_b, YS_SWIZZLE(d_c, 0, 2, 1, 3));
+	trace = _mm_add_ps(trace, YS_SWIZZLE(trace, 1, 0, 3, 2));
+	trace = _mm_add_ps(trace, YS_SWIZZLE(trace, 2, 3, 0, 1));
+	__m128 det = _mm_sub_ps(
+		_mm_add_ps(_mm_mul_ps(det_a, det_d), _mm_mul_ps(det_b, det_c)), trace);
+
+	if (_mm_cvtss_f32(det) == 0.f)
+		return false;
+
+	__m128 inv_det = _mm_div_ps(_mm_setr_ps(1.f, -1.f, -1.f, 1.f), det);
+	x = _mm_mul_ps(x, inv_det);
+	y = _mm_mul_ps(y, inv_det);
+	z = _mm_mul_ps(z, inv_det);
+	w = _mm_mul_ps(w, inv_det);
+
+	// NOTE: Applies the adjugate and reassembles the rows in one shuffle.
+	_mm_store_ps(&out.m[0], YS_SHUFFLE(x, y, 3, 1, 3, 1));
+	_mm_store_ps(&out.m[4], YS_SHUFFLE(x, y, 2, 0, 2, 0));
+	_mm_store_ps(&out.m[8], YS_SHUFFLE(z, w, 3, 1, 3, 1));
+	_mm_store_ps(&out.m[12], YS_SHUFFLE(z, w, 2, 0, 2, 0));
+	return true;
+}
+
+
+YsVec4
+ys_mat4_transform(const YsMat4& matrix, const YsVec4& v)
+{
+	__m128 columns[4];
+	ys_sse_load_columns(matrix, columns);
+
+	YsVec4 result;
+	_mm_store_ps(&result.x, ys_sse_transform(columns, _mm_load_ps(&v.x)));
+	return result;
+}
+
+
+void
+ys_mat4_transform_points(const YsMat4& matrix, const YsVec4* in, YsVec4* out,
+						 uint32_t count)
+{
+	uint32_t i = 0;
+
+#ifdef YS_MATH_AVX
+	// NOTE: Two points per iteration, each lane holds a copy of the columns.
+	{
+		__m256 c0 = _mm256_broadcast_ps((const __m128*)&matrix.m[0]);
+		__m256 c1 = _mm256_broadcast_ps((const __m128*)&matrix.m[4]);
+		__m256 c2 = _mm256_broadcast_ps((const __m128*)&matrix.m[8]);
+		__m256 c3 = _mm256_broadcast_ps((const __m128*)&matrix.m[12]);
+
+		for (; i + 2 <= count; i += 2)
+		{
+			__m256 v = _mm256_loadu_ps(&in[i].x);
+			__m256 result = _mm256_mul_ps(c0, _mm256_permute_ps(v, 0x00));
+			result = _mm256_add_ps(result, _mm256_mul_ps(c1, _mm256_permute_ps(v, 0x55)));
+			result = _mm256_add_ps(result, _mm256_mul_ps(c2, _mm256_permute_ps(v, 0xAA)));
+			result = _mm256_add_ps(result, _mm256_mul_ps(c3, _mm256_permute_ps(v, 0xFF)));
+			_mm256_storeu_ps(&out[i].x, result);
+		}
+	}
+#endif
+
+	__m128 columns[4];
+	ys_sse_load_columns(matrix, columns);
+	for (; i < count; ++i)
+		_mm_store_ps(&out[i].x, ys_sse_transform(columns, _mm_load_ps(&in[i].x)));
+}
+
+#else
+
+YsMat4
+ys_mat4_multiply(const YsMat4& a, const YsMat4& b)
+{
+	return ys_mat4_multiply_scalar(a, b);
+}
+
+
+void
+ys_mat4_multiply_batch(const YsMat4& lhs, const YsMat4* rhs, YsMat4* out, uint32_t count)
+{
+	ys_mat4_multiply_batch_scalar(lhs, rhs, out, count);
+}
+
+
+bool
+ys_mat4_inverse(const YsMat4& matrix, YsMat4& out)
+{
+	return ys_mat4_inverse_scalar(matrix, out);
+}
+
+
+YsVec4
+ys_mat4_transform(const YsMat4& matrix, const YsVec4& v)
+{
+	YsVec4 result;
+	ys_mat4_transform_points_scalar(matrix, &v, &result, 1);
+	return result;
+}
+
+
+void
+ys_mat4_transform_points(const YsMat4& matrix, const YsVec4* in, YsVec4* out,
+						 uint32_t count)
+{
+	ys_mat4_transform_points_scalar(matrix, in, out, count);
+}
+
+#endif
+
+
+// PROJECTIONS
+
+YsMat4
+ys_mat4_perspective(float near_plane, float far_plane, float fov, float aspect_ratio)
+{
+	float h = 1.f / tanf(fov * 3.14159265f / 360.f);
+	float depth = far_plane - near_plane;
+
+	YsMat4 result;
+	result.m[0] = h / aspect_ratio;
+	result.m[5] = h;
+	result.m[10] = -(far_plane + near_plane) / depth;
+	result.m[11] = -1.f;
+	result.m[14] = -2.f * (far_plane * near_plane) / depth;
+	result.m[15] = 0.f;
+	return result;
+}
+
+
+YsMat4
+ys_mat4_look_at(const YsVec4& eye, const YsVec4& target, const YsVec4& up)
+{
+	float f[3] = { target.x - eye.x, target.y - eye.y, target.z - eye.z };
+	float f_length = sqrtf(f[0] * f[0] + f[1] * f[1] + f[2] * f[2]);
+	for (uint32_t i = 0; i < 3; ++i)
+		f[i] /= f_length;
+
+	// s = f x up
+	float s[3] = { f[1] * up.z - f[2] * up.y,
+				   f[2] * up.x - f[0] * up.z,
+				   f[0] * up.y - f[1] * up.x };
+	float s_length = sqrtf(s[0] * s[0] + s[1] * s[1] + s[2] * s[2]);
+	for (uint32_t i = 0; i < 3; ++i)
+		s[i] /= s_length;
+
+	// u = s x f
+	float u[3] = { s[1] * f[2] - s[2] * f[1],
+				   s[2] * f[0] - s[0] * f[2],
+				   s[0] * f[1] - s[1] * f[0] };
+
+	YsMat4 result;
+	for (uint32_t i = 0; i < 3; ++i)
+	{
+		result.m[i * 4 + 0] = s[i];
+		result.m[i * 4 + 1] = u[i];
+		result.m[i * 4 + 2] = -f[i];
+	}
+	result.m[12] = -(s[0] * eye.x + s[1] * eye.y + s[2] * eye.z);
+	result.m[13] = -(u[0] * eye.x + u[1] * eye.y + u[2] * eye.z);
+	result.m[14] = (f[0] * eye.x + f[1] * eye.y + f[2] * eye.z);
+	return result;
+}
@@ -0,0 +1,166 @@
+#include "ys_profiler.h"
+
+#ifdef YS_PROFILER_ENABLED
+
+#include <stdio.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Events of one thread. Only the owning thread writes, the oldest events are
+// overwritten once the ring is full.
+struct YsProfileRing
+{
+	static const uint32_t	capacity = 1 << 16;
+
+	YsProfileEvent			events[capacity];
+	std::atomic<uint64_t>	write_index;
+	uint32_t				thread_id;
+	std::string				thread_name;
+};
+
+// NOTE: The mutex only guards the list of rings, it is taken once per thread.
+static std::mutex					ys_profiler_mutex;
+static std::vector<YsProfileRing*>	ys_profiler_rings;
+static uint32_t						ys_profiler_next_thread_id = 1;
+static thread_local YsProfileRing*	ys_profiler_thread_ring = nullptr;
+static YsProfileRing*				ys_profiler_gpu_ring = nullptr;
+
+static const std::chrono::steady_clock::time_point	ys_profiler_epoch =
+	std::chrono::steady_clock::now();
+
+
+static YsProfileRing*
+ys_profiler_ring_create(const char* name)
+{
+	YsProfileRing* ring = new YsProfileRing;
+	ring->write_index.store(0, std::memory_order_relaxed);
+
+	std::lock_guard<std::mutex> lock(ys_profiler_mutex);
+	ring->thread_id = ys_profiler_next_thread_id++;
+	ring->thread_name = name ? name : "thread " + std::to_string(ring->thread_id);
+	ys_profiler_rings.push_back(ring);
+
+	return ring;
+}
+
+
+static void
+ys_profiler_ring_push(YsProfileRing* ring, const char* name,
+					  uint64_t begin_ns, uint64_t end_ns)
+{
+	uint64_t index = ring->write_index.load(std::memory_order_relaxed);
+
+	YsProfileEvent& event = ring->events[index & (YsProfileRing::capacity - 1)];
+	event.name = name;
+	event.begin_ns = begin_ns;
+	event.end_ns = end_ns;
+
+	ring->write_index.store(index + 1, std::memory_order_release);
+}
+
+
+uint64_t
+ys_profiler_now()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now() - ys_profiler_epoch).count();
+}
+
+
+void
+ys_profiler_record(const char* name, uint64_t begin_ns, uint64_t end_ns)
+{
+	if (!ys_profiler_thread_ring)
+		ys_profiler_thread_ring = ys_profiler_ring_create(nullptr);
+
+	ys_profiler_ring_push(ys_profiler_thread_ring, name, begin_ns, end_ns);
+}
+
+
+void
+ys_profiler_set_thread_name(const char* name)
+{
+	if (!ys_profiler_thread_ring)
+	{
+		ys_profiler_thread_ring = ys_profiler_ring_create(name);
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(ys_profiler_mutex);
+	ys_profiler_thread_ring->thread_name = name;
+}
+
+
+void
+ys_profiler_record_gpu(const char* name, uint64_t begin_ns, uint64_t end_ns)
+{
+	if (!ys_profiler_gpu_ring)
+		ys_profiler_gpu_ring = ys_profiler_ring_create("GPU");
+
+	ys_profiler_ring_push(ys_profiler_gpu_ring, name, begin_ns, end_ns);
+}
+
+
+static void
+ys_profiler_write_string(FILE* file, const char* str)
+{
+	fputc('"', file);
+	for (; *str; ++str)
+	{
+		if (*str == '"' || *str == '\\')
+			fputc('\\', file);
+		fputc(*str, file);
+	}
+	fputc('"', file);
+}
+
+
+bool
+ys_profiler_write_trace(const char* path)
+{
+	FILE* file = fopen(path, "wb");
+	if (!file)
+		return false;
+
+	std::lock_guard<std::mutex> lock(ys_profiler_mutex);
+
+	fputs("{\"traceEvents\":[\n", file);
+	bool first = true;
+
+	for (YsProfileRing* ring : ys_profiler_rings)
+	{
+		fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,"
+				"\"args\":{\"name\":", first ? "" : ",\n", ring->thread_id);
+		ys_profiler_write_string(file, ring->thread_name.c_str());
+		fputs("}}", file);
+		first = false;
+
+		uint64_t end = ring->write_index.load(std::memory_order_acquire);
+		uint64_t begin = (end > YsProfileRing::capacity) ?
+			end - YsProfileRing::capacity : 0;
+
+		for (uint64_t i = begin; i < end; ++i)
+		{
+			const YsProfileEvent& event =
+				ring->events[i & (YsProfileRing::capacity - 1)];
+
+			// NOTE: Chrome expects microseconds.
+			fputs(",\n{\"name\":", file);
+			ys_profiler_write_string(file, event.name);
+			fprintf(file, ",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+					ring->thread_id, (double)event.begin_ns / 1000.0,
+					(double)(event.end_ns - event.begin_ns) / 1000.0);
+		}
+	}
+
+	fputs("\n]}\n", file);
+	fclose(file);
+
+	return true;
+}
+
+#endif
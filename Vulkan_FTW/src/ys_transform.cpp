@@ -0,0 +1,325 @@
+#include "ys_transform.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#ifdef YS_MATH_SSE
+#include <xmmintrin.h>
+#endif
+
+
+static uint32_t
+ys_transform_padded(uint32_t count)
+{
+	return (count + 3) & ~3u;
+}
+
+
+static void
+ys_transform_resize(YsTransformSystem& system, uint32_t size)
+{
+	system.position_x.resize(size, 0.f);
+	system.position_y.resize(size, 0.f);
+	system.position_z.resize(size, 0.f);
+	system.rotation_x.resize(size, 0.f);
+	system.rotation_y.resize(size, 0.f);
+	system.rotation_z.resize(size, 0.f);
+	system.rotation_w.resize(size, 1.f);
+	system.scale_x.resize(size, 1.f);
+	system.scale_y.resize(size, 1.f);
+	system.scale_z.resize(size, 1.f);
+	system.parent.resize(size, YS_TRANSFORM_NONE);
+	system.depth.resize(size, 0);
+	system.dirty.resize(size, 0);
+	system.world.resize(size);
+	system.id_of.resize(size, YS_TRANSFORM_NONE);
+}
+
+
+void
+ys_transform_reserve(YsTransformSystem& system, uint32_t capacity)
+{
+	uint32_t size = ys_transform_padded(capacity);
+	system.position_x.reserve(size);
+	system.position_y.reserve(size);
+	system.position_z.reserve(size);
+	system.rotation_x.reserve(size);
+	system.rotation_y.reserve(size);
+	system.rotation_z.reserve(size);
+	system.rotation_w.reserve(size);
+	system.scale_x.reserve(size);
+	system.scale_y.reserve(size);
+	system.scale_z.reserve(size);
+	system.parent.reserve(size);
+	system.depth.reserve(size);
+	system.dirty.reserve(size);
+	system.world.reserve(size);
+	system.id_of.reserve(size);
+	system.index_of.reserve(capacity);
+}
+
+
+YsTransformId
+ys_transform_create(YsTransformSystem& system, YsTransformId parent)
+{
+	uint32_t index = system.count++;
+	ys_transform_resize(system, ys_transform_padded(system.count));
+
+	YsTransformId id = (YsTransformId)system.index_of.size();
+	system.index_of.push_back(index);
+	system.id_of[index] = id;
+	system.dirty[index] = 1;
+
+	if (parent != YS_TRANSFORM_NONE)
+	{
+		uint32_t parent_index = system.index_of[parent];
+		system.parent[index] = parent_index;
+		system.depth[index] = system.depth[parent_index] + 1;
+	}
+
+	// NOTE: Appending keeps parents before children, only the depth order
+	//		 may be broken.
+	if (index > 0 && system.depth[index] < system.depth[index - 1])
+		system.sorted = false;
+
+	return id;
+}
+
+
+void
+ys_transform_set_position(YsTransformSystem& system, YsTransformId id,
+						  float x, float y, float z)
+{
+	uint32_t index = system.index_of[id];
+	system.position_x[index] = x;
+	system.position_y[index] = y;
+	system.position_z[index] = z;
+	system.dirty[index] = 1;
+}
+
+
+void
+ys_transform_set_rotation(YsTransformSystem& system, YsTransformId id,
+						  float x, float y, float z, float w)
+{
+	uint32_t index = system.index_of[id];
+	system.rotation_x[index] = x;
+	system.rotation_y[index] = y;
+	system.rotation_z[index] = z;
+	system.rotation_w[index] = w;
+	system.dirty[index] = 1;
+}
+
+
+void
+ys_transform_set_scale(YsTransformSystem& system, YsTransformId id,
+					   float x, float y, float z)
+{
+	uint32_t index = system.index_of[id];
+	system.scale_x[index] = x;
+	system.scale_y[index] = y;
+	system.scale_z[index] = z;
+	system.dirty[index] = 1;
+}
+
+
+template <typename T>
+static void
+ys_transform_permute(std::vector<T>& values, const std::vector<uint32_t>& order)
+{
+	std::vector<T> sorted(values);
+	for (uint32_t i = 0; i < (uint32_t)order.size(); ++i)
+		sorted[i] = values[order[i]];
+	values.swap(sorted);
+}
+
+
+// Stable sort by depth, the relative order of siblings is kept.
+static void
+ys_transform_sort(YsTransformSystem& system)
+{
+	std::vector<uint32_t> order(system.count);
+	for (uint32_t i = 0; i < system.count; ++i)
+		order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [&](uint32_t lhs, uint32_t rhs) {
+		return system.depth[lhs] < system.depth[rhs];
+	});
+
+	std::vector<uint32_t> new_index(system.count);
+	for (uint32_t i = 0; i < system.count; ++i)
+		new_index[order[i]] = i;
+
+	ys_transform_permute(system.position_x, order);
+	ys_transform_permute(system.position_y, order);
+	ys_transform_permute(system.position_z, order);
+	ys_transform_permute(system.rotation_x, order);
+	ys_transform_permute(system.rotation_y, order);
+	ys_transform_permute(system.rotation_z, order);
+	ys_transform_permute(system.rotation_w, order);
+	ys_transform_permute(system.scale_x, order);
+	ys_transform_permute(system.scale_y, order);
+	ys_transform_permute(system.scale_z, order);
+	ys_transform_permute(system.parent, order);
+	ys_transform_permute(system.depth, order);
+	ys_transform_permute(system.dirty, order);
+	ys_transform_permute(system.world, order);
+	ys_transform_permute(system.id_of, order);
+
+	for (uint32_t i = 0; i < system.count; ++i)
+	{
+		if (system.parent[i] != YS_TRANSFORM_NONE)
+			system.parent[i] = new_index[system.parent[i]];
+		system.index_of[system.id_of[i]] = i;
+	}
+
+	system.sorted = true;
+}
+
+
+// Builds the local matrices of the four nodes starting at first.
+static void
+ys_transform_compose_local(const YsTransformSystem& system, uint32_t first,
+						   YsMat4 local[4])
+{
+#ifdef YS_MATH_SSE
+	__m128 x = _mm_loadu_ps(&system.rotation_x[first]);
+	__m128 y = _mm_loadu_ps(&system.rotation_y[first]);
+	__m128 z = _mm_loadu_ps(&system.rotation_z[first]);
+	__m128 w = _mm_loadu_ps(&system.rotation_w[first]);
+	__m128 sx = _mm_loadu_ps(&system.scale_x[first]);
+	__m128 sy = _mm_loadu_ps(&system.scale_y[first]);
+	__m128 sz = _mm_loadu_ps(&system.scale_z[first]);
+
+	__m128 one = _mm_set1_ps(1.f);
+	__m128 two = _mm_set1_ps(2.f);
+	__m128 x2 = _mm_mul_ps(x, two);
+	__m128 y2 = _mm_mul_ps(y, two);
+	__m128 z2 = _mm_mul_ps(z, two);
+	__m128 xx = _mm_mul_ps(x, x2);
+	__m128 yy = _mm_mul_ps(y, y2);
+	__m128 zz = _mm_mul_ps(z, z2);
+	__m128 xy = _mm_mul_ps(x, y2);
+	__m128 xz = _mm_mul_ps(x, z2);
+	__m128 yz = _mm_mul_ps(y, z2);
+	__m128 wx = _mm_mul_ps(w, x2);
+	__m128 wy = _mm_mul_ps(w, y2);
+	__m128 wz = _mm_mul_ps(w, z2);
+
+	// NOTE: Each register holds one matrix element for the four nodes, the
+	//		 transposes below turn them into columns.
+	__m128 c0[4] = {
+		_mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(yy, zz)), sx),
+		_mm_mul_ps(_mm_add_ps(xy, wz), sx),
+		_mm_mul_ps(_mm_sub_ps(xz, wy), sx),
+		_mm_setzero_ps()
+	};
+	__m128 c1[4] = {
+		_mm_mul_ps(_mm_sub_ps(xy, wz), sy),
+		_mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, zz)), sy),
+		_mm_mul_ps(_mm_add_ps(yz, wx), sy),
+		_mm_setzero_ps()
+	};
+	__m128 c2[4] = {
+		_mm_mul_ps(_mm_add_ps(xz, wy), sz),
+		_mm_mul_ps(_mm_sub_ps(yz, wx), sz),
+		_mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, yy)), sz),
+		_mm_setzero_ps()
+	};
+	__m128 c3[4] = {
+		_mm_loadu_ps(&system.position_x[first]),
+		_mm_loadu_ps(&system.position_y[first]),
+		_mm_loadu_ps(&system.position_z[first]),
+		one
+	};
+
+	_MM_TRANSPOSE4_PS(c0[0], c0[1], c0[2], c0[3]);
+	_MM_TRANSPOSE4_PS(c1[0], c1[1], c1[2], c1[3]);
+	_MM_TRANSPOSE4_PS(c2[0], c2[1], c2[2], c2[3]);
+	_MM_TRANSPOSE4_PS(c3[0], c3[1], c3[2], c3[3]);
+
+	for (uint32_t i = 0; i < 4; ++i)
+	{
+		_mm_store_ps(&local[i].m[0], c0[i]);
+		_mm_store_ps(&local[i].m[4], c1[i]);
+		_mm_store_ps(&local[i].m[8], c2[i]);
+		_mm_store_ps(&local[i].m[12], c3[i]);
+	}
+#else
+	for (uint32_t i = 0; i < 4; ++i)
+	{
+		uint32_t index = first + i;
+		float x = system.rotation_x[index];
+		float y = system.rotation_y[index];
+		float z = system.rotation_z[index];
+		float w = system.rotation_w[index];
+		float sx = system.scale_x[index];
+		float sy = system.scale_y[index];
+		float sz = system.scale_z[index];
+
+		float* m = local[i].m;
+		m[0] = (1.f - 2.f * (y * y + z * z)) * sx;
+		m[1] = 2.f * (x * y + w * z) * sx;
+		m[2] = 2.f * (x * z - w * y) * sx;
+		m[3] = 0.f;
+		m[4] = 2.f * (x * y - w * z) * sy;
+		m[5] = (1.f - 2.f * (x * x + z * z)) * sy;
+		m[6] = 2.f * (y * z + w * x) * sy;
+		m[7] = 0.f;
+		m[8] = 2.f * (x * z + w * y) * sz;
+		m[9] = 2.f * (y * z - w * x) * sz;
+		m[10] = (1.f - 2.f * (x * x + y * y)) * sz;
+		m[11] = 0.f;
+		m[12] = system.position_x[index];
+		m[13] = system.position_y[index];
+		m[14] = system.position_z[index];
+		m[15] = 1.f;
+	}
+#endif
+}
+
+
+uint32_t
+ys_transform_update(YsTransformSystem& system)
+{
+	if (!system.sorted)
+		ys_transform_sort(system);
+
+	uint8_t* dirty = system.dirty.data();
+	const uint32_t* parent = system.parent.data();
+	uint32_t count = system.count;
+
+	// NOTE: Parents come first, their flag is final when a child reads it.
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		if (parent[i] != YS_TRANSFORM_NONE && dirty[parent[i]])
+			dirty[i] = 1;
+	}
+
+	uint32_t written = 0;
+	for (uint32_t first = 0; first < count; first += 4)
+	{
+		// NOTE: Padding nodes are never dirty.
+		if (!(dirty[first] | dirty[first + 1] | dirty[first + 2] | dirty[first + 3]))
+			continue;
+
+		YsMat4 local[4];
+		ys_transform_compose_local(system, first, local);
+
+		for (uint32_t i = 0; i < 4; ++i)
+		{
+			uint32_t index = first + i;
+			if (!dirty[index])
+				continue;
+
+			if (parent[index] == YS_TRANSFORM_NONE)
+				system.world[index] = local[i];
+			else
+				system.world[index] = ys_mat4_multiply(system.world[parent[index]], local[i]);
+			written++;
+		}
+	}
+
+	memset(dirty, 0, count);
+	return written;
+}